@@ -0,0 +1,723 @@
+/*  MultiSlicerEngine.cpp
+
+    The C interface of MultiSlicerEngine.h over the plugin's own code: the
+    layouts drive MultiSlicer.cpp through EffectMain on a minimal stand-in
+    host, as the Linux replay does, so embedders render exactly what After
+    Effects renders, through the same geometry cache and row renderers.
+
+    The stand-in host (MultiSlicerHost.cpp, shared with the replay) hands
+    out heap handles, runs iterate_generic on the executor of the layout
+    being rendered, answers parameter checkouts from the frame and copies
+    for pass-through frames. The engine offers it no compute cache: the
+    plugin keeps its recent geometry maps itself, as on hosts before AE
+    2022. The environment options of the plugin (MULTISLICER_EXPLAIN,
+    MULTISLICER_LAYOUT_CACHE_DIR, ...) work here too.
+
+    Only the SDK's headers and Util sources are needed to build it; the
+    result does not use After Effects. On Linux, from this directory, with
+    the repository in the SDK's Examples tree as for the Mac and Win
+    projects:
+
+      g++ -std=c++14 -O2 -fPIC -shared -fvisibility=hidden \
+          -DMULTISLICER_ENGINE_BUILD -I.. -I../../../Headers \
+          -I../../../Headers/SP -I../../../Util MultiSlicerEngine.cpp \
+          MultiSlicerHost.cpp ../MultiSlicer.cpp ../MultiSlicer_Strings.cpp \
+          ../../../Util/AEGP_SuiteHandler.cpp \
+          ../../../Util/MissingSuiteError.cpp -lpthread \
+          -o libMultiSlicerEngine.so
+
+    Windows builds define MULTISLICER_ENGINE_SHARED as well for a DLL.
+*/
+
+#include "MultiSlicerEngine.h"
+#include "MultiSlicerHost.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// =============================================================================
+// Layouts and frames
+// =============================================================================
+
+struct MultiSlicerLayout {
+  PF_ParamDef defs[MULTISLICER_NUM_PARAMS]; // the input layer is set per frame
+  A_long width;
+  A_long height;
+  int32_t depth; // MULTISLICER_DEPTH_8 or _16: what the plugin renders at
+  PF_RationalScale pixelAspect;
+  MultiSlicerExecutor executor;
+  PF_Handle sequenceData;
+};
+
+// A frame's parameters and layers, ready for the plugin; defs are its
+// commands' effect_ref. Scratch keeps its memory from frame to frame of a
+// batch.
+typedef struct {
+  PF_ParamDef defs[MULTISLICER_NUM_PARAMS];
+  PF_ParamDef *params[MULTISLICER_NUM_PARAMS];
+  std::vector<char> layerScratch[MULTISLICER_NUM_PARAMS]; // converted layers
+  std::vector<char> outputScratch;
+} EngineFrame;
+
+// The plugin is set up while any layout exists; GetHostParamDefs holds the
+// parameters PARAMS_SETUP added, with their defaults
+static std::mutex sEngineMutex;
+static A_long sEngineLayouts = 0;
+
+// Parameter of every MULTISLICER_PARAM_* (the anchor's x and y share one)
+static const A_long kParamIndex[] = {
+    -1,
+    MULTISLICER_SHIFT,
+    MULTISLICER_WIDTH,
+    MULTISLICER_SLICES,
+    MULTISLICER_ANCHOR_POINT,
+    MULTISLICER_ANCHOR_POINT,
+    MULTISLICER_ANGLE,
+    MULTISLICER_SEED,
+    MULTISLICER_SHIFT_MAP_SAMPLING,
+    MULTISLICER_DENSITY_AMOUNT,
+    MULTISLICER_SLICE_ROTATION,
+    MULTISLICER_SLICE_SCALE,
+    MULTISLICER_SLICE_DEPTH,
+    MULTISLICER_SLICE_TILT,
+    MULTISLICER_EDGE_WARP,
+    MULTISLICER_WARP_AMPLITUDE,
+    MULTISLICER_WARP_FREQUENCY,
+    MULTISLICER_WARP_SEED,
+    MULTISLICER_SHATTER_VELOCITY,
+    MULTISLICER_SHATTER_SPIN,
+    MULTISLICER_SHATTER_GRAVITY,
+    MULTISLICER_SHATTER_START,
+    MULTISLICER_PIXEL_SORT,
+    MULTISLICER_SORT_THRESHOLD,
+    MULTISLICER_CROP_TO_CONTENT,
+    MULTISLICER_SOURCE_MODE,
+    MULTISLICER_SOURCE_TRANSITION,
+    MULTISLICER_PREFILTER,
+    MULTISLICER_OUTPUT_SCALE,
+};
+
+// Largest point or angle value that still fits PF_Fixed
+#define ENGINE_FIXED_MAX 32767.0
+
+/**
+ * Set one parameter value, checked against the parameter's valid range.
+ *
+ * @param defs Parameters to change
+ * @param value Parameter and value
+ * @return false for an unknown parameter or a value out of range
+ */
+static bool SetParamValue(PF_ParamDef *defs, const MultiSlicerParamValue &value) {
+  const int32_t count = static_cast<int32_t>(sizeof(kParamIndex) / sizeof(kParamIndex[0]));
+  const double v = value.value;
+  if (value.param < MULTISLICER_PARAM_SHIFT || value.param >= count || !std::isfinite(v)) {
+    return false;
+  }
+  PF_ParamDef &def = defs[kParamIndex[value.param]];
+  switch (def.param_type) {
+  case PF_Param_FLOAT_SLIDER:
+    if (v < def.u.fs_d.valid_min || v > def.u.fs_d.valid_max) {
+      return false;
+    }
+    def.u.fs_d.value = v;
+    break;
+  case PF_Param_SLIDER:
+    if (v < def.u.sd.valid_min || v > def.u.sd.valid_max) {
+      return false;
+    }
+    def.u.sd.value = static_cast<PF_ParamValue>(lround(v));
+    break;
+  case PF_Param_POPUP:
+    if (v < 1.0 || v > def.u.pd.num_choices) {
+      return false;
+    }
+    def.u.pd.value = static_cast<PF_ParamValue>(lround(v));
+    break;
+  case PF_Param_CHECKBOX:
+    def.u.bd.value = (v != 0.0);
+    break;
+  case PF_Param_ANGLE:
+    if (fabs(v) > ENGINE_FIXED_MAX) {
+      return false;
+    }
+    def.u.ad.value = static_cast<PF_Fixed>(lround(v * FIXED_POINT_SCALE));
+    break;
+  case PF_Param_POINT:
+    if (fabs(v) > ENGINE_FIXED_MAX) {
+      return false;
+    }
+    if (value.param == MULTISLICER_PARAM_ANCHOR_X) {
+      def.u.td.x_value = static_cast<PF_Fixed>(lround(v * FIXED_POINT_SCALE));
+    } else {
+      def.u.td.y_value = static_cast<PF_Fixed>(lround(v * FIXED_POINT_SCALE));
+    }
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+static PF_InData MakeInData(const MultiSlicerLayout *layout, EngineFrame *frame) {
+  PF_InData in_data = MakeHostInData(frame ? frame->defs : nullptr);
+  if (layout) {
+    in_data.pixel_aspect_ratio = layout->pixelAspect;
+    in_data.sequence_data = layout->sequenceData;
+  }
+  return in_data;
+}
+
+/**
+ * Issue one command to the plugin, with the layout's executor behind
+ * iterate_generic. Exceptions (a missing suite, allocation failures in the
+ * standard library) become errors.
+ */
+static PF_Err CallPlugin(const MultiSlicerLayout *layout, PF_Cmd cmd, PF_InData &in_data,
+                         PF_OutData &out_data, PF_ParamDef *params[], PF_LayerDef *output,
+                         void *extra = nullptr) {
+  const MultiSlicerExecutor *previous = SetThreadExecutor(layout ? &layout->executor : nullptr);
+  PF_Err err = PF_Err_NONE;
+  try {
+    err = EffectMain(cmd, &in_data, &out_data, params, output, extra);
+  } catch (const std::bad_alloc &) {
+    err = PF_Err_OUT_OF_MEMORY;
+  } catch (...) {
+    err = PF_Err_INTERNAL_STRUCT_DAMAGED;
+  }
+  SetThreadExecutor(previous);
+  return err;
+}
+
+static MultiSlicerStatus StatusFromErr(PF_Err err) {
+  switch (err) {
+  case PF_Err_NONE:
+    return MULTISLICER_OK;
+  case PF_Err_OUT_OF_MEMORY:
+    return MULTISLICER_ERROR_OUT_OF_MEMORY;
+  default:
+    return MULTISLICER_ERROR_RENDER;
+  }
+}
+
+// Set the plugin up for the first layout. Called with sEngineMutex held.
+static PF_Err AcquireEngine() {
+  if (sEngineLayouts > 0) {
+    sEngineLayouts++;
+    return PF_Err_NONE;
+  }
+  InitializeHostSuites();
+  std::vector<PF_ParamDef> &paramDefs = GetHostParamDefs();
+  paramDefs.clear();
+  PF_InData in_data = MakeInData(nullptr, nullptr);
+  PF_OutData out_data;
+  AEFX_CLR_STRUCT(out_data);
+  PF_Err err = CallPlugin(nullptr, PF_Cmd_GLOBAL_SETUP, in_data, out_data, nullptr, nullptr);
+  PF_ParamDef input;
+  AEFX_CLR_STRUCT(input);
+  input.param_type = PF_Param_LAYER;
+  paramDefs.push_back(input);
+  if (!err) {
+    err = CallPlugin(nullptr, PF_Cmd_PARAMS_SETUP, in_data, out_data, nullptr, nullptr);
+  }
+  if (!err && paramDefs.size() != MULTISLICER_NUM_PARAMS) {
+    err = PF_Err_INTERNAL_STRUCT_DAMAGED;
+  }
+  if (err) {
+    CallPlugin(nullptr, PF_Cmd_GLOBAL_SETDOWN, in_data, out_data, nullptr, nullptr);
+    return err;
+  }
+  sEngineLayouts = 1;
+  return PF_Err_NONE;
+}
+
+// Set the plugin down after the last layout. Called with sEngineMutex held.
+static void ReleaseEngine() {
+  if (--sEngineLayouts > 0) {
+    return;
+  }
+  PF_InData in_data = MakeInData(nullptr, nullptr);
+  PF_OutData out_data;
+  AEFX_CLR_STRUCT(out_data);
+  CallPlugin(nullptr, PF_Cmd_GLOBAL_SETDOWN, in_data, out_data, nullptr, nullptr);
+}
+
+// =============================================================================
+// Pixels
+// =============================================================================
+
+static size_t PixelSize(int32_t depth) {
+  switch (depth) {
+  case MULTISLICER_DEPTH_8:
+    return 4 * sizeof(A_u_char);
+  case MULTISLICER_DEPTH_16:
+    return 4 * sizeof(A_u_short);
+  case MULTISLICER_DEPTH_32F:
+    return 4 * sizeof(float);
+  default:
+    return 0;
+  }
+}
+
+static bool IsValidBuffer(const MultiSlicerBuffer &buffer) {
+  const size_t pixelSize = PixelSize(buffer.depth);
+  return buffer.data && buffer.width > 0 && buffer.height > 0 && pixelSize &&
+         buffer.order >= MULTISLICER_ORDER_ARGB && buffer.order <= MULTISLICER_ORDER_ABGR &&
+         buffer.row_bytes >= static_cast<int64_t>(buffer.width) * static_cast<int64_t>(pixelSize) &&
+         buffer.row_bytes <= INT_MAX;
+}
+
+// Whether the plugin can use a buffer as is: ARGB at the layout's depth,
+// channels aligned
+static bool IsNativeBuffer(const MultiSlicerLayout &layout, const MultiSlicerBuffer &buffer) {
+  const size_t channelSize = PixelSize(buffer.depth) / 4;
+  return buffer.order == MULTISLICER_ORDER_ARGB && buffer.depth == layout.depth &&
+         reinterpret_cast<uintptr_t>(buffer.data) % channelSize == 0 &&
+         buffer.row_bytes % static_cast<int64_t>(channelSize) == 0;
+}
+
+// Memory position of alpha, red, green and blue in each MULTISLICER_ORDER_*
+static const int kChannelPositions[4][4] = {
+    {0, 1, 2, 3}, // ARGB
+    {3, 0, 1, 2}, // RGBA
+    {3, 2, 1, 0}, // BGRA
+    {0, 3, 2, 1}, // ABGR
+};
+
+// Channel as 0-1 (float channels are clamped)
+static inline float ReadChannel(const char *pixel, int32_t depth, int position) {
+  switch (depth) {
+  case MULTISLICER_DEPTH_8:
+    return reinterpret_cast<const A_u_char *>(pixel)[position] / 255.0f;
+  case MULTISLICER_DEPTH_16:
+    return reinterpret_cast<const A_u_short *>(pixel)[position] /
+           static_cast<float>(PF_MAX_CHAN16);
+  default: {
+    float value;
+    memcpy(&value, pixel + position * sizeof(float), sizeof(value));
+    return (value > 0.0f) ? ((value < 1.0f) ? value : 1.0f) : 0.0f;
+  }
+  }
+}
+
+static inline void WriteChannel(char *pixel, int32_t depth, int position, float value) {
+  switch (depth) {
+  case MULTISLICER_DEPTH_8:
+    reinterpret_cast<A_u_char *>(pixel)[position] = static_cast<A_u_char>(value * 255.0f + 0.5f);
+    break;
+  case MULTISLICER_DEPTH_16:
+    reinterpret_cast<A_u_short *>(pixel)[position] =
+        static_cast<A_u_short>(value * PF_MAX_CHAN16 + 0.5f);
+    break;
+  default:
+    memcpy(pixel + position * sizeof(float), &value, sizeof(value));
+    break;
+  }
+}
+
+/**
+ * Convert the top-left width x height pixels between two buffers of any
+ * depth and channel order.
+ */
+static void ConvertPixels(const MultiSlicerBuffer &from, const MultiSlicerBuffer &to,
+                          int32_t width, int32_t height) {
+  const size_t fromSize = PixelSize(from.depth);
+  const size_t toSize = PixelSize(to.depth);
+  const int *fromPositions = kChannelPositions[from.order];
+  const int *toPositions = kChannelPositions[to.order];
+  for (int32_t y = 0; y < height; y++) {
+    const char *fromRow = static_cast<const char *>(from.data) + y * from.row_bytes;
+    char *toRow = static_cast<char *>(to.data) + y * to.row_bytes;
+    for (int32_t x = 0; x < width; x++) {
+      for (int c = 0; c < 4; c++) {
+        WriteChannel(toRow + x * toSize, to.depth, toPositions[c],
+                     ReadChannel(fromRow + x * fromSize, from.depth, fromPositions[c]));
+      }
+    }
+  }
+}
+
+// An ARGB buffer at the layout's depth over scratch, which is resized to fit
+static MultiSlicerBuffer ScratchBuffer(const MultiSlicerLayout &layout, A_long width,
+                                       A_long height, std::vector<char> &scratch) {
+  MultiSlicerBuffer buffer;
+  buffer.width = width;
+  buffer.height = height;
+  buffer.depth = layout.depth;
+  buffer.order = MULTISLICER_ORDER_ARGB;
+  buffer.row_bytes = static_cast<int64_t>(width) * PixelSize(layout.depth);
+  scratch.resize(static_cast<size_t>(buffer.row_bytes) * height);
+  buffer.data = scratch.data();
+  return buffer;
+}
+
+// Describe a native buffer (its top-left width x height) as a world. The
+// world is the plugin's image view: its stride is an A_long (IsValidBuffer
+// keeps row_bytes within one), and every row address the plugin takes goes
+// through PixelRow in ptrdiff_t, so frames past 2 GB in total are fine
+static void WrapWorld(const MultiSlicerBuffer &buffer, A_long width, A_long height,
+                      PF_LayerDef &world) {
+  AEFX_CLR_STRUCT(world);
+  world.data = reinterpret_cast<PF_PixelPtr>(buffer.data);
+  world.width = width;
+  world.height = height;
+  world.rowbytes = static_cast<A_long>(buffer.row_bytes);
+  world.world_flags =
+      PF_WorldFlag_WRITEABLE | (buffer.depth == MULTISLICER_DEPTH_16 ? PF_WorldFlag_DEEP : 0);
+  world.pix_aspect_ratio.num = 1;
+  world.pix_aspect_ratio.den = 1;
+  world.extent_hint.right = width;
+  world.extent_hint.bottom = height;
+}
+
+/**
+ * Connect a layer parameter to a buffer: in place when it is native,
+ * otherwise converted into scratch.
+ *
+ * @param layout Layout being rendered
+ * @param buffer Layer pixels, null for no layer
+ * @param scratch Scratch for a conversion
+ * @param def Layer parameter to connect
+ * @return false for an invalid buffer
+ */
+static bool ConnectLayer(const MultiSlicerLayout &layout, const MultiSlicerBuffer *buffer,
+                         std::vector<char> &scratch, PF_ParamDef &def) {
+  AEFX_CLR_STRUCT(def.u.ld);
+  if (!buffer) {
+    return true;
+  }
+  if (!IsValidBuffer(*buffer)) {
+    return false;
+  }
+  if (IsNativeBuffer(layout, *buffer)) {
+    WrapWorld(*buffer, buffer->width, buffer->height, def.u.ld);
+    return true;
+  }
+  MultiSlicerBuffer converted = ScratchBuffer(layout, buffer->width, buffer->height, scratch);
+  ConvertPixels(*buffer, converted, buffer->width, buffer->height);
+  WrapWorld(converted, converted.width, converted.height, def.u.ld);
+  return true;
+}
+
+/**
+ * Copy a caller's frame, of any version, into this version's struct.
+ *
+ * @param frame Caller's frame, struct_size bytes long
+ * @param copy Receives the frame; fields the caller's version lacks are zero
+ * @return MULTISLICER_ERROR_VERSION below the version 1 size
+ */
+static MultiSlicerStatus ReadFrame(const MultiSlicerFrame &frame, MultiSlicerFrame &copy) {
+  if (frame.struct_size < MULTISLICER_FRAME_V1_SIZE) {
+    return MULTISLICER_ERROR_VERSION;
+  }
+  memset(&copy, 0, sizeof(copy));
+  memcpy(&copy, &frame, MIN(static_cast<size_t>(frame.struct_size), sizeof(copy)));
+  return MULTISLICER_OK;
+}
+
+/**
+ * Load a frame's parameter values and layers.
+ *
+ * @param layout Layout being rendered
+ * @param frame Frame to render
+ * @param state Receives the parameters
+ * @return MULTISLICER_OK, or why the frame cannot be rendered
+ */
+static MultiSlicerStatus PrepareFrame(const MultiSlicerLayout &layout,
+                                      const MultiSlicerFrame &frame, EngineFrame &state) {
+  if ((frame.value_count > 0 && !frame.values) || frame.value_count < 0 ||
+      !(frame.budget_ms >= 0.0) ||
+      frame.source.width != layout.width || frame.source.height != layout.height) {
+    return MULTISLICER_ERROR_INVALID_ARGUMENT;
+  }
+
+  memcpy(state.defs, layout.defs, sizeof(state.defs));
+  for (int32_t i = 0; i < frame.value_count; i++) {
+    if (!SetParamValue(state.defs, frame.values[i])) {
+      return MULTISLICER_ERROR_INVALID_ARGUMENT;
+    }
+  }
+
+  const struct {
+    A_long index;
+    const MultiSlicerBuffer *buffer;
+  } layers[] = {
+      {MULTISLICER_INPUT, &frame.source},          {MULTISLICER_SHIFT_MAP, frame.shift_map},
+      {MULTISLICER_DENSITY_MAP, frame.density_map}, {MULTISLICER_SOURCE_2, frame.sources[0]},
+      {MULTISLICER_SOURCE_3, frame.sources[1]},     {MULTISLICER_SOURCE_4, frame.sources[2]},
+  };
+  for (const auto &layer : layers) {
+    if (!ConnectLayer(layout, layer.buffer, state.layerScratch[layer.index],
+                      state.defs[layer.index])) {
+      return MULTISLICER_ERROR_INVALID_ARGUMENT;
+    }
+  }
+  for (A_long i = 0; i < MULTISLICER_NUM_PARAMS; i++) {
+    state.params[i] = &state.defs[i];
+  }
+  return MULTISLICER_OK;
+}
+
+/**
+ * FRAME_SETUP for a prepared frame.
+ *
+ * @param in_data Command input; frame_data is set to what the plugin keeps
+ *                for the render, to be given back with FRAME_SETDOWN
+ * @param rect Receives the frame's size and origin
+ */
+static PF_Err SetupFrame(const MultiSlicerLayout &layout, EngineFrame &state,
+                         PF_InData &in_data, MultiSlicerFrameRect &rect) {
+  PF_OutData out_data;
+  AEFX_CLR_STRUCT(out_data);
+  // AE starts from the layer's size; FRAME_SETUP only changes it to expand
+  out_data.width = layout.width;
+  out_data.height = layout.height;
+  PF_ParamDef input;
+  PF_ParamDef *params[MULTISLICER_NUM_PARAMS];
+  MakeFrameSetupParams(state.params, input, params);
+  PF_Err err = CallPlugin(&layout, PF_Cmd_FRAME_SETUP, in_data, out_data, params, nullptr);
+  in_data.frame_data = out_data.frame_data;
+  rect.width = out_data.width;
+  rect.height = out_data.height;
+  rect.origin_x = out_data.origin.h;
+  rect.origin_y = out_data.origin.v;
+  return err;
+}
+
+static void SetdownFrame(const MultiSlicerLayout &layout, EngineFrame &state,
+                         PF_InData &in_data) {
+  if (in_data.frame_data) {
+    PF_OutData out_data;
+    AEFX_CLR_STRUCT(out_data);
+    CallPlugin(&layout, PF_Cmd_FRAME_SETDOWN, in_data, out_data, state.params, nullptr);
+    in_data.frame_data = nullptr;
+  }
+}
+
+static void SetFrameTime(const MultiSlicerFrame &frame, PF_InData &in_data) {
+  in_data.current_time = frame.time;
+  in_data.time_scale = frame.time_scale ? frame.time_scale : 1;
+}
+
+/**
+ * Render one frame: FRAME_SETUP, RENDER into the destination (or scratch
+ * converted into it) and FRAME_SETDOWN. The caller's frame receives the
+ * rect and, from version 2, what the frame budget gave up.
+ */
+static MultiSlicerStatus RenderFrame(const MultiSlicerLayout &layout,
+                                     MultiSlicerFrame &callerFrame, EngineFrame &state) {
+  MultiSlicerFrame frame;
+  MultiSlicerStatus status = ReadFrame(callerFrame, frame);
+  if (!status) {
+    status = PrepareFrame(layout, frame, state);
+  }
+  if (status) {
+    return status;
+  }
+  PF_InData in_data = MakeInData(&layout, &state);
+  SetFrameTime(frame, in_data);
+  MultiSlicerFrameRect rect;
+  PF_Err err = SetupFrame(layout, state, in_data, rect);
+  if (!err) {
+    callerFrame.rect = rect;
+  }
+  MultiSlicerFrameBudget budget;
+  AEFX_CLR_STRUCT(budget);
+  budget.magic = FRAME_BUDGET_MAGIC;
+  budget.budgetMs = frame.budget_ms;
+
+  const MultiSlicerBuffer &destination = frame.destination;
+  if (!err && !IsValidBuffer(destination)) {
+    status = MULTISLICER_ERROR_INVALID_ARGUMENT;
+  } else if (!err && (destination.width < rect.width || destination.height < rect.height)) {
+    status = MULTISLICER_ERROR_BUFFER_SIZE;
+  } else if (!err) {
+    const bool native = IsNativeBuffer(layout, destination);
+    PF_LayerDef output;
+    MultiSlicerBuffer scratch = destination;
+    try {
+      if (!native) {
+        scratch = ScratchBuffer(layout, rect.width, rect.height, state.outputScratch);
+      }
+    } catch (const std::bad_alloc &) {
+      err = PF_Err_OUT_OF_MEMORY;
+    }
+    if (!err) {
+      WrapWorld(scratch, rect.width, rect.height, output);
+      PF_OutData out_data;
+      AEFX_CLR_STRUCT(out_data);
+      in_data.output_origin_x = rect.origin_x;
+      in_data.output_origin_y = rect.origin_y;
+      err = CallPlugin(&layout, PF_Cmd_RENDER, in_data, out_data, state.params, &output,
+                       &budget);
+    }
+    if (!err && !native) {
+      ConvertPixels(scratch, destination, rect.width, rect.height);
+    }
+  }
+  if (!err && callerFrame.struct_size >= sizeof(MultiSlicerFrame)) {
+    callerFrame.draft = budget.draft ? 1 : 0;
+    callerFrame.reduced = budget.reduced ? 1 : 0;
+  }
+
+  SetdownFrame(layout, state, in_data);
+  return status ? status : StatusFromErr(err);
+}
+
+// =============================================================================
+// Interface
+// =============================================================================
+
+extern "C" int32_t MultiSlicer_GetApiVersion(void) {
+  return MULTISLICER_ENGINE_API_VERSION;
+}
+
+extern "C" MultiSlicerStatus MultiSlicer_CreateLayout(int32_t api_version,
+                                                     const MultiSlicerLayoutDesc *desc,
+                                                     MultiSlicerLayout **layout) {
+  if (!layout) {
+    return MULTISLICER_ERROR_INVALID_ARGUMENT;
+  }
+  *layout = nullptr;
+  if (api_version < 1 || api_version > MULTISLICER_ENGINE_API_VERSION) {
+    return MULTISLICER_ERROR_VERSION;
+  }
+  if (!desc) {
+    return MULTISLICER_ERROR_INVALID_ARGUMENT;
+  }
+  if (desc->struct_size < sizeof(MultiSlicerLayoutDesc) ||
+      (desc->executor && desc->executor->struct_size < sizeof(MultiSlicerExecutor))) {
+    return MULTISLICER_ERROR_VERSION;
+  }
+  if (desc->width <= 0 || desc->height <= 0 || !PixelSize(desc->depth) ||
+      desc->pixel_aspect_num < 0 || (desc->pixel_aspect_num > 0 && desc->pixel_aspect_den <= 0) ||
+      (desc->value_count > 0 && !desc->values) || desc->value_count < 0 ||
+      (desc->executor && (desc->executor->workers < 1 || !desc->executor->run))) {
+    return MULTISLICER_ERROR_INVALID_ARGUMENT;
+  }
+
+  std::unique_ptr<MultiSlicerLayout> created(new (std::nothrow) MultiSlicerLayout());
+  if (!created) {
+    return MULTISLICER_ERROR_OUT_OF_MEMORY;
+  }
+  std::lock_guard<std::mutex> lock(sEngineMutex);
+  PF_Err err = AcquireEngine();
+  if (err) {
+    return StatusFromErr(err);
+  }
+
+  MultiSlicerLayout &l = *created;
+  memcpy(l.defs, GetHostParamDefs().data(), sizeof(l.defs));
+  l.width = desc->width;
+  l.height = desc->height;
+  l.depth = (desc->depth == MULTISLICER_DEPTH_8) ? MULTISLICER_DEPTH_8 : MULTISLICER_DEPTH_16;
+  l.pixelAspect.num = desc->pixel_aspect_num ? desc->pixel_aspect_num : 1;
+  l.pixelAspect.den = desc->pixel_aspect_num ? desc->pixel_aspect_den : 1;
+  l.executor = desc->executor ? *desc->executor : GetHostExecutor();
+  l.executor.struct_size = sizeof(l.executor);
+
+  // The anchor defaults to a position in percent of the layer, which AE
+  // turns into pixels
+  PF_PointDef &anchor = l.defs[MULTISLICER_ANCHOR_POINT].u.td;
+  anchor.x_value = static_cast<PF_Fixed>(static_cast<double>(anchor.x_dephault) * l.width / 100.0);
+  anchor.y_value = static_cast<PF_Fixed>(static_cast<double>(anchor.y_dephault) * l.height / 100.0);
+  for (int32_t i = 0; i < desc->value_count; i++) {
+    if (!SetParamValue(l.defs, desc->values[i])) {
+      ReleaseEngine();
+      return MULTISLICER_ERROR_INVALID_ARGUMENT;
+    }
+  }
+
+  PF_InData in_data = MakeInData(&l, nullptr);
+  PF_OutData out_data;
+  AEFX_CLR_STRUCT(out_data);
+  err = CallPlugin(&l, PF_Cmd_SEQUENCE_SETUP, in_data, out_data, nullptr, nullptr);
+  if (err) {
+    ReleaseEngine();
+    return StatusFromErr(err);
+  }
+  l.sequenceData = out_data.sequence_data;
+  *layout = created.release();
+  return MULTISLICER_OK;
+}
+
+extern "C" void MultiSlicer_DestroyLayout(MultiSlicerLayout *layout) {
+  if (!layout) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(sEngineMutex);
+  PF_InData in_data = MakeInData(layout, nullptr);
+  PF_OutData out_data;
+  AEFX_CLR_STRUCT(out_data);
+  CallPlugin(layout, PF_Cmd_SEQUENCE_SETDOWN, in_data, out_data, nullptr, nullptr);
+  ReleaseEngine();
+  delete layout;
+}
+
+extern "C" MultiSlicerStatus MultiSlicer_GetFrameRect(MultiSlicerLayout *layout,
+                                                     const MultiSlicerFrame *frame,
+                                                     MultiSlicerFrameRect *rect) {
+  if (!layout || !frame || !rect) {
+    return MULTISLICER_ERROR_INVALID_ARGUMENT;
+  }
+  try {
+    std::unique_ptr<EngineFrame> state(new EngineFrame());
+    MultiSlicerFrame current;
+    MultiSlicerStatus status = ReadFrame(*frame, current);
+    if (!status) {
+      status = PrepareFrame(*layout, current, *state);
+    }
+    if (status) {
+      return status;
+    }
+    PF_InData in_data = MakeInData(layout, state.get());
+    SetFrameTime(current, in_data);
+    PF_Err err = SetupFrame(*layout, *state, in_data, *rect);
+    SetdownFrame(*layout, *state, in_data);
+    return StatusFromErr(err);
+  } catch (const std::bad_alloc &) {
+    return MULTISLICER_ERROR_OUT_OF_MEMORY;
+  }
+}
+
+extern "C" MultiSlicerStatus MultiSlicer_RenderFrames(MultiSlicerLayout *layout,
+                                                     MultiSlicerFrame *frames, int32_t count,
+                                                     int32_t *rendered) {
+  if (rendered) {
+    *rendered = 0;
+  }
+  if (!layout || count < 0 || (count > 0 && !frames)) {
+    return MULTISLICER_ERROR_INVALID_ARGUMENT;
+  }
+  try {
+    std::unique_ptr<EngineFrame> state(new EngineFrame());
+    // Frames are as long as the caller's version has them
+    const size_t stride = (count > 0) ? frames->struct_size : 0;
+    for (int32_t i = 0; i < count; i++) {
+      MultiSlicerFrame &frame =
+          *reinterpret_cast<MultiSlicerFrame *>(reinterpret_cast<char *>(frames) + i * stride);
+      MultiSlicerStatus status = RenderFrame(*layout, frame, *state);
+      if (status) {
+        return status;
+      }
+      if (rendered) {
+        (*rendered)++;
+      }
+    }
+  } catch (const std::bad_alloc &) {
+    return MULTISLICER_ERROR_OUT_OF_MEMORY;
+  }
+  return MULTISLICER_OK;
+}
+
+extern "C" MultiSlicerStatus MultiSlicer_Render(MultiSlicerLayout *layout,
+                                               MultiSlicerFrame *frame) {
+  return MultiSlicer_RenderFrames(layout, frame, 1, nullptr);
+}
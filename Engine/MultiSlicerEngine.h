@@ -0,0 +1,242 @@
+/*  MultiSlicerEngine.h
+
+    C interface to the MultiSlicer slice engine, for pipelines that link it
+    directly instead of running it inside After Effects. Nothing here depends
+    on the After Effects SDK, and nothing throws: every call returns a
+    MultiSlicerStatus.
+
+    A layout holds the parameter values, the source size, the executor and
+    a plugin instance of its own; it is created once and reused for every
+    frame rendered with it. Frames pass their own pixels and may override
+    any parameter (typically Shift or Shatter time). A layout holds no slice
+    geometry: as in After Effects, the plugin's geometry cache builds a map
+    once a layout renders the same geometry twice in a row, and frames that
+    only animate Shift reuse it. That cache is shared by all layouts and
+    keeps a few maps (GEOMETRY_CACHE_MAPS and GEOMETRY_CACHE_BYTES in
+    MultiSlicer.h), so layouts with different geometry rendered in turn can
+    evict one another's maps. Layouts are never changed after creation: any
+    number of threads may render with the same layout at once.
+
+    Buffers belong to the caller and are read and written in place when
+    their channel order is ARGB and their depth is the layout's; any other
+    order or depth goes through a conversion into scratch. Pixels have
+    premultiplied alpha. 16-bit channels use After Effects' range, 0 to
+    32768; 32-bit float channels are 0 to 1, rendered at 16 bits.
+
+    Version MULTISLICER_ENGINE_API_VERSION. Structs start with struct_size;
+    later versions only append fields, and calls reject sizes smaller than
+    the version 1 struct.
+*/
+
+#ifndef MULTISLICER_ENGINE_H
+#define MULTISLICER_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(MULTISLICER_ENGINE_SHARED)
+#ifdef MULTISLICER_ENGINE_BUILD
+#define MULTISLICER_ENGINE_API __declspec(dllexport)
+#else
+#define MULTISLICER_ENGINE_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define MULTISLICER_ENGINE_API __attribute__((visibility("default")))
+#else
+#define MULTISLICER_ENGINE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MULTISLICER_ENGINE_API_VERSION 2
+
+typedef int32_t MultiSlicerStatus;
+enum {
+  MULTISLICER_OK = 0,
+  MULTISLICER_ERROR_INVALID_ARGUMENT, // null pointer, unknown parameter or
+                                      // value out of range, bad buffer
+  MULTISLICER_ERROR_VERSION,          // API version or struct_size unknown
+  MULTISLICER_ERROR_BUFFER_SIZE,      // destination smaller than the frame
+  MULTISLICER_ERROR_OUT_OF_MEMORY,
+  MULTISLICER_ERROR_RENDER            // the engine itself failed
+};
+
+// Channel depth of a buffer
+enum {
+  MULTISLICER_DEPTH_8 = 8,
+  MULTISLICER_DEPTH_16 = 16,
+  MULTISLICER_DEPTH_32F = 32
+};
+
+// Channel order of a buffer, first to last in memory
+enum {
+  MULTISLICER_ORDER_ARGB = 0, // After Effects' own
+  MULTISLICER_ORDER_RGBA,
+  MULTISLICER_ORDER_BGRA,
+  MULTISLICER_ORDER_ABGR
+};
+
+// Parameters, in the units of the Effect Controls. Menus count from 1 and
+// checkboxes are 0 or 1. The anchor is in source pixels (default: the
+// center); Shatter is driven by the frame's time.
+enum {
+  MULTISLICER_PARAM_SHIFT = 1,
+  MULTISLICER_PARAM_WIDTH,
+  MULTISLICER_PARAM_SLICES,
+  MULTISLICER_PARAM_ANCHOR_X,
+  MULTISLICER_PARAM_ANCHOR_Y,
+  MULTISLICER_PARAM_ANGLE,
+  MULTISLICER_PARAM_SEED,
+  MULTISLICER_PARAM_SHIFT_MAP_SAMPLING,
+  MULTISLICER_PARAM_DENSITY_AMOUNT,
+  MULTISLICER_PARAM_SLICE_ROTATION,
+  MULTISLICER_PARAM_SLICE_SCALE,
+  MULTISLICER_PARAM_SLICE_DEPTH,
+  MULTISLICER_PARAM_SLICE_TILT,
+  MULTISLICER_PARAM_EDGE_WARP,
+  MULTISLICER_PARAM_WARP_AMPLITUDE,
+  MULTISLICER_PARAM_WARP_FREQUENCY,
+  MULTISLICER_PARAM_WARP_SEED,
+  MULTISLICER_PARAM_SHATTER_VELOCITY,
+  MULTISLICER_PARAM_SHATTER_SPIN,
+  MULTISLICER_PARAM_SHATTER_GRAVITY,
+  MULTISLICER_PARAM_SHATTER_START,
+  MULTISLICER_PARAM_PIXEL_SORT,
+  MULTISLICER_PARAM_SORT_THRESHOLD,
+  MULTISLICER_PARAM_CROP_TO_CONTENT,
+  MULTISLICER_PARAM_SOURCE_MODE,
+  MULTISLICER_PARAM_SOURCE_TRANSITION,
+  MULTISLICER_PARAM_PREFILTER,
+  MULTISLICER_PARAM_OUTPUT_SCALE
+};
+
+typedef struct {
+  int32_t param; // MULTISLICER_PARAM_*
+  double value;
+} MultiSlicerParamValue;
+
+// Caller-owned pixels
+typedef struct {
+  void *data;
+  int32_t width;
+  int32_t height;
+  int64_t row_bytes; // at least width times the pixel size, at most INT_MAX
+  int32_t depth;     // MULTISLICER_DEPTH_*
+  int32_t order;     // MULTISLICER_ORDER_*
+} MultiSlicerBuffer;
+
+// Work for an executor: one call per index
+typedef void (*MultiSlicerTask)(void *task_context, int32_t worker, int32_t index);
+
+// The embedder's thread pool. run calls task once for every index in
+// [0, count), each with a worker in [0, workers) that no other call running
+// at the same time has, and returns when all calls have returned. Calls may
+// all run on the calling thread. Tasks never block on one another.
+typedef struct {
+  uint32_t struct_size; // sizeof(MultiSlicerExecutor)
+  int32_t workers;      // at least 1
+  void *context;
+  void (*run)(void *context, int32_t count, MultiSlicerTask task, void *task_context);
+} MultiSlicerExecutor;
+
+typedef struct {
+  uint32_t struct_size; // sizeof(MultiSlicerLayoutDesc)
+  int32_t width;        // source size in pixels
+  int32_t height;
+  int32_t depth;              // MULTISLICER_DEPTH_* to render at
+  int32_t pixel_aspect_num;   // source pixel aspect ratio; 0 for square
+  int32_t pixel_aspect_den;
+  const MultiSlicerExecutor *executor; // null: threads of the engine's own
+  const MultiSlicerParamValue *values; // changes from the defaults
+  int32_t value_count;
+} MultiSlicerLayoutDesc;
+
+// Where a frame's output lies: the destination position of the source's
+// top-left pixel and the size that holds every pixel the slices can reach
+typedef struct {
+  int32_t width;
+  int32_t height;
+  int32_t origin_x;
+  int32_t origin_y;
+} MultiSlicerFrameRect;
+
+typedef struct {
+  uint32_t struct_size; // sizeof(MultiSlicerFrame)
+  int32_t time;         // layer time is time / time_scale seconds
+  uint32_t time_scale;  // 0 for 1
+  const MultiSlicerParamValue *values; // changes from the layout's values
+  int32_t value_count;
+  MultiSlicerBuffer source;          // the layout's width and height
+  const MultiSlicerBuffer *shift_map;   // optional layers, null when unused
+  const MultiSlicerBuffer *density_map;
+  const MultiSlicerBuffer *sources[3];  // Source 2-4
+  MultiSlicerBuffer destination; // at least the frame's size; rendered from its top-left
+  MultiSlicerFrameRect rect;     // set by rendering: what was rendered
+  // Version 2: frame budget (real-time playout). A frame whose estimated
+  // render time exceeds budget_ms first drops Prefilter Slices and Output
+  // Scale subsampling (draft), then renders at half resolution on both
+  // axes (reduced). Estimates come from the layout's own measured frames,
+  // so the first frames of a layout render at full quality.
+  double budget_ms; // 0 for none
+  int32_t draft;    // set by rendering: 1 when rendered with draft sampling
+  int32_t reduced;  // set by rendering: 1 when rendered at half resolution
+} MultiSlicerFrame;
+
+// struct_size of a version 1 MultiSlicerFrame
+#define MULTISLICER_FRAME_V1_SIZE offsetof(MultiSlicerFrame, budget_ms)
+
+typedef struct MultiSlicerLayout MultiSlicerLayout;
+
+// MULTISLICER_ENGINE_API_VERSION of the library
+MULTISLICER_ENGINE_API int32_t MultiSlicer_GetApiVersion(void);
+
+/**
+ * Create a layout.
+ *
+ * @param api_version MULTISLICER_ENGINE_API_VERSION the caller was built with
+ * @param desc Source size, depth, executor and parameter values
+ * @param layout Receives the layout; release with MultiSlicer_DestroyLayout
+ */
+MULTISLICER_ENGINE_API MultiSlicerStatus MultiSlicer_CreateLayout(
+    int32_t api_version, const MultiSlicerLayoutDesc *desc, MultiSlicerLayout **layout);
+
+// Release a layout no render is using any more (null is ignored)
+MULTISLICER_ENGINE_API void MultiSlicer_DestroyLayout(MultiSlicerLayout *layout);
+
+/**
+ * Size of a frame's output, to allocate its destination. The destination
+ * is not used; the source is read for Crop to Content.
+ *
+ * @param layout Layout to render with
+ * @param frame Time, parameter changes and layers of the frame
+ * @param rect Receives the frame's size and origin
+ */
+MULTISLICER_ENGINE_API MultiSlicerStatus MultiSlicer_GetFrameRect(
+    MultiSlicerLayout *layout, const MultiSlicerFrame *frame, MultiSlicerFrameRect *rect);
+
+/**
+ * Render frames one after another, on the layout's executor.
+ *
+ * Each frame's rect is set; a destination smaller than it fails with
+ * MULTISLICER_ERROR_BUFFER_SIZE and is left alone. Rendering stops at the
+ * first frame that fails.
+ *
+ * @param layout Layout to render with
+ * @param frames Frames to render, all of the first frame's struct_size
+ * @param count Number of frames
+ * @param rendered Receives the number of frames rendered (may be null)
+ */
+MULTISLICER_ENGINE_API MultiSlicerStatus MultiSlicer_RenderFrames(
+    MultiSlicerLayout *layout, MultiSlicerFrame *frames, int32_t count, int32_t *rendered);
+
+// One frame: MultiSlicer_RenderFrames with a count of 1
+MULTISLICER_ENGINE_API MultiSlicerStatus MultiSlicer_Render(MultiSlicerLayout *layout,
+                                                            MultiSlicerFrame *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MULTISLICER_ENGINE_H
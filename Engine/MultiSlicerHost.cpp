@@ -0,0 +1,283 @@
+/*  MultiSlicerHost.cpp
+
+    The stand-in host of MultiSlicerHost.h. Built into the engine and the
+    Linux replay alike; see their build lines.
+*/
+
+#include "MultiSlicerHost.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// =============================================================================
+// Handles and iteration
+// =============================================================================
+
+// Handles are a pointer to the data, with the size stored just before it
+static PF_Handle HostNewHandle(A_u_longlong size) {
+  A_u_longlong *block = static_cast<A_u_longlong *>(calloc(1, sizeof(A_u_longlong) + size));
+  void **handle = static_cast<void **>(malloc(sizeof(void *)));
+  if (!block || !handle) {
+    free(block);
+    free(handle);
+    return nullptr;
+  }
+  block[0] = size;
+  *handle = block + 1;
+  return handle;
+}
+
+static void *HostLockHandle(PF_Handle handle) {
+  return handle ? *handle : nullptr;
+}
+
+static void HostUnlockHandle(PF_Handle handle) {}
+
+void DisposeHostHandle(PF_Handle handle) {
+  if (handle) {
+    free(static_cast<A_u_longlong *>(*handle) - 1);
+    free(handle);
+  }
+}
+
+static A_u_longlong HostGetHandleSize(PF_Handle handle) {
+  return handle ? static_cast<A_u_longlong *>(*handle)[-1] : 0;
+}
+
+static PF_Err HostResizeHandle(A_u_longlong size, PF_Handle *handle) {
+  A_u_longlong *block = static_cast<A_u_longlong *>(
+      realloc(static_cast<A_u_longlong *>(**handle) - 1, sizeof(A_u_longlong) + size));
+  if (!block) {
+    return PF_Err_OUT_OF_MEMORY;
+  }
+  block[0] = size;
+  **handle = block + 1;
+  return PF_Err_NONE;
+}
+
+// The host's own executor, for callers that bring none
+static MultiSlicerExecutor sOwnExecutor;
+
+// Executor of the commands issued on this thread (SetThreadExecutor)
+static thread_local const MultiSlicerExecutor *tExecutor = nullptr;
+
+static void RunOnOwnThreads(void *context, int32_t count, MultiSlicerTask task,
+                            void *task_context) {
+  const int32_t workers = MIN(sOwnExecutor.workers, MAX(count, 1));
+  std::atomic<int32_t> next(0);
+  auto work = [&](int32_t worker) {
+    for (int32_t i = next++; i < count; i = next++) {
+      task(task_context, worker, i);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  try {
+    for (int32_t worker = 1; worker < workers; worker++) {
+      threads.emplace_back(work, worker);
+    }
+  } catch (const std::exception &) {
+    // Fewer workers; this thread takes whatever is left
+  }
+  work(0);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+// One iterate_generic call, as executor tasks
+typedef struct {
+  PF_Err (*fn)(void *refcon, A_long thread_index, A_long i, A_long iterations);
+  void *refcon;
+  A_long iterations;
+  std::atomic<PF_Err> err;
+} IterateTask;
+
+static void RunIterateTask(void *task_context, int32_t worker, int32_t index) {
+  IterateTask *task = static_cast<IterateTask *>(task_context);
+  if (task->err) {
+    return;
+  }
+  PF_Err err = task->fn(task->refcon, worker, index, task->iterations);
+  if (err) {
+    PF_Err none = PF_Err_NONE;
+    task->err.compare_exchange_strong(none, err);
+  }
+}
+
+/**
+ * iterate_generic on the calling thread's executor.
+ *
+ * ONCE_PER_PROCESSOR calls fn once per worker of the executor; otherwise
+ * every iteration is one task. After an error the remaining tasks return
+ * at once.
+ */
+static PF_Err HostIterateGeneric(A_long iterations, void *refcon,
+                                 PF_Err (*fn)(void *refcon, A_long thread_index, A_long i,
+                                              A_long iterations)) {
+  const MultiSlicerExecutor *executor = tExecutor ? tExecutor : &sOwnExecutor;
+  IterateTask task;
+  task.fn = fn;
+  task.refcon = refcon;
+  task.iterations =
+      (iterations == PF_Iterations_ONCE_PER_PROCESSOR) ? executor->workers : iterations;
+  task.err = PF_Err_NONE;
+  if (task.iterations > 0) {
+    executor->run(executor->context, task.iterations, RunIterateTask, &task);
+  }
+  return task.err;
+}
+
+// copy_hq without resampling: the plugin only copies equal-sized rects
+static PF_Err HostCopyHQ(PF_ProgPtr effect_ref, PF_EffectWorld *src, PF_EffectWorld *dst,
+                         PF_Rect *src_r, PF_Rect *dst_r) {
+  const size_t pixelSize = PF_WORLD_IS_DEEP(src) ? sizeof(PF_Pixel16) : sizeof(PF_Pixel);
+  PF_Rect from = src_r ? *src_r : PF_Rect{0, 0, src->width, src->height};
+  PF_Rect to = dst_r ? *dst_r : PF_Rect{0, 0, dst->width, dst->height};
+  const A_long width = MIN(from.right - from.left, to.right - to.left);
+  const A_long height = MIN(from.bottom - from.top, to.bottom - to.top);
+  for (A_long y = 0; y < height; y++) {
+    memcpy(static_cast<char *>(static_cast<void *>(dst->data)) +
+               (to.top + y) * static_cast<ptrdiff_t>(dst->rowbytes) + to.left * pixelSize,
+           static_cast<const char *>(static_cast<const void *>(src->data)) +
+               (from.top + y) * static_cast<ptrdiff_t>(src->rowbytes) + from.left * pixelSize,
+           width * pixelSize);
+  }
+  return PF_Err_NONE;
+}
+
+// =============================================================================
+// Parameters
+// =============================================================================
+
+static std::vector<PF_ParamDef> sParamDefs;
+
+static PF_Err HostAddParam(PF_ProgPtr effect_ref, PF_ParamIndex index, PF_ParamDef *def) {
+  sParamDefs.push_back(*def);
+  return PF_Err_NONE;
+}
+
+// effect_ref points to the command's MULTISLICER_NUM_PARAMS parameters
+static PF_Err HostCheckoutParam(PF_ProgPtr effect_ref, PF_ParamIndex index, A_long what_time,
+                                A_long time_step, A_u_long time_scale, PF_ParamDef *param) {
+  const PF_ParamDef *defs = reinterpret_cast<const PF_ParamDef *>(effect_ref);
+  if (!defs || index < 0 || index >= MULTISLICER_NUM_PARAMS) {
+    return PF_Err_BAD_CALLBACK_PARAM;
+  }
+  *param = defs[index];
+  return PF_Err_NONE;
+}
+
+static PF_Err HostCheckinParam(PF_ProgPtr effect_ref, PF_ParamDef *param) {
+  return PF_Err_NONE;
+}
+
+// =============================================================================
+// Suite table
+// =============================================================================
+
+static PF_HandleSuite1 sHandleSuite;
+static PF_Iterate8Suite1 sIterate8Suite;
+static PF_WorldTransformSuite1 sWorldTransformSuite;
+static const AEGP_ComputeCacheSuite1 *sComputeCacheSuite = nullptr;
+
+// The version argument's type differs between SDK releases of SPBasic.h
+template <typename Version>
+static SPErr HostAcquireSuite(const char *name, Version version, const void **suite) {
+  *suite = nullptr;
+  if (!strcmp(name, kPFHandleSuite)) {
+    *suite = &sHandleSuite;
+  } else if (!strcmp(name, kPFIterate8Suite)) {
+    *suite = &sIterate8Suite;
+  } else if (!strcmp(name, kPFWorldTransformSuite)) {
+    *suite = &sWorldTransformSuite;
+  } else if (!strcmp(name, kAEGPComputeCacheSuite)) {
+    *suite = sComputeCacheSuite;
+  }
+  return *suite ? 0 : PF_Err_BAD_CALLBACK_PARAM;
+}
+
+template <typename Version> static SPErr HostReleaseSuite(const char *name, Version version) {
+  return 0;
+}
+
+static SPBasicSuite sBasicSuite;
+
+void InitializeHostSuites() {
+  AEFX_CLR_STRUCT(sHandleSuite);
+  sHandleSuite.host_new_handle = HostNewHandle;
+  sHandleSuite.host_lock_handle = HostLockHandle;
+  sHandleSuite.host_unlock_handle = HostUnlockHandle;
+  sHandleSuite.host_dispose_handle = DisposeHostHandle;
+  sHandleSuite.host_get_handle_size = HostGetHandleSize;
+  sHandleSuite.host_resize_handle = HostResizeHandle;
+
+  AEFX_CLR_STRUCT(sIterate8Suite);
+  sIterate8Suite.iterate_generic = HostIterateGeneric;
+
+  AEFX_CLR_STRUCT(sWorldTransformSuite);
+  sWorldTransformSuite.copy_hq = HostCopyHQ;
+
+  AEFX_CLR_STRUCT(sBasicSuite);
+  sBasicSuite.AcquireSuite = HostAcquireSuite;
+  sBasicSuite.ReleaseSuite = HostReleaseSuite;
+
+  AEFX_CLR_STRUCT(sOwnExecutor);
+  sOwnExecutor.struct_size = sizeof(sOwnExecutor);
+  sOwnExecutor.workers = MAX(static_cast<int32_t>(std::thread::hardware_concurrency()), 1);
+  sOwnExecutor.run = RunOnOwnThreads;
+}
+
+void SetHostComputeCache(const AEGP_ComputeCacheSuite1 *suite) {
+  sComputeCacheSuite = suite;
+}
+
+void SetHostWorkers(int32_t workers) {
+  sOwnExecutor.workers = MAX(workers, 1);
+}
+
+const MultiSlicerExecutor &GetHostExecutor() {
+  return sOwnExecutor;
+}
+
+const MultiSlicerExecutor *SetThreadExecutor(const MultiSlicerExecutor *executor) {
+  const MultiSlicerExecutor *previous = tExecutor;
+  tExecutor = executor;
+  return previous;
+}
+
+std::vector<PF_ParamDef> &GetHostParamDefs() {
+  return sParamDefs;
+}
+
+PF_InData MakeHostInData(const PF_ParamDef *defs) {
+  PF_InData in_data;
+  AEFX_CLR_STRUCT(in_data);
+  in_data.inter.add_param = HostAddParam;
+  in_data.inter.checkout_param = HostCheckoutParam;
+  in_data.inter.checkin_param = HostCheckinParam;
+  in_data.pica_basicP = &sBasicSuite;
+  in_data.effect_ref = reinterpret_cast<PF_ProgPtr>(const_cast<PF_ParamDef *>(defs));
+  in_data.downsample_x.num = in_data.downsample_x.den = 1;
+  in_data.downsample_y.num = in_data.downsample_y.den = 1;
+  in_data.pixel_aspect_ratio.num = in_data.pixel_aspect_ratio.den = 1;
+  in_data.time_step = 1;
+  in_data.time_scale = 1;
+  in_data.quality = PF_Quality_HI;
+  in_data.num_params = MULTISLICER_NUM_PARAMS;
+  return in_data;
+}
+
+void MakeFrameSetupParams(PF_ParamDef *const params[], PF_ParamDef &input,
+                          PF_ParamDef *setupParams[]) {
+  for (A_long i = 0; i < MULTISLICER_NUM_PARAMS; i++) {
+    setupParams[i] = params[i];
+  }
+  input = *params[MULTISLICER_INPUT];
+  input.u.ld.data = nullptr;
+  setupParams[MULTISLICER_INPUT] = &input;
+}
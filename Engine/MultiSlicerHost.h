@@ -0,0 +1,73 @@
+/*  MultiSlicerHost.h
+
+    The minimal stand-in After Effects host that both MultiSlicerEngine.cpp
+    and the Linux replay (../Linux/MultiSlicerReplay.cpp) drive the plugin
+    on: heap handles, iterate_generic on an executor, copy_hq for the
+    equal-sized copies the plugin makes, and parameter checkouts answered
+    from the parameters a command's effect_ref points to. A compute cache
+    is only offered when the host sets one (the replay does; the engine
+    keeps to the plugin's own geometry cache, as on hosts before AE 2022).
+
+    One process runs one plugin; the host's state is global.
+*/
+
+#ifndef MULTISLICER_HOST_H
+#define MULTISLICER_HOST_H
+
+#include "MultiSlicer.h"
+#include "MultiSlicerEngine.h"
+
+#include <vector>
+
+// Fill in the suite table; the host's own executor gets one worker per
+// hardware thread
+void InitializeHostSuites();
+
+// Offer a compute cache suite to the plugin from its next GLOBAL_SETUP,
+// null for none
+void SetHostComputeCache(const AEGP_ComputeCacheSuite1 *suite);
+
+// Workers of the host's own executor: a thread per worker and call
+void SetHostWorkers(int32_t workers);
+const MultiSlicerExecutor &GetHostExecutor();
+
+/**
+ * Choose the executor iterate_generic runs on for commands issued from the
+ * calling thread. iterate_generic has no effect_ref to tell callers apart
+ * by, and the plugin calls it from the thread it was called on.
+ *
+ * @param executor Executor to use, null for the host's own
+ * @return The executor it replaces, to be set back afterwards
+ */
+const MultiSlicerExecutor *SetThreadExecutor(const MultiSlicerExecutor *executor);
+
+// Parameters added by PARAMS_SETUP, in order; the host puts the input
+// layer first itself
+std::vector<PF_ParamDef> &GetHostParamDefs();
+
+/**
+ * Input data for one command, at full resolution and quality, square
+ * pixels and time 0 of a 1 Hz time scale.
+ *
+ * @param defs MULTISLICER_NUM_PARAMS parameters checkouts are answered
+ *             from (the command's effect_ref); null for commands without
+ * @return Input data for EffectMain
+ */
+PF_InData MakeHostInData(const PF_ParamDef *defs);
+
+/**
+ * The parameters of a PF_Cmd_FRAME_SETUP, as After Effects passes them: the
+ * input layer has its size and flags but no pixels. Checkouts still answer
+ * from the full parameters.
+ *
+ * @param params The command's parameters
+ * @param input Receives the input layer without pixels
+ * @param setupParams Receives params with the input replaced by input
+ */
+void MakeFrameSetupParams(PF_ParamDef *const params[], PF_ParamDef &input,
+                          PF_ParamDef *setupParams[]);
+
+// Dispose a handle the plugin left with the host (frame_data, sequence_data)
+void DisposeHostHandle(PF_Handle handle);
+
+#endif // MULTISLICER_HOST_H
@@ -0,0 +1,1074 @@
+/*  MultiSlicerReplay.cpp
+
+    Replays a render trace recorded by MultiSlicer on the minimal stand-in
+    After Effects host the engine uses too (../Engine/MultiSlicerHost.cpp),
+    with a stand-in compute cache added, so the command mix AE actually
+    sends (interleaved FRAME_SETUP / RENDER at varying downsample, MFR
+    threads, repeated frames, parameter scrubs) can be timed offline.
+
+    Record a trace by starting After Effects (or aerender) with
+    MULTISLICER_TRACE=<file> in the environment; each process writes
+    <file>.<process id>. Layers are not recorded; the replay fills each one
+    with a test pattern of the recorded size.
+
+    Build on Linux from this directory, with the repository in the SDK's
+    Examples tree as for the Mac and Win projects:
+
+      g++ -std=c++14 -O2 -I.. -I../../../Headers -I../../../Headers/SP \
+          -I../../../Util MultiSlicerReplay.cpp ../Engine/MultiSlicerHost.cpp \
+          ../MultiSlicer.cpp ../MultiSlicer_Strings.cpp \
+          ../../../Util/AEGP_SuiteHandler.cpp \
+          ../../../Util/MissingSuiteError.cpp -lpthread -o MultiSlicerReplay
+
+    Usage: MultiSlicerReplay [-j threads[,threads...]] [-n repeat] [-c MB] [-x] [-m] [-v]
+                             [-k] [-b ms] <trace>
+      -j  worker threads behind iterate_generic (default: all cores); a
+          list replays once per count, each on a freshly set up plugin
+      -n  replay the whole trace this many times (default 1)
+      -c  compute cache budget (default 512 MB)
+      -x  no compute cache, as on hosts before AE 2022
+      -m  replay each recorded thread on its own thread, as AE's MFR did
+      -v  print every replayed command
+      -k  check: replay once with the geometry cache and once without it
+          (MULTISLICER_GEOMETRY_CACHE=0), in recorded order, and fail if
+          any rendered frame differs; with -x the plugin's own cache is
+          checked, otherwise the compute cache path
+      -b  render with this frame budget, as a real-time playout host would
+          (After Effects itself never sets one)
+
+    After the replay the instance's own statistics (MultiSlicerStats, asked
+    for with PF_Cmd_COMPLETELY_GENERAL as an AEGP would) are printed too,
+    then throughput per worker count. Where the Linux powercap RAPL
+    counters are readable (/sys/class/powercap, usually root only) the
+    package energy of each run is reported as joules per frame and per
+    megapixel; it covers the whole machine, so keep it otherwise idle.
+
+*/
+
+#include "../Engine/MultiSlicerHost.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// =============================================================================
+// Stand-in compute cache
+// =============================================================================
+
+// Values stay cached until the budget is exceeded, then the least recently
+// used ones nobody has checked out are deleted, as AE does under pressure
+static size_t sCacheBudget = 512u << 20;
+static bool sCacheEnabled = true;
+
+typedef struct {
+  AEGP_CCComputeValueRefconP value;
+  size_t size;
+  A_long checkouts;
+  bool ready; // false while one thread computes it
+  A_u_longlong lastUse;
+} CacheEntry;
+
+typedef struct {
+  AEGP_ComputeCacheCallbacks callbacks;
+  std::map<std::string, CacheEntry> entries;
+} CacheClass;
+
+typedef struct {
+  CacheClass *owner;
+  std::string key;
+  AEGP_CCComputeValueRefconP value;
+} CacheReceipt;
+
+typedef struct {
+  A_long computed;
+  A_long hits;
+  A_long waits;
+  A_long purged;
+  size_t size;
+  size_t peak;
+} CacheStats;
+
+static std::mutex sCacheMutex;
+static std::condition_variable sCacheReady;
+static std::map<std::string, CacheClass> sCacheClasses;
+static CacheStats sCacheStats;
+static A_u_longlong sCacheClock = 0;
+
+static std::string CacheKey(CacheClass &owner, AEGP_CCComputeOptionsRefconP options,
+                            A_Err &err) {
+  AEGP_CCComputeKey key;
+  AEFX_CLR_STRUCT(key);
+  err = owner.callbacks.generate_key(options, &key);
+  return std::string(reinterpret_cast<const char *>(&key), sizeof(key));
+}
+
+static AEGP_CCCheckoutReceiptP CheckoutEntry(CacheClass &owner, const std::string &key,
+                                             CacheEntry &entry) {
+  entry.checkouts++;
+  entry.lastUse = ++sCacheClock;
+  CacheReceipt *receipt = new CacheReceipt();
+  receipt->owner = &owner;
+  receipt->key = key;
+  receipt->value = entry.value;
+  return reinterpret_cast<AEGP_CCCheckoutReceiptP>(receipt);
+}
+
+// Delete idle values, oldest first, until the cache fits its budget
+static void PurgeCache() {
+  while (sCacheStats.size > sCacheBudget) {
+    CacheClass *oldestClass = nullptr;
+    std::map<std::string, CacheEntry>::iterator oldest;
+    for (auto &cacheClass : sCacheClasses) {
+      for (auto it = cacheClass.second.entries.begin(); it != cacheClass.second.entries.end();
+           ++it) {
+        if (it->second.ready && it->second.checkouts == 0 &&
+            (!oldestClass || it->second.lastUse < oldest->second.lastUse)) {
+          oldestClass = &cacheClass.second;
+          oldest = it;
+        }
+      }
+    }
+    if (!oldestClass) {
+      return;
+    }
+    oldestClass->callbacks.delete_compute_value(oldest->second.value);
+    sCacheStats.size -= oldest->second.size;
+    sCacheStats.purged++;
+    oldestClass->entries.erase(oldest);
+  }
+}
+
+static A_Err HostClassRegister(AEGP_CCComputeClassIdP compute_classP,
+                               const AEGP_ComputeCacheCallbacks *callbacksP) {
+  std::lock_guard<std::mutex> lock(sCacheMutex);
+  sCacheClasses[compute_classP].callbacks = *callbacksP;
+  return A_Err_NONE;
+}
+
+static A_Err HostClassUnregister(AEGP_CCComputeClassIdP compute_classP) {
+  std::lock_guard<std::mutex> lock(sCacheMutex);
+  auto found = sCacheClasses.find(compute_classP);
+  if (found != sCacheClasses.end()) {
+    for (auto &entry : found->second.entries) {
+      if (entry.second.ready) {
+        found->second.callbacks.delete_compute_value(entry.second.value);
+        sCacheStats.size -= entry.second.size;
+      }
+    }
+    sCacheClasses.erase(found);
+  }
+  return A_Err_NONE;
+}
+
+static A_Err HostCheckoutCached(AEGP_CCComputeClassIdP compute_classP,
+                                AEGP_CCComputeOptionsRefconP opaque_optionsP,
+                                AEGP_CCCheckoutReceiptP *compute_receiptPP) {
+  *compute_receiptPP = nullptr;
+  std::unique_lock<std::mutex> lock(sCacheMutex);
+  auto found = sCacheClasses.find(compute_classP);
+  if (found == sCacheClasses.end()) {
+    return PF_Err_BAD_CALLBACK_PARAM;
+  }
+  A_Err err = A_Err_NONE;
+  std::string key = CacheKey(found->second, opaque_optionsP, err);
+  auto entry = found->second.entries.find(key);
+  if (!err && entry != found->second.entries.end() && entry->second.ready) {
+    sCacheStats.hits++;
+    *compute_receiptPP = CheckoutEntry(found->second, key, entry->second);
+  }
+  return err;
+}
+
+/**
+ * Check out a value, computing it on this thread when nobody has.
+ *
+ * A value another thread is computing is waited for (or, without
+ * wait_for_other_threadB, reported as not available with a null receipt).
+ */
+static A_Err HostComputeIfNeededAndCheckout(AEGP_CCComputeClassIdP compute_classP,
+                                            AEGP_CCComputeOptionsRefconP opaque_optionsP,
+                                            bool wait_for_other_threadB,
+                                            AEGP_CCCheckoutReceiptP *compute_receiptPP) {
+  *compute_receiptPP = nullptr;
+  std::unique_lock<std::mutex> lock(sCacheMutex);
+  auto found = sCacheClasses.find(compute_classP);
+  if (found == sCacheClasses.end()) {
+    return PF_Err_BAD_CALLBACK_PARAM;
+  }
+  CacheClass &owner = found->second;
+  A_Err err = A_Err_NONE;
+  std::string key = CacheKey(owner, opaque_optionsP, err);
+  if (err) {
+    return err;
+  }
+
+  for (;;) {
+    auto entry = owner.entries.find(key);
+    if (entry == owner.entries.end()) {
+      break;
+    }
+    if (entry->second.ready) {
+      sCacheStats.hits++;
+      *compute_receiptPP = CheckoutEntry(owner, key, entry->second);
+      return A_Err_NONE;
+    }
+    if (!wait_for_other_threadB) {
+      return A_Err_NONE;
+    }
+    sCacheStats.waits++;
+    sCacheReady.wait(lock);
+  }
+
+  // Compute outside the lock; others asking for the key wait on the entry
+  CacheEntry pending;
+  AEFX_CLR_STRUCT(pending);
+  owner.entries[key] = pending;
+  lock.unlock();
+  AEGP_CCComputeValueRefconP value = nullptr;
+  err = owner.callbacks.compute(opaque_optionsP, &value);
+  size_t size = (!err && value) ? owner.callbacks.approx_size_value(value) : 0;
+  lock.lock();
+
+  if (err || !value) {
+    owner.entries.erase(key);
+    sCacheReady.notify_all();
+    return err;
+  }
+  CacheEntry &entry = owner.entries[key];
+  entry.value = value;
+  entry.size = size;
+  entry.ready = true;
+  sCacheStats.computed++;
+  sCacheStats.size += size;
+  sCacheStats.peak = MAX(sCacheStats.peak, sCacheStats.size);
+  *compute_receiptPP = CheckoutEntry(owner, key, entry);
+  PurgeCache();
+  sCacheReady.notify_all();
+  return A_Err_NONE;
+}
+
+static A_Err HostGetReceiptComputeValue(const AEGP_CCCheckoutReceiptP compute_receiptP,
+                                        AEGP_CCComputeValueRefconP *compute_valuePP) {
+  *compute_valuePP = reinterpret_cast<const CacheReceipt *>(compute_receiptP)->value;
+  return A_Err_NONE;
+}
+
+static A_Err HostCheckinComputeReceipt(AEGP_CCCheckoutReceiptP compute_receiptP) {
+  CacheReceipt *receipt = reinterpret_cast<CacheReceipt *>(compute_receiptP);
+  std::lock_guard<std::mutex> lock(sCacheMutex);
+  auto entry = receipt->owner->entries.find(receipt->key);
+  if (entry != receipt->owner->entries.end()) {
+    entry->second.checkouts--;
+  }
+  delete receipt;
+  PurgeCache();
+  return A_Err_NONE;
+}
+
+// Compute cache suite over the functions above, offered to the plugin
+// unless -x is given
+static AEGP_ComputeCacheSuite1 sComputeCacheSuite;
+
+static void InitializeComputeCache() {
+  AEFX_CLR_STRUCT(sComputeCacheSuite);
+  sComputeCacheSuite.AEGP_ClassRegister = HostClassRegister;
+  sComputeCacheSuite.AEGP_ClassUnregister = HostClassUnregister;
+  sComputeCacheSuite.AEGP_ComputeIfNeededAndCheckout = HostComputeIfNeededAndCheckout;
+  sComputeCacheSuite.AEGP_CheckoutCached = HostCheckoutCached;
+  sComputeCacheSuite.AEGP_GetReceiptComputeValue = HostGetReceiptComputeValue;
+  sComputeCacheSuite.AEGP_CheckinComputeReceipt = HostCheckinComputeReceipt;
+  SetHostComputeCache(sCacheEnabled ? &sComputeCacheSuite : nullptr);
+}
+
+// =============================================================================
+// Parameters and layers
+// =============================================================================
+
+// One recorded command
+typedef struct {
+  TraceRecord record;
+  std::vector<TraceParam> params;
+} ReplayCommand;
+
+// A host-owned layer, filled with the test pattern once per size
+typedef struct {
+  std::vector<char> pixels;
+  PF_LayerDef world;
+} ReplayWorld;
+
+// Per-thread replay state; defs are the command's effect_ref
+typedef struct {
+  PF_ParamDef defs[MULTISLICER_NUM_PARAMS];
+  ReplayWorld layers[MULTISLICER_NUM_PARAMS];
+  ReplayWorld output;
+  PF_Handle frameData;
+} ReplayThread;
+
+// Statistics of one command type
+typedef struct {
+  A_long count;
+  A_long errors;
+  A_long mismatches; // FRAME_SETUP answered a different size or origin
+  double recordedMs;
+  double replayMs;
+  double megapixels; // RENDER: output pixels
+} ReplayStats;
+
+/**
+ * Size a world, filling it with the test pattern when it changes.
+ *
+ * The pattern is a gradient with a checkerboard inside an opaque ellipse,
+ * transparent outside it, so content bounds and empty tiles behave as they
+ * do on a typical layer.
+ *
+ * @param world World to size
+ * @param width Width in pixels (0 for an unconnected layer)
+ * @param height Height in pixels
+ * @param deep Whether the world is 16-bit
+ * @param fill Whether to draw the pattern (outputs are left as allocated)
+ */
+static void PrepareWorld(ReplayWorld &world, A_long width, A_long height, bool deep, bool fill) {
+  const size_t pixelSize = deep ? sizeof(PF_Pixel16) : sizeof(PF_Pixel);
+  if (world.world.width == width && world.world.height == height &&
+      PF_WORLD_IS_DEEP(&world.world) == deep && (width == 0 || world.world.data)) {
+    return;
+  }
+  AEFX_CLR_STRUCT(world.world);
+  world.pixels.assign(static_cast<size_t>(width) * height * pixelSize, 0);
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+  world.world.data = reinterpret_cast<PF_PixelPtr>(world.pixels.data());
+  world.world.width = width;
+  world.world.height = height;
+  world.world.rowbytes = static_cast<A_long>(width * pixelSize);
+  world.world.world_flags = PF_WorldFlag_WRITEABLE | (deep ? PF_WorldFlag_DEEP : 0);
+  world.world.pix_aspect_ratio.num = 1;
+  world.world.pix_aspect_ratio.den = 1;
+  world.world.extent_hint.right = width;
+  world.world.extent_hint.bottom = height;
+  if (!fill) {
+    return;
+  }
+
+  for (A_long y = 0; y < height; y++) {
+    for (A_long x = 0; x < width; x++) {
+      float u = (x + 0.5f) / width * 2.0f - 1.0f;
+      float v = (y + 0.5f) / height * 2.0f - 1.0f;
+      bool inside = (u * u + v * v) < 0.81f;
+      int checker = ((x >> 4) + (y >> 4)) & 1;
+      int alpha = inside ? 255 : 0;
+      int red = inside ? x * 255 / width : 0;
+      int green = inside ? y * 255 / height : 0;
+      int blue = inside ? (checker ? 200 : 40) : 0;
+      if (deep) {
+        PF_Pixel16 &p = reinterpret_cast<PF_Pixel16 *>(world.pixels.data())[y * width + x];
+        p.alpha = static_cast<A_u_short>(alpha * PF_MAX_CHAN16 / 255);
+        p.red = static_cast<A_u_short>(red * PF_MAX_CHAN16 / 255);
+        p.green = static_cast<A_u_short>(green * PF_MAX_CHAN16 / 255);
+        p.blue = static_cast<A_u_short>(blue * PF_MAX_CHAN16 / 255);
+      } else {
+        PF_Pixel &p = reinterpret_cast<PF_Pixel *>(world.pixels.data())[y * width + x];
+        p.alpha = static_cast<A_u_char>(alpha);
+        p.red = static_cast<A_u_char>(red);
+        p.green = static_cast<A_u_char>(green);
+        p.blue = static_cast<A_u_char>(blue);
+      }
+    }
+  }
+}
+
+/**
+ * Load the recorded parameter values and layers into the thread's defs.
+ *
+ * @param thread Replay state of the calling thread
+ * @param command Command to replay
+ */
+static void ApplyTraceParams(ReplayThread &thread, const ReplayCommand &command) {
+  const TraceRecord &record = command.record;
+  for (A_long i = 0; i < MULTISLICER_NUM_PARAMS; i++) {
+    PF_ParamDef &def = thread.defs[i];
+    const TraceParam &value = command.params[i];
+    def = GetHostParamDefs()[i];
+    switch (def.param_type) {
+    case PF_Param_LAYER:
+      if (i == MULTISLICER_INPUT) {
+        PrepareWorld(thread.layers[i], record.inputWidth, record.inputHeight,
+                     record.deep != 0, true);
+      } else {
+        PrepareWorld(thread.layers[i], value.x, value.y, value.value != 0.0, true);
+      }
+      def.u.ld = thread.layers[i].world;
+      break;
+    case PF_Param_FLOAT_SLIDER:
+      def.u.fs_d.value = value.value;
+      break;
+    case PF_Param_POINT:
+      def.u.td.x_value = value.x;
+      def.u.td.y_value = value.y;
+      break;
+    case PF_Param_SLIDER:
+      def.u.sd.value = value.x;
+      break;
+    case PF_Param_ANGLE:
+      def.u.ad.value = value.x;
+      break;
+    case PF_Param_CHECKBOX:
+      def.u.bd.value = value.x;
+      break;
+    case PF_Param_POPUP:
+      def.u.pd.value = value.x;
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// =============================================================================
+// Replay
+// =============================================================================
+
+static bool IsReplayedCommand(A_long cmd) {
+  return cmd == PF_Cmd_FRAME_SETUP || cmd == PF_Cmd_RENDER || cmd == PF_Cmd_FRAME_SETDOWN;
+}
+
+static const char *CommandName(A_long cmd) {
+  switch (cmd) {
+  case PF_Cmd_GLOBAL_SETUP:
+    return "GLOBAL_SETUP";
+  case PF_Cmd_GLOBAL_SETDOWN:
+    return "GLOBAL_SETDOWN";
+  case PF_Cmd_PARAMS_SETUP:
+    return "PARAMS_SETUP";
+  case PF_Cmd_SEQUENCE_SETUP:
+    return "SEQUENCE_SETUP";
+  case PF_Cmd_SEQUENCE_RESETUP:
+    return "SEQUENCE_RESETUP";
+  case PF_Cmd_SEQUENCE_SETDOWN:
+    return "SEQUENCE_SETDOWN";
+  case PF_Cmd_GET_FLATTENED_SEQUENCE_DATA:
+    return "FLATTENED_SEQ";
+  case PF_Cmd_COMPLETELY_GENERAL:
+    return "GENERAL";
+  case PF_Cmd_FRAME_SETUP:
+    return "FRAME_SETUP";
+  case PF_Cmd_RENDER:
+    return "RENDER";
+  case PF_Cmd_FRAME_SETDOWN:
+    return "FRAME_SETDOWN";
+  case PF_Cmd_QUERY_DYNAMIC_FLAGS:
+    return "QUERY_DYNAMIC_FLAGS";
+  case PF_Cmd_USER_CHANGED_PARAM:
+    return "USER_CHANGED_PARAM";
+  case PF_Cmd_UPDATE_PARAMS_UI:
+    return "UPDATE_PARAMS_UI";
+  default:
+    return "other";
+  }
+}
+
+// Sequence data of the one replayed instance
+static PF_Handle sSequenceData = nullptr;
+
+// Frame budget passed with every RENDER (-b), 0 for none
+static double sFrameBudgetMs = 0.0;
+
+// While a check (-k) runs: receives the output hash of every RENDER, in
+// replay order
+static std::vector<A_u_longlong> *sOutputHashes = nullptr;
+
+// FNV-1a of a world's pixels, to check a change leaves output alone
+static A_u_longlong HashWorld(const ReplayWorld &world) {
+  A_u_longlong hash = 14695981039346656037ULL;
+  for (char byte : world.pixels) {
+    hash = (hash ^ static_cast<A_u_char>(byte)) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static PF_InData MakeInData(ReplayThread *thread) {
+  PF_InData in_data = MakeHostInData(thread->defs);
+  in_data.sequence_data = sSequenceData;
+  return in_data;
+}
+
+/**
+ * Issue one recorded command to the plugin and time it.
+ *
+ * @param thread Replay state of the calling thread
+ * @param command Command to replay
+ * @param stats Statistics per command type, updated
+ * @param verbose Whether to print the command
+ */
+static void ReplayOne(ReplayThread &thread, const ReplayCommand &command,
+                      std::map<A_long, ReplayStats> &stats, bool verbose) {
+  const TraceRecord &record = command.record;
+  PF_InData in_data = MakeInData(&thread);
+  PF_OutData out_data;
+  PF_ParamDef *params[MULTISLICER_NUM_PARAMS];
+  PF_LayerDef *output = nullptr;
+  AEFX_CLR_STRUCT(out_data);
+
+  in_data.current_time = record.currentTime;
+  in_data.time_step = record.timeStep;
+  in_data.time_scale = record.timeScale;
+  in_data.downsample_x = record.downsampleX;
+  in_data.downsample_y = record.downsampleY;
+  in_data.pixel_aspect_ratio = record.pixelAspect;
+  in_data.output_origin_x = record.originX;
+  in_data.output_origin_y = record.originY;
+  in_data.frame_data = thread.frameData;
+  in_data.num_params = MULTISLICER_NUM_PARAMS;
+
+  if (record.numParams == MULTISLICER_NUM_PARAMS) {
+    ApplyTraceParams(thread, command);
+  }
+  for (A_long i = 0; i < MULTISLICER_NUM_PARAMS; i++) {
+    params[i] = &thread.defs[i];
+  }
+  PF_ParamDef setupInput;
+  if (record.cmd == PF_Cmd_FRAME_SETUP) {
+    MakeFrameSetupParams(params, setupInput, params);
+  }
+  if (record.cmd == PF_Cmd_RENDER) {
+    PrepareWorld(thread.output, record.outputWidth, record.outputHeight, record.deep != 0,
+                 false);
+    output = &thread.output.world;
+  }
+
+  MultiSlicerFrameBudget budget;
+  AEFX_CLR_STRUCT(budget);
+  budget.magic = FRAME_BUDGET_MAGIC;
+  budget.budgetMs = sFrameBudgetMs;
+  void *extra = (record.cmd == PF_Cmd_RENDER && sFrameBudgetMs > 0.0) ? &budget : nullptr;
+
+  auto start = std::chrono::steady_clock::now();
+  PF_Err err = EffectMain(record.cmd, &in_data, &out_data, params, output, extra);
+  double replayMs =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  ReplayStats &entry = stats[record.cmd];
+  entry.count++;
+  entry.errors += (err != record.err) ? 1 : 0;
+  entry.recordedMs += record.durationNs * 1e-6;
+  entry.replayMs += replayMs;
+  if (record.cmd == PF_Cmd_RENDER) {
+    entry.megapixels += static_cast<double>(record.outputWidth) * record.outputHeight * 1e-6;
+  }
+  if (record.cmd == PF_Cmd_FRAME_SETUP) {
+    thread.frameData = out_data.frame_data;
+    if (out_data.width != record.outputWidth || out_data.height != record.outputHeight ||
+        out_data.origin.h != record.outputOriginX || out_data.origin.v != record.outputOriginY) {
+      entry.mismatches++;
+    }
+  } else if (record.cmd == PF_Cmd_FRAME_SETDOWN) {
+    thread.frameData = nullptr;
+  }
+
+  if (verbose) {
+    printf("%-13s t=%-6d ds=%d/%d,%d/%d in=%dx%d out=%dx%d  recorded %8.3f ms  replay %8.3f ms",
+           CommandName(record.cmd), static_cast<int>(record.currentTime),
+           static_cast<int>(record.downsampleX.num), static_cast<int>(record.downsampleX.den),
+           static_cast<int>(record.downsampleY.num), static_cast<int>(record.downsampleY.den),
+           static_cast<int>(record.inputWidth), static_cast<int>(record.inputHeight),
+           static_cast<int>(record.outputWidth), static_cast<int>(record.outputHeight),
+           record.durationNs * 1e-6, replayMs);
+    if (output) {
+      printf("  %016llx", static_cast<unsigned long long>(HashWorld(thread.output)));
+    }
+    if (budget.draft || budget.reduced) {
+      printf("  budget:%s%s", budget.draft ? " draft" : "", budget.reduced ? " half" : "");
+    }
+    printf("\n");
+  }
+  if (output && sOutputHashes) {
+    sOutputHashes->push_back(HashWorld(thread.output));
+  }
+}
+
+static void ReplayStream(const std::vector<const ReplayCommand *> &commands,
+                         std::map<A_long, ReplayStats> &stats, bool verbose) {
+  std::unique_ptr<ReplayThread> thread(new ReplayThread());
+  for (const ReplayCommand *command : commands) {
+    ReplayOne(*thread, *command, stats, verbose);
+  }
+  if (thread->frameData) {
+    DisposeHostHandle(thread->frameData);
+  }
+}
+
+/**
+ * Read a trace file.
+ *
+ * @param path Trace file
+ * @param commands Receives the commands, in the order they started
+ * @return false if the file is missing, truncated or from another version
+ */
+static bool ReadTrace(const char *path, std::vector<ReplayCommand> &commands) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  TraceHeader header;
+  bool ok = fread(&header, sizeof(header), 1, file) == 1 && header.magic == TRACE_MAGIC &&
+            header.version == TRACE_VERSION && header.recordSize == sizeof(TraceRecord) &&
+            header.numParams == MULTISLICER_NUM_PARAMS;
+  if (!ok) {
+    fprintf(stderr, "%s is not a trace of this MultiSlicer build\n", path);
+  }
+
+  ReplayCommand command;
+  while (ok && fread(&command.record, sizeof(TraceRecord), 1, file) == 1) {
+    command.params.assign(MULTISLICER_NUM_PARAMS, TraceParam());
+    if (command.record.numParams != 0 &&
+        (command.record.numParams != MULTISLICER_NUM_PARAMS ||
+         fread(command.params.data(), sizeof(TraceParam), MULTISLICER_NUM_PARAMS, file) !=
+             MULTISLICER_NUM_PARAMS)) {
+      fprintf(stderr, "%s is truncated\n", path);
+      break;
+    }
+    commands.push_back(command);
+  }
+  fclose(file);
+
+  // Records are written as commands finish
+  std::stable_sort(commands.begin(), commands.end(),
+                   [](const ReplayCommand &a, const ReplayCommand &b) {
+                     return a.record.startNs < b.record.startNs;
+                   });
+  return ok;
+}
+
+// =============================================================================
+// Energy - Linux powercap (RAPL) package counters
+// =============================================================================
+
+#define POWERCAP_DIR "/sys/class/powercap"
+
+// One package's energy counter, in microjoules; it wraps at range
+typedef struct {
+  std::string path;
+  A_u_longlong range;
+  A_u_longlong last;
+} EnergyCounter;
+
+static bool ReadCounter(const std::string &path, A_u_longlong &value) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (!file) {
+    return false;
+  }
+  unsigned long long read = 0;
+  bool ok = fscanf(file, "%llu", &read) == 1;
+  fclose(file);
+  value = read;
+  return ok;
+}
+
+/**
+ * Find the readable package counters.
+ *
+ * Only top-level zones (intel-rapl:N, which AMD packages use too) are
+ * kept: core, uncore and dram subzones are part of their package and
+ * would be counted twice. Recent kernels only let root read them.
+ *
+ * @param counters Receives the counters, empty when there are none
+ */
+static void OpenEnergyCounters(std::vector<EnergyCounter> &counters) {
+  DIR *dir = opendir(POWERCAP_DIR);
+  if (!dir) {
+    return;
+  }
+  while (struct dirent *entry = readdir(dir)) {
+    const char *name = entry->d_name;
+    if (strncmp(name, "intel-rapl:", 11) || strchr(name + 11, ':')) {
+      continue;
+    }
+    EnergyCounter counter;
+    std::string zone = std::string(POWERCAP_DIR "/") + name;
+    counter.path = zone + "/energy_uj";
+    if (ReadCounter(zone + "/max_energy_range_uj", counter.range) &&
+        ReadCounter(counter.path, counter.last)) {
+      counters.push_back(counter);
+    }
+  }
+  closedir(dir);
+}
+
+// Joules used by all packages since the last call. A counter must be
+// sampled at least once per wrap (minutes at full load), so this is called
+// after every pass.
+static double SampleEnergy(std::vector<EnergyCounter> &counters) {
+  double joules = 0.0;
+  for (EnergyCounter &counter : counters) {
+    A_u_longlong now = 0;
+    if (!ReadCounter(counter.path, now)) {
+      continue;
+    }
+    A_u_longlong used = (now >= counter.last) ? now - counter.last
+                                              : now + counter.range - counter.last;
+    counter.last = now;
+    joules += used * 1e-6;
+  }
+  return joules;
+}
+
+// =============================================================================
+// Main
+// =============================================================================
+
+// Totals of one replay run (all passes at one worker count)
+typedef struct {
+  A_long workers;
+  A_long frames;     // RENDER commands
+  double megapixels; // output pixels rendered
+  double wallMs;
+  double joules; // negative without energy counters
+} RunSummary;
+
+static void PrintUsage() {
+  fprintf(stderr, "usage: MultiSlicerReplay [-j threads[,threads...]] [-n repeat] [-c MB] [-x] "
+                  "[-m] [-v] [-k] [-b ms] <trace>\n");
+}
+
+/**
+ * Replay the trace on a fresh plugin instance and print its report.
+ *
+ * Every run sets the plugin up anew, so the geometry and compute caches
+ * start empty at every worker count.
+ *
+ * @param streams Replayed commands by recorded thread
+ * @param sequence Replayed commands in the order they started
+ * @param skipped Commands not replayed, by type
+ * @param repeat Passes over the trace
+ * @param concurrent Whether recorded threads replay on their own threads
+ * @param verbose Whether to print every command
+ * @param recordedSpanMs Length of the recorded session
+ * @param counters Energy counters (may be empty)
+ * @param summary Receives the run's totals
+ * @return false if the plugin failed to set up
+ */
+static bool RunReplay(const std::map<A_u_long, std::vector<const ReplayCommand *>> &streams,
+                      const std::vector<const ReplayCommand *> &sequence,
+                      const std::map<A_long, A_long> &skipped, A_long repeat, bool concurrent,
+                      bool verbose, double recordedSpanMs, std::vector<EnergyCounter> &counters,
+                      RunSummary &summary) {
+  AEFX_CLR_STRUCT(sCacheStats);
+  std::vector<PF_ParamDef> &paramDefs = GetHostParamDefs();
+  paramDefs.clear();
+  ReplayThread setupThread = ReplayThread();
+  PF_InData in_data = MakeInData(&setupThread);
+  PF_OutData out_data;
+  AEFX_CLR_STRUCT(out_data);
+  PF_Err err = EffectMain(PF_Cmd_GLOBAL_SETUP, &in_data, &out_data, nullptr, nullptr, nullptr);
+  PF_ParamDef input;
+  AEFX_CLR_STRUCT(input);
+  input.param_type = PF_Param_LAYER;
+  paramDefs.push_back(input);
+  if (!err) {
+    err = EffectMain(PF_Cmd_PARAMS_SETUP, &in_data, &out_data, nullptr, nullptr, nullptr);
+  }
+  if (!err) {
+    err = EffectMain(PF_Cmd_SEQUENCE_SETUP, &in_data, &out_data, nullptr, nullptr, nullptr);
+    sSequenceData = out_data.sequence_data;
+  }
+  if (err || paramDefs.size() != MULTISLICER_NUM_PARAMS) {
+    fprintf(stderr, "plugin setup failed (%d)\n", static_cast<int>(err));
+    return false;
+  }
+
+  std::map<A_long, ReplayStats> stats;
+  double joules = 0.0;
+  SampleEnergy(counters);
+  auto start = std::chrono::steady_clock::now();
+  for (A_long pass = 0; pass < repeat; pass++) {
+    if (!concurrent) {
+      ReplayStream(sequence, stats, verbose);
+      joules += SampleEnergy(counters);
+      continue;
+    }
+    std::vector<std::map<A_long, ReplayStats>> threadStats(streams.size());
+    std::vector<std::thread> threads;
+    size_t index = 0;
+    for (const auto &stream : streams) {
+      threads.emplace_back(ReplayStream, std::cref(stream.second),
+                           std::ref(threadStats[index++]), false);
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+    joules += SampleEnergy(counters);
+    for (const auto &threadStat : threadStats) {
+      for (const auto &entry : threadStat) {
+        ReplayStats &total = stats[entry.first];
+        total.count += entry.second.count;
+        total.errors += entry.second.errors;
+        total.mismatches += entry.second.mismatches;
+        total.recordedMs += entry.second.recordedMs;
+        total.replayMs += entry.second.replayMs;
+        total.megapixels += entry.second.megapixels;
+      }
+    }
+  }
+  double wallMs =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  MultiSlicerStats instance;
+  AEFX_CLR_STRUCT(instance);
+  instance.magic = STATS_MAGIC;
+  instance.version = STATS_VERSION;
+  instance.size = sizeof(instance);
+  in_data = MakeInData(&setupThread);
+  EffectMain(PF_Cmd_COMPLETELY_GENERAL, &in_data, &out_data, nullptr, nullptr, &instance);
+  EffectMain(PF_Cmd_SEQUENCE_SETDOWN, &in_data, &out_data, nullptr, nullptr, nullptr);
+  sSequenceData = nullptr;
+  EffectMain(PF_Cmd_GLOBAL_SETDOWN, &in_data, &out_data, nullptr, nullptr, nullptr);
+
+  printf("%zu commands from %zu threads, %d pass(es), %d workers%s\n", sequence.size(),
+         streams.size(), static_cast<int>(repeat), static_cast<int>(GetHostExecutor().workers),
+         concurrent ? ", threads replayed concurrently" : "");
+  printf("%-14s %7s %14s %14s %7s %7s %9s\n", "command", "count", "recorded ms", "replay ms",
+         "ratio", "errors", "mismatch");
+  for (const auto &entry : stats) {
+    const ReplayStats &s = entry.second;
+    printf("%-14s %7d %14.3f %14.3f %7.3f %7d %9d\n", CommandName(entry.first),
+           static_cast<int>(s.count), s.recordedMs, s.replayMs,
+           s.recordedMs > 0.0 ? s.replayMs / s.recordedMs : 0.0, static_cast<int>(s.errors),
+           static_cast<int>(s.mismatches));
+  }
+  for (const auto &entry : skipped) {
+    printf("%-14s %7d not replayed\n", CommandName(entry.first), static_cast<int>(entry.second));
+  }
+  if (sCacheEnabled) {
+    printf("compute cache: %d computed, %d hits, %d waits, %d purged, peak %.1f MB\n",
+           static_cast<int>(sCacheStats.computed), static_cast<int>(sCacheStats.hits),
+           static_cast<int>(sCacheStats.waits), static_cast<int>(sCacheStats.purged),
+           sCacheStats.peak / 1048576.0);
+  }
+  if (instance.version == STATS_VERSION && instance.size == sizeof(instance)) {
+    printf("instance %u: %llu frames (%llu failed), average %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           static_cast<unsigned>(instance.instance),
+           static_cast<unsigned long long>(instance.frames),
+           static_cast<unsigned long long>(instance.failedFrames), instance.averageMs,
+           instance.p99Ms, instance.maxMs);
+    printf("  paths: %llu pass-through, %llu slice rows, %llu cached rows, %llu transformed "
+           "rows; %llu resampled, %llu sorted\n",
+           static_cast<unsigned long long>(instance.paths[STATS_PATH_PASS_THROUGH]),
+           static_cast<unsigned long long>(instance.paths[STATS_PATH_SLICE_ROWS]),
+           static_cast<unsigned long long>(instance.paths[STATS_PATH_CACHED_ROWS]),
+           static_cast<unsigned long long>(instance.paths[STATS_PATH_TRANSFORMED_ROWS]),
+           static_cast<unsigned long long>(instance.resampledFrames),
+           static_cast<unsigned long long>(instance.sortedFrames));
+    printf("  geometry: %llu hits, %llu built, %llu misses; %llu frame setups expanded by "
+           "%.1f MB\n",
+           static_cast<unsigned long long>(instance.geometryHits),
+           static_cast<unsigned long long>(instance.geometryBuilds),
+           static_cast<unsigned long long>(instance.geometryMisses),
+           static_cast<unsigned long long>(instance.frameSetups),
+           instance.expansionBytes / 1048576.0);
+    if (instance.budgetMs > 0.0) {
+      printf("  frame budget %.1f ms: %llu draft, %llu half resolution, %llu over budget\n",
+             instance.budgetMs, static_cast<unsigned long long>(instance.draftFrames),
+             static_cast<unsigned long long>(instance.reducedFrames),
+             static_cast<unsigned long long>(instance.overBudgetFrames));
+    }
+  }
+  printf("wall %.3f ms per pass (recorded session %.3f ms)\n", wallMs / repeat, recordedSpanMs);
+
+  const ReplayStats &renders = stats[PF_Cmd_RENDER];
+  summary.workers = GetHostExecutor().workers;
+  summary.frames = renders.count;
+  summary.megapixels = renders.megapixels;
+  summary.wallMs = wallMs;
+  summary.joules = counters.empty() ? -1.0 : joules;
+  return true;
+}
+
+/**
+ * Replay the trace with the geometry cache on, then off, and compare.
+ *
+ * Both runs replay every command in recorded order on one thread, so the
+ * n-th frame of one is the n-th frame of the other. Frames rendered from
+ * the cache must be identical to the slice rows they replace.
+ *
+ * @param streams Replayed commands by recorded thread
+ * @param sequence Replayed commands in the order they started
+ * @param skipped Commands not replayed, by type
+ * @param repeat Passes over the trace
+ * @param recordedSpanMs Length of the recorded session
+ * @param counters Energy counters (may be empty)
+ * @return Whether every frame matched
+ */
+static bool CheckGeometryCache(
+    const std::map<A_u_long, std::vector<const ReplayCommand *>> &streams,
+    const std::vector<const ReplayCommand *> &sequence, const std::map<A_long, A_long> &skipped,
+    A_long repeat, double recordedSpanMs, std::vector<EnergyCounter> &counters) {
+  std::vector<A_u_longlong> hashes[2];
+  for (int off = 0; off < 2; off++) {
+    RunSummary summary;
+    AEFX_CLR_STRUCT(summary);
+    printf("%s== geometry cache %s ==\n", off ? "\n" : "", off ? "off" : "on");
+    if (off) {
+      setenv(GEOMETRY_CACHE_ENV, "0", 1);
+    } else {
+      unsetenv(GEOMETRY_CACHE_ENV);
+    }
+    sOutputHashes = &hashes[off];
+    bool ok = RunReplay(streams, sequence, skipped, repeat, false, false, recordedSpanMs,
+                        counters, summary);
+    sOutputHashes = nullptr;
+    if (!ok) {
+      return false;
+    }
+  }
+
+  size_t differ = 0;
+  for (size_t i = 0; i < hashes[0].size() && i < hashes[1].size(); i++) {
+    if (hashes[0][i] != hashes[1][i]) {
+      if (differ++ < 10) {
+        printf("frame %zu: %016llx with the cache, %016llx without\n", i,
+               static_cast<unsigned long long>(hashes[0][i]),
+               static_cast<unsigned long long>(hashes[1][i]));
+      }
+    }
+  }
+  if (hashes[0].size() != hashes[1].size()) {
+    differ++;
+  }
+  printf("\ncheck: %zu of %zu frames differ with the geometry cache\n", differ,
+         hashes[0].size());
+  return differ == 0;
+}
+
+int main(int argc, char **argv) {
+  const char *path = nullptr;
+  A_long repeat = 1;
+  bool concurrent = false;
+  bool verbose = false;
+  bool check = false;
+  std::vector<A_long> workerCounts;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+      for (const char *list = argv[++i]; list; list = strchr(list, ',')) {
+        list += (*list == ',') ? 1 : 0;
+        workerCounts.push_back(MAX(static_cast<A_long>(atoi(list)), static_cast<A_long>(1)));
+      }
+    } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+      repeat = MAX(repeat, static_cast<A_long>(1));
+    } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+      sCacheBudget = static_cast<size_t>(MAX(atoi(argv[i + 1]), 0)) << 20;
+      i++;
+    } else if (!strcmp(argv[i], "-x")) {
+      sCacheEnabled = false;
+    } else if (!strcmp(argv[i], "-m")) {
+      concurrent = true;
+    } else if (!strcmp(argv[i], "-v")) {
+      verbose = true;
+    } else if (!strcmp(argv[i], "-k")) {
+      check = true;
+    } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      sFrameBudgetMs = MAX(atof(argv[i + 1]), 0.0);
+      i++;
+    } else if (argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      PrintUsage();
+      return 2;
+    }
+  }
+  if (!path) {
+    PrintUsage();
+    return 2;
+  }
+  if (workerCounts.empty()) {
+    workerCounts.push_back(
+        MAX(static_cast<A_long>(std::thread::hardware_concurrency()), static_cast<A_long>(1)));
+  }
+
+  std::vector<ReplayCommand> commands;
+  if (!ReadTrace(path, commands)) {
+    return 1;
+  }
+
+  // Group the replayed commands by recorded thread; FRAME_SETUP, RENDER and
+  // FRAME_SETDOWN of a frame share their thread's frame_data
+  std::map<A_u_long, std::vector<const ReplayCommand *>> streams;
+  std::vector<const ReplayCommand *> sequence;
+  std::map<A_long, A_long> skipped;
+  double recordedSpanMs = 0.0;
+  for (const ReplayCommand &command : commands) {
+    recordedSpanMs = MAX(recordedSpanMs,
+                         (command.record.startNs + command.record.durationNs) * 1e-6);
+    if (!IsReplayedCommand(command.record.cmd)) {
+      skipped[command.record.cmd]++;
+      continue;
+    }
+    streams[command.record.thread].push_back(&command);
+    sequence.push_back(&command);
+  }
+
+  InitializeHostSuites();
+  InitializeComputeCache();
+  std::vector<EnergyCounter> counters;
+  OpenEnergyCounters(counters);
+
+  if (check) {
+    SetHostWorkers(workerCounts.front());
+    return CheckGeometryCache(streams, sequence, skipped, repeat, recordedSpanMs, counters)
+               ? 0
+               : 1;
+  }
+
+  std::vector<RunSummary> summaries;
+  for (A_long workers : workerCounts) {
+    RunSummary summary;
+    AEFX_CLR_STRUCT(summary);
+    SetHostWorkers(workers);
+    if (workerCounts.size() > 1) {
+      printf("%s== %d workers ==\n", summaries.empty() ? "" : "\n", static_cast<int>(workers));
+    }
+    if (!RunReplay(streams, sequence, skipped, repeat, concurrent, verbose, recordedSpanMs,
+                   counters, summary)) {
+      return 1;
+    }
+    summaries.push_back(summary);
+  }
+
+  // Throughput and energy per worker count; energy is the whole machine's
+  // packages, so keep it otherwise idle
+  printf("\n%7s %7s %9s %11s %9s %9s %9s %9s\n", "workers", "frames", "Mpixels", "wall ms",
+         "frames/s", "MP/s", "J/frame", "J/MP");
+  for (const RunSummary &s : summaries) {
+    const double seconds = s.wallMs * 1e-3;
+    printf("%7d %7d %9.2f %11.3f %9.2f %9.2f", static_cast<int>(s.workers),
+           static_cast<int>(s.frames), s.megapixels, s.wallMs,
+           seconds > 0.0 ? s.frames / seconds : 0.0,
+           seconds > 0.0 ? s.megapixels / seconds : 0.0);
+    if (s.joules >= 0.0) {
+      printf(" %9.4f %9.4f\n", s.frames ? s.joules / s.frames : 0.0,
+             s.megapixels > 0.0 ? s.joules / s.megapixels : 0.0);
+    } else {
+      printf(" %9s %9s\n", "n/a", "n/a");
+    }
+  }
+  if (counters.empty()) {
+    printf("energy: no readable RAPL counters under %s (root may be needed)\n", POWERCAP_DIR);
+  }
+  return 0;
+}
@@ -37,6 +37,31 @@
 #include <math.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <set>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifndef AE_OS_WIN
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // Clamp helper for color values
 template <typename T> static inline T CLAMP(T value, T min, T max) {
@@ -57,6 +82,14 @@ static inline float GetDownscaleFactor(const PF_RationalScale &scale) {
   return (value > 0.0f) ? value : 1.0f;
 }
 
+// Width of a buffer pixel in units of its height: the layer's pixel aspect
+// ratio, adjusted for unequal horizontal and vertical downsampling
+static inline float GetPixelAspect(const PF_InData *in_data) {
+  float downscale_x = GetDownscaleFactor(in_data->downsample_x);
+  float downscale_y = GetDownscaleFactor(in_data->downsample_y);
+  return GetDownscaleFactor(in_data->pixel_aspect_ratio) * downscale_y / downscale_x;
+}
+
 static PF_Err About(PF_InData *in_data, PF_OutData *out_data,
                     PF_ParamDef *params[], PF_LayerDef *output) {
   AEGP_SuiteHandler suites(in_data->pica_basicP);
@@ -75,15 +108,21 @@ static PF_Err GlobalSetup(PF_InData *in_data, PF_OutData *out_data,
                                     STAGE_VERSION, BUILD_VERSION);
 
   // Support 16-bit, pixel-independent, and buffer expansion for out-of-bounds rendering
-  // CRITICAL FIX: Match PiPL flags (0x06000602)
+  // NON_PARAM_VARY is the worst case for Shatter; QueryDynamicFlags clears it
+  // CRITICAL FIX: Match PiPL flags (0x06000606)
   out_data->out_flags = PF_OutFlag_DEEP_COLOR_AWARE |
                         PF_OutFlag_PIX_INDEPENDENT |
                         PF_OutFlag_I_EXPAND_BUFFER |
                         PF_OutFlag_SEND_UPDATE_PARAMS_UI |
-                        PF_OutFlag_WIDE_TIME_INPUT;
+                        PF_OutFlag_WIDE_TIME_INPUT |
+                        PF_OutFlag_NON_PARAM_VARY;
 
-  // Enable Multi-Frame Rendering support
-  out_data->out_flags2 = PF_OutFlag2_SUPPORTS_THREADED_RENDERING;
+  // Enable Multi-Frame Rendering support, and dynamic flags for Shatter.
+  // Sequence data (the statistics id) is flat; MFR needs it on request.
+  // These must match the PiPL's AE_Effect_Global_OutFlags_2 (0x08400001)
+  out_data->out_flags2 = PF_OutFlag2_SUPPORTS_THREADED_RENDERING |
+                         PF_OutFlag2_SUPPORTS_QUERY_DYNAMIC_FLAGS |
+                         PF_OutFlag2_SUPPORTS_GET_FLATTENED_SEQUENCE_DATA;
 
   return PF_Err_NONE;
 }
@@ -92,6 +131,8 @@ static PF_Err ParamsSetup(PF_InData *in_data, PF_OutData *out_data,
   PF_Err err = PF_Err_NONE;
   PF_ParamDef def;
 
+  // Parameters of the slice geometry are supervised: each change starts the
+  // geometry warm-up (PF_Cmd_USER_CHANGED_PARAM)
   AEFX_CLR_STRUCT(def);
 
   // Shift parameter - controls how much the slices move, in pixels
@@ -101,15 +142,17 @@ static PF_Err ParamsSetup(PF_InData *in_data, PF_OutData *out_data,
   // Width parameter - controls the display width of split image from 0-100%
   AEFX_CLR_STRUCT(def);
   PF_ADD_FLOAT_SLIDERX(STR(StrID_Width_Param_Name), 0, 100, 0, 100, 100,
-                       PF_Precision_TENTHS, 0, 0, WIDTH_DISK_ID);
+                       PF_Precision_TENTHS, 0, PF_ParamFlag_SUPERVISE, WIDTH_DISK_ID);
 
   // Number of slices parameter
   AEFX_CLR_STRUCT(def);
+  def.flags = PF_ParamFlag_SUPERVISE;
   PF_ADD_SLIDER(STR(StrID_Slices_Param_Name), 1, 1000, 1, 50, 10,
                 SLICES_DISK_ID);
 
   // Anchor Point - center point for rotation
   AEFX_CLR_STRUCT(def);
+  def.flags = PF_ParamFlag_SUPERVISE;
   PF_ADD_POINT("Anchor Point", MULTISLICER_ANCHOR_X_DFLT,
                MULTISLICER_ANCHOR_Y_DFLT, FALSE, ANCHOR_POINT_DISK_ID);
 
@@ -120,64 +163,162 @@ static PF_Err ParamsSetup(PF_InData *in_data, PF_OutData *out_data,
   // The slices rotate around the Anchor Point, but the slice direction is fixed
   // by this angle
   AEFX_CLR_STRUCT(def);
+  def.flags = PF_ParamFlag_SUPERVISE;
   PF_ADD_ANGLE(STR(StrID_Angle_Param_Name), MULTISLICER_ANGLE_DFLT,
                ANGLE_DISK_ID);
 
   // Seed for randomness
   AEFX_CLR_STRUCT(def);
+  def.flags = PF_ParamFlag_SUPERVISE;
   PF_ADD_SLIDER(STR(StrID_Seed_Param_Name), 0, 10000, 0, 500, 0, SEED_DISK_ID);
 
-  out_data->num_params = MULTISLICER_NUM_PARAMS;
+  // Shift Map - optional layer whose luminance scales each slice's shift
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_LAYER(STR(StrID_Shift_Map_Param_Name), PF_LayerDefault_NONE,
+               SHIFT_MAP_DISK_ID);
 
-  return err;
-}
+  // Shift Map Sampling - where the map is read for each slice
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_POPUP(STR(StrID_Shift_Map_Sampling_Param_Name),
+               SHIFT_MAP_SAMPLING_NUM_CHOICES, SHIFT_MAP_SAMPLING_CENTER,
+               STR(StrID_Shift_Map_Sampling_Choices),
+               SHIFT_MAP_SAMPLING_DISK_ID);
 
-// FrameSetup: expand output buffer based on shift amount
-static PF_Err FrameSetup(PF_InData *in_data, PF_OutData *out_data,
-                         PF_ParamDef *params[], PF_LayerDef *output) {
-  PF_Err err = PF_Err_NONE;
+  // Density Map - optional layer whose luminance sets where slices are dense
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_LAYER(STR(StrID_Density_Map_Param_Name), PF_LayerDefault_NONE,
+               DENSITY_MAP_DISK_ID);
 
-  // Get input dimensions
-  PF_LayerDef *input = &params[MULTISLICER_INPUT]->u.ld;
-  const int input_width = input->width;
-  const int input_height = input->height;
+  // Density Amount - blend between random spacing (0%) and the map (100%)
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Density_Amount_Param_Name), 0, 100, 0, 100,
+                       MULTISLICER_DENSITY_AMOUNT_DFLT, PF_Precision_TENTHS,
+                       PF_ValueDisplayFlag_PERCENT, PF_ParamFlag_SUPERVISE,
+                       DENSITY_AMOUNT_DISK_ID);
 
-  if (input_width <= 0 || input_height <= 0) {
-    return PF_Err_NONE;
-  }
+  // Random Rotation - maximum random rotation of each slice about its center, in degrees
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Slice_Rotation_Param_Name), 0, 180, 0, 45, 0,
+                       PF_Precision_TENTHS, 0, 0, SLICE_ROTATION_DISK_ID);
 
-  // Get shift parameter
-  float shiftRaw = params[MULTISLICER_SHIFT]->u.fs_d.value;
+  // Random Scale - maximum random scale change of each slice, 0-100%
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Slice_Scale_Param_Name), 0, 100, 0, 100, 0,
+                       PF_Precision_TENTHS, PF_ValueDisplayFlag_PERCENT, 0,
+                       SLICE_SCALE_DISK_ID);
 
-  // Downsample adjustment
-  float downscale_x = GetDownscaleFactor(in_data->downsample_x);
-  float downscale_y = GetDownscaleFactor(in_data->downsample_y);
-  float resolution_scale = MIN(downscale_x, downscale_y);
-  float shiftAmount = fabsf(shiftRaw) * resolution_scale;
+  // Random Depth - maximum distance of each slice in front of or behind the
+  // layer plane, in pixels (turns on perspective mode)
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Slice_Depth_Param_Name), 0,
+                       MULTISLICER_SLICE_DEPTH_MAX, 0, 1000, 0,
+                       PF_Precision_TENTHS, 0, 0, SLICE_DEPTH_DISK_ID);
 
-  // If no shift, no expansion needed
-  if (shiftAmount < NO_EFFECT_THRESHOLD) {
-    return PF_Err_NONE;
-  }
+  // Random Tilt - maximum tilt of each slice about its long axis, in degrees
+  // (turns on perspective mode)
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Slice_Tilt_Param_Name), 0, 89, 0, 89, 0,
+                       PF_Precision_TENTHS, 0, 0, SLICE_TILT_DISK_ID);
 
-  // Calculate expansion needed (shift can occur in any direction)
-  // Use maximum possible shift with some margin
-  // CRITICAL FIX #5: Check for integer overflow before setting dimensions
-  int expansion = static_cast<int>(ceilf(shiftAmount * EXPANSION_MULTIPLIER)) + EXPANSION_MARGIN;
-  expansion = MIN(expansion, MAX_EXPANSION);
+  // Edge Warp - displace slice boundaries along the slices
+  AEFX_CLR_STRUCT(def);
+  def.flags = PF_ParamFlag_SUPERVISE;
+  PF_ADD_POPUP(STR(StrID_Edge_Warp_Param_Name), EDGE_WARP_NUM_CHOICES,
+               EDGE_WARP_NONE, STR(StrID_Edge_Warp_Choices), EDGE_WARP_DISK_ID);
 
-  // Check for integer overflow before setting dimensions
-  if (input_width > INT_MAX - expansion * 2 || input_height > INT_MAX - expansion * 2) {
-    // Skip expansion on overflow to prevent undefined behavior
-    return PF_Err_NONE;
-  }
+  // Warp Amplitude - maximum boundary displacement in pixels
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Warp_Amplitude_Param_Name), 0,
+                       MULTISLICER_WARP_AMPLITUDE_MAX, 0, 100, 10,
+                       PF_Precision_TENTHS, 0, PF_ParamFlag_SUPERVISE,
+                       WARP_AMPLITUDE_DISK_ID);
+
+  // Warp Frequency - waves per 100 pixels along the slices
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Warp_Frequency_Param_Name), 0, 50, 0, 10,
+                       MULTISLICER_WARP_FREQUENCY_DFLT, PF_Precision_HUNDREDTHS,
+                       0, PF_ParamFlag_SUPERVISE, WARP_FREQUENCY_DISK_ID);
+
+  // Warp Seed - phase of the sine wave or pattern of the noise
+  AEFX_CLR_STRUCT(def);
+  def.flags = PF_ParamFlag_SUPERVISE;
+  PF_ADD_SLIDER(STR(StrID_Warp_Seed_Param_Name), 0, 10000, 0, 500,
+                MULTISLICER_WARP_SEED_DFLT, WARP_SEED_DISK_ID);
+
+  // Shatter Velocity - initial speed of each slice in pixels per second
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Shatter_Velocity_Param_Name), 0,
+                       MULTISLICER_SHATTER_MAX, 0, 1000, 0, PF_Precision_TENTHS,
+                       0, 0, SHATTER_VELOCITY_DISK_ID);
+
+  // Shatter Spin - rotation speed of each slice in degrees per second
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Shatter_Spin_Param_Name), 0,
+                       MULTISLICER_SHATTER_MAX, 0, 360, 0, PF_Precision_TENTHS,
+                       0, 0, SHATTER_SPIN_DISK_ID);
+
+  // Shatter Gravity - downward acceleration in pixels per second squared
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Shatter_Gravity_Param_Name), 0,
+                       MULTISLICER_SHATTER_MAX, 0, 2000, 0, PF_Precision_TENTHS,
+                       0, 0, SHATTER_GRAVITY_DISK_ID);
+
+  // Shatter Start - layer time in seconds when the slices start moving
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Shatter_Start_Param_Name), 0, 3600, 0, 10, 0,
+                       PF_Precision_HUNDREDTHS, 0, 0, SHATTER_START_DISK_ID);
+
+  // Pixel Sort - sort pixels along the slices by luminance or hue
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_POPUP(STR(StrID_Pixel_Sort_Param_Name), PIXEL_SORT_NUM_CHOICES,
+               PIXEL_SORT_OFF, STR(StrID_Pixel_Sort_Choices), PIXEL_SORT_DISK_ID);
+
+  // Sort Threshold - only runs of pixels at least this bright are sorted
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Sort_Threshold_Param_Name), 0, 100, 0, 100,
+                       MULTISLICER_SORT_THRESHOLD_DFLT, PF_Precision_TENTHS,
+                       PF_ValueDisplayFlag_PERCENT, 0, SORT_THRESHOLD_DISK_ID);
 
-  // Set output dimensions and origin
-  out_data->width = input_width + expansion * 2;
-  out_data->height = input_height + expansion * 2;
-  // CRITICAL FIX: Clamp expansion to SHRT_MAX to prevent short overflow
-  out_data->origin.h = static_cast<short>(MIN(expansion, SHRT_MAX));
-  out_data->origin.v = static_cast<short>(MIN(expansion, SHRT_MAX));
+  // Crop to Content - limit the output and the work to the layer's
+  // non-transparent bounds
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_CHECKBOXX(STR(StrID_Crop_To_Content_Param_Name), FALSE, 0,
+                   CROP_TO_CONTENT_DISK_ID);
+
+  // Source 2-4 - additional layers the slices can draw from
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_LAYER(STR(StrID_Source_2_Param_Name), PF_LayerDefault_NONE, SOURCE_2_DISK_ID);
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_LAYER(STR(StrID_Source_3_Param_Name), PF_LayerDefault_NONE, SOURCE_3_DISK_ID);
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_LAYER(STR(StrID_Source_4_Param_Name), PF_LayerDefault_NONE, SOURCE_4_DISK_ID);
+
+  // Source Selection - which source each slice draws from
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_POPUP(STR(StrID_Source_Mode_Param_Name), SOURCE_MODE_NUM_CHOICES,
+               SOURCE_MODE_ALTERNATE, STR(StrID_Source_Mode_Choices),
+               SOURCE_MODE_DISK_ID);
+
+  // Source Transition - progress from the Input to the last source, each
+  // slice switching at its own random moment (Transition mode)
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Source_Transition_Param_Name), 0, 100, 0, 100,
+                       0, PF_Precision_TENTHS, PF_ValueDisplayFlag_PERCENT, 0,
+                       SOURCE_TRANSITION_DISK_ID);
+
+  // Prefilter Slices - area-average the slices under each pixel, for slices
+  // narrower than a pixel
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_CHECKBOXX(STR(StrID_Prefilter_Param_Name), FALSE, 0, PREFILTER_DISK_ID);
+
+  // Output Scale - render the result at another resolution in the same pass
+  // (area-filtered below 100%)
+  AEFX_CLR_STRUCT(def);
+  PF_ADD_FLOAT_SLIDERX(STR(StrID_Output_Scale_Param_Name), 1, 400, 10, 200,
+                       MULTISLICER_OUTPUT_SCALE_DFLT, PF_Precision_TENTHS,
+                       PF_ValueDisplayFlag_PERCENT, 0, OUTPUT_SCALE_DISK_ID);
+
+  out_data->num_params = MULTISLICER_NUM_PARAMS;
 
   return err;
 }
@@ -212,44 +353,51 @@ static float GetRandomValue(A_long seed, A_long index) {
   return result;
 }
 
+// Row y of a pixel buffer. The offset is computed in ptrdiff_t: y * rowbytes
+// passes 2^31 on large deep frames (e.g. 16K 16-bit with expansion), where
+// A_long arithmetic would silently wrap.
+template <typename PixelType>
+static inline PixelType *PixelRow(void *data, ptrdiff_t rowbytes, A_long y) {
+  return reinterpret_cast<PixelType *>(reinterpret_cast<char *>(data) +
+                                       static_cast<ptrdiff_t>(y) * rowbytes);
+}
+
+template <typename PixelType>
+static inline const PixelType *PixelRow(const void *data, ptrdiff_t rowbytes, A_long y) {
+  return reinterpret_cast<const PixelType *>(reinterpret_cast<const char *>(data) +
+                                             static_cast<ptrdiff_t>(y) * rowbytes);
+}
+
 // Nearest neighbor sampling to preserve source colors without interpolation
 static PF_Pixel SampleSourcePixel8(float srcX, float srcY,
-                                   const SliceContext *ctx) {
+                                   const SliceSource *source) {
   PF_Pixel result = {0, 0, 0, 0};
 
   // Round to nearest integer
-  A_long x = static_cast<A_long>(srcX + SAMPLE_ROUND_OFFSET);
-  A_long y = static_cast<A_long>(srcY + SAMPLE_ROUND_OFFSET);
+  A_long x = static_cast<A_long>(srcX + SAMPLE_ROUND_OFFSET) - source->offsetX;
+  A_long y = static_cast<A_long>(srcY + SAMPLE_ROUND_OFFSET) - source->offsetY;
 
-  if (x < 0 || x >= ctx->width || y < 0 || y >= ctx->height) {
+  if (x < 0 || x >= source->width || y < 0 || y >= source->height) {
     return result;
   }
 
-  PF_Pixel *p = reinterpret_cast<PF_Pixel *>(
-      reinterpret_cast<char *>(ctx->srcData) + y * ctx->rowbytes +
-      x * static_cast<A_long>(sizeof(PF_Pixel)));
-
-  return *p;
+  return PixelRow<PF_Pixel>(source->data, source->rowbytes, y)[x];
 }
 
 // Nearest neighbor sampling to preserve source colors without interpolation (16-bit)
 static PF_Pixel16 SampleSourcePixel16(float srcX, float srcY,
-                                      const SliceContext *ctx) {
+                                      const SliceSource *source) {
   PF_Pixel16 result = {0, 0, 0, 0};
 
   // Round to nearest integer
-  A_long x = static_cast<A_long>(srcX + SAMPLE_ROUND_OFFSET);
-  A_long y = static_cast<A_long>(srcY + SAMPLE_ROUND_OFFSET);
+  A_long x = static_cast<A_long>(srcX + SAMPLE_ROUND_OFFSET) - source->offsetX;
+  A_long y = static_cast<A_long>(srcY + SAMPLE_ROUND_OFFSET) - source->offsetY;
 
-  if (x < 0 || x >= ctx->width || y < 0 || y >= ctx->height) {
+  if (x < 0 || x >= source->width || y < 0 || y >= source->height) {
     return result;
   }
 
-  PF_Pixel16 *p = reinterpret_cast<PF_Pixel16 *>(
-      reinterpret_cast<char *>(ctx->srcData) + y * ctx->rowbytes +
-      x * static_cast<A_long>(sizeof(PF_Pixel16)));
-
-  return *p;
+  return PixelRow<PF_Pixel16>(source->data, source->rowbytes, y)[x];
 }
 
 static inline void ComputeShiftedSourceCoords(const SliceContext *ctx,
@@ -290,6 +438,36 @@ static void RotatePoint(float centerX, float centerY, float &x, float &y,
   y = newY;
 }
 
+/**
+ * Binary search among slices low..high, which must include the slice
+ * containing sliceX (or the slice after a gap it falls in).
+ *
+ * @param segments Slice segments in slice order
+ * @param sliceX Coordinate in slice space
+ * @param low First slice to search
+ * @param high Last slice to search
+ * @return Index of the containing slice
+ */
+static inline A_long SearchSliceRange(const SliceSegment *segments, float sliceX, A_long low,
+                                      A_long high) {
+  const A_long last = high;
+  while (low <= high) {
+    A_long mid = (low + high) >> 1;
+    const SliceSegment &seg = segments[mid];
+
+    if (sliceX < seg.sliceStart) {
+      high = mid - 1;
+    } else if (sliceX > seg.sliceEnd) {
+      low = mid + 1;
+    } else {
+      return mid;
+    }
+  }
+
+  // Should not reach here, but return nearest slice
+  return (low < last) ? low : last;
+}
+
 /**
  * Binary search to find the slice containing a given slice-space coordinate.
  *
@@ -342,24 +520,339 @@ static inline A_long FindSliceIndex(const SliceContext *ctx, float sliceX) {
   }
 
   // Binary search for larger slice counts
-  A_long low = 0;
-  A_long high = numSlices - 1;
+  return SearchSliceRange(segments, sliceX, 0, numSlices - 1);
+}
 
-  while (low <= high) {
-    A_long mid = (low + high) >> 1;
-    const SliceSegment &seg = segments[mid];
+/**
+ * Find the slice containing a slice-space coordinate through the Prefilter
+ * Slices bucket index: the bucket the coordinate falls in names the slices
+ * that can contain it, and only those are searched. The same slice as
+ * FindSliceIndex, up to which of two slices a shared edge is given to.
+ *
+ * @param ctx Slice context with prefix sums and buckets (numSlices > 0)
+ * @param sliceX Coordinate in slice space
+ * @return Index of the containing slice
+ */
+static inline A_long FindBucketedSliceIndex(const SliceContext *ctx, float sliceX) {
+  const SliceSegment *segments = ctx->segments;
+  const A_long last = ctx->numSlices - 1;
+  if (sliceX < segments[0].sliceStart) {
+    return 0;
+  }
+  if (sliceX > segments[last].sliceEnd) {
+    return last;
+  }
+  const float bucket = (sliceX - ctx->bucketStart) * ctx->bucketInvStep;
+  const A_long b = CLAMP(static_cast<A_long>(bucket), static_cast<A_long>(0), ctx->bucketCount - 1);
+  // One slice of slack either way for rounding at the bucket edges
+  const A_long low = MAX(ctx->buckets[b] - 1, static_cast<A_long>(0));
+  const A_long high = MIN(ctx->buckets[b + 1] + 1, last);
+  return SearchSliceRange(segments, sliceX, low, high);
+}
 
-    if (sliceX < seg.sliceStart) {
-      high = mid - 1;
-    } else if (sliceX > seg.sliceEnd) {
-      low = mid + 1;
-    } else {
-      return mid;
+/**
+ * Look up the edge warp displacement for a position along the slices.
+ *
+ * Nearest entry of the per-frame table; positions outside it use the end
+ * values.
+ *
+ * @param ctx Slice context with a warp table
+ * @param along Slice-space Y (position along the slices)
+ * @return Displacement to add to slice-space X
+ */
+static inline float SampleEdgeWarp(const SliceContext *ctx, float along) {
+  float index = (along - ctx->warpStart) * ctx->warpInvStep + SAMPLE_ROUND_OFFSET;
+  index = CLAMP(index, 0.0f, static_cast<float>(ctx->warpCount - 1));
+  return ctx->warp[static_cast<A_long>(index)];
+}
+
+/**
+ * Slice-space X of a layer position: rotated into slice space around the
+ * anchor, plus the edge warp displacement when Edge Warp is on.
+ */
+static inline float SlicePositionAt(const SliceContext *ctx, float worldX, float worldY) {
+  float sliceX = worldX;
+  float sliceY = worldY;
+  RotatePoint(ctx->centerX, ctx->centerY, sliceX, sliceY, ctx->angleCos,
+              -ctx->angleSin);
+  if (ctx->warp) {
+    sliceX += SampleEdgeWarp(ctx, sliceY);
+  }
+  return sliceX;
+}
+
+/**
+ * Soft coverage of a slice at a slice-space coordinate.
+ *
+ * Fades linearly over DEFAULT_FEATHER on either side of the visible edges.
+ *
+ * @param seg Slice to test
+ * @param sliceX Coordinate in slice space
+ * @return Coverage in range [0.0, 1.0], 0 outside the feathered region
+ */
+static inline float SliceCoverage(const SliceSegment &seg, float sliceX) {
+  constexpr float feather = DEFAULT_FEATHER;
+
+  if (sliceX < seg.visibleStart - feather ||
+      sliceX > seg.visibleEnd + feather) {
+    return 0.0f; // Outside feathered region
+  } else if (sliceX < seg.visibleStart + feather) {
+    // Fade in at leading edge
+    return (sliceX - (seg.visibleStart - feather)) / FEATHER_SOFT_EDGE;
+  } else if (sliceX > seg.visibleEnd - feather) {
+    // Fade out at trailing edge
+    return ((seg.visibleEnd + feather) - sliceX) / FEATHER_SOFT_EDGE;
+  }
+  return 1.0f;
+}
+
+/**
+ * Accumulate one slice sample into a pixel.
+ *
+ * Alpha: Additive blending (sum of coverages)
+ * RGB: Select color from slice with highest coverage
+ * CRITICAL FIX: Ignore transparent (alpha=0) pixels when selecting RGB,
+ * to prevent picking "black" from outside the slice boundary
+ *
+ * @param p Sampled source pixel
+ * @param coverage Soft coverage of the slice at this pixel
+ * @param accumA In/out accumulated alpha
+ * @param maxCoverage In/out coverage of the current best pixel
+ * @param bestPixel In/out pixel providing the output RGB
+ */
+template <typename PixelType>
+static inline void AccumulateSample(const PixelType &p, float coverage,
+                                    float &accumA, float &maxCoverage,
+                                    PixelType &bestPixel) {
+  // Accumulate Alpha
+  accumA += static_cast<float>(p.alpha) * coverage;
+
+  // Logic to select best RGB:
+  // Prioritize opaque pixels over transparent ones.
+  // If both opaque (or both transparent), pick highest coverage.
+  bool currentIsOpaque = (p.alpha > 0);
+  bool bestIsOpaque = (bestPixel.alpha > 0);
+
+  if (currentIsOpaque && !bestIsOpaque) {
+    // Found an opaque pixel, take it immediately
+    maxCoverage = coverage;
+    bestPixel = p;
+  } else if (currentIsOpaque == bestIsOpaque) {
+    // Both opaque or both transparent -> use coverage
+    if (coverage > maxCoverage) {
+      maxCoverage = coverage;
+      bestPixel = p;
     }
   }
+}
 
-  // Should not reach here, but return nearest slice
-  return (low < numSlices) ? low : numSlices - 1;
+// =============================================================================
+// Source occupancy - coarse tiles to skip sampling empty source regions
+// =============================================================================
+
+/**
+ * Classify one row of source tiles as empty, opaque or mixed.
+ *
+ * Streams the OCCUPANCY_TILE_SIZE source rows of tile row i once, left to
+ * right, reading only pixels inside the content rectangle; everything
+ * outside it is known to be zero. Called through iterate_generic with one
+ * iteration per tile row.
+ *
+ * @param refcon Pointer to OccupancyContext
+ * @param thread_index Worker thread index (unused)
+ * @param i Tile row to classify
+ * @param iterations Total number of tile rows (unused)
+ * @return PF_Err error code (always PF_Err_NONE)
+ */
+template <typename PixelType, A_long MaxChannel>
+static PF_Err BuildOccupancyRowT(void *refcon, A_long thread_index, A_long i,
+                                 A_long iterations) {
+  (void)thread_index;
+  (void)iterations;
+  const OccupancyContext *oc = reinterpret_cast<const OccupancyContext *>(refcon);
+  A_u_char *tiles = oc->occupancy + i * oc->tilesX;
+  const A_long y0 = i << OCCUPANCY_TILE_SHIFT;
+  const A_long y1 = MIN(y0 + OCCUPANCY_TILE_SIZE, oc->height);
+  const A_long scanY0 = MAX(y0, oc->content.top);
+  const A_long scanY1 = MIN(y1, oc->content.bottom);
+  const bool rowsClipped = (scanY0 != y0 || scanY1 != y1);
+
+  // Bit 0: some pixel is non-zero, bit 1: some pixel is not opaque.
+  // Tiles reaching outside the content hold zero pixels, so are not opaque.
+  for (A_long tx = 0; tx < oc->tilesX; tx++) {
+    const A_long x0 = tx << OCCUPANCY_TILE_SHIFT;
+    const A_long x1 = MIN(x0 + OCCUPANCY_TILE_SIZE, oc->width);
+    tiles[tx] = (rowsClipped || x0 < oc->content.left || x1 > oc->content.right) ? 2 : 0;
+  }
+  for (A_long y = scanY0; y < scanY1; y++) {
+    const PixelType *row = PixelRow<PixelType>(oc->srcData, oc->rowbytes, y);
+    for (A_long x = oc->content.left; x < oc->content.right; x++) {
+      const PixelType &p = row[x];
+      A_u_char flags = 0;
+      if (p.alpha || p.red || p.green || p.blue) {
+        flags |= 1;
+      }
+      if (p.alpha != MaxChannel) {
+        flags |= 2;
+      }
+      tiles[x >> OCCUPANCY_TILE_SHIFT] |= flags;
+    }
+  }
+
+  for (A_long tx = 0; tx < oc->tilesX; tx++) {
+    tiles[tx] = !(tiles[tx] & 1) ? OCCUPANCY_EMPTY
+                : !(tiles[tx] & 2) ? OCCUPANCY_OPAQUE
+                                   : OCCUPANCY_MIXED;
+  }
+  return PF_Err_NONE;
+}
+
+static PF_Err BuildOccupancyRow8(void *refcon, A_long thread_index, A_long i, A_long iterations) {
+  return BuildOccupancyRowT<PF_Pixel, 255>(refcon, thread_index, i, iterations);
+}
+
+static PF_Err BuildOccupancyRow16(void *refcon, A_long thread_index, A_long i, A_long iterations) {
+  return BuildOccupancyRowT<PF_Pixel16, PF_MAX_CHAN16>(refcon, thread_index, i, iterations);
+}
+
+/**
+ * Mark tiles that can be skipped: empty, and surrounded by empty tiles.
+ *
+ * The one-tile margin absorbs nearest-neighbor rounding and float error in
+ * span setup, so skip decisions can be made from tile indices alone.
+ *
+ * @param occupancy Tile states (tilesX * tilesY)
+ * @param tileSkip Output skip flags (tilesX * tilesY)
+ */
+static void BuildTileSkip(const A_u_char *occupancy, A_long tilesX, A_long tilesY,
+                          A_u_char *tileSkip) {
+  for (A_long ty = 0; ty < tilesY; ty++) {
+    for (A_long tx = 0; tx < tilesX; tx++) {
+      A_u_char skip = 1;
+      for (A_long ny = MAX(ty - 1, static_cast<A_long>(0));
+           skip && ny <= MIN(ty + 1, tilesY - 1); ny++) {
+        for (A_long nx = MAX(tx - 1, static_cast<A_long>(0));
+             nx <= MIN(tx + 1, tilesX - 1); nx++) {
+          if (occupancy[ny * tilesX + nx] != OCCUPANCY_EMPTY) {
+            skip = 0;
+            break;
+          }
+        }
+      }
+      tileSkip[ty * tilesX + tx] = skip;
+    }
+  }
+}
+
+/**
+ * Whether a source sample at (srcX, srcY) is known to be zero.
+ *
+ * Positions a full tile outside the layer always are; positions inside or
+ * near it use the (dilated) skip flags of the nearest tile.
+ */
+static inline bool IsSourceSkippable(const SliceContext *ctx, float srcX, float srcY) {
+  float tileX = floorf(srcX * (1.0f / OCCUPANCY_TILE_SIZE));
+  float tileY = floorf(srcY * (1.0f / OCCUPANCY_TILE_SIZE));
+  if (tileX < -1.0f || tileY < -1.0f || tileX > static_cast<float>(ctx->tilesX) ||
+      tileY > static_cast<float>(ctx->tilesY)) {
+    return true;
+  }
+  A_long tx = CLAMP(static_cast<A_long>(tileX), static_cast<A_long>(0), ctx->tilesX - 1);
+  A_long ty = CLAMP(static_cast<A_long>(tileY), static_cast<A_long>(0), ctx->tilesY - 1);
+  return ctx->tileSkip[ty * ctx->tilesX + tx] != 0;
+}
+
+// =============================================================================
+// Prefiltered slices - area average over the pixel footprint
+// =============================================================================
+
+/**
+ * Integrate the slices from the start of slice space up to sliceX.
+ *
+ * The prefix sums cover whole slices; only the slice containing sliceX is
+ * added partially, so the cost is one bucket lookup. Slices shifted forward
+ * and backward are summed apart (index 0 and 1).
+ *
+ * @param ctx Slice context with prefix sums
+ * @param sliceX Coordinate in slice space
+ * @param width Output visible width before sliceX, per shift direction
+ * @param shift Output visible width weighted by the slices' shift factors,
+ *              per shift direction
+ */
+static inline void IntegrateSlices(const SliceContext *ctx, float sliceX,
+                                   float width[2], float shift[2]) {
+  const A_long i = FindBucketedSliceIndex(ctx, sliceX);
+  const A_long count = ctx->numSlices + 1;
+  const SliceSegment &seg = ctx->segments[i];
+  const float partial =
+      CLAMP(sliceX - seg.visibleStart, 0.0f, MAX(0.0f, seg.visibleEnd - seg.visibleStart));
+  for (int direction = 0; direction < 2; direction++) {
+    width[direction] = ctx->prefixWidth[direction * count + i];
+    shift[direction] = ctx->prefixShift[direction * count + i];
+  }
+  const int direction = (seg.shiftDirection < 0.0f) ? 1 : 0;
+  width[direction] += partial;
+  shift[direction] += partial * seg.shiftRandomFactor;
+}
+
+/**
+ * Prefiltered pixel: box filter over the pixel's footprint across the slices.
+ *
+ * The footprint is FEATHER_SOFT_EDGE wide, the same ramp SliceCoverage
+ * gives a single edge, so wide slices keep their usual edges. However many
+ * slices fall inside it, two prefix-sum lookups give the visible width and
+ * the area-weighted mean shift of the slices moving each way; each lookup
+ * finds its slice through the bucket index, so the cost stays flat as the
+ * slice count grows. Slices shift
+ * forward or backward at random, so a single mean over both would cancel
+ * towards no shift at all; instead the source is sampled once per direction
+ * present (at most twice) and the samples are blended by their widths. All
+ * of this changes continuously as the footprint slides, so slices narrower
+ * than a pixel no longer shimmer as one or another is picked. The source is
+ * the one of the slice at the pixel center.
+ */
+template <typename PixelType, typename ChannelType, ChannelType MaxChannel,
+          PixelType (*SampleFunc)(float, float, const SliceSource *)>
+static inline void PrefilterPixelT(const SliceContext *ctx, float worldX, float worldY,
+                                   float sliceX, PixelType *out) {
+  float width0[2], shift0[2], width1[2], shift1[2];
+  IntegrateSlices(ctx, sliceX - DEFAULT_FEATHER, width0, shift0);
+  IntegrateSlices(ctx, sliceX + DEFAULT_FEATHER, width1, shift1);
+
+  const float visible = (width1[0] - width0[0]) + (width1[1] - width0[1]);
+  const float fraction = visible / FEATHER_SOFT_EDGE;
+  if (fraction <= COVERAGE_THRESHOLD) {
+    out->alpha = out->red = out->green = out->blue = 0;
+    return;
+  }
+
+  // Color is the width-weighted mean of the samples; alpha also covers
+  // the visible fraction of the footprint
+  const SliceSegment &seg = ctx->segments[FindBucketedSliceIndex(ctx, sliceX)];
+  float accum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  for (int direction = 0; direction < 2; direction++) {
+    const float groupWidth = width1[direction] - width0[direction];
+    if (groupWidth <= 0.0f) {
+      continue;
+    }
+    const float sign = direction ? -1.0f : 1.0f;
+    const float offsetPixels =
+        sign * ctx->shiftAmount * (shift1[direction] - shift0[direction]) / groupWidth;
+    PixelType p = SampleFunc(worldX + ctx->shiftDirX * offsetPixels,
+                             worldY + ctx->shiftDirY * offsetPixels,
+                             &ctx->sources[seg.source]);
+    const float weight = groupWidth / visible;
+    accum[0] += p.red * weight;
+    accum[1] += p.green * weight;
+    accum[2] += p.blue * weight;
+    accum[3] += p.alpha * weight;
+  }
+
+  const float maxC = static_cast<float>(MaxChannel);
+  out->alpha = static_cast<ChannelType>(CLAMP(accum[3] * MIN(fraction, 1.0f) + 0.5f, 0.0f, maxC));
+  out->red = static_cast<ChannelType>(CLAMP(accum[0] + 0.5f, 0.0f, maxC));
+  out->green = static_cast<ChannelType>(CLAMP(accum[1] + 0.5f, 0.0f, maxC));
+  out->blue = static_cast<ChannelType>(CLAMP(accum[2] + 0.5f, 0.0f, maxC));
 }
 
 // =============================================================================
@@ -390,7 +883,7 @@ static inline A_long FindSliceIndex(const SliceContext *ctx, float sliceX) {
  * @return PF_Err error code (always PF_Err_NONE)
  */
 template <typename PixelType, typename ChannelType, ChannelType MaxChannel,
-          PixelType (*SampleFunc)(float, float, const SliceContext *)>
+          PixelType (*SampleFunc)(float, float, const SliceSource *)>
 static PF_Err ProcessMultiSliceT(void *refcon, A_long x, A_long y,
                                   PixelType *in, PixelType *out) {
   (void)in; // Unused - kept for iterate callback signature
@@ -403,13 +896,16 @@ static PF_Err ProcessMultiSliceT(void *refcon, A_long x, A_long y,
   }
 
   // Convert buffer coordinates to layer coordinates
-  // Buffer coord (x,y) -> Layer coord (x - origin_x, y - origin_y)
-  float worldX = static_cast<float>(x) - ctx->output_origin_x;
-  float worldY = static_cast<float>(y) - ctx->output_origin_y;
-  float sliceX = worldX;
-  float sliceY = worldY;
-  RotatePoint(ctx->centerX, ctx->centerY, sliceX, sliceY, ctx->angleCos,
-              -ctx->angleSin);
+  // Buffer coord (x,y) -> Layer coord ((x - origin_x) * scale, (y - origin_y) * scale)
+  float worldX = (static_cast<float>(x) - ctx->output_origin_x) * ctx->pixelScale;
+  float worldY = (static_cast<float>(y) - ctx->output_origin_y) * ctx->pixelScale;
+  const float sliceX = SlicePositionAt(ctx, worldX, worldY);
+
+  if (ctx->prefixWidth) {
+    PrefilterPixelT<PixelType, ChannelType, MaxChannel, SampleFunc>(ctx, worldX, worldY,
+                                                                    sliceX, out);
+    return err;
+  }
 
   const A_long idx = FindSliceIndex(ctx, sliceX);
   if (idx < 0) {
@@ -418,10 +914,7 @@ static PF_Err ProcessMultiSliceT(void *refcon, A_long x, A_long y,
   }
 
   // Accumulate contributions from adjacent slices for soft edge blending
-  // Alpha: Additive blending (sum of coverages)
-  // RGB: Select color from slice with highest coverage
-  // CRITICAL FIX: Ignore transparent (alpha=0) pixels when selecting RGB,
-  // to prevent picking "black" from outside the slice boundary
+  // (see AccumulateSample for the alpha and RGB rules)
   float accumA = 0.0f;
   PixelType bestPixel = {0, 0, 0, 0};
   float maxCoverage = -1.0f;
@@ -434,48 +927,16 @@ static PF_Err ProcessMultiSliceT(void *refcon, A_long x, A_long y,
     const SliceSegment &seg = ctx->segments[sliceIdx];
 
     // Calculate soft coverage based on distance from visible slice edges
-    float coverage = 1.0f;
-    constexpr float feather = DEFAULT_FEATHER;
-
-    if (sliceX < seg.visibleStart - feather ||
-        sliceX > seg.visibleEnd + feather) {
-      return; // Outside feathered region
-    } else if (sliceX < seg.visibleStart + feather) {
-      // Fade in at leading edge
-      coverage = (sliceX - (seg.visibleStart - feather)) / FEATHER_SOFT_EDGE;
-    } else if (sliceX > seg.visibleEnd - feather) {
-      // Fade out at trailing edge
-      coverage = ((seg.visibleEnd + feather) - sliceX) / FEATHER_SOFT_EDGE;
-    }
-
+    float coverage = SliceCoverage(seg, sliceX);
     if (coverage <= COVERAGE_THRESHOLD)
       return;
 
     // Compute source coordinates with shift applied
     float srcX = 0.0f, srcY = 0.0f;
     ComputeShiftedSourceCoords(ctx, seg, worldX, worldY, srcX, srcY);
-    PixelType p = SampleFunc(srcX, srcY, ctx);
-
-    // Accumulate Alpha
-    accumA += static_cast<float>(p.alpha) * coverage;
+    PixelType p = SampleFunc(srcX, srcY, &ctx->sources[seg.source]);
 
-    // Logic to select best RGB:
-    // Prioritize opaque pixels over transparent ones.
-    // If both opaque (or both transparent), pick highest coverage.
-    bool currentIsOpaque = (p.alpha > 0);
-    bool bestIsOpaque = (bestPixel.alpha > 0);
-
-    if (currentIsOpaque && !bestIsOpaque) {
-      // Found an opaque pixel, take it immediately
-      maxCoverage = coverage;
-      bestPixel = p;
-    } else if (currentIsOpaque == bestIsOpaque) {
-      // Both opaque or both transparent -> use coverage
-      if (coverage > maxCoverage) {
-        maxCoverage = coverage;
-        bestPixel = p;
-      }
-    }
+    AccumulateSample(p, coverage, accumA, maxCoverage, bestPixel);
   };
 
   // Accumulate from primary slice and adjacent slices for edge blending
@@ -494,150 +955,5012 @@ static PF_Err ProcessMultiSliceT(void *refcon, A_long x, A_long y,
 }
 
 // =============================================================================
-// Iterate callback wrappers for template functions
-// CRITICAL FIX #1: Replace std::thread with SDK Iterate Pattern
+// Row-based rendering with empty-source skipping
 // =============================================================================
 
-static PF_Err Iterate8Callback(void *refcon, A_long x, A_long y, PF_Pixel *in, PF_Pixel *out) {
-  return ProcessMultiSliceT<PF_Pixel, A_u_char, 255, SampleSourcePixel8>(refcon, x, y, in, out);
-}
+/**
+ * Clip an integer span [x0, x1] to where (f0 + x * df) >= 0.
+ *
+ * Every span constraint is written in this form: for perspective slices the
+ * homogeneous coordinates are linear along a row, so bounds on the projected
+ * values become linear after multiplying through by the (positive) w.
+ *
+ * @return true if any of the span remains
+ */
+static inline bool ClipSpan(float f0, float df, A_long &x0, A_long &x1) {
+  if (fabsf(df) < 1e-9f) {
+    // Constant along the span: all or nothing
+    return f0 >= 0.0f && x0 <= x1;
+  }
 
-static PF_Err Iterate16Callback(void *refcon, A_long x, A_long y, PF_Pixel16 *in, PF_Pixel16 *out) {
-  return ProcessMultiSliceT<PF_Pixel16, A_u_short, PF_MAX_CHAN16, SampleSourcePixel16>(refcon, x, y, in, out);
+  // Clamp in float before converting so far-away spans cannot overflow
+  float root = -f0 / df;
+  if (df > 0.0f) {
+    if (root > static_cast<float>(x1)) {
+      return false;
+    }
+    if (root > static_cast<float>(x0)) {
+      x0 = static_cast<A_long>(ceilf(root));
+    }
+  } else {
+    if (root < static_cast<float>(x0)) {
+      return false;
+    }
+    if (root < static_cast<float>(x1)) {
+      x1 = static_cast<A_long>(floorf(root));
+    }
+  }
+  return x0 <= x1;
 }
 
-// =============================================================================
-// Division points calculation - extracted from Render for modularity
-// =============================================================================
-
 /**
- * Calculate division points that define slice boundaries.
+ * Render one output row of untransformed slices.
  *
- * Creates randomized but ordered division points across the slice length:
- * 1. Sets first and last points at slice boundaries
- * 2. Distributes remaining points with average spacing
- * 3. Applies random offsets for visual variety (70% get 20-90% spacing, 30% get 100-180%)
- * 4. Sorts using insertion sort (optimal for small arrays)
- * 5. Enforces minimum spacing (5% of average) to prevent overlap
- * 6. Scales to fit full range if needed (prevents compression at edges)
+ * Without transforms the source of slice k along a row is one source row,
+ * shifted by a constant. So for every slice whose (conservatively widened)
+ * feathered band crosses the row, the band's x-range is mapped to source
+ * tile columns and only pixels whose tiles are not skippable are marked
+ * live. Live pixels run the exact per-pixel logic of ProcessMultiSliceT;
+ * all others would only ever read zero samples and are written as zero.
+ * For text and logo layers most of the frame is skipped without rotating,
+ * searching or sampling.
  *
- * @param seed Random seed for consistent patterns
- * @param numSlices Number of slices to create
- * @param sliceLength Total length of slice space
- * @param divPoints Output array of size (numSlices + 1) for division points
- */
-static void CalculateDivisionPoints(A_long seed, A_long numSlices, float sliceLength, float *divPoints) {
-  // Set first and last division points at slice boundaries
-  divPoints[0] = -sliceLength / 2.0f;
-  divPoints[numSlices] = sliceLength / 2.0f;
+ * Called through iterate_generic with one iteration per output row.
+ *
+ * @param refcon Pointer to SliceContext (dst* must be set)
+ * @param thread_index Worker thread index (unused)
+ * @param y Output row to render
+ * @param iterations Total number of rows (unused)
+ * @return PF_Err error code (always PF_Err_NONE)
+ */
+template <typename PixelType, typename ChannelType, ChannelType MaxChannel,
+          PixelType (*SampleFunc)(float, float, const SliceSource *)>
+static PF_Err RenderSliceRowT(void *refcon, A_long thread_index, A_long y,
+                              A_long iterations) {
+  (void)thread_index;
+  (void)iterations;
+  SliceContext *ctx = reinterpret_cast<SliceContext *>(refcon);
+  PixelType *outRow = PixelRow<PixelType>(ctx->dstData, ctx->dstRowbytes, y);
+
+  if (!ctx->tileSkip) {
+    for (A_long x = 0; x < ctx->dstWidth; ++x) {
+      ProcessMultiSliceT<PixelType, ChannelType, MaxChannel, SampleFunc>(
+          ctx, x, y, nullptr, &outRow[x]);
+    }
+    return PF_Err_NONE;
+  }
 
-  // Calculate baseline random offset for organic feel
-  float baselineOffset = (GetRandomValue(seed, SEARCH_HASH_BASE1) - RANDOM_ROUND_THRESHOLD) * sliceLength * SEARCH_LENGTH_MARGIN;
-  float avgSpacing = sliceLength / numSlices;
+  // Band limits are widened by one pixel against float differences
+  const float margin = DEFAULT_FEATHER + ctx->warpAmplitude + 1.0f;
+  const float scale = ctx->pixelScale;
+  const float worldX0 = -ctx->output_origin_x * scale;
+  const float worldY = (static_cast<float>(y) - ctx->output_origin_y) * scale;
+  // Slice-space X along the row: sliceX0 + x * sliceStep
+  const float sliceX0 = (worldX0 - ctx->centerX) * ctx->angleCos +
+                        (worldY - ctx->centerY) * ctx->angleSin + ctx->centerX;
+  const float sliceStep = ctx->angleCos * scale;
+
+  A_u_char live[SPAN_CHUNK_SIZE];
+
+  for (A_long chunkStart = 0; chunkStart < ctx->dstWidth; chunkStart += SPAN_CHUNK_SIZE) {
+    const A_long chunkEnd = MIN(chunkStart + SPAN_CHUNK_SIZE, ctx->dstWidth);
+    memset(live, 0, sizeof(live));
+
+    for (A_long i = ctx->firstSlice; i <= ctx->lastSlice; ++i) {
+      const SliceSegment &seg = ctx->segments[i];
+      A_long x0 = chunkStart;
+      A_long x1 = chunkEnd - 1;
+      if (!ClipSpan(sliceX0 - (seg.visibleStart - margin), sliceStep, x0, x1) ||
+          !ClipSpan((seg.visibleEnd + margin) - sliceX0, -sliceStep, x0, x1)) {
+        continue;
+      }
 
-  if (numSlices > 1) {
-    // Initial even distribution
-    for (A_long i = 1; i < numSlices; i++) {
-      divPoints[i] = divPoints[0] + (i * avgSpacing);
+      // Source row and column offset of this slice
+      const float offsetPixels =
+          ctx->shiftAmount * seg.shiftRandomFactor * seg.shiftDirection;
+      const float srcY = worldY + ctx->shiftDirY * offsetPixels;
+      const float srcOffsetX = worldX0 + ctx->shiftDirX * offsetPixels;
+
+      // Only the part of the row that samples the content can be non-zero
+      // (one pixel of slack either way against float differences)
+      const float srcMinX = ctx->content.left - SPAN_SOURCE_MARGIN;
+      const float srcMaxX = ctx->content.right - 1.0f + SPAN_SOURCE_MARGIN;
+      if (srcY < ctx->content.top - SPAN_SOURCE_MARGIN ||
+          srcY > ctx->content.bottom - 1.0f + SPAN_SOURCE_MARGIN ||
+          !ClipSpan(srcOffsetX - srcMinX, scale, x0, x1) ||
+          !ClipSpan(srcMaxX - srcOffsetX, -scale, x0, x1)) {
+        continue;
+      }
+
+      // The occupancy map describes the Input only
+      if (seg.source != 0) {
+        memset(live + (x0 - chunkStart), 1, x1 - x0 + 1);
+        continue;
+      }
+
+      // Walk the span one source tile at a time
+      A_long x = x0;
+      while (x <= x1) {
+        float srcX = static_cast<float>(x) * scale + srcOffsetX;
+        float tileEnd = (floorf(srcX * (1.0f / OCCUPANCY_TILE_SIZE)) + 1.0f) * OCCUPANCY_TILE_SIZE;
+        A_long next = MIN(x1 + 1, static_cast<A_long>(ceilf((tileEnd - srcOffsetX) / scale)));
+        next = MAX(next, x + 1);
+        if (!IsSourceSkippable(ctx, srcX, srcY)) {
+          memset(live + (x - chunkStart), 1, next - x);
+        }
+        x = next;
+      }
     }
 
-    // Apply random offsets for visual variety
-    // Distribution: 70% get 20-90% spacing, 30% get 100-180% spacing
-    for (A_long i = 1; i < numSlices; i++) {
-      float baseRandom = GetRandomValue(seed, i * DIV_BASE_RANDOM_INDEX1 + DIV_BASE_RANDOM_INDEX2);
-      float randomFactor;
-      if (baseRandom < DIV_RANDOM_THRESHOLD_1) {
-        randomFactor = DIV_RANDOM_FACTOR_LOW + (baseRandom / DIV_RANDOM_THRESHOLD_1) * DIV_RANDOM_THRESHOLD_1;
+    for (A_long x = chunkStart; x < chunkEnd; ++x) {
+      if (live[x - chunkStart]) {
+        ProcessMultiSliceT<PixelType, ChannelType, MaxChannel, SampleFunc>(
+            ctx, x, y, nullptr, &outRow[x]);
       } else {
-        randomFactor = DIV_RANDOM_FACTOR_HIGH + ((baseRandom - DIV_RANDOM_THRESHOLD_1) / DIV_RANDOM_THRESHOLD_2) * DIV_RANDOM_FACTOR_MAX;
+        outRow[x].alpha = outRow[x].red = outRow[x].green = outRow[x].blue = 0;
       }
+    }
+  }
 
-      float offset = (randomFactor - DIV_RANDOM_FACTOR_HIGH) * avgSpacing;
-      divPoints[i] += offset + baselineOffset;
+  return PF_Err_NONE;
+}
+
+// =============================================================================
+// Row-based span rendering for per-slice transforms
+// =============================================================================
+
+/**
+ * Composite a premultiplied sample under what is already in front of it.
+ *
+ * Used in perspective mode, where slices are visited front to back.
+ *
+ * @return true once the pixel is opaque and later slices cannot show
+ */
+template <typename PixelType>
+static inline bool CompositeUnder(const PixelType &p, float coverage, float maxC,
+                                  float *accum) {
+  float weight = coverage * (1.0f - accum[3] / maxC);
+  accum[0] += p.red * weight;
+  accum[1] += p.green * weight;
+  accum[2] += p.blue * weight;
+  accum[3] += p.alpha * weight;
+  return accum[3] >= maxC - 0.5f;
+}
+
+/**
+ * Render one output row when slices carry their own transform.
+ *
+ * Instead of searching for a slice per pixel, each slice's inverse transform
+ * is evaluated once per row: the homogeneous layout position (and therefore
+ * the slice-space X and the source position times w) is linear along the
+ * row, so each slice clips to a single span (in front of the camera,
+ * feathered band, source content) and is stepped incrementally - one add per
+ * coordinate and, in perspective mode, one divide per pixel. With Edge Warp
+ * on, the band is widened by the warp amplitude and each pixel adds one
+ * table lookup. Samples that land in skippable source tiles are not taken.
+ *
+ * Flat slices accumulate with the same rules as ProcessMultiSliceT.
+ * Perspective slices are visited front to back in drawOrder and composited
+ * with "under"; once every pixel of a chunk is opaque the remaining slices
+ * are skipped. Work is done in chunks of SPAN_CHUNK_SIZE pixels so no
+ * per-row allocation is needed.
+ *
+ * Called through iterate_generic with one iteration per output row.
+ *
+ * @param refcon Pointer to SliceContext (transforms and dst* must be set)
+ * @param thread_index Worker thread index (unused)
+ * @param y Output row to render
+ * @param iterations Total number of rows (unused)
+ * @return PF_Err error code (always PF_Err_NONE)
+ */
+template <typename PixelType, typename ChannelType, ChannelType MaxChannel,
+          PixelType (*SampleFunc)(float, float, const SliceSource *)>
+static PF_Err RenderTransformedRowT(void *refcon, A_long thread_index, A_long y,
+                                    A_long iterations) {
+  (void)thread_index;
+  (void)iterations;
+  const SliceContext *ctx = reinterpret_cast<const SliceContext *>(refcon);
+  PixelType *outRow = PixelRow<PixelType>(ctx->dstData, ctx->dstRowbytes, y);
+
+  constexpr float feather = DEFAULT_FEATHER;
+  const float maxC = static_cast<float>(MaxChannel);
+  const bool perspective = (ctx->drawOrder != nullptr);
+  const float scale = ctx->pixelScale;
+  const float worldX0 = -ctx->output_origin_x * scale;
+  const float worldY = (static_cast<float>(y) - ctx->output_origin_y) * scale;
+  // Source bounds: samples outside the content rectangle are zero
+  const float srcMinX = static_cast<float>(ctx->content.left) - SPAN_SOURCE_MARGIN;
+  const float srcMinY = static_cast<float>(ctx->content.top) - SPAN_SOURCE_MARGIN;
+  const float srcMaxX = static_cast<float>(ctx->content.right) - SAMPLE_ROUND_OFFSET;
+  const float srcMaxY = static_cast<float>(ctx->content.bottom) - SAMPLE_ROUND_OFFSET;
+  // Slice-space X = nx * layoutX + ny * layoutY + sliceOffset
+  const float nx = ctx->angleCos;
+  const float ny = ctx->angleSin;
+  const float sliceOffset = ctx->centerX - nx * ctx->centerX - ny * ctx->centerY;
+  // Slice-space Y = nx * layoutY - ny * layoutX + alongOffset
+  const float alongOffset = ctx->centerY + ny * ctx->centerX - nx * ctx->centerY;
+
+  // Flat mode: alpha sum and best coverage; perspective mode: RGBA under
+  float accumA[SPAN_CHUNK_SIZE];
+  float maxCoverage[SPAN_CHUNK_SIZE];
+  float accumRGBA[SPAN_CHUNK_SIZE][4];
+
+  for (A_long chunkStart = 0; chunkStart < ctx->dstWidth; chunkStart += SPAN_CHUNK_SIZE) {
+    const A_long chunkEnd = MIN(chunkStart + SPAN_CHUNK_SIZE, ctx->dstWidth);
+    A_long opaqueCount = 0;
+
+    for (A_long x = chunkStart; x < chunkEnd; ++x) {
+      outRow[x].alpha = outRow[x].red = outRow[x].green = outRow[x].blue = 0;
+      accumA[x - chunkStart] = 0.0f;
+      maxCoverage[x - chunkStart] = -1.0f;
+      accumRGBA[x - chunkStart][0] = accumRGBA[x - chunkStart][1] = 0.0f;
+      accumRGBA[x - chunkStart][2] = accumRGBA[x - chunkStart][3] = 0.0f;
     }
 
-    // Sort division points (insertion sort - small array, good cache locality)
-    for (A_long i = 1; i < numSlices; i++) {
-      float key = divPoints[i];
-      A_long j = i - 1;
-      while (j >= 0 && divPoints[j] > key) {
-        divPoints[j + 1] = divPoints[j];
-        j--;
+    for (A_long n = 0; n < ctx->numSlices; ++n) {
+      // Early out: nothing behind an opaque chunk can show through
+      if (opaqueCount == chunkEnd - chunkStart) {
+        break;
       }
-      divPoints[j + 1] = key;
+
+      const A_long i = perspective ? ctx->drawOrder[n] : n;
+      if (i < ctx->firstSlice || i > ctx->lastSlice) {
+        continue;
+      }
+      const SliceSegment &seg = ctx->segments[i];
+      const SliceSource *source = &ctx->sources[seg.source];
+      // The occupancy map describes the Input only
+      const bool tileSkip = ctx->tileSkip && seg.source == 0;
+      const float *inv = ctx->transforms[i].inverse;
+
+      // Homogeneous layout position at buffer x = 0, and its step per pixel
+      const float hx0 = inv[0] * worldX0 + inv[1] * worldY + inv[2];
+      const float hy0 = inv[3] * worldX0 + inv[4] * worldY + inv[5];
+      const float hw0 = inv[6] * worldX0 + inv[7] * worldY + inv[8];
+      const float stepX = inv[0] * scale;
+      const float stepY = inv[3] * scale;
+      const float stepW = inv[6] * scale;
+
+      // Slice-space X and Y (times w) along the row
+      const float sliceX0 = nx * hx0 + ny * hy0 + sliceOffset * hw0;
+      const float sliceStep = nx * stepX + ny * stepY + sliceOffset * stepW;
+      const float along0 = nx * hy0 - ny * hx0 + alongOffset * hw0;
+      const float alongStep = nx * stepY - ny * stepX + alongOffset * stepW;
+
+      // Source position is layout + shift (shift times w in homogeneous form)
+      const float offsetPixels =
+          ctx->shiftAmount * seg.shiftRandomFactor * seg.shiftDirection;
+      const float offX = ctx->shiftDirX * offsetPixels;
+      const float offY = ctx->shiftDirY * offsetPixels;
+      // Warped edges can move by up to the warp amplitude either way
+      const float lo = seg.visibleStart - feather - ctx->warpAmplitude;
+      const float hi = seg.visibleEnd + feather + ctx->warpAmplitude;
+
+      A_long x0 = chunkStart;
+      A_long x1 = chunkEnd - 1;
+      if (!ClipSpan(hw0 - HOMOGENEOUS_W_EPSILON, stepW, x0, x1) ||
+          !ClipSpan(1.0f / CAMERA_NEAR_W - hw0, -stepW, x0, x1) ||
+          !ClipSpan(sliceX0 - lo * hw0, sliceStep - lo * stepW, x0, x1) ||
+          !ClipSpan(hi * hw0 - sliceX0, hi * stepW - sliceStep, x0, x1) ||
+          !ClipSpan(hx0 + (offX - srcMinX) * hw0, stepX + (offX - srcMinX) * stepW, x0, x1) ||
+          !ClipSpan((srcMaxX - offX) * hw0 - hx0, (srcMaxX - offX) * stepW - stepX, x0, x1) ||
+          !ClipSpan(hy0 + (offY - srcMinY) * hw0, stepY + (offY - srcMinY) * stepW, x0, x1) ||
+          !ClipSpan((srcMaxY - offY) * hw0 - hy0, (srcMaxY - offY) * stepW - stepY, x0, x1)) {
+        continue;
+      }
+
+      float hx = hx0 + stepX * x0;
+      float hy = hy0 + stepY * x0;
+      float hw = hw0 + stepW * x0;
+      float sliceX = sliceX0 + sliceStep * x0;
+      float along = along0 + alongStep * x0;
+      for (A_long x = x0; x <= x1; ++x) {
+        const float invW = perspective ? 1.0f / hw : 1.0f;
+        const float warp = ctx->warp ? SampleEdgeWarp(ctx, along * invW) : 0.0f;
+        const float coverage = SliceCoverage(seg, sliceX * invW + warp);
+        if (coverage > COVERAGE_THRESHOLD &&
+            !(tileSkip && IsSourceSkippable(ctx, hx * invW + offX, hy * invW + offY))) {
+          float *accum = accumRGBA[x - chunkStart];
+          if (!perspective) {
+            PixelType p = SampleFunc(hx + offX, hy + offY, source);
+            AccumulateSample(p, coverage, accumA[x - chunkStart],
+                             maxCoverage[x - chunkStart], outRow[x]);
+          } else if (accum[3] < maxC - 0.5f) {
+            PixelType p = SampleFunc(hx * invW + offX, hy * invW + offY, source);
+            if (CompositeUnder(p, coverage, maxC, accum)) {
+              ++opaqueCount;
+            }
+          }
+        }
+        hx += stepX;
+        hy += stepY;
+        hw += stepW;
+        sliceX += sliceStep;
+        along += alongStep;
+      }
+    }
+
+    if (perspective) {
+      // Output: premultiplied front-to-back composite
+      for (A_long x = chunkStart; x < chunkEnd; ++x) {
+        const float *accum = accumRGBA[x - chunkStart];
+        outRow[x].red = static_cast<ChannelType>(CLAMP(accum[0] + 0.5f, 0.0f, maxC));
+        outRow[x].green = static_cast<ChannelType>(CLAMP(accum[1] + 0.5f, 0.0f, maxC));
+        outRow[x].blue = static_cast<ChannelType>(CLAMP(accum[2] + 0.5f, 0.0f, maxC));
+        outRow[x].alpha = static_cast<ChannelType>(CLAMP(accum[3] + 0.5f, 0.0f, maxC));
+      }
+    } else {
+      // Output: RGB from the best pixel (untouched), Alpha accumulated
+      for (A_long x = chunkStart; x < chunkEnd; ++x) {
+        outRow[x].alpha = static_cast<ChannelType>(
+            CLAMP(accumA[x - chunkStart] + 0.5f, 0.0f, maxC));
+      }
+    }
+  }
+
+  return PF_Err_NONE;
+}
+
+static PF_Err SliceRow8Callback(void *refcon, A_long thread_index, A_long y, A_long iterations) {
+  return RenderSliceRowT<PF_Pixel, A_u_char, 255, SampleSourcePixel8>(refcon, thread_index, y, iterations);
+}
+
+static PF_Err SliceRow16Callback(void *refcon, A_long thread_index, A_long y, A_long iterations) {
+  return RenderSliceRowT<PF_Pixel16, A_u_short, PF_MAX_CHAN16, SampleSourcePixel16>(refcon, thread_index, y, iterations);
+}
+
+static PF_Err TransformedRow8Callback(void *refcon, A_long thread_index, A_long y, A_long iterations) {
+  return RenderTransformedRowT<PF_Pixel, A_u_char, 255, SampleSourcePixel8>(refcon, thread_index, y, iterations);
+}
+
+static PF_Err TransformedRow16Callback(void *refcon, A_long thread_index, A_long y, A_long iterations) {
+  return RenderTransformedRowT<PF_Pixel16, A_u_short, PF_MAX_CHAN16, SampleSourcePixel16>(refcon, thread_index, y, iterations);
+}
+
+// =============================================================================
+// Files - read-only mapping and whole-file replacement, for layout cache and
+// slice export files shared between processes
+// =============================================================================
+
+// A whole file mapped read-only, unmapped when destroyed
+struct MappedFile {
+  const void *data = nullptr;
+  size_t size = 0;
+
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() {
+    if (data) {
+#ifdef AE_OS_WIN
+      UnmapViewOfFile(data);
+#else
+      munmap(const_cast<void *>(data), size);
+#endif
+    }
+  }
+};
+
+/**
+ * Map a whole file read-only.
+ *
+ * Pages come from the system file cache, so every process that maps the
+ * same file shares one copy.
+ *
+ * @param path File to map
+ * @param file Receives the mapping
+ * @return Whether the file exists, is not empty and could be mapped
+ */
+static bool MapFileReadOnly(const char *path, MappedFile &file) {
+#ifdef AE_OS_WIN
+  HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER size;
+  HANDLE mapping = NULL;
+  if (GetFileSizeEx(handle, &size) && size.QuadPart > 0) {
+    mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  }
+  if (mapping) {
+    file.data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    file.size = file.data ? static_cast<size_t>(size.QuadPart) : 0;
+    CloseHandle(mapping);
+  }
+  CloseHandle(handle);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    void *data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED) {
+      file.data = data;
+      file.size = static_cast<size_t>(info.st_size);
+    }
+  }
+  close(fd);
+#endif
+  return file.data != nullptr;
+}
+
+static unsigned long CurrentProcessId() {
+#ifdef AE_OS_WIN
+  return GetCurrentProcessId();
+#else
+  return static_cast<unsigned long>(getpid());
+#endif
+}
+
+// Temporary name next to path, unique to this process and to unique (an
+// address the writer holds while writing)
+static void TemporaryPath(const char *path, const void *unique, char *temporary, size_t size) {
+  snprintf(temporary, size, "%s.%lu-%p.tmp", path, CurrentProcessId(), unique);
+}
+
+/**
+ * Put a finished temporary file in place of another in one step, so readers
+ * see the old file or the new one, never a partial one. The temporary file
+ * is removed when that fails.
+ *
+ * @param temporary Finished file, from TemporaryPath
+ * @param path File to create or replace
+ * @return Whether path is now the temporary file
+ */
+static bool ReplaceWithFile(const char *temporary, const char *path) {
+#ifdef AE_OS_WIN
+  const bool ok = MoveFileExA(temporary, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  const bool ok = rename(temporary, path) == 0;
+#endif
+  if (!ok) {
+    remove(temporary);
+  }
+  return ok;
+}
+
+// =============================================================================
+// Geometry cache - per-pixel slice geometry reused while only Shift changes
+// =============================================================================
+
+// Everything the per-pixel slice geometry depends on. Shift only moves the
+// sources, so it is not part of the key, nor of the edge warp table.
+struct GeometryKey {
+  A_long imageWidth = 0;
+  A_long imageHeight = 0;
+  A_long numSlices = 0;
+  float centerX = 0.0f;
+  float centerY = 0.0f;
+  float angleCos = 0.0f;
+  float angleSin = 0.0f;
+  // Edge warp table, by what InitializeEdgeWarp builds it from (all 0 when
+  // Edge Warp is off)
+  A_long warpMode = 0;
+  float warpAmplitude = 0.0f;
+  float warpFrequency = 0.0f;
+  A_long warpSeed = 0;
+  float warpStart = 0.0f;
+  A_long warpCount = 0;
+  // Slice and visible bounds of every slice
+  std::vector<float> bands;
+
+  bool operator==(const GeometryKey &o) const {
+    return imageWidth == o.imageWidth && imageHeight == o.imageHeight &&
+           numSlices == o.numSlices && centerX == o.centerX &&
+           centerY == o.centerY && angleCos == o.angleCos &&
+           angleSin == o.angleSin && warpMode == o.warpMode &&
+           warpAmplitude == o.warpAmplitude && warpFrequency == o.warpFrequency &&
+           warpSeed == o.warpSeed && warpStart == o.warpStart &&
+           warpCount == o.warpCount && bands == o.bands;
+  }
+};
+
+// Cached cells over a layer-space rectangle: slice index and class per pixel
+struct GeometryMap {
+  GeometryKey key;
+  A_long left = 0;
+  A_long top = 0;
+  A_long width = 0;
+  A_long height = 0;
+  bool warmed = false; // built by WarmGeometryCache before its first render
+  std::vector<A_u_short> cells;
+  // Instead of cells: read in place from a layout cache file
+  const A_u_short *mapped = nullptr;
+  std::unique_ptr<MappedFile> file;
+};
+
+static inline const A_u_short *GeometryCells(const GeometryMap &map) {
+  return map.mapped ? map.mapped : map.cells.data();
+}
+
+// Maps shared by all instances and render threads, used when the host has
+// no compute cache: most recently used first, within GEOMETRY_CACHE_MAPS and
+// GEOMETRY_CACHE_BYTES. Renders hold their own reference, so a map can be
+// evicted while others still read it.
+static std::mutex sGeometryMutex;
+static std::list<std::shared_ptr<const GeometryMap>> sGeometryMaps;
+
+// Layer and output of a render that tried the cache: what a warm-up builds
+// the next map for
+struct GeometryShape {
+  bool valid = false;
+  bool layerMaps = false;
+  A_long imageWidth = 0;
+  A_long imageHeight = 0;
+  float downscaleX = 1.0f;
+  float downscaleY = 1.0f;
+  float pixelAspect = 1.0f;
+  A_long left = 0;
+  A_long top = 0;
+  A_long width = 0;
+  A_long height = 0;
+};
+
+// Per instance, by statistics id (0 for all instances without one): the key
+// of its last render, and the shape of its last render that tried the
+// cache. A map is built once an instance sees the same key twice in a row,
+// however other instances render in between, and a warm-up builds for the
+// instance whose parameters changed.
+struct GeometryInstance {
+  GeometryKey lastKey;
+  GeometryShape shape;
+  A_u_longlong warmFingerprint = 0; // WarmupFingerprint of its last warm-up
+};
+static std::map<A_u_long, GeometryInstance> sGeometryInstances;
+
+// Set at global setup from GEOMETRY_CACHE_ENV
+static bool sGeometryCacheOff = false;
+
+// AE's compute cache (AE 2022 and later), registered at global setup. Maps
+// then live in AE's memory budget and are purged with its other caches,
+// and MFR renders of the same key wait on one computation.
+static const AEGP_ComputeCacheSuite1 *sComputeCache = nullptr;
+
+// Warm-up after a parameter change (WarmGeometryCache): the map for sWarmKey
+// is built on a thread of its own while sWarmBuilding. Finished, the map
+// joins sGeometryMaps, or with the compute cache waits in sWarmMap until
+// a render moves it into the cache.
+//
+// Renders share their rows out through iterate_generic, but AE's suites
+// only serve the command that is running, and a warm-up has to outlive the
+// UI command that starts it. So it runs on plain threads (at most
+// GEOMETRY_WARMUP_THREADS), which only classify cells and read or write
+// the layout cache, never calling into AE.
+//
+// Starting a warm-up makes it sWarmGeneration; older ones stop at their
+// next row and drop their map, and nobody waits for them. Their threads
+// stay in sWarmThreads (UI thread only) with a flag they set as their last
+// step; the next warm-up joins those that have set it, so it never waits,
+// and global setdown joins the rest. The other warm-up state is guarded by
+// sGeometryMutex.
+struct WarmThread {
+  std::thread thread;
+  std::shared_ptr<std::atomic<bool>> finished;
+};
+static std::atomic<A_u_long> sWarmGeneration(0);
+static std::list<WarmThread> sWarmThreads;
+static bool sWarmBuilding = false;
+static GeometryKey sWarmKey;
+static std::unique_ptr<GeometryMap> sWarmMap;
+
+// Compute cache request: everything ComputeGeometryMap needs
+struct GeometryComputeOptions {
+  const SliceContext *ctx;
+  AEGP_SuiteHandler *suites;
+  const GeometryKey *key;
+  A_long margin; // beyond the layer on every side
+  bool *built;   // set when ComputeGeometryMap ran for this request
+};
+
+// A map in use by one render: a reference to the in-plugin map, or a
+// compute cache receipt that ReleaseGeometryMap checks back in
+struct GeometryHold {
+  const GeometryMap *map = nullptr;
+  std::shared_ptr<const GeometryMap> shared;
+  AEGP_CCCheckoutReceiptP receipt = nullptr;
+  bool built = false; // built by this render rather than reused
+  const char *miss = nullptr; // why there is no map, for the explain log
+};
+
+static void BuildGeometryKey(const SliceLayout &layout, GeometryKey &key) {
+  key.imageWidth = layout.imageWidth;
+  key.imageHeight = layout.imageHeight;
+  key.numSlices = layout.numSlices;
+  key.centerX = layout.centerX;
+  key.centerY = layout.centerY;
+  key.angleCos = layout.angleCos;
+  key.angleSin = layout.angleSin;
+  key.warpMode = layout.warp ? layout.warpMode : 0;
+  key.warpAmplitude = layout.warp ? layout.warpAmplitude : 0.0f;
+  key.warpFrequency = layout.warp ? layout.warpFrequency : 0.0f;
+  key.warpSeed = layout.warp ? layout.warpSeed : 0;
+  key.warpStart = layout.warp ? layout.warpStart : 0.0f;
+  key.warpCount = layout.warp ? layout.warpCount : 0;
+  key.bands.clear();
+  key.bands.reserve(layout.numSlices * 4);
+  for (A_long i = 0; i < layout.numSlices; i++) {
+    const SliceSegment &segment = layout.segments[i];
+    key.bands.push_back(segment.sliceStart);
+    key.bands.push_back(segment.sliceEnd);
+    key.bands.push_back(segment.visibleStart);
+    key.bands.push_back(segment.visibleEnd);
+  }
+}
+
+/**
+ * Classify one row of the geometry cache.
+ *
+ * Runs the slice search and coverage tests of ProcessMultiSliceT once per
+ * pixel and stores the slice index with its class: empty, covered only by
+ * that slice (the pixel is then exactly its shifted sample), or on a
+ * feathered edge. Called through iterate_generic with one iteration per row.
+ *
+ * @param refcon Pointer to GeometryBuildContext
+ * @param thread_index Worker thread index (unused)
+ * @param i Cache row to classify
+ * @param iterations Total number of rows (unused)
+ * @return PF_Err error code (always PF_Err_NONE)
+ */
+static PF_Err BuildGeometryRow(void *refcon, A_long thread_index, A_long i,
+                               A_long iterations) {
+  (void)thread_index;
+  (void)iterations;
+  const GeometryBuildContext *gc = reinterpret_cast<const GeometryBuildContext *>(refcon);
+  const SliceContext *ctx = gc->slices;
+  A_u_short *row = gc->cells + static_cast<ptrdiff_t>(i) * gc->width;
+  const float worldY = static_cast<float>(gc->top + i);
+
+  for (A_long x = 0; x < gc->width; x++) {
+    const float sliceX = SlicePositionAt(ctx, static_cast<float>(gc->left + x), worldY);
+    const A_long idx = FindSliceIndex(ctx, sliceX);
+    A_long cls = GEOMETRY_EMPTY;
+    if (idx >= 0) {
+      const float coverage = SliceCoverage(ctx->segments[idx], sliceX);
+      bool neighbors = false;
+      for (A_long n = idx - 1; n <= idx + 1; n += 2) {
+        if (n >= 0 && n < ctx->numSlices &&
+            SliceCoverage(ctx->segments[n], sliceX) > COVERAGE_THRESHOLD) {
+          neighbors = true;
+        }
+      }
+      if (neighbors || (coverage > COVERAGE_THRESHOLD && coverage < 1.0f)) {
+        cls = GEOMETRY_BLEND;
+      } else if (coverage > COVERAGE_THRESHOLD) {
+        cls = GEOMETRY_SINGLE;
+      }
+    }
+    row[x] = static_cast<A_u_short>((cls << GEOMETRY_CLASS_SHIFT) |
+                                    (MAX(idx, static_cast<A_long>(0)) & GEOMETRY_INDEX_MASK));
+  }
+  return PF_Err_NONE;
+}
+
+/**
+ * Allocate an unclassified map over the layer plus margin.
+ *
+ * @param key Geometry key of the layout, moved into the map
+ * @param margin Pixels beyond the layer on every side
+ * @param map Receives the map (null when it would be too large or
+ *            allocation fails)
+ */
+static void AllocateGeometryMap(GeometryKey &&key, A_long margin,
+                                std::unique_ptr<GeometryMap> &map) {
+  const double cells = static_cast<double>(key.imageWidth + 2 * margin) *
+                       static_cast<double>(key.imageHeight + 2 * margin);
+  if (cells > GEOMETRY_MAX_CELLS) {
+    map.reset();
+    return;
+  }
+  try {
+    map.reset(new GeometryMap());
+    map->width = key.imageWidth + 2 * margin;
+    map->height = key.imageHeight + 2 * margin;
+    map->key = std::move(key);
+    map->left = -margin;
+    map->top = -margin;
+    map->cells.resize(static_cast<size_t>(map->width) * map->height);
+  } catch (const std::bad_alloc &) {
+    map.reset();
+  }
+}
+
+/**
+ * Allocate and classify a map over the layer plus margin.
+ *
+ * @param ctx Render context (layout fields set)
+ * @param suites Suite handler for iterate_generic
+ * @param key Geometry key of the layout, moved into the map
+ * @param margin Pixels beyond the layer on every side
+ * @param map Receives the map (null when it would be too large or
+ *            allocation fails)
+ * @return PF_Err error code
+ */
+static PF_Err BuildGeometryMap(const SliceContext *ctx, AEGP_SuiteHandler &suites,
+                               GeometryKey &&key, A_long margin,
+                               std::unique_ptr<GeometryMap> &map) {
+  PF_Err err = PF_Err_NONE;
+  AllocateGeometryMap(std::move(key), margin, map);
+  if (!map) {
+    return PF_Err_NONE;
+  }
+
+  GeometryBuildContext buildContext;
+  buildContext.slices = ctx;
+  buildContext.cells = map->cells.data();
+  buildContext.left = map->left;
+  buildContext.top = map->top;
+  buildContext.width = map->width;
+  ERR(suites.Iterate8Suite1()->iterate_generic(map->height, &buildContext,
+                                               BuildGeometryRow));
+  if (err) {
+    map.reset();
+  }
+  return err;
+}
+
+/**
+ * Margin beyond the layer for a map that covers an output rectangle: the
+ * given margin, doubled until it is enough.
+ *
+ * @param imageWidth, imageHeight Layer size
+ * @param left, top, width, height Layer-space rectangle of the output
+ * @param margin Smallest margin to use
+ * @return The margin, or 0 when the output reaches beyond MAX_EXPANSION
+ */
+static A_long CoverGeometryMargin(A_long imageWidth, A_long imageHeight, A_long left,
+                                  A_long top, A_long width, A_long height, A_long margin) {
+  const A_long need = MAX(MAX(-left, -top),
+                          MAX(left + width - imageWidth, top + height - imageHeight));
+  while (margin < need) {
+    margin *= 2;
+  }
+  margin = MIN(margin, static_cast<A_long>(MAX_EXPANSION));
+  return (margin < need) ? 0 : margin;
+}
+
+/**
+ * 128-bit hash of a geometry key and margin, naming the map in AE's compute
+ * cache and in the layout cache.
+ *
+ * @param key Geometry key
+ * @param margin Pixels beyond the layer on every side
+ * @param hash Receives the hash
+ */
+static void HashGeometryKey(const GeometryKey &key, A_long margin, A_u_longlong hash[2]) {
+  hash[0] = GEOMETRY_HASH_BASIS;
+  hash[1] = GEOMETRY_HASH_BASIS ^ GEOMETRY_HASH_SALT;
+  auto mix = [hash](const void *data, size_t size) {
+    const A_u_char *bytes = static_cast<const A_u_char *>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash[0] = (hash[0] ^ bytes[i]) * GEOMETRY_HASH_PRIME;
+      hash[1] = (hash[1] ^ bytes[i]) * GEOMETRY_HASH_PRIME + i;
+    }
+  };
+  mix(&key.imageWidth, sizeof(key.imageWidth));
+  mix(&key.imageHeight, sizeof(key.imageHeight));
+  mix(&key.numSlices, sizeof(key.numSlices));
+  mix(&key.centerX, sizeof(key.centerX));
+  mix(&key.centerY, sizeof(key.centerY));
+  mix(&key.angleCos, sizeof(key.angleCos));
+  mix(&key.angleSin, sizeof(key.angleSin));
+  mix(&key.warpMode, sizeof(key.warpMode));
+  mix(&key.warpAmplitude, sizeof(key.warpAmplitude));
+  mix(&key.warpFrequency, sizeof(key.warpFrequency));
+  mix(&key.warpSeed, sizeof(key.warpSeed));
+  mix(&key.warpStart, sizeof(key.warpStart));
+  mix(&key.warpCount, sizeof(key.warpCount));
+  mix(key.bands.data(), key.bands.size() * sizeof(float));
+  mix(&margin, sizeof(margin));
+}
+
+// =============================================================================
+// Layout cache - geometry maps shared between render processes as files
+// =============================================================================
+//
+// Render farm nodes run one process per frame or chunk, each of which would
+// classify the same geometry again. With LAYOUT_CACHE_DIR_ENV set, every map
+// built is also written to that directory, named by the hash of its key and
+// margin, and a process that needs a map it has not built tries the file
+// first. Files are mapped read-only and their cells used in place, so all
+// processes on a machine share one copy in the system file cache. A file is
+// written under a temporary name and renamed into place, so readers never see
+// a partial one; the header repeats the whole key and is checked in full
+// before a file is used. Files are not removed by the plugin.
+
+// Layout cache directory from LAYOUT_CACHE_DIR_ENV, null when there is none
+static const char *ReadLayoutCacheDir() {
+  const char *value = getenv(LAYOUT_CACHE_DIR_ENV);
+  return (value && *value) ? value : nullptr;
+}
+
+static const char *GetLayoutCacheDir() {
+  static const char *const directory = ReadLayoutCacheDir();
+  return directory;
+}
+
+// Header a layout cache file for this key and margin must start with
+static void FillLayoutCacheHeader(const GeometryKey &key, A_long margin,
+                                  LayoutCacheHeader &header) {
+  memset(&header, 0, sizeof(header));
+  header.magic = LAYOUT_CACHE_MAGIC;
+  header.version = LAYOUT_CACHE_VERSION;
+  HashGeometryKey(key, margin, header.hash);
+  header.imageWidth = key.imageWidth;
+  header.imageHeight = key.imageHeight;
+  header.numSlices = key.numSlices;
+  header.centerX = key.centerX;
+  header.centerY = key.centerY;
+  header.angleCos = key.angleCos;
+  header.angleSin = key.angleSin;
+  header.warpMode = key.warpMode;
+  header.warpAmplitude = key.warpAmplitude;
+  header.warpFrequency = key.warpFrequency;
+  header.warpSeed = key.warpSeed;
+  header.warpStart = key.warpStart;
+  header.warpCount = key.warpCount;
+  header.bandCount = static_cast<A_long>(key.bands.size());
+  header.left = -margin;
+  header.top = -margin;
+  header.width = key.imageWidth + 2 * margin;
+  header.height = key.imageHeight + 2 * margin;
+  const A_u_longlong bandsEnd = sizeof(header) + key.bands.size() * sizeof(float);
+  header.cellsOffset = (bandsEnd + LAYOUT_CACHE_ALIGN - 1) / LAYOUT_CACHE_ALIGN * LAYOUT_CACHE_ALIGN;
+  header.fileSize = header.cellsOffset + static_cast<A_u_longlong>(header.width) *
+                                             header.height * sizeof(A_u_short);
+}
+
+static void LayoutCachePath(const LayoutCacheHeader &header, char (&path)[LAYOUT_CACHE_PATH_SIZE]) {
+  snprintf(path, sizeof(path), "%s/geometry-%016llx%016llx.msgeo", GetLayoutCacheDir(),
+           static_cast<unsigned long long>(header.hash[0]),
+           static_cast<unsigned long long>(header.hash[1]));
+}
+
+// Whether the layout cache has a file for this key and margin
+static bool LayoutCacheFileExists(const GeometryKey &key, A_long margin) {
+  if (!GetLayoutCacheDir()) {
+    return false;
+  }
+  LayoutCacheHeader header;
+  char path[LAYOUT_CACHE_PATH_SIZE];
+  FillLayoutCacheHeader(key, margin, header);
+  LayoutCachePath(header, path);
+#ifdef AE_OS_WIN
+  return GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES;
+#else
+  return access(path, R_OK) == 0;
+#endif
+}
+
+// Whether every cell is one BuildGeometryRow can write for this many slices.
+// Cached rows index the segments with cells unchecked, so a damaged or
+// foreign file must not get that far.
+static bool AreGeometryCellsValid(const A_u_short *cells, size_t count, A_long numSlices) {
+  for (size_t i = 0; i < count; i++) {
+    if ((cells[i] >> GEOMETRY_CLASS_SHIFT) > GEOMETRY_BLEND ||
+        (cells[i] & GEOMETRY_INDEX_MASK) >= numSlices) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Map a geometry map from the layout cache. The header and bands must match
+ * the key and every cell must be valid for it, which reads the whole file
+ * once.
+ *
+ * @param key Geometry key of the layout
+ * @param margin Pixels beyond the layer on every side
+ * @param map Receives a map whose cells are read from the file in place;
+ *            left alone when there is no valid file
+ * @return Whether a map was loaded
+ */
+static bool LoadGeometryMapFile(const GeometryKey &key, A_long margin,
+                                std::unique_ptr<GeometryMap> &map) {
+  if (!GetLayoutCacheDir()) {
+    return false;
+  }
+  LayoutCacheHeader header;
+  char path[LAYOUT_CACHE_PATH_SIZE];
+  FillLayoutCacheHeader(key, margin, header);
+  LayoutCachePath(header, path);
+
+  try {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    if (!MapFileReadOnly(path, *file) || file->size != header.fileSize ||
+        memcmp(file->data, &header, sizeof(header)) != 0 ||
+        memcmp(static_cast<const char *>(file->data) + sizeof(header), key.bands.data(),
+               key.bands.size() * sizeof(float)) != 0) {
+      return false;
+    }
+    const A_u_short *cells = reinterpret_cast<const A_u_short *>(
+        static_cast<const char *>(file->data) + header.cellsOffset);
+    if (!AreGeometryCellsValid(cells, static_cast<size_t>(header.width) * header.height,
+                               key.numSlices)) {
+      return false;
+    }
+    std::unique_ptr<GeometryMap> loaded(new GeometryMap());
+    loaded->key = key;
+    loaded->left = header.left;
+    loaded->top = header.top;
+    loaded->width = header.width;
+    loaded->height = header.height;
+    loaded->mapped = cells;
+    loaded->file = std::move(file);
+    map = std::move(loaded);
+  } catch (const std::bad_alloc &) {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Write a geometry map to the layout cache. Called after LoadGeometryMapFile
+ * found no valid file, so a file in the way is replaced. Failures are
+ * ignored: the map is only not shared.
+ *
+ * @param map Classified map
+ */
+static void StoreGeometryMapFile(const GeometryMap &map) {
+  if (!GetLayoutCacheDir() || map.mapped) {
+    return;
+  }
+  LayoutCacheHeader header;
+  char path[LAYOUT_CACHE_PATH_SIZE];
+  char temporary[LAYOUT_CACHE_PATH_SIZE + 64];
+  FillLayoutCacheHeader(map.key, -map.left, header);
+  LayoutCachePath(header, path);
+  TemporaryPath(path, &map, temporary, sizeof(temporary));
+
+  FILE *file = fopen(temporary, "wb");
+  if (!file) {
+    return;
+  }
+  static const char padding[LAYOUT_CACHE_ALIGN] = {0};
+  const size_t bandsSize = map.key.bands.size() * sizeof(float);
+  const size_t cellsSize = map.cells.size() * sizeof(A_u_short);
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && fwrite(map.key.bands.data(), 1, bandsSize, file) == bandsSize;
+  const size_t pad = static_cast<size_t>(header.cellsOffset) - sizeof(header) - bandsSize;
+  ok = ok && fwrite(padding, 1, pad, file) == pad;
+  ok = ok && fwrite(map.cells.data(), 1, cellsSize, file) == cellsSize;
+  ok = (fclose(file) == 0) && ok;
+  if (ok) {
+    ReplaceWithFile(temporary, path);
+  } else {
+    remove(temporary);
+  }
+}
+
+// Compute cache callbacks. The key is HashGeometryKey of the geometry key
+// and margin; the map keeps the full key, checked on every checkout.
+static A_Err GenerateGeometryCacheKey(AEGP_CCComputeOptionsRefconP opaque_optionsP,
+                                      AEGP_CCComputeKeyP out_keyP) {
+  const GeometryComputeOptions *options =
+      static_cast<const GeometryComputeOptions *>(opaque_optionsP);
+  A_u_longlong hash[2];
+  HashGeometryKey(*options->key, options->margin, hash);
+
+  AEFX_CLR_STRUCT(*out_keyP);
+  memcpy(out_keyP, hash, MIN(sizeof(*out_keyP), sizeof(hash)));
+  return A_Err_NONE;
+}
+
+static A_Err ComputeGeometryMap(AEGP_CCComputeOptionsRefconP opaque_optionsP,
+                                AEGP_CCComputeValueRefconP *out_valuePP) {
+  const GeometryComputeOptions *options =
+      static_cast<const GeometryComputeOptions *>(opaque_optionsP);
+  std::unique_ptr<GeometryMap> map;
+  GeometryKey key;
+
+  // A warm-up already built it: the cache takes the map over
+  {
+    std::lock_guard<std::mutex> lock(sGeometryMutex);
+    if (sWarmMap && sWarmMap->left == -options->margin && sWarmMap->key == *options->key) {
+      *out_valuePP = sWarmMap.release();
+      return A_Err_NONE;
+    }
+  }
+
+  // Another render process already built it
+  if (LoadGeometryMapFile(*options->key, options->margin, map)) {
+    *out_valuePP = map.release();
+    return A_Err_NONE;
+  }
+
+  try {
+    key = *options->key;
+  } catch (const std::bad_alloc &) {
+    return A_Err_ALLOC;
+  }
+  // The cache takes A_Err codes: a map too large or out of memory is
+  // A_Err_ALLOC, anything else iterate_generic reports A_Err_GENERIC
+  PF_Err err = BuildGeometryMap(options->ctx, *options->suites, std::move(key),
+                                options->margin, map);
+  if (err == PF_Err_OUT_OF_MEMORY || (!err && !map)) {
+    return A_Err_ALLOC;
+  }
+  if (err) {
+    return A_Err_GENERIC;
+  }
+  StoreGeometryMapFile(*map);
+  *out_valuePP = map.release();
+  *options->built = true;
+  return A_Err_NONE;
+}
+
+static size_t GeometryMapBytes(const GeometryMap &map) {
+  return sizeof(GeometryMap) + map.cells.size() * sizeof(A_u_short) +
+         map.key.bands.size() * sizeof(float);
+}
+
+static size_t ApproxGeometryMapSize(AEGP_CCComputeValueRefconP valueP) {
+  return GeometryMapBytes(*static_cast<const GeometryMap *>(valueP));
+}
+
+static void DeleteGeometryMap(AEGP_CCComputeValueRefconP valueP) {
+  delete static_cast<const GeometryMap *>(valueP);
+}
+
+// Use AE's compute cache for geometry maps when the host has one, unless
+// GEOMETRY_CACHE_ENV turns the geometry cache off
+static void RegisterGeometryCache(PF_InData *in_data) {
+  static const AEGP_ComputeCacheCallbacks callbacks = {
+      GenerateGeometryCacheKey, ComputeGeometryMap, ApproxGeometryMapSize, DeleteGeometryMap};
+  const char *enabled = getenv(GEOMETRY_CACHE_ENV);
+  sGeometryCacheOff = enabled && !strcmp(enabled, "0");
+  const void *suite = nullptr;
+  if (sGeometryCacheOff || sComputeCache || !in_data->pica_basicP ||
+      in_data->pica_basicP->AcquireSuite(kAEGPComputeCacheSuite,
+                                         kAEGPComputeCacheSuiteVersion1, &suite) ||
+      !suite) {
+    return;
+  }
+  const AEGP_ComputeCacheSuite1 *cache = static_cast<const AEGP_ComputeCacheSuite1 *>(suite);
+  if (cache->AEGP_ClassRegister(GEOMETRY_CACHE_CLASS, &callbacks)) {
+    in_data->pica_basicP->ReleaseSuite(kAEGPComputeCacheSuite, kAEGPComputeCacheSuiteVersion1);
+    return;
+  }
+  sComputeCache = cache;
+}
+
+/**
+ * Get a map from AE's compute cache.
+ *
+ * A map already in the cache is always used. Otherwise, like the in-plugin
+ * cache, it is only computed for a key seen on the previous render too,
+ * and only when the frame budget allows it; concurrent renders asking for
+ * the same key wait for that computation.
+ * A map that cannot be computed leaves the frame to render slice rows; the
+ * render reports its own errors (an interrupt included) from those.
+ *
+ * @param options Compute request (key and margin)
+ * @param seenBefore Whether the previous render had the same key
+ * @param mayBuild Whether the frame budget leaves time to compute the map
+ * @param hold Receives the map and its receipt
+ * @return PF_Err error code (always PF_Err_NONE)
+ */
+static PF_Err CheckoutCachedGeometryMap(GeometryComputeOptions &options, bool seenBefore,
+                                        bool mayBuild, GeometryHold &hold) {
+  AEGP_CCCheckoutReceiptP receipt = nullptr;
+  if (sComputeCache->AEGP_CheckoutCached(GEOMETRY_CACHE_CLASS, &options, &receipt)) {
+    receipt = nullptr;
+  }
+  if (!receipt && !seenBefore) {
+    hold.miss = "slice geometry differs from the previous frame";
+    return PF_Err_NONE;
+  }
+  if (!receipt && !mayBuild) {
+    hold.miss = "no time in the frame budget to build the map";
+    return PF_Err_NONE;
+  }
+  if (!receipt) {
+    const A_Err cacheErr = sComputeCache->AEGP_ComputeIfNeededAndCheckout(
+        GEOMETRY_CACHE_CLASS, &options, true, &receipt);
+    if (cacheErr || !receipt) {
+      hold.miss = (cacheErr == A_Err_ALLOC) ? "layer too large for the geometry cache"
+                                            : "geometry map could not be computed";
+      return PF_Err_NONE;
+    }
+  }
+
+  AEGP_CCComputeValueRefconP value = nullptr;
+  const GeometryMap *map = nullptr;
+  if (!sComputeCache->AEGP_GetReceiptComputeValue(receipt, &value)) {
+    map = static_cast<const GeometryMap *>(value);
+  }
+  if (map && map->left == -options.margin && map->key == *options.key) {
+    hold.map = map;
+    hold.receipt = receipt;
+  } else {
+    sComputeCache->AEGP_CheckinComputeReceipt(receipt);
+    hold.miss = "compute cache key collision";
+  }
+  return PF_Err_NONE;
+}
+
+// The in-plugin map for a key, moved to the front; null when there is none.
+// Call with sGeometryMutex held.
+static std::shared_ptr<const GeometryMap> FindGeometryMap(const GeometryKey &key) {
+  for (auto it = sGeometryMaps.begin(); it != sGeometryMaps.end(); ++it) {
+    if ((*it)->key == key) {
+      sGeometryMaps.splice(sGeometryMaps.begin(), sGeometryMaps, it);
+      return sGeometryMaps.front();
+    }
+  }
+  return nullptr;
+}
+
+// Put a map first, replacing one for the same key, and drop the least
+// recently used beyond the limits. Call with sGeometryMutex held.
+static void InsertGeometryMap(const std::shared_ptr<const GeometryMap> &map) {
+  sGeometryMaps.remove_if([&map](const std::shared_ptr<const GeometryMap> &cached) {
+    return cached->key == map->key;
+  });
+  sGeometryMaps.push_front(map);
+  size_t bytes = 0;
+  A_long count = 0;
+  for (auto it = sGeometryMaps.begin(); it != sGeometryMaps.end();) {
+    bytes += GeometryMapBytes(**it);
+    if (count && (count >= GEOMETRY_CACHE_MAPS || bytes > GEOMETRY_CACHE_BYTES)) {
+      it = sGeometryMaps.erase(it);
+    } else {
+      ++it;
+      count++;
+    }
+  }
+}
+
+// Whether an instance's previous render had this key; remembers it for the
+// next. Call with sGeometryMutex held.
+static bool SeenGeometryKey(A_u_long instance, const GeometryKey &key) {
+  try {
+    GeometryKey &lastKey = sGeometryInstances[instance].lastKey;
+    if (lastKey == key) {
+      return true;
+    }
+    try {
+      lastKey = key;
+    } catch (const std::bad_alloc &) {
+      lastKey = GeometryKey();
+    }
+  } catch (const std::bad_alloc &) {
+  }
+  return false;
+}
+
+/**
+ * Get the geometry cache for this frame's untransformed slices.
+ *
+ * Reuses the cached map when the geometry key matches and the map covers
+ * the output. A new map is only built once the instance has seen the same
+ * key on two renders in a row, so a single still frame never pays for it. Maps
+ * cover the layer plus a margin that at least doubles on every rebuild, so
+ * a steadily growing Shift (and buffer) rebuilds only a few times.
+ *
+ * Maps go through AE's compute cache when RegisterGeometryCache found it,
+ * with the margin rounded up to a power of two as part of the key;
+ * otherwise the plugin keeps the most recently used maps itself. While
+ * WarmGeometryCache is building the key the frame goes without a map; a
+ * map it has finished is used as if seen before. A map that is not cached
+ * is not built when the frame budget has no time for it.
+ *
+ * @param ctx Render context (layout fields set)
+ * @param layout Slice layout of this frame
+ * @param suites Suite handler for iterate_generic
+ * @param instance Statistics id of the rendering instance
+ * @param left, top, width, height Layer-space rectangle of the output buffer
+ * @param mayBuild Whether the frame budget leaves time to build a map
+ * @param hold Receives the map, left empty when there is none to use;
+ *             release with ReleaseGeometryMap
+ * @return PF_Err error code
+ */
+static PF_Err AcquireGeometryMap(const SliceContext *ctx, const SliceLayout &layout,
+                                 AEGP_SuiteHandler &suites, A_u_long instance, A_long left,
+                                 A_long top, A_long width, A_long height, bool mayBuild,
+                                 GeometryHold &hold) {
+  PF_Err err = PF_Err_NONE;
+  GeometryKey key;
+  A_long margin = GEOMETRY_MIN_MARGIN;
+  bool seenBefore = false;
+
+  if (sGeometryCacheOff) {
+    hold.miss = "geometry cache turned off";
+    return PF_Err_NONE;
+  }
+  try {
+    BuildGeometryKey(layout, key);
+  } catch (const std::bad_alloc &) {
+    hold.miss = "out of memory";
+    return PF_Err_NONE;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(sGeometryMutex);
+    // A warm-up is still classifying this key: render without a map rather
+    // than wait for it or build the same map again
+    if (sWarmBuilding && sWarmKey == key) {
+      hold.miss = "geometry warm-up still running";
+      return PF_Err_NONE;
+    }
+    std::shared_ptr<const GeometryMap> cached = sComputeCache ? nullptr : FindGeometryMap(key);
+    if (cached) {
+      if (left >= cached->left && top >= cached->top &&
+          left + width <= cached->left + cached->width &&
+          top + height <= cached->top + cached->height) {
+        hold.map = cached.get();
+        hold.shared = std::move(cached);
+        return PF_Err_NONE;
+      }
+      margin = MAX(margin, 2 * (-cached->left));
+    }
+    seenBefore = SeenGeometryKey(instance, key);
+    if (!seenBefore) {
+      if (!sComputeCache && !GetLayoutCacheDir()) {
+        hold.miss = "slice geometry differs from the previous frame";
+        return PF_Err_NONE;
+      }
+    }
+    // A warmed-up map goes into the compute cache on its first render, at
+    // no cost to the frame
+    if (sWarmMap && sWarmMap->key == key) {
+      seenBefore = true;
+      mayBuild = true;
+    }
+  }
+
+  // Margin beyond the layer, enough for this output
+  margin = CoverGeometryMargin(layout.imageWidth, layout.imageHeight, left, top, width, height,
+                               margin);
+  if (!margin) {
+    hold.miss = "output reaches beyond the largest cached margin";
+    return PF_Err_NONE;
+  }
+
+  // A map in the layout cache is used as if seen before
+  if (sComputeCache) {
+    GeometryComputeOptions options = {ctx, &suites, &key, margin, &hold.built};
+    return CheckoutCachedGeometryMap(options, seenBefore || LayoutCacheFileExists(key, margin),
+                                     mayBuild, hold);
+  }
+
+  std::unique_ptr<GeometryMap> built;
+  const bool loaded = LoadGeometryMapFile(key, margin, built);
+  if (!loaded && !seenBefore) {
+    hold.miss = "slice geometry differs from the previous frame";
+    return PF_Err_NONE;
+  }
+  if (!loaded && !mayBuild) {
+    hold.miss = "no time in the frame budget to build the map";
+    return PF_Err_NONE;
+  }
+  if (!loaded) {
+    err = BuildGeometryMap(ctx, suites, std::move(key), margin, built);
+    if (!err && built) {
+      StoreGeometryMapFile(*built);
+    }
+  }
+  if (!err && built) {
+    std::shared_ptr<const GeometryMap> shared;
+    try {
+      shared.reset(built.release());
+    } catch (const std::bad_alloc &) {
+      return PF_Err_NONE;
+    }
+    std::lock_guard<std::mutex> lock(sGeometryMutex);
+    try {
+      InsertGeometryMap(shared);
+    } catch (const std::bad_alloc &) {
+      // Used by this render only
+    }
+    hold.shared = shared;
+    hold.map = shared.get();
+    hold.built = !loaded;
+  } else if (!err) {
+    hold.miss = "layer too large for the geometry cache";
+  }
+  return err;
+}
+
+// Give back the map a render used
+static void ReleaseGeometryMap(GeometryHold &hold) {
+  if (hold.receipt) {
+    sComputeCache->AEGP_CheckinComputeReceipt(hold.receipt);
+    hold.receipt = nullptr;
+  }
+  hold.shared.reset();
+  hold.map = nullptr;
+  hold.built = false;
+  hold.miss = nullptr;
+}
+
+// Stop a running warm-up at its next row, without waiting for it
+static void CancelGeometryWarmup() {
+  sWarmGeneration++;
+}
+
+// Join the warm-up threads that have finished, or all of them (setdown,
+// after cancelling)
+static void JoinGeometryWarmups(bool all) {
+  for (auto it = sWarmThreads.begin(); it != sWarmThreads.end();) {
+    if (all || *it->finished) {
+      it->thread.join();
+      it = sWarmThreads.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Remember the layer and output of an instance's render that tried the cache
+static void RememberGeometryShape(PF_InData *in_data, A_u_long instance,
+                                  const SliceLayout &layout, A_long left, A_long top,
+                                  A_long width, A_long height) {
+  GeometryShape shape;
+  shape.valid = true;
+  shape.layerMaps = layout.layerMaps;
+  shape.imageWidth = layout.imageWidth;
+  shape.imageHeight = layout.imageHeight;
+  shape.downscaleX = GetDownscaleFactor(in_data->downsample_x);
+  shape.downscaleY = GetDownscaleFactor(in_data->downsample_y);
+  shape.pixelAspect = layout.pixelAspect;
+  shape.left = left;
+  shape.top = top;
+  shape.width = width;
+  shape.height = height;
+  std::lock_guard<std::mutex> lock(sGeometryMutex);
+  try {
+    sGeometryInstances[instance].shape = shape;
+  } catch (const std::bad_alloc &) {
+    // No warm-up for this instance until a later render
+  }
+}
+
+// Forget an instance's last key (sequence setdown)
+static void ForgetGeometryInstance(A_u_long instance) {
+  std::lock_guard<std::mutex> lock(sGeometryMutex);
+  sGeometryInstances.erase(instance);
+}
+
+// Drop the geometry cache (global setdown)
+static void ReleaseGeometryCache(PF_InData *in_data) {
+  CancelGeometryWarmup();
+  JoinGeometryWarmups(true);
+  std::lock_guard<std::mutex> lock(sGeometryMutex);
+  sGeometryMaps.clear();
+  sGeometryInstances.clear();
+  sWarmMap.reset();
+  sWarmKey = GeometryKey();
+  if (sComputeCache) {
+    sComputeCache->AEGP_ClassUnregister(GEOMETRY_CACHE_CLASS);
+    in_data->pica_basicP->ReleaseSuite(kAEGPComputeCacheSuite, kAEGPComputeCacheSuiteVersion1);
+    sComputeCache = nullptr;
+  }
+}
+
+/**
+ * Render one output row of untransformed slices from the geometry cache.
+ *
+ * Pixels covered by a single slice are its shifted sample, with no
+ * rotation or slice search; empty pixels are zero; only feathered edges
+ * run ProcessMultiSliceT. The output is identical to RenderSliceRowT.
+ *
+ * Called through iterate_generic with one iteration per output row.
+ *
+ * @param refcon Pointer to SliceContext (geometry and dst* must be set)
+ * @param thread_index Worker thread index (unused)
+ * @param y Output row to render
+ * @param iterations Total number of rows (unused)
+ * @return PF_Err error code (always PF_Err_NONE)
+ */
+template <typename PixelType, typename ChannelType, ChannelType MaxChannel,
+          PixelType (*SampleFunc)(float, float, const SliceSource *)>
+static PF_Err RenderCachedRowT(void *refcon, A_long thread_index, A_long y,
+                               A_long iterations) {
+  (void)thread_index;
+  (void)iterations;
+  SliceContext *ctx = reinterpret_cast<SliceContext *>(refcon);
+  PixelType *outRow = PixelRow<PixelType>(ctx->dstData, ctx->dstRowbytes, y);
+  const A_u_short *cells = ctx->geometry + static_cast<ptrdiff_t>(y) * ctx->geometryStride;
+  const float worldY = static_cast<float>(y) - ctx->output_origin_y;
+
+  for (A_long x = 0; x < ctx->dstWidth; ++x) {
+    const A_long cls = cells[x] >> GEOMETRY_CLASS_SHIFT;
+    if (cls == GEOMETRY_SINGLE) {
+      float srcX = 0.0f, srcY = 0.0f;
+      const SliceSegment &seg = ctx->segments[cells[x] & GEOMETRY_INDEX_MASK];
+      ComputeShiftedSourceCoords(ctx, seg, static_cast<float>(x) - ctx->output_origin_x,
+                                 worldY, srcX, srcY);
+      outRow[x] = SampleFunc(srcX, srcY, &ctx->sources[seg.source]);
+    } else if (cls == GEOMETRY_BLEND) {
+      ProcessMultiSliceT<PixelType, ChannelType, MaxChannel, SampleFunc>(
+          ctx, x, y, nullptr, &outRow[x]);
+    } else {
+      outRow[x].alpha = outRow[x].red = outRow[x].green = outRow[x].blue = 0;
+    }
+  }
+
+  return PF_Err_NONE;
+}
+
+static PF_Err CachedRow8Callback(void *refcon, A_long thread_index, A_long y, A_long iterations) {
+  return RenderCachedRowT<PF_Pixel, A_u_char, 255, SampleSourcePixel8>(refcon, thread_index, y, iterations);
+}
+
+static PF_Err CachedRow16Callback(void *refcon, A_long thread_index, A_long y, A_long iterations) {
+  return RenderCachedRowT<PF_Pixel16, A_u_short, PF_MAX_CHAN16, SampleSourcePixel16>(refcon, thread_index, y, iterations);
+}
+
+// =============================================================================
+// Output Scale - area-filtered rendering below 100%
+// =============================================================================
+
+/**
+ * Render output rows below 100% Output Scale.
+ *
+ * Each output pixel is the box average of factor x factor subsamples spread
+ * evenly over its footprint in the layer, so a smaller delivery size comes
+ * straight from the full-resolution layer without an intermediate frame.
+ * The subsample rows of one output row are rendered by the usual row
+ * renderer into per-call scratch, through a copy of the context whose
+ * origin and pixel scale address the subsample grid.
+ *
+ * Called through iterate_generic with PF_Iterations_ONCE_PER_PROCESSOR;
+ * each call takes every iterations-th output row.
+ *
+ * @param refcon Pointer to ResampleContext
+ * @param thread_index Worker thread index (passed on to the row renderer)
+ * @param i Index of this call
+ * @param iterations Number of calls
+ * @return PF_Err error code
+ */
+template <typename PixelType, typename ChannelType>
+static PF_Err ResampleRowsT(void *refcon, A_long thread_index, A_long i,
+                            A_long iterations) {
+  PF_Err err = PF_Err_NONE;
+  const ResampleContext *rc = reinterpret_cast<const ResampleContext *>(refcon);
+  const SliceContext *ctx = rc->slices;
+  const A_long factor = rc->factor;
+  const ptrdiff_t subRowbytes =
+      static_cast<ptrdiff_t>(ctx->dstWidth) * factor * sizeof(PixelType);
+
+  // Per-call scratch: the factor subsample rows of one output row
+  PF_Handle scratchHandle = rc->handleSuite->host_new_handle(factor * subRowbytes);
+  if (!scratchHandle || !*scratchHandle) {
+    if (scratchHandle) {
+      rc->handleSuite->host_dispose_handle(scratchHandle);
+    }
+    return PF_Err_OUT_OF_MEMORY;
+  }
+
+  // Subsample (x * factor + k) sits (k + 0.5) / factor - 0.5 output pixels
+  // from the center of output pixel x, on both axes
+  SliceContext sub = *ctx;
+  sub.dstData = *scratchHandle;
+  sub.dstRowbytes = subRowbytes;
+  sub.dstWidth = ctx->dstWidth * factor;
+  sub.pixelScale = ctx->pixelScale / factor;
+  sub.output_origin_x = ctx->output_origin_x * factor + (factor - 1) * 0.5f;
+  const float subOriginY = ctx->output_origin_y * factor + (factor - 1) * 0.5f;
+  const float norm = 1.0f / static_cast<float>(factor * factor);
+
+  for (A_long y = i; y < rc->height && !err; y += iterations) {
+    // Subsample rows y * factor + k are rendered into scratch row k
+    sub.output_origin_y = subOriginY - static_cast<float>(y * factor);
+    for (A_long k = 0; k < factor && !err; k++) {
+      err = rc->renderRow(&sub, thread_index, k, factor);
+    }
+
+    PixelType *outRow = PixelRow<PixelType>(ctx->dstData, ctx->dstRowbytes, y);
+    for (A_long x = 0; x < ctx->dstWidth && !err; x++) {
+      float red = 0.0f, green = 0.0f, blue = 0.0f, alpha = 0.0f;
+      for (A_long k = 0; k < factor; k++) {
+        const PixelType *subRow = PixelRow<PixelType>(sub.dstData, subRowbytes, k) + x * factor;
+        for (A_long j = 0; j < factor; j++) {
+          red += subRow[j].red;
+          green += subRow[j].green;
+          blue += subRow[j].blue;
+          alpha += subRow[j].alpha;
+        }
+      }
+      outRow[x].red = static_cast<ChannelType>(red * norm + 0.5f);
+      outRow[x].green = static_cast<ChannelType>(green * norm + 0.5f);
+      outRow[x].blue = static_cast<ChannelType>(blue * norm + 0.5f);
+      outRow[x].alpha = static_cast<ChannelType>(alpha * norm + 0.5f);
+    }
+  }
+
+  rc->handleSuite->host_dispose_handle(scratchHandle);
+  return err;
+}
+
+static PF_Err ResampleRows8Callback(void *refcon, A_long thread_index, A_long i, A_long iterations) {
+  return ResampleRowsT<PF_Pixel, A_u_char>(refcon, thread_index, i, iterations);
+}
+
+static PF_Err ResampleRows16Callback(void *refcon, A_long thread_index, A_long i, A_long iterations) {
+  return ResampleRowsT<PF_Pixel16, A_u_short>(refcon, thread_index, i, iterations);
+}
+
+// =============================================================================
+// Frame budget - half-resolution rendering
+// =============================================================================
+
+/**
+ * Render output rows at reduced resolution.
+ *
+ * Every step x step block of output pixels gets one sample, taken at the
+ * block's center by the usual row renderer into per-call scratch, through
+ * a copy of the context whose origin and pixel scale address the coarse
+ * grid (as ResampleRowsT does for the fine one). Used when a frame would
+ * miss its budget at full resolution.
+ *
+ * Called through iterate_generic with PF_Iterations_ONCE_PER_PROCESSOR;
+ * each call takes every iterations-th coarse row.
+ *
+ * @param refcon Pointer to ReducedContext
+ * @param thread_index Worker thread index (passed on to the row renderer)
+ * @param i Index of this call
+ * @param iterations Number of calls
+ * @return PF_Err error code
+ */
+template <typename PixelType>
+static PF_Err ReducedRowsT(void *refcon, A_long thread_index, A_long i, A_long iterations) {
+  PF_Err err = PF_Err_NONE;
+  const ReducedContext *rc = reinterpret_cast<const ReducedContext *>(refcon);
+  const SliceContext *ctx = rc->slices;
+  const A_long step = rc->step;
+  const A_long coarseWidth = (ctx->dstWidth + step - 1) / step;
+  const A_long coarseHeight = (rc->height + step - 1) / step;
+
+  PF_Handle scratchHandle = rc->handleSuite->host_new_handle(coarseWidth * sizeof(PixelType));
+  if (!scratchHandle || !*scratchHandle) {
+    if (scratchHandle) {
+      rc->handleSuite->host_dispose_handle(scratchHandle);
+    }
+    return PF_Err_OUT_OF_MEMORY;
+  }
+
+  // Coarse pixel c sits at the center of output pixels c * step .. c * step
+  // + step - 1, on both axes
+  SliceContext coarse = *ctx;
+  coarse.dstData = *scratchHandle;
+  coarse.dstRowbytes = coarseWidth * sizeof(PixelType);
+  coarse.dstWidth = coarseWidth;
+  coarse.pixelScale = ctx->pixelScale * step;
+  coarse.output_origin_x = (ctx->output_origin_x - (step - 1) * 0.5f) / step;
+  const float coarseOriginY = (ctx->output_origin_y - (step - 1) * 0.5f) / step;
+
+  const PixelType *samples = reinterpret_cast<const PixelType *>(*scratchHandle);
+  for (A_long c = i; c < coarseHeight && !err; c += iterations) {
+    coarse.output_origin_y = coarseOriginY - static_cast<float>(c);
+    err = rc->renderRow(&coarse, thread_index, 0, 1);
+
+    const A_long lastRow = MIN((c + 1) * step, rc->height);
+    for (A_long y = c * step; y < lastRow && !err; y++) {
+      PixelType *outRow = PixelRow<PixelType>(ctx->dstData, ctx->dstRowbytes, y);
+      for (A_long x = 0; x < ctx->dstWidth; x++) {
+        outRow[x] = samples[x / step];
+      }
+    }
+  }
+
+  rc->handleSuite->host_dispose_handle(scratchHandle);
+  return err;
+}
+
+static PF_Err ReducedRows8Callback(void *refcon, A_long thread_index, A_long i, A_long iterations) {
+  return ReducedRowsT<PF_Pixel8>(refcon, thread_index, i, iterations);
+}
+
+static PF_Err ReducedRows16Callback(void *refcon, A_long thread_index, A_long i, A_long iterations) {
+  return ReducedRowsT<PF_Pixel16>(refcon, thread_index, i, iterations);
+}
+
+// =============================================================================
+// Pixel sort - segmented radix sort along the slices, after rendering
+// =============================================================================
+
+/**
+ * Sort a run of indices by 16-bit keys.
+ *
+ * Least-significant-digit radix sort with PIXEL_SORT_RADIX_BITS per pass
+ * (one pass for 8-bit keys, two for 16-bit keys); short runs use insertion
+ * sort, which is faster below PIXEL_SORT_MIN_RADIX_RUN. Both are stable, so
+ * equal keys keep their order along the line.
+ *
+ * @param keys Sort keys indexed by line position
+ * @param order In/out run of line positions (size count)
+ * @param temp Scratch array (size count)
+ * @param count Number of positions in the run
+ * @param passes Number of radix passes (key bits / PIXEL_SORT_RADIX_BITS)
+ */
+static void RadixSortRun(const A_u_short *keys, A_long *order, A_long *temp,
+                         A_long count, int passes) {
+  if (count < PIXEL_SORT_MIN_RADIX_RUN) {
+    for (A_long i = 1; i < count; i++) {
+      A_long current = order[i];
+      A_long j = i - 1;
+      while (j >= 0 && keys[order[j]] > keys[current]) {
+        order[j + 1] = order[j];
+        j--;
+      }
+      order[j + 1] = current;
+    }
+    return;
+  }
+
+  A_long *src = order;
+  A_long *dst = temp;
+  for (int pass = 0; pass < passes; pass++) {
+    const int shift = pass * PIXEL_SORT_RADIX_BITS;
+    A_long offsets[PIXEL_SORT_RADIX_BUCKETS + 1] = {0};
+
+    for (A_long i = 0; i < count; i++) {
+      offsets[((keys[src[i]] >> shift) & (PIXEL_SORT_RADIX_BUCKETS - 1)) + 1]++;
+    }
+    for (int b = 0; b < PIXEL_SORT_RADIX_BUCKETS; b++) {
+      offsets[b + 1] += offsets[b];
+    }
+    for (A_long i = 0; i < count; i++) {
+      dst[offsets[(keys[src[i]] >> shift) & (PIXEL_SORT_RADIX_BUCKETS - 1)]++] = src[i];
+    }
+
+    A_long *swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  if (src != order) {
+    for (A_long i = 0; i < count; i++) {
+      order[i] = src[i];
+    }
+  }
+}
+
+/**
+ * Hue of an RGB color in [0, 1).
+ */
+static inline float ComputeHue(float r, float g, float b) {
+  float maxV = MAX(r, MAX(g, b));
+  float minV = MIN(r, MIN(g, b));
+  float delta = maxV - minV;
+  if (delta <= 0.0f) {
+    return 0.0f;
+  }
+
+  float hue;
+  if (maxV == r) {
+    hue = (g - b) / delta;
+    if (hue < 0.0f) {
+      hue += 6.0f;
+    }
+  } else if (maxV == g) {
+    hue = (b - r) / delta + 2.0f;
+  } else {
+    hue = (r - g) / delta + 4.0f;
+  }
+  return MIN(hue / 6.0f, 1.0f);
+}
+
+/**
+ * Slice index of an output pixel in the (untransformed) slice partition.
+ */
+static inline A_long SliceIndexAt(const SliceContext *ctx, A_long x, A_long y) {
+  float sliceX = (static_cast<float>(x) - ctx->output_origin_x) * ctx->pixelScale;
+  float sliceY = (static_cast<float>(y) - ctx->output_origin_y) * ctx->pixelScale;
+  RotatePoint(ctx->centerX, ctx->centerY, sliceX, sliceY, ctx->angleCos,
+              -ctx->angleSin);
+  if (ctx->warp) {
+    sliceX += SampleEdgeWarp(ctx, sliceY);
+  }
+  return FindSliceIndex(ctx, sliceX);
+}
+
+// Output pixel at step t of a pixel sort line
+static inline void SortLinePixel(const PixelSortContext *sc, A_long line,
+                                 A_long t, A_long &x, A_long &y) {
+  A_long minor = line + static_cast<A_long>(floorf(t * sc->slope + 0.5f));
+  x = sc->yMajor ? minor : t;
+  y = sc->yMajor ? t : minor;
+}
+
+/**
+ * Sort pixels along the slices, one processor's share of lines at a time.
+ *
+ * Each line is split into segments: maximal runs of pixels that lie in the
+ * same slice, are not transparent and whose (straight) luminance is at
+ * least the threshold. Every segment is sorted independently by its 8- or
+ * 16-bit key (luminance or hue) with RadixSortRun, then written back in
+ * place. Lines never share pixels, so processors need no synchronization.
+ *
+ * Called through iterate_generic with PF_Iterations_ONCE_PER_PROCESSOR;
+ * call i handles lines i, i + iterations, ...
+ *
+ * @param refcon Pointer to PixelSortContext
+ * @param thread_index Worker thread index (unused)
+ * @param i Index of this call
+ * @param iterations Number of calls (processors)
+ * @return PF_Err error code
+ */
+template <typename PixelType, A_long KeyMax>
+static PF_Err SortLinesT(void *refcon, A_long thread_index, A_long i,
+                         A_long iterations) {
+  (void)thread_index;
+  const PixelSortContext *sc = reinterpret_cast<const PixelSortContext *>(refcon);
+  const SliceContext *ctx = sc->slices;
+  const A_long len = sc->lineLength;
+  const int passes = (KeyMax > 0xFF) ? 2 : 1;
+
+  // Per-call scratch: pixels, slice ids, order, temp, keys
+  PF_Handle scratchHandle = sc->handleSuite->host_new_handle(
+      len * (sizeof(PixelType) + 3 * sizeof(A_long) + sizeof(A_u_short)));
+  if (!scratchHandle || !*scratchHandle) {
+    if (scratchHandle) {
+      sc->handleSuite->host_dispose_handle(scratchHandle);
+    }
+    return PF_Err_OUT_OF_MEMORY;
+  }
+  PixelType *pixels = *reinterpret_cast<PixelType **>(scratchHandle);
+  A_long *segmentIds = reinterpret_cast<A_long *>(pixels + len);
+  A_long *order = segmentIds + len;
+  A_long *temp = order + len;
+  A_u_short *keys = reinterpret_cast<A_u_short *>(temp + len);
+
+  for (A_long line = i; line < sc->numLines; line += iterations) {
+    const A_long lineOffset = sc->firstLine + line;
+
+    // Gather the line and compute keys and segment ids
+    for (A_long t = 0; t < len; t++) {
+      A_long x = 0, y = 0;
+      SortLinePixel(sc, lineOffset, t, x, y);
+      segmentIds[t] = -1;
+      if (x < 0 || x >= sc->width || y < 0 || y >= sc->height) {
+        continue;
+      }
+      const PixelType *row = PixelRow<PixelType>(ctx->dstData, ctx->dstRowbytes, y);
+      const PixelType &p = row[x];
+      pixels[t] = p;
+      if (p.alpha == 0) {
+        continue;
+      }
+
+      // Straight (unpremultiplied) color for threshold and keys
+      const float unpremult = 1.0f / static_cast<float>(p.alpha);
+      float r = MIN(p.red * unpremult, 1.0f);
+      float g = MIN(p.green * unpremult, 1.0f);
+      float b = MIN(p.blue * unpremult, 1.0f);
+      float luma = LUMA_WEIGHT_R * r + LUMA_WEIGHT_G * g + LUMA_WEIGHT_B * b;
+      if (luma < sc->threshold) {
+        continue;
+      }
+
+      float key = (sc->mode == PIXEL_SORT_HUE) ? ComputeHue(r, g, b) : luma;
+      A_long keyValue = static_cast<A_long>(key * KeyMax + 0.5f);
+      keyValue = CLAMP(keyValue, static_cast<A_long>(0), static_cast<A_long>(KeyMax));
+      keys[t] = static_cast<A_u_short>(sc->descending ? KeyMax - keyValue : keyValue);
+      segmentIds[t] = SliceIndexAt(ctx, x, y);
+    }
+
+    // Sort each segment and scatter it back along the line
+    A_long start = 0;
+    while (start < len) {
+      if (segmentIds[start] < 0) {
+        start++;
+        continue;
+      }
+      A_long end = start + 1;
+      while (end < len && segmentIds[end] == segmentIds[start]) {
+        end++;
+      }
+
+      A_long count = end - start;
+      if (count > 1) {
+        for (A_long j = 0; j < count; j++) {
+          order[j] = start + j;
+        }
+        RadixSortRun(keys, order, temp, count, passes);
+
+        for (A_long j = 0; j < count; j++) {
+          A_long x = 0, y = 0;
+          SortLinePixel(sc, lineOffset, start + j, x, y);
+          PixelType *row = PixelRow<PixelType>(ctx->dstData, ctx->dstRowbytes, y);
+          row[x] = pixels[order[j]];
+        }
+      }
+      start = end;
+    }
+  }
+
+  sc->handleSuite->host_dispose_handle(scratchHandle);
+  return PF_Err_NONE;
+}
+
+static PF_Err SortLines8Callback(void *refcon, A_long thread_index, A_long i, A_long iterations) {
+  return SortLinesT<PF_Pixel, 0xFF>(refcon, thread_index, i, iterations);
+}
+
+static PF_Err SortLines16Callback(void *refcon, A_long thread_index, A_long i, A_long iterations) {
+  return SortLinesT<PF_Pixel16, 0xFFFF>(refcon, thread_index, i, iterations);
+}
+
+// =============================================================================
+// Division points calculation - extracted from Render for modularity
+// =============================================================================
+
+/**
+ * Calculate division points that define slice boundaries.
+ *
+ * Creates randomized but ordered division points across the slice length:
+ * 1. Sets first and last points at slice boundaries
+ * 2. Distributes remaining points with average spacing
+ * 3. Applies random offsets for visual variety (70% get 20-90% spacing, 30% get 100-180%)
+ * 4. Sorts using insertion sort (optimal for small arrays)
+ * 5. Enforces minimum spacing (5% of average) to prevent overlap
+ * 6. Scales to fit full range if needed (prevents compression at edges)
+ *
+ * @param seed Random seed for consistent patterns
+ * @param numSlices Number of slices to create
+ * @param sliceLength Total length of slice space
+ * @param divPoints Output array of size (numSlices + 1) for division points
+ */
+static void CalculateDivisionPoints(A_long seed, A_long numSlices, float sliceLength, float *divPoints) {
+  // Set first and last division points at slice boundaries
+  divPoints[0] = -sliceLength / 2.0f;
+  divPoints[numSlices] = sliceLength / 2.0f;
+
+  // Calculate baseline random offset for organic feel
+  float baselineOffset = (GetRandomValue(seed, SEARCH_HASH_BASE1) - RANDOM_ROUND_THRESHOLD) * sliceLength * SEARCH_LENGTH_MARGIN;
+  float avgSpacing = sliceLength / numSlices;
+
+  if (numSlices > 1) {
+    // Initial even distribution
+    for (A_long i = 1; i < numSlices; i++) {
+      divPoints[i] = divPoints[0] + (i * avgSpacing);
+    }
+
+    // Apply random offsets for visual variety
+    // Distribution: 70% get 20-90% spacing, 30% get 100-180% spacing
+    for (A_long i = 1; i < numSlices; i++) {
+      float baseRandom = GetRandomValue(seed, i * DIV_BASE_RANDOM_INDEX1 + DIV_BASE_RANDOM_INDEX2);
+      float randomFactor;
+      if (baseRandom < DIV_RANDOM_THRESHOLD_1) {
+        randomFactor = DIV_RANDOM_FACTOR_LOW + (baseRandom / DIV_RANDOM_THRESHOLD_1) * DIV_RANDOM_THRESHOLD_1;
+      } else {
+        randomFactor = DIV_RANDOM_FACTOR_HIGH + ((baseRandom - DIV_RANDOM_THRESHOLD_1) / DIV_RANDOM_THRESHOLD_2) * DIV_RANDOM_FACTOR_MAX;
+      }
+
+      float offset = (randomFactor - DIV_RANDOM_FACTOR_HIGH) * avgSpacing;
+      divPoints[i] += offset + baselineOffset;
+    }
+
+    // Sort division points (insertion sort - small array, good cache locality)
+    for (A_long i = 1; i < numSlices; i++) {
+      float key = divPoints[i];
+      A_long j = i - 1;
+      while (j >= 0 && divPoints[j] > key) {
+        divPoints[j + 1] = divPoints[j];
+        j--;
+      }
+      divPoints[j + 1] = key;
+    }
+
+    // Enforce minimum spacing to prevent overlapping slices
+    float minSpacing = avgSpacing * DIV_MIN_SPACING_RATIO;
+    for (A_long i = 1; i < numSlices; i++) {
+      if (divPoints[i] < divPoints[i - 1] + minSpacing) {
+        divPoints[i] = divPoints[i - 1] + minSpacing;
+      }
+    }
+
+    // Scale to fit full range if needed (prevents compression at edges)
+    if (divPoints[numSlices - 1] < divPoints[numSlices] - minSpacing) {
+      float actualRange = divPoints[numSlices - 1] - divPoints[0];
+      float targetRange = divPoints[numSlices] - divPoints[0];
+
+      if (actualRange > DIV_RANGE_CHECK_THRESHOLD) {
+        // Proportional scaling
+        for (A_long i = 1; i < numSlices; i++) {
+          float relativePos = (divPoints[i] - divPoints[0]) / actualRange;
+          divPoints[i] = divPoints[0] + relativePos * targetRange;
+        }
+      } else {
+        // Fallback to even distribution
+        for (A_long i = 1; i < numSlices; i++) {
+          divPoints[i] = divPoints[0] + (i * targetRange / numSlices);
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Initialize slice segment metadata from division points.
+ *
+ * For each slice, calculates:
+ * - Boundaries (sliceStart, sliceEnd) from division points
+ * - Visible region (visibleStart, visibleEnd) based on width parameter
+ *   (controls how much of each slice is displayed)
+ * - Random shift direction (perpendicular to slice direction)
+ * - Random shift magnitude (affects how far slices move)
+ * - Random shatter response: velocity direction and speed factor, spin
+ *   factor and gravity factor (unitless; scaled by the Shatter parameters)
+ *
+ * @param seed Random seed for consistent patterns
+ * @param numSlices Number of slices to initialize
+ * @param width Width parameter (0.0-1.0) for visible portion
+ * @param shiftDirection Global shift direction (1.0 or -1.0)
+ * @param divPoints Array of division points (size numSlices + 1)
+ * @param segments Output array of SliceSegment structures (size numSlices)
+ */
+static void InitializeSliceSegments(A_long seed, A_long numSlices, float width,
+                                     float shiftDirection, const float *divPoints,
+                                     SliceSegment *segments) {
+  for (A_long i = 0; i < numSlices; i++) {
+    SliceSegment &segment = segments[i];
+
+    // Set slice boundaries from division points
+    segment.sliceStart = divPoints[i];
+    segment.sliceEnd = divPoints[i + 1];
+    float sliceWidth = segment.sliceEnd - segment.sliceStart;
+    float sliceCenter = segment.sliceStart + (sliceWidth * 0.5f);
+
+    // Calculate visible region based on width parameter
+    float halfVisible = MAX(0.0f, sliceWidth * width * 0.5f);
+    segment.visibleStart = sliceCenter - halfVisible;
+    segment.visibleEnd = sliceCenter + halfVisible;
+
+    // Generate random shift properties
+    A_long dirSeed = (seed * DIR_SEED_MULT + i * DIR_SEED_OFFSET) & 0x7FFF;
+    A_long factorSeed = (seed * FACTOR_SEED_MULT + i * FACTOR_SEED_OFFSET) & 0x7FFF;
+    float randomDir = (GetRandomValue(dirSeed, 0) > 0.5f) ? 1.0f : -1.0f;
+    float randomShiftFactor = DEFAULT_FEATHER + GetRandomValue(factorSeed, 0) * MAX_RANDOM_SHIFT_FACTOR;
+
+    segment.shiftDirection = shiftDirection * randomDir;
+    segment.shiftRandomFactor = randomShiftFactor;
+
+    // Generate random shatter response
+    A_long angleSeed = (seed * SHATTER_ANGLE_SEED_MULT + i * SHATTER_ANGLE_SEED_OFFSET) & 0x7FFF;
+    A_long speedSeed = (seed * SHATTER_SPEED_SEED_MULT + i * SHATTER_SPEED_SEED_OFFSET) & 0x7FFF;
+    A_long spinSeed = (seed * SHATTER_SPIN_SEED_MULT + i * SHATTER_SPIN_SEED_OFFSET) & 0x7FFF;
+    A_long gravitySeed = (seed * SHATTER_GRAVITY_SEED_MULT + i * SHATTER_GRAVITY_SEED_OFFSET) & 0x7FFF;
+    float velocityAngle = GetRandomValue(angleSeed, 0) * 2.0f * static_cast<float>(PF_PI);
+    float speedFactor = SHATTER_RANDOM_MIN + GetRandomValue(speedSeed, 0);
+
+    segment.velocityX = cosf(velocityAngle) * speedFactor;
+    segment.velocityY = sinf(velocityAngle) * speedFactor;
+    segment.spinFactor = GetRandomValue(spinSeed, 0) * 2.0f - 1.0f;
+    segment.gravityFactor = SHATTER_RANDOM_MIN + GetRandomValue(gravitySeed, 0);
+
+    // Every slice draws from the Input until AssignSliceSources says otherwise
+    segment.source = 0;
+  }
+}
+
+// =============================================================================
+// Shift map - per-slice shift scaling, sampled once per slice during layout
+// =============================================================================
+
+/**
+ * Read the alpha-weighted luminance of a map layer pixel.
+ *
+ * Nearest neighbor lookup like SampleSourcePixel8/16; coordinates outside
+ * the map read as 0 (fully transparent).
+ *
+ * @param map Checked-out map layer (8-bit or 16-bit)
+ * @param mapX X coordinate in map pixels
+ * @param mapY Y coordinate in map pixels
+ * @return Luminance in range [0.0, 1.0]
+ */
+static float SampleMapLuminance(const PF_LayerDef *map, float mapX, float mapY) {
+  A_long x = static_cast<A_long>(mapX + SAMPLE_ROUND_OFFSET);
+  A_long y = static_cast<A_long>(mapY + SAMPLE_ROUND_OFFSET);
+
+  if (x < 0 || x >= map->width || y < 0 || y >= map->height) {
+    return 0.0f;
+  }
+
+  float r, g, b, a, maxC;
+  if (PF_WORLD_IS_DEEP(map)) {
+    const PF_Pixel16 *p = PixelRow<PF_Pixel16>(map->data, map->rowbytes, y) + x;
+    r = p->red; g = p->green; b = p->blue; a = p->alpha;
+    maxC = static_cast<float>(PF_MAX_CHAN16);
+  } else {
+    const PF_Pixel *p = PixelRow<PF_Pixel>(map->data, map->rowbytes, y) + x;
+    r = p->red; g = p->green; b = p->blue; a = p->alpha;
+    maxC = 255.0f;
+  }
+
+  float luma = (LUMA_WEIGHT_R * r + LUMA_WEIGHT_G * g + LUMA_WEIGHT_B * b) / maxC;
+  return CLAMP(luma * (a / maxC), 0.0f, 1.0f);
+}
+
+/**
+ * Clip a parametric line (base + t * dir) to the rectangle [0,maxX]x[0,maxY].
+ *
+ * Liang-Barsky clipping against both axes.
+ *
+ * @return true if the line crosses the rectangle; t0/t1 hold the clipped range
+ */
+static bool ClipLineToRect(float baseX, float baseY, float dirX, float dirY,
+                           float maxX, float maxY, float &t0, float &t1) {
+  t0 = -FLT_MAX;
+  t1 = FLT_MAX;
+
+  const float base[2] = {baseX, baseY};
+  const float dir[2] = {dirX, dirY};
+  const float limit[2] = {maxX, maxY};
+
+  for (int axis = 0; axis < 2; ++axis) {
+    if (fabsf(dir[axis]) < NO_EFFECT_THRESHOLD) {
+      // Parallel to this axis: either always inside or never
+      if (base[axis] < 0.0f || base[axis] > limit[axis]) {
+        return false;
+      }
+      continue;
+    }
+    float ta = (0.0f - base[axis]) / dir[axis];
+    float tb = (limit[axis] - base[axis]) / dir[axis];
+    t0 = MAX(t0, MIN(ta, tb));
+    t1 = MIN(t1, MAX(ta, tb));
+  }
+
+  return t0 <= t1;
+}
+
+/**
+ * Find the part of a slice's centerline that lies inside the layer.
+ *
+ * The centerline runs along slice-space Y through the middle of the slice;
+ * in layer space it is base + t * (-angleSin, angleCos).
+ *
+ * @param segment Slice whose centerline to clip
+ * @param baseX Out: X of the centerline point level with the anchor
+ * @param baseY Out: Y of the centerline point level with the anchor
+ * @param t0 Out: start of the chord inside the layer
+ * @param t1 Out: end of the chord inside the layer
+ * @return false if the centerline misses the layer
+ */
+static bool ClipSliceCenterline(const SliceSegment &segment, A_long imageWidth,
+                                A_long imageHeight, float centerX, float centerY,
+                                float angleCos, float angleSin, float &baseX,
+                                float &baseY, float &t0, float &t1) {
+  baseX = segment.sliceStart + (segment.sliceEnd - segment.sliceStart) * 0.5f;
+  baseY = centerY;
+  RotatePoint(centerX, centerY, baseX, baseY, angleCos, angleSin);
+
+  return ClipLineToRect(baseX, baseY, -angleSin, angleCos,
+                        static_cast<float>(imageWidth - 1),
+                        static_cast<float>(imageHeight - 1), t0, t1);
+}
+
+/**
+ * Scale each slice's shift factor by the shift map luminance.
+ *
+ * The map is stretched to the layer bounds and read once per slice, so the
+ * per-pixel kernel cost is unchanged. Each slice's centerline is clipped to
+ * the layer: SHIFT_MAP_SAMPLING_CENTER reads the midpoint of that chord,
+ * SHIFT_MAP_SAMPLING_CENTERLINE averages SHIFT_MAP_CENTERLINE_SAMPLES points
+ * along it. Slices whose centerline misses the layer are left unchanged.
+ *
+ * @param map Checked-out shift map layer
+ * @param sampling SHIFT_MAP_SAMPLING_CENTER or SHIFT_MAP_SAMPLING_CENTERLINE
+ * @param imageWidth Layer width in pixels
+ * @param imageHeight Layer height in pixels
+ * @param centerX X coordinate of the rotation anchor
+ * @param centerY Y coordinate of the rotation anchor
+ * @param angleCos Pre-computed cosine of the slice angle
+ * @param angleSin Pre-computed sine of the slice angle
+ * @param numSlices Number of slices
+ * @param segments In/out array of SliceSegment structures (size numSlices)
+ */
+static void ApplyShiftMap(const PF_LayerDef *map, A_long sampling,
+                          A_long imageWidth, A_long imageHeight, float centerX,
+                          float centerY, float angleCos, float angleSin,
+                          A_long numSlices, SliceSegment *segments) {
+  if (map->width <= 0 || map->height <= 0) {
+    return;
+  }
+
+  const float mapScaleX = static_cast<float>(map->width) / static_cast<float>(imageWidth);
+  const float mapScaleY = static_cast<float>(map->height) / static_cast<float>(imageHeight);
+  const float dirX = -angleSin;
+  const float dirY = angleCos;
+
+  for (A_long i = 0; i < numSlices; i++) {
+    SliceSegment &segment = segments[i];
+
+    float baseX = 0.0f, baseY = 0.0f, t0 = 0.0f, t1 = 0.0f;
+    if (!ClipSliceCenterline(segment, imageWidth, imageHeight, centerX, centerY,
+                             angleCos, angleSin, baseX, baseY, t0, t1)) {
+      continue;
+    }
+
+    float luma = 0.0f;
+    if (sampling == SHIFT_MAP_SAMPLING_CENTERLINE) {
+      const float step = (t1 - t0) / SHIFT_MAP_CENTERLINE_SAMPLES;
+      for (A_long s = 0; s < SHIFT_MAP_CENTERLINE_SAMPLES; ++s) {
+        float t = t0 + (s + 0.5f) * step;
+        luma += SampleMapLuminance(map, (baseX + dirX * t) * mapScaleX,
+                                   (baseY + dirY * t) * mapScaleY);
+      }
+      luma /= SHIFT_MAP_CENTERLINE_SAMPLES;
+    } else {
+      float t = (t0 + t1) * 0.5f;
+      luma = SampleMapLuminance(map, (baseX + dirX * t) * mapScaleX,
+                                (baseY + dirY * t) * mapScaleY);
+    }
+
+    segment.shiftRandomFactor *= luma;
+  }
+}
+
+// =============================================================================
+// Density map - redistribute division points by inverse-CDF sampling
+// =============================================================================
+
+/**
+ * Redistribute division points so slices are dense where the map is bright.
+ *
+ * Builds a 1-D density profile along the slice axis:
+ * 1. Projects a sparse grid of map samples (at most
+ *    DENSITY_MAX_SAMPLES_PER_AXIS per axis) onto numBins bins over
+ *    [-sliceLength/2, sliceLength/2] and averages luminance per bin
+ * 2. Blends each bin with uniform density by amount, with a floor of
+ *    DENSITY_MIN_WEIGHT so dark regions still receive (wide) slices
+ * 3. Integrates the profile into a CDF
+ * 4. Maps each existing division point through the inverse CDF
+ *
+ * The existing points are treated as quantiles, so the seed's random spacing
+ * survives and ordering is preserved. The division points are sorted, so the
+ * inverse lookup is a single merge walk: O(numBins + numSlices).
+ *
+ * @param map Checked-out density map layer
+ * @param amount Blend factor (0.0-1.0) between uniform and map density
+ * @param imageWidth Layer width in pixels
+ * @param imageHeight Layer height in pixels
+ * @param centerX X coordinate of the rotation anchor
+ * @param centerY Y coordinate of the rotation anchor
+ * @param angleCos Pre-computed cosine of the slice angle
+ * @param angleSin Pre-computed sine of the slice angle
+ * @param numSlices Number of slices
+ * @param sliceLength Total length of slice space
+ * @param numBins Number of profile bins
+ * @param scratch Scratch array of size (3 * numBins + 1)
+ * @param divPoints In/out array of size (numSlices + 1) for division points
+ */
+static void ApplyDensityMap(const PF_LayerDef *map, float amount,
+                            A_long imageWidth, A_long imageHeight,
+                            float centerX, float centerY, float angleCos,
+                            float angleSin, A_long numSlices, float sliceLength,
+                            A_long numBins, float *scratch, float *divPoints) {
+  if (map->width <= 0 || map->height <= 0 || numBins <= 0) {
+    return;
+  }
+
+  float *binSum = scratch;
+  float *binCount = scratch + numBins;
+  float *cdf = scratch + 2 * numBins;
+  for (A_long i = 0; i < 2 * numBins; ++i) {
+    scratch[i] = 0.0f;
+  }
+
+  const float mapScaleX = static_cast<float>(map->width) / static_cast<float>(imageWidth);
+  const float mapScaleY = static_cast<float>(map->height) / static_cast<float>(imageHeight);
+  const float sliceStart = -sliceLength / 2.0f;
+  const float binScale = static_cast<float>(numBins) / sliceLength;
+  const A_long step = MAX(1, MAX(imageWidth, imageHeight) / DENSITY_MAX_SAMPLES_PER_AXIS);
+
+  // Project the map onto the slice axis
+  for (A_long y = 0; y < imageHeight; y += step) {
+    for (A_long x = 0; x < imageWidth; x += step) {
+      float sliceX = static_cast<float>(x);
+      float sliceY = static_cast<float>(y);
+      RotatePoint(centerX, centerY, sliceX, sliceY, angleCos, -angleSin);
+
+      A_long bin = static_cast<A_long>((sliceX - sliceStart) * binScale);
+      if (bin < 0 || bin >= numBins) {
+        continue;
+      }
+      binSum[bin] += SampleMapLuminance(map, x * mapScaleX, y * mapScaleY);
+      binCount[bin] += 1.0f;
+    }
+  }
+
+  // Blend with uniform density and integrate
+  cdf[0] = 0.0f;
+  for (A_long i = 0; i < numBins; ++i) {
+    float luma = (binCount[i] > 0.0f) ? binSum[i] / binCount[i] : 0.0f;
+    float weight = (1.0f - amount) + amount * luma;
+    cdf[i + 1] = cdf[i] + MAX(weight, DENSITY_MIN_WEIGHT);
+  }
+
+  // Inverse CDF: existing division points are read as quantiles
+  const float total = cdf[numBins];
+  const float binWidth = sliceLength / static_cast<float>(numBins);
+  A_long bin = 0;
+  for (A_long i = 1; i < numSlices; ++i) {
+    float quantile = CLAMP((divPoints[i] - sliceStart) / sliceLength, 0.0f, 1.0f);
+    float target = quantile * total;
+
+    while (bin < numBins - 1 && cdf[bin + 1] < target) {
+      ++bin;
+    }
+
+    float binMass = cdf[bin + 1] - cdf[bin];
+    float frac = (binMass > 0.0f) ? CLAMP((target - cdf[bin]) / binMass, 0.0f, 1.0f) : 0.0f;
+    divPoints[i] = sliceStart + (static_cast<float>(bin) + frac) * binWidth;
+  }
+}
+
+// =============================================================================
+// Per-slice transforms - random rotation, scale, depth and tilt
+// =============================================================================
+
+/**
+ * Whether per-slice transforms are active for the current parameters.
+ *
+ * A single slice is passed through unchanged, so it never needs transforms.
+ */
+static inline bool HasSliceTransforms(PF_ParamDef *params[]) {
+  return params[MULTISLICER_SLICES]->u.sd.value > 1 &&
+         (params[MULTISLICER_SLICE_ROTATION]->u.fs_d.value > 0.0 ||
+          params[MULTISLICER_SLICE_SCALE]->u.fs_d.value > 0.0 ||
+          params[MULTISLICER_SLICE_DEPTH]->u.fs_d.value > 0.0 ||
+          params[MULTISLICER_SLICE_TILT]->u.fs_d.value > 0.0 ||
+          params[MULTISLICER_SHATTER_VELOCITY]->u.fs_d.value > 0.0 ||
+          params[MULTISLICER_SHATTER_SPIN]->u.fs_d.value > 0.0 ||
+          params[MULTISLICER_SHATTER_GRAVITY]->u.fs_d.value > 0.0);
+}
+
+/**
+ * Whether slices are placed in 3-D and seen through the comp camera.
+ */
+static inline bool HasSlicePerspective(PF_ParamDef *params[]) {
+  return params[MULTISLICER_SLICE_DEPTH]->u.fs_d.value > 0.0 ||
+         params[MULTISLICER_SLICE_TILT]->u.fs_d.value > 0.0;
+}
+
+// Multiply 3x3 row-major matrices: out = a * b (out must not alias a or b)
+static inline void MultiplyMatrix3(const double *a, const double *b, double *out) {
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) {
+      out[r * 3 + c] = a[r * 3] * b[c] + a[r * 3 + 1] * b[3 + c] + a[r * 3 + 2] * b[6 + c];
+    }
+  }
+}
+
+/**
+ * Invert a 3x3 row-major matrix using its adjugate.
+ *
+ * @return false if the matrix is singular
+ */
+static bool InvertMatrix3(const double *m, double *out) {
+  double c0 = m[4] * m[8] - m[5] * m[7];
+  double c1 = m[5] * m[6] - m[3] * m[8];
+  double c2 = m[3] * m[7] - m[4] * m[6];
+  double det = m[0] * c0 + m[1] * c1 + m[2] * c2;
+  if (fabs(det) < HOMOGRAPHY_DET_EPSILON) {
+    return false;
+  }
+
+  double invDet = 1.0 / det;
+  out[0] = c0 * invDet;
+  out[1] = (m[2] * m[7] - m[1] * m[8]) * invDet;
+  out[2] = (m[1] * m[5] - m[2] * m[4]) * invDet;
+  out[3] = c1 * invDet;
+  out[4] = (m[0] * m[8] - m[2] * m[6]) * invDet;
+  out[5] = (m[2] * m[3] - m[0] * m[5]) * invDet;
+  out[6] = c2 * invDet;
+  out[7] = (m[1] * m[6] - m[0] * m[7]) * invDet;
+  out[8] = (m[0] * m[4] - m[1] * m[3]) * invDet;
+  return true;
+}
+
+/**
+ * Initialize per-slice transforms.
+ *
+ * Each slice is treated as a card pivoting about the center of its visible
+ * content (the midpoint of its centerline chord inside the layer, moved by
+ * the slice's shift), and gets:
+ * 1. A random in-plane rotation in [-maxRotation, maxRotation] radians
+ * 2. A random uniform scale in [1 - scaleAmount, 1 + scaleAmount]
+ * 3. A random tilt in [-maxTilt, maxTilt] radians about its (rotated) long axis
+ * 4. A random z offset in [-maxDepth, maxDepth] pixels
+ * 5. Shatter motion at shatterTime seconds, in closed form: rotation
+ *    spin * t and translation velocity * t + gravity * t^2 / 2, so any frame
+ *    is independent of the ones before it
+ * and is then projected through a camera looking at the layer center, with
+ * AE's default 50mm zoom for the layer width. Steps 1-4 are affine in 3-D
+ * and the projection is linear in homogeneous coordinates, so every slice
+ * maps through a single 3x3 homography. Both the forward matrix (for
+ * FrameSetup bounds) and its inverse (for rendering) are stored, so no
+ * per-pixel trigonometry or inversion is needed. Without depth and tilt the
+ * last row stays [0 0 1] and the transform is a plain affine one.
+ *
+ * @param seed Random seed for consistent patterns
+ * @param maxRotation Maximum rotation in radians
+ * @param scaleAmount Maximum relative scale change (0.0-1.0)
+ * @param maxDepth Maximum z offset in (downsampled) pixels
+ * @param maxTilt Maximum tilt in radians (below 90 degrees)
+ * @param shatterTime Seconds since Shatter Start (0 or more)
+ * @param velocity Shatter speed in (downsampled) pixels per second
+ * @param spin Shatter spin in radians per second
+ * @param gravity Shatter gravity in (downsampled) pixels per second squared
+ * @param layout Slice layout with initialized segments
+ * @param transforms Output array of SliceTransform structures (size numSlices)
+ */
+static void InitializeSliceTransforms(A_long seed, float maxRotation,
+                                      float scaleAmount, float maxDepth,
+                                      float maxTilt, float shatterTime,
+                                      float velocity, float spin, float gravity,
+                                      const SliceLayout &layout,
+                                      SliceTransform *transforms) {
+  const double shiftDirX = -layout.angleSin;
+  const double shiftDirY = layout.angleCos;
+  const bool perspective = (maxDepth > 0.0f || maxTilt > 0.0f);
+
+  // Cards live in square pixels: each transform is built there (x times
+  // aspect) and conjugated back into buffer pixels at the end
+  const double aspect = layout.pixelAspect;
+  double normalX = layout.angleCos;
+  double normalY = layout.angleSin;
+  if (aspect != 1.0) {
+    normalX /= aspect;
+    double length = sqrt(normalX * normalX + normalY * normalY);
+    normalX /= length;
+    normalY /= length;
+  }
+
+  // Comp camera: centered on the layer, zoom from the default 50mm lens
+  const double zoom =
+      static_cast<double>(layout.imageWidth) * aspect * CAMERA_FOCAL_LENGTH / CAMERA_FILM_SIZE;
+  const double cameraX = layout.imageWidth * aspect * 0.5;
+  const double cameraY = layout.imageHeight * 0.5;
+
+  for (A_long i = 0; i < layout.numSlices; i++) {
+    const SliceSegment &segment = layout.segments[i];
+
+    // Pivot: center of the slice's content inside the layer, after the shift
+    float baseX = 0.0f, baseY = 0.0f, t0 = 0.0f, t1 = 0.0f;
+    float mid = 0.0f;
+    if (ClipSliceCenterline(segment, layout.imageWidth, layout.imageHeight,
+                            layout.centerX, layout.centerY, layout.angleCos,
+                            layout.angleSin, baseX, baseY, t0, t1)) {
+      mid = (t0 + t1) * 0.5f;
+    }
+    double offsetPixels =
+        layout.shiftAmount * segment.shiftRandomFactor * segment.shiftDirection;
+    double pivotX = (baseX + shiftDirX * mid - shiftDirX * offsetPixels) * aspect;
+    double pivotY = baseY + shiftDirY * mid - shiftDirY * offsetPixels;
+
+    // Generate random rotation, scale, depth and tilt
+    A_long rotationSeed = (seed * ROTATION_SEED_MULT + i * ROTATION_SEED_OFFSET) & 0x7FFF;
+    A_long scaleSeed = (seed * SCALE_SEED_MULT + i * SCALE_SEED_OFFSET) & 0x7FFF;
+    A_long depthSeed = (seed * DEPTH_SEED_MULT + i * DEPTH_SEED_OFFSET) & 0x7FFF;
+    A_long tiltSeed = (seed * TILT_SEED_MULT + i * TILT_SEED_OFFSET) & 0x7FFF;
+    double rotation = (GetRandomValue(rotationSeed, 0) * 2.0f - 1.0f) * maxRotation;
+    double scale = 1.0f + (GetRandomValue(scaleSeed, 0) * 2.0f - 1.0f) * scaleAmount;
+    double depth = (GetRandomValue(depthSeed, 0) * 2.0f - 1.0f) * maxDepth;
+    double tilt = (GetRandomValue(tiltSeed, 0) * 2.0f - 1.0f) * maxTilt;
+    scale = MAX(scale, static_cast<double>(MIN_SLICE_SCALE));
+
+    // Shatter: closed-form spin and ballistic translation at shatterTime
+    double t = shatterTime;
+    rotation += segment.spinFactor * spin * t;
+    double moveX = segment.velocityX * velocity * t;
+    double moveY = segment.velocityY * velocity * t + 0.5 * segment.gravityFactor * gravity * t * t;
+
+    double rotCos = cos(rotation);
+    double rotSin = sin(rotation);
+
+    // In-plane rotation and scale about the pivot, then the shatter motion
+    double a = scale * rotCos, b = -scale * rotSin;
+    double c = scale * rotSin, d = scale * rotCos;
+    const double planar[9] = {a, b, pivotX - a * pivotX - b * pivotY + moveX,
+                              c, d, pivotY - c * pivotX - d * pivotY + moveY,
+                              0.0, 0.0, 1.0};
+
+    SliceTransform &xf = transforms[i];
+    xf.depth = static_cast<float>(depth);
+
+    double forward[9];
+    if (perspective) {
+      // Tilt about the rotated long axis: the across-slice component u of
+      // (q - pivot) shrinks by cos(tilt) and moves u * sin(tilt) in z
+      double acrossX = rotCos * normalX - rotSin * normalY;
+      double acrossY = rotSin * normalX + rotCos * normalY;
+      double acrossPivot = acrossX * pivotX + acrossY * pivotY;
+      double k = cos(tilt) - 1.0;
+      double tiltSin = sin(tilt);
+
+      // Rows X, Y, Z of the card in 3-D, as functions of (qx, qy, 1)
+      double card[9] = {
+          1.0 + k * acrossX * acrossX, k * acrossX * acrossY, -k * acrossX * acrossPivot,
+          k * acrossY * acrossX, 1.0 + k * acrossY * acrossY, -k * acrossY * acrossPivot,
+          tiltSin * acrossX, tiltSin * acrossY, depth - tiltSin * acrossPivot};
+
+      // Perspective divide by w = 1 + Z / zoom about the camera center:
+      // x' * w = X + cameraX * Z / zoom
+      double projected[9];
+      for (int col = 0; col < 3; ++col) {
+        double z = card[6 + col] / zoom;
+        projected[col] = card[col] + cameraX * z;
+        projected[3 + col] = card[3 + col] + cameraY * z;
+        projected[6 + col] = z + (col == 2 ? 1.0 : 0.0);
+      }
+      MultiplyMatrix3(projected, planar, forward);
+    } else {
+      for (int e = 0; e < 9; ++e) {
+        forward[e] = planar[e];
+      }
+    }
+    if (aspect != 1.0) {
+      // diag(1 / aspect, 1, 1) * forward * diag(aspect, 1, 1)
+      forward[1] /= aspect;
+      forward[2] /= aspect;
+      forward[3] *= aspect;
+      forward[6] *= aspect;
+    }
+
+    double inverse[9];
+    if (!InvertMatrix3(forward, inverse)) {
+      // Degenerate card (seen edge-on): collapse it so nothing is drawn
+      for (int e = 0; e < 9; ++e) {
+        inverse[e] = 0.0;
+      }
+    }
+    for (int e = 0; e < 9; ++e) {
+      xf.forward[e] = static_cast<float>(forward[e]);
+      xf.inverse[e] = static_cast<float>(inverse[e]);
+    }
+  }
+}
+
+/**
+ * Sort slice indices front to back by the depth of their centers.
+ *
+ * Uses insertion sort like CalculateDivisionPoints; ties keep slice order so
+ * the result is stable across frames.
+ *
+ * @param transforms Per-slice transforms with depth set
+ * @param numSlices Number of slices
+ * @param order Output array of slice indices (size numSlices)
+ */
+static void SortSlicesByDepth(const SliceTransform *transforms, A_long numSlices,
+                              A_long *order) {
+  for (A_long i = 0; i < numSlices; i++) {
+    A_long current = order[i] = i;
+    A_long j = i - 1;
+    while (j >= 0 && transforms[order[j]].depth > transforms[current].depth) {
+      order[j + 1] = order[j];
+      j--;
+    }
+    order[j + 1] = current;
+  }
+}
+
+// =============================================================================
+// Edge warp - wavy and noisy slice boundaries
+// =============================================================================
+
+/**
+ * Fill the edge warp table with sine or fractal value noise displacement.
+ *
+ * The displacement depends only on the position along the slices, so it is
+ * computed once per frame and each pixel needs a single table read.
+ * Noise sums WARP_NOISE_OCTAVES octaves of smoothstep-interpolated lattice
+ * values (each octave doubles the frequency and halves the amplitude) and
+ * is normalized to [-amplitude, amplitude].
+ *
+ * @param mode EDGE_WARP_SINE or EDGE_WARP_NOISE
+ * @param amplitude Maximum displacement in pixels
+ * @param frequency Waves per WARP_FREQUENCY_SCALE pixels
+ * @param seed Warp seed (sine phase or noise pattern)
+ * @param start Slice-space Y of the first entry
+ * @param step Slice-space Y distance between entries
+ * @param count Number of entries
+ * @param warp Output table (size count)
+ */
+static void BuildEdgeWarp(A_long mode, float amplitude, float frequency,
+                          A_long seed, float start, float step, A_long count,
+                          float *warp) {
+  const float cyclesPerPixel = frequency / WARP_FREQUENCY_SCALE;
+
+  if (mode == EDGE_WARP_SINE) {
+    float phase = GetRandomValue(seed, 0) * 2.0f * static_cast<float>(PF_PI);
+    for (A_long i = 0; i < count; i++) {
+      float along = start + i * step;
+      warp[i] = amplitude * sinf(2.0f * static_cast<float>(PF_PI) * cyclesPerPixel * along + phase);
+    }
+    return;
+  }
+
+  // Normalize so the octave weights sum to 1
+  float totalWeight = 0.0f;
+  for (int octave = 0; octave < WARP_NOISE_OCTAVES; octave++) {
+    totalWeight += 1.0f / static_cast<float>(1 << octave);
+  }
+
+  for (A_long i = 0; i < count; i++) {
+    float along = start + i * step;
+    float value = 0.0f;
+    for (int octave = 0; octave < WARP_NOISE_OCTAVES; octave++) {
+      A_long octaveSeed = seed * WARP_SEED_MULT + octave * WARP_SEED_OFFSET;
+      float t = along * cyclesPerPixel * static_cast<float>(1 << octave);
+      float cell = floorf(t);
+      float f = t - cell;
+      f = f * f * (3.0f - 2.0f * f);
+
+      A_long lattice = static_cast<A_long>(cell);
+      float v0 = GetRandomValue(octaveSeed, lattice) * 2.0f - 1.0f;
+      float v1 = GetRandomValue(octaveSeed, lattice + 1) * 2.0f - 1.0f;
+      value += (v0 + (v1 - v0) * f) / static_cast<float>(1 << octave);
+    }
+    warp[i] = amplitude * value / totalWeight;
+  }
+}
+
+/**
+ * Allocate and fill the layout's edge warp table, if Edge Warp is on.
+ *
+ * The table spans every slice-space Y a rendered pixel can have: the layer
+ * widened by MAX_EXPANSION on every side, projected onto the slice axis. It
+ * starts on a whole pixel with one entry per pixel, so neither its range nor
+ * its phase follows Shift and a Shift animation keeps one geometry key.
+ * Lookups beyond the table use its end values.
+ */
+static PF_Err InitializeEdgeWarp(PF_ParamDef *params[], AEGP_SuiteHandler &suites,
+                                 SliceLayout &layout) {
+  A_long mode = params[MULTISLICER_EDGE_WARP]->u.pd.value;
+  float amplitude = static_cast<float>(params[MULTISLICER_WARP_AMPLITUDE]->u.fs_d.value) *
+                    layout.resolutionScale * layout.acrossScale;
+  float frequency = static_cast<float>(params[MULTISLICER_WARP_FREQUENCY]->u.fs_d.value) /
+                    layout.resolutionScale / layout.alongScale;
+  if (mode == EDGE_WARP_NONE || amplitude <= 0.0f) {
+    return PF_Err_NONE;
+  }
+
+  // Range of slice-space Y over the corners of the largest output
+  const float expansion = static_cast<float>(MAX_EXPANSION);
+  float minAlong = FLT_MAX, maxAlong = -FLT_MAX;
+  for (int corner = 0; corner < 4; corner++) {
+    float x = (corner & 1) ? static_cast<float>(layout.imageWidth) + expansion : -expansion;
+    float y = (corner & 2) ? static_cast<float>(layout.imageHeight) + expansion : -expansion;
+    float along = layout.angleCos * (y - layout.centerY) -
+                  layout.angleSin * (x - layout.centerX) + layout.centerY;
+    minAlong = MIN(minAlong, along);
+    maxAlong = MAX(maxAlong, along);
+  }
+
+  // One entry per pixel from a whole pixel; past WARP_MAX_ENTRIES the range
+  // shrinks evenly around the layer rather than the step growing
+  float start = floorf(minAlong);
+  A_long count = static_cast<A_long>(ceilf(maxAlong) - start) + 1;
+  if (count > WARP_MAX_ENTRIES) {
+    start += floorf(static_cast<float>(count - WARP_MAX_ENTRIES) * 0.5f);
+    count = WARP_MAX_ENTRIES;
+  }
+
+  layout.warpHandle = suites.HandleSuite1()->host_new_handle(count * sizeof(float));
+  if (!layout.warpHandle || !*layout.warpHandle) {
+    return PF_Err_OUT_OF_MEMORY;
+  }
+  layout.warp = *((float **)layout.warpHandle);
+  layout.warpStart = start;
+  layout.warpInvStep = 1.0f;
+  layout.warpCount = count;
+  layout.warpAmplitude = amplitude;
+  layout.warpMode = mode;
+  layout.warpFrequency = frequency;
+  layout.warpSeed = params[MULTISLICER_WARP_SEED]->u.sd.value;
+
+  BuildEdgeWarp(mode, amplitude, frequency, layout.warpSeed, start, 1.0f, count, layout.warp);
+  return PF_Err_NONE;
+}
+
+// =============================================================================
+// Slice layout - shared by FrameSetup and Render
+// =============================================================================
+
+/**
+ * Fill the Prefilter Slices prefix sums: running visible width and running
+ * width times shift factor, in slice order, for the slices shifted forward
+ * and for those shifted backward.
+ */
+static void BuildSlicePrefixSums(SliceLayout &layout) {
+  const A_long count = layout.numSlices + 1;
+  float width[2] = {0.0f, 0.0f};
+  float shift[2] = {0.0f, 0.0f};
+  for (A_long i = 0; i <= layout.numSlices; i++) {
+    for (int direction = 0; direction < 2; direction++) {
+      layout.prefixWidth[direction * count + i] = width[direction];
+      layout.prefixShift[direction * count + i] = shift[direction];
+    }
+    if (i < layout.numSlices) {
+      const SliceSegment &segment = layout.segments[i];
+      const int direction = (segment.shiftDirection < 0.0f) ? 1 : 0;
+      float visible = MAX(0.0f, segment.visibleEnd - segment.visibleStart);
+      width[direction] += visible;
+      shift[direction] += visible * segment.shiftRandomFactor;
+    }
+  }
+
+  // Bucket index: each bucket start keeps the first slice ending at or after
+  // it, so a coordinate in bucket b lies in slices buckets[b]..buckets[b + 1]
+  const A_long last = layout.numSlices - 1;
+  const float start = layout.segments[0].sliceStart;
+  const float span = layout.segments[last].sliceEnd - start;
+  layout.bucketStart = start;
+  layout.bucketInvStep = (span > 0.0f) ? layout.bucketCount / span : 0.0f;
+  A_long slice = 0;
+  for (A_long b = 0; b <= layout.bucketCount; b++) {
+    const float bucketX = start + span * b / layout.bucketCount;
+    while (slice < last && bucketX > layout.segments[slice].sliceEnd) {
+      slice++;
+    }
+    layout.buckets[b] = slice;
+  }
+}
+
+// Render trace: size and depth of every layer parameter the current command
+// checked out on this thread, as RecordTraceCommand records them. Cleared
+// by EffectMain before each traced command.
+static thread_local TraceParam tTraceLayers[MULTISLICER_NUM_PARAMS];
+
+// Check out a layer parameter at the current time, noting its size for the
+// render trace
+static PF_Err CheckoutLayerParam(PF_InData *in_data, A_long index, PF_ParamDef *def) {
+  PF_Err err = PF_CHECKOUT_PARAM(in_data, index, in_data->current_time, in_data->time_step,
+                                 in_data->time_scale, def);
+  if (!err && def->u.ld.data) {
+    TraceParam &layer = tTraceLayers[index];
+    layer.x = def->u.ld.width;
+    layer.y = def->u.ld.height;
+    layer.value = PF_WORLD_IS_DEEP(&def->u.ld) ? 1.0 : 0.0;
+  }
+  return err;
+}
+
+/**
+ * Redistribute division points by the Density Map layer, if one is set.
+ */
+static PF_Err ApplyDensityMapParam(PF_InData *in_data, PF_ParamDef *params[],
+                                   AEGP_SuiteHandler &suites,
+                                   SliceLayout &layout, float *divPoints) {
+  PF_Err err = PF_Err_NONE;
+  PF_ParamDef densityMapParam;
+  AEFX_CLR_STRUCT(densityMapParam);
+
+  err = CheckoutLayerParam(in_data, MULTISLICER_DENSITY_MAP, &densityMapParam);
+  if (err) {
+    return err;
+  }
+
+  if (densityMapParam.u.ld.data) {
+    layout.layerMaps = true;
+    A_long densityBins =
+        MIN(DENSITY_MAX_BINS, MAX(1, static_cast<A_long>(ceilf(layout.sliceLength))));
+    PF_Handle densityHandle =
+        suites.HandleSuite1()->host_new_handle((3 * densityBins + 1) * sizeof(float));
+    if (densityHandle && *densityHandle) {
+      ApplyDensityMap(&densityMapParam.u.ld,
+                      params[MULTISLICER_DENSITY_AMOUNT]->u.fs_d.value / 100.0f,
+                      layout.imageWidth, layout.imageHeight, layout.centerX,
+                      layout.centerY, layout.angleCos, layout.angleSin,
+                      layout.numSlices, layout.sliceLength, densityBins,
+                      *((float **)densityHandle), divPoints);
+    } else {
+      err = PF_Err_OUT_OF_MEMORY;
+    }
+    if (densityHandle) {
+      suites.HandleSuite1()->host_dispose_handle(densityHandle);
+    }
+  }
+
+  ERR(PF_CHECKIN_PARAM(in_data, &densityMapParam));
+  return err;
+}
+
+/**
+ * Scale shift factors by the Shift Map layer, if one is set.
+ */
+static PF_Err ApplyShiftMapParam(PF_InData *in_data, PF_ParamDef *params[],
+                                 SliceLayout &layout) {
+  PF_Err err = PF_Err_NONE;
+  PF_ParamDef shiftMapParam;
+  AEFX_CLR_STRUCT(shiftMapParam);
+
+  err = CheckoutLayerParam(in_data, MULTISLICER_SHIFT_MAP, &shiftMapParam);
+  if (err) {
+    return err;
+  }
+
+  if (shiftMapParam.u.ld.data) {
+    layout.layerMaps = true;
+    ApplyShiftMap(&shiftMapParam.u.ld, params[MULTISLICER_SHIFT_MAP_SAMPLING]->u.pd.value,
+                  layout.imageWidth, layout.imageHeight, layout.centerX,
+                  layout.centerY, layout.angleCos, layout.angleSin,
+                  layout.numSlices, layout.segments);
+  }
+
+  ERR(PF_CHECKIN_PARAM(in_data, &shiftMapParam));
+  return err;
+}
+
+/**
+ * Build the slice layout for the current frame from the effect parameters.
+ *
+ * FrameSetup and Render both call this (through BuildSliceLayout) so they
+ * always agree on the slices:
+ * 1. Division points (random spacing, optionally redistributed by the
+ *    Density Map)
+ * 2. Slice segments (optionally scaled by the Shift Map)
+ * 3. Edge warp table, only when Edge Warp is on
+ * 4. Per-slice transforms, only when Random Rotation/Scale/Depth/Tilt or
+ *    Shatter are set
+ *
+ * Handles are stored in the layout as soon as they are allocated; the caller
+ * must release them with DisposeSliceLayout, also when an error is returned.
+ *
+ * @param in_data Input data for parameter checkout and the current time
+ * @param params Effect parameters
+ * @param suites Suite handler for memory allocation
+ * @param layerMaps Whether to check out and apply the Shift and Density Map
+ *                  layers (not during UI commands)
+ * @param layout Output layout (must be cleared by the caller, then
+ *               imageWidth, imageHeight, centerX, centerY (the Anchor
+ *               Point in buffer pixels), resolutionScale and pixelAspect
+ *               set)
+ * @return PF_Err error code
+ */
+static PF_Err BuildSliceLayoutFor(PF_InData *in_data, PF_ParamDef *params[],
+                                  AEGP_SuiteHandler &suites, bool layerMaps,
+                                  SliceLayout &layout) {
+  PF_Err err = PF_Err_NONE;
+
+  // Extract parameters
+  float shiftRaw = params[MULTISLICER_SHIFT]->u.fs_d.value;
+  float width = params[MULTISLICER_WIDTH]->u.fs_d.value / 100.0f;
+  A_long numSlices = params[MULTISLICER_SLICES]->u.sd.value;
+  A_long angle_long = params[MULTISLICER_ANGLE]->u.ad.value >> 16;
+  A_long seed = params[MULTISLICER_SEED]->u.sd.value;
+
+  // CRITICAL FIX: Validate numSlices to prevent integer overflow
+  if (numSlices > 1000 || numSlices < 1) {
+    return PF_Err_UNRECOGNIZED_PARAM_TYPE;
+  }
+
+  float shiftDirection = (shiftRaw >= 0) ? 1.0f : -1.0f;
+
+  layout.numSlices = numSlices;
+
+  // Keep the anchor point on the layer
+  layout.centerX = MAX(0.0f, MIN(layout.centerX, static_cast<float>(layout.imageWidth - 1)));
+  layout.centerY = MAX(0.0f, MIN(layout.centerY, static_cast<float>(layout.imageHeight - 1)));
+
+  // Calculate rotation parameters
+  float angleRad = (float)angle_long * PF_RAD_PER_DEGREE;
+  layout.angleCos = cosf(angleRad);
+  layout.angleSin = sinf(angleRad);
+
+  // Use LAYER size for sliceLength (controls slice spacing/appearance)
+  // Not expanded buffer size - that would stretch the slices
+  layout.sliceLength =
+      2.0f * sqrtf(static_cast<float>(layout.imageWidth * layout.imageWidth +
+                                      layout.imageHeight * layout.imageHeight));
+
+  // Non-square pixels: the square-pixel slice normal (cos, sin) becomes
+  // (aspect * cos, sin) / k in buffer pixels - still parallel slices, at
+  // another angle, with square distances across them divided by k and
+  // along them multiplied by k / aspect. Folding this into the layout keeps
+  // every renderer in buffer pixels with no resampling.
+  layout.acrossScale = 1.0f;
+  layout.alongScale = 1.0f;
+  if (layout.pixelAspect != 1.0f) {
+    float normalX = layout.pixelAspect * layout.angleCos;
+    float k = sqrtf(normalX * normalX + layout.angleSin * layout.angleSin);
+    layout.angleCos = normalX / k;
+    layout.angleSin /= k;
+    layout.acrossScale = 1.0f / k;
+    layout.alongScale = k / layout.pixelAspect;
+
+    float squareWidth = layout.imageWidth * layout.pixelAspect;
+    float squareHeight = static_cast<float>(layout.imageHeight);
+    layout.sliceLength = 2.0f * sqrtf(squareWidth * squareWidth + squareHeight * squareHeight) *
+                         layout.acrossScale;
+  }
+  layout.shiftAmount = fabsf(shiftRaw) * layout.resolutionScale * layout.alongScale;
+
+  // Allocate memory for slice segments
+  layout.segmentsHandle = suites.HandleSuite1()->host_new_handle(numSlices * sizeof(SliceSegment));
+  if (!layout.segmentsHandle || !*layout.segmentsHandle) {
+    return PF_Err_OUT_OF_MEMORY;
+  }
+  layout.segments = *((SliceSegment **)layout.segmentsHandle);
+
+  // Division points are only needed until the segments are initialized
+  PF_Handle divPointsHandle = suites.HandleSuite1()->host_new_handle((numSlices + 1) * sizeof(float));
+  if (!divPointsHandle || !*divPointsHandle) {
+    if (divPointsHandle) {
+      suites.HandleSuite1()->host_dispose_handle(divPointsHandle);
+    }
+    return PF_Err_OUT_OF_MEMORY;
+  }
+  float *divPoints = *((float **)divPointsHandle);
+
+  CalculateDivisionPoints(seed, numSlices, layout.sliceLength, divPoints);
+  if (layerMaps) {
+    err = ApplyDensityMapParam(in_data, params, suites, layout, divPoints);
+  }
+  if (!err) {
+    InitializeSliceSegments(seed, numSlices, width, shiftDirection, divPoints,
+                            layout.segments);
+  }
+  suites.HandleSuite1()->host_dispose_handle(divPointsHandle);
+  if (err) {
+    return err;
+  }
+
+  if (layerMaps) {
+    err = ApplyShiftMapParam(in_data, params, layout);
+    if (err) {
+      return err;
+    }
+  }
+
+  // Edge warp table (after the shift map, since its range follows the shift)
+  err = InitializeEdgeWarp(params, suites, layout);
+  if (err) {
+    return err;
+  }
+
+  // Prefix sums for Prefilter Slices (after the shift map, which scales the
+  // shift factors). Transformed slices are rendered per slice and do not
+  // use them.
+  if (params[MULTISLICER_PREFILTER]->u.bd.value && !HasSliceTransforms(params)) {
+    layout.bucketCount = numSlices * PREFILTER_BUCKETS_PER_SLICE;
+    layout.prefixHandle = suites.HandleSuite1()->host_new_handle(
+        4 * (numSlices + 1) * sizeof(float) + (layout.bucketCount + 1) * sizeof(A_long));
+    if (!layout.prefixHandle || !*layout.prefixHandle) {
+      return PF_Err_OUT_OF_MEMORY;
+    }
+    layout.prefixWidth = *((float **)layout.prefixHandle);
+    layout.prefixShift = layout.prefixWidth + 2 * (numSlices + 1);
+    layout.buckets = reinterpret_cast<A_long *>(layout.prefixShift + 2 * (numSlices + 1));
+    BuildSlicePrefixSums(layout);
+  }
+
+  // Per-slice transforms (after the shift map, since pivots follow the shift)
+  if (HasSliceTransforms(params)) {
+    layout.transformsHandle =
+        suites.HandleSuite1()->host_new_handle(numSlices * sizeof(SliceTransform));
+    if (!layout.transformsHandle || !*layout.transformsHandle) {
+      return PF_Err_OUT_OF_MEMORY;
+    }
+    layout.transforms = *((SliceTransform **)layout.transformsHandle);
+
+    float maxRotation = static_cast<float>(params[MULTISLICER_SLICE_ROTATION]->u.fs_d.value) *
+                        static_cast<float>(PF_RAD_PER_DEGREE);
+    float scaleAmount = static_cast<float>(params[MULTISLICER_SLICE_SCALE]->u.fs_d.value) / 100.0f;
+    float maxDepth = static_cast<float>(params[MULTISLICER_SLICE_DEPTH]->u.fs_d.value) *
+                     layout.resolutionScale;
+    float maxTilt = static_cast<float>(params[MULTISLICER_SLICE_TILT]->u.fs_d.value) *
+                    static_cast<float>(PF_RAD_PER_DEGREE);
+
+    // Shatter time is relative to Shatter Start and never runs backwards
+    float shatterTime = static_cast<float>(in_data->current_time) /
+                            static_cast<float>(in_data->time_scale) -
+                        static_cast<float>(params[MULTISLICER_SHATTER_START]->u.fs_d.value);
+    shatterTime = MAX(0.0f, shatterTime);
+    float velocity = static_cast<float>(params[MULTISLICER_SHATTER_VELOCITY]->u.fs_d.value) *
+                     layout.resolutionScale;
+    float spin = static_cast<float>(params[MULTISLICER_SHATTER_SPIN]->u.fs_d.value) *
+                 static_cast<float>(PF_RAD_PER_DEGREE);
+    float gravity = static_cast<float>(params[MULTISLICER_SHATTER_GRAVITY]->u.fs_d.value) *
+                    layout.resolutionScale;
+
+    InitializeSliceTransforms(seed, maxRotation, scaleAmount, maxDepth, maxTilt,
+                              shatterTime, velocity, spin, gravity, layout,
+                              layout.transforms);
+
+    // Perspective mode composites front to back for correct occlusion
+    if (HasSlicePerspective(params)) {
+      layout.drawOrderHandle =
+          suites.HandleSuite1()->host_new_handle(numSlices * sizeof(A_long));
+      if (!layout.drawOrderHandle || !*layout.drawOrderHandle) {
+        return PF_Err_OUT_OF_MEMORY;
+      }
+      layout.drawOrder = *((A_long **)layout.drawOrderHandle);
+      SortSlicesByDepth(layout.transforms, numSlices, layout.drawOrder);
+    }
+  }
+
+  return err;
+}
+
+/**
+ * Build the slice layout of a render or frame setup: for the Input layer at
+ * the current downsampling, with the Shift and Density Map layers.
+ */
+static PF_Err BuildSliceLayout(PF_InData *in_data, PF_ParamDef *params[],
+                               AEGP_SuiteHandler &suites, SliceLayout &layout) {
+  const PF_LayerDef *input = &params[MULTISLICER_INPUT]->u.ld;
+  float downscale_x = GetDownscaleFactor(in_data->downsample_x);
+  float downscale_y = GetDownscaleFactor(in_data->downsample_y);
+  layout.imageWidth = input->width;
+  layout.imageHeight = input->height;
+  // Point parameters arrive in buffer pixels
+  layout.centerX =
+      static_cast<float>(params[MULTISLICER_ANCHOR_POINT]->u.td.x_value) / FIXED_POINT_SCALE;
+  layout.centerY =
+      static_cast<float>(params[MULTISLICER_ANCHOR_POINT]->u.td.y_value) / FIXED_POINT_SCALE;
+  layout.resolutionScale = MIN(downscale_x, downscale_y);
+  layout.pixelAspect = GetPixelAspect(in_data);
+  return BuildSliceLayoutFor(in_data, params, suites, true, layout);
+}
+
+// Release the handles owned by a slice layout
+static void DisposeSliceLayout(AEGP_SuiteHandler &suites, SliceLayout &layout) {
+  if (layout.segmentsHandle) {
+    suites.HandleSuite1()->host_dispose_handle(layout.segmentsHandle);
+    layout.segmentsHandle = nullptr;
+    layout.segments = nullptr;
+  }
+  if (layout.transformsHandle) {
+    suites.HandleSuite1()->host_dispose_handle(layout.transformsHandle);
+    layout.transformsHandle = nullptr;
+    layout.transforms = nullptr;
+  }
+  if (layout.drawOrderHandle) {
+    suites.HandleSuite1()->host_dispose_handle(layout.drawOrderHandle);
+    layout.drawOrderHandle = nullptr;
+    layout.drawOrder = nullptr;
+  }
+  if (layout.warpHandle) {
+    suites.HandleSuite1()->host_dispose_handle(layout.warpHandle);
+    layout.warpHandle = nullptr;
+    layout.warp = nullptr;
+  }
+  if (layout.prefixHandle) {
+    suites.HandleSuite1()->host_dispose_handle(layout.prefixHandle);
+    layout.prefixHandle = nullptr;
+    layout.prefixWidth = nullptr;
+    layout.prefixShift = nullptr;
+    layout.buckets = nullptr;
+  }
+}
+
+/**
+ * Clip a convex polygon to the half-plane nx * x + ny * y <= limit.
+ *
+ * Sutherland-Hodgman against a single edge.
+ *
+ * @return Number of output vertices (at most n + 1)
+ */
+static int ClipPolygonToHalfPlane(const float *inX, const float *inY, int n,
+                                  float nx, float ny, float limit, float *outX,
+                                  float *outY) {
+  int count = 0;
+  for (int i = 0; i < n; ++i) {
+    int j = (i + 1) % n;
+    float di = nx * inX[i] + ny * inY[i] - limit;
+    float dj = nx * inX[j] + ny * inY[j] - limit;
+
+    if (di <= 0.0f) {
+      outX[count] = inX[i];
+      outY[count] = inY[i];
+      ++count;
+    }
+    if ((di < 0.0f && dj > 0.0f) || (di > 0.0f && dj < 0.0f)) {
+      float t = di / (di - dj);
+      outX[count] = inX[i] + (inX[j] - inX[i]) * t;
+      outY[count] = inY[i] + (inY[j] - inY[i]) * t;
+      ++count;
+    }
+  }
+  return count;
+}
+
+/**
+ * The part of one slice that can be non-transparent, before its transform.
+ *
+ * This is the content rectangle (moved against the slice's shift) clipped
+ * to the slice's feathered band, widened by the edge warp amplitude. For
+ * perspective slices it is also clipped to the camera's near plane
+ * (w >= CAMERA_NEAR_W), so the projected polygon stays convex and finite.
+ * Each of the three clips adds at most one vertex to the rectangle's 4.
+ *
+ * @param layout Slice layout, with or without transforms
+ * @param content Source rectangle outside of which the layer is transparent
+ * @param index Slice to clip
+ * @param polyX Receives the vertices in layout coordinates (8 entries)
+ * @param polyY Receives the vertices in layout coordinates (8 entries)
+ * @return Number of vertices, 0 if the slice has no content
+ */
+static int ClipSliceContent(const SliceLayout &layout, const PF_Rect &content,
+                            A_long index, float *polyX, float *polyY) {
+  constexpr float feather = DEFAULT_FEATHER;
+  const float shiftDirX = -layout.angleSin;
+  const float shiftDirY = layout.angleCos;
+  // Slice-space X = nx * x + ny * y + sliceOffset
+  const float nx = layout.angleCos;
+  const float ny = layout.angleSin;
+  const float sliceOffset =
+      layout.centerX - nx * layout.centerX - ny * layout.centerY;
+  const float left = static_cast<float>(content.left) - SAMPLE_ROUND_OFFSET;
+  const float top = static_cast<float>(content.top) - SAMPLE_ROUND_OFFSET;
+  const float right = static_cast<float>(content.right) - SAMPLE_ROUND_OFFSET;
+  const float bottom = static_cast<float>(content.bottom) - SAMPLE_ROUND_OFFSET;
+
+  if (content.left >= content.right || content.top >= content.bottom) {
+    return 0;
+  }
+
+  const SliceSegment &segment = layout.segments[index];
+  float offsetPixels =
+      layout.shiftAmount * segment.shiftRandomFactor * segment.shiftDirection;
+  float dx = -shiftDirX * offsetPixels;
+  float dy = -shiftDirY * offsetPixels;
+
+  // Up to 4 + 3 vertices after the band and near-plane clips
+  float rectX[4] = {left + dx, right + dx, right + dx, left + dx};
+  float rectY[4] = {top + dy, top + dy, bottom + dy, bottom + dy};
+  float clipX[8], clipY[8];
+
+  int n = ClipPolygonToHalfPlane(
+      rectX, rectY, 4, nx, ny,
+      segment.visibleEnd + feather + layout.warpAmplitude - sliceOffset,
+      clipX, clipY);
+  n = ClipPolygonToHalfPlane(
+      clipX, clipY, n, -nx, -ny,
+      sliceOffset - (segment.visibleStart - feather - layout.warpAmplitude),
+      polyX, polyY);
+  if (!layout.transforms) {
+    return n;
+  }
+
+  const float *fwd = layout.transforms[index].forward;
+  for (int v = 0; v < n; ++v) {
+    clipX[v] = polyX[v];
+    clipY[v] = polyY[v];
+  }
+  return ClipPolygonToHalfPlane(clipX, clipY, n, -fwd[6], -fwd[7],
+                                fwd[8] - CAMERA_NEAR_W, polyX, polyY);
+}
+
+/**
+ * Grow a layer-space box by the exact bounds of one slice: the corners of
+ * its content (ClipSliceContent) mapped through the forward transform (if
+ * any).
+ *
+ * @param layout Slice layout, with or without transforms
+ * @param content Source rectangle outside of which the layer is transparent
+ * @param index Slice to add
+ * @return false if the slice has no content
+ */
+static bool AccumulateSliceBounds(const SliceLayout &layout, const PF_Rect &content,
+                                  A_long index, float &minX, float &minY,
+                                  float &maxX, float &maxY) {
+  static const float identity[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+                                    0.0f, 0.0f, 0.0f, 1.0f};
+  float polyX[8], polyY[8];
+  const int n = ClipSliceContent(layout, content, index, polyX, polyY);
+
+  const float *fwd = layout.transforms ? layout.transforms[index].forward : identity;
+  for (int v = 0; v < n; ++v) {
+    float w = fwd[6] * polyX[v] + fwd[7] * polyY[v] + fwd[8];
+    float x = (fwd[0] * polyX[v] + fwd[1] * polyY[v] + fwd[2]) / w;
+    float y = (fwd[3] * polyX[v] + fwd[4] * polyY[v] + fwd[5]) / w;
+    minX = MIN(minX, x);
+    minY = MIN(minY, y);
+    maxX = MAX(maxX, x);
+    maxY = MAX(maxY, y);
+  }
+
+  return n > 0;
+}
+
+/**
+ * Compute the exact layer-space bounds of all slices (see
+ * AccumulateSliceBounds).
+ *
+ * @return false if no slice has any content
+ */
+static bool ComputeSliceBounds(const SliceLayout &layout, const PF_Rect &content,
+                               float &minX, float &minY, float &maxX, float &maxY) {
+  bool found = false;
+  minX = minY = FLT_MAX;
+  maxX = maxY = -FLT_MAX;
+
+  for (A_long i = 0; i < layout.numSlices; i++) {
+    if (AccumulateSliceBounds(layout, content, i, minX, minY, maxX, maxY)) {
+      found = true;
+    }
+  }
+
+  return found;
+}
+
+// =============================================================================
+// Content bounds (Crop to Content)
+// =============================================================================
+
+/**
+ * Whether one source row is entirely zero (transparent, no color).
+ */
+template <typename PixelType>
+static inline bool IsRowEmpty(const PF_LayerDef *layer, A_long y) {
+  const PixelType *row = PixelRow<PixelType>(layer->data, layer->rowbytes, y);
+  for (A_long x = 0; x < layer->width; x++) {
+    if (row[x].alpha || row[x].red || row[x].green || row[x].blue) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Measure the bounding box of the non-zero pixels of a layer.
+ *
+ * Empty rows are trimmed from the top and bottom first; each remaining row
+ * is then only scanned from the edges inwards up to the current left and
+ * right bounds, so the cost is roughly the transparent margin, not the
+ * whole layer.
+ *
+ * @param layer Layer to measure (data must be valid)
+ * @param bounds Output rectangle, right and bottom exclusive; empty
+ *               (all zero) when the layer is fully transparent
+ */
+template <typename PixelType>
+static void MeasureContentBoundsT(const PF_LayerDef *layer, PF_Rect &bounds) {
+  A_long top = 0;
+  A_long bottom = layer->height;
+  while (top < bottom && IsRowEmpty<PixelType>(layer, top)) {
+    ++top;
+  }
+  while (bottom > top && IsRowEmpty<PixelType>(layer, bottom - 1)) {
+    --bottom;
+  }
+
+  bounds.left = bounds.top = bounds.right = bounds.bottom = 0;
+  if (top == bottom) {
+    return;
+  }
+
+  A_long left = layer->width;
+  A_long right = 0;
+  for (A_long y = top; y < bottom; y++) {
+    const PixelType *row = PixelRow<PixelType>(layer->data, layer->rowbytes, y);
+    for (A_long x = 0; x < left; x++) {
+      if (row[x].alpha || row[x].red || row[x].green || row[x].blue) {
+        left = x;
+        break;
+      }
+    }
+    for (A_long x = layer->width - 1; x >= right; x--) {
+      if (row[x].alpha || row[x].red || row[x].green || row[x].blue) {
+        right = x + 1;
+        break;
+      }
+    }
+  }
+
+  bounds.left = left;
+  bounds.top = top;
+  bounds.right = right;
+  bounds.bottom = bottom;
+}
+
+static void MeasureContentBounds(const PF_LayerDef *layer, PF_Rect &bounds) {
+  if (PF_WORLD_IS_DEEP(layer)) {
+    MeasureContentBoundsT<PF_Pixel16>(layer, bounds);
+  } else {
+    MeasureContentBoundsT<PF_Pixel>(layer, bounds);
+  }
+}
+
+/**
+ * Find the range of slices that can show any content.
+ *
+ * The shift runs along the slices, so a slice reaches the content exactly
+ * when the content's extent across the slices overlaps its feathered band
+ * (widened by the edge warp amplitude). Transforms are applied after this
+ * test and do not change it.
+ *
+ * @param layout Slice layout
+ * @param content Source rectangle outside of which the layer is transparent
+ * @param firstSlice Output first slice index
+ * @param lastSlice Output last slice index (less than firstSlice if none)
+ */
+static void CullSlicesToContent(const SliceLayout &layout, const PF_Rect &content,
+                                A_long &firstSlice, A_long &lastSlice) {
+  firstSlice = 0;
+  lastSlice = -1;
+  if (content.left >= content.right || content.top >= content.bottom) {
+    return;
+  }
+
+  // Extent of the content across the slices (slice-space X)
+  const float nx = layout.angleCos;
+  const float ny = layout.angleSin;
+  const float sliceOffset =
+      layout.centerX - nx * layout.centerX - ny * layout.centerY;
+  const float left = static_cast<float>(content.left) - SPAN_SOURCE_MARGIN;
+  const float top = static_cast<float>(content.top) - SPAN_SOURCE_MARGIN;
+  const float right = static_cast<float>(content.right) - SAMPLE_ROUND_OFFSET;
+  const float bottom = static_cast<float>(content.bottom) - SAMPLE_ROUND_OFFSET;
+  const float minS = MIN(nx * left, nx * right) + MIN(ny * top, ny * bottom) + sliceOffset;
+  const float maxS = MAX(nx * left, nx * right) + MAX(ny * top, ny * bottom) + sliceOffset;
+  const float margin = DEFAULT_FEATHER + layout.warpAmplitude + 1.0f;
+
+  bool found = false;
+  for (A_long i = 0; i < layout.numSlices; i++) {
+    const SliceSegment &segment = layout.segments[i];
+    if (segment.visibleEnd + margin >= minS && segment.visibleStart - margin <= maxS) {
+      if (!found) {
+        firstSlice = i;
+        found = true;
+      }
+      lastSlice = i;
+    }
+  }
+}
+
+// =============================================================================
+// Multiple sources - Input plus the Source 2-4 layers
+// =============================================================================
+
+/**
+ * Check out the Source 2-4 layer parameters.
+ *
+ * @param in_data Input data for parameter checkout
+ * @param defs Output parameter definitions (MULTI_SOURCE_MAX - 1)
+ * @param numCheckedOut Output number of definitions to check back in, also
+ *                      when an error is returned
+ * @return PF_Err error code
+ */
+static PF_Err CheckoutExtraSources(PF_InData *in_data, PF_ParamDef *defs,
+                                   A_long &numCheckedOut) {
+  PF_Err err = PF_Err_NONE;
+  numCheckedOut = 0;
+  for (A_long n = 0; n < MULTI_SOURCE_MAX - 1 && !err; n++) {
+    AEFX_CLR_STRUCT(defs[n]);
+    err = CheckoutLayerParam(in_data, MULTISLICER_SOURCE_2 + n, &defs[n]);
+    if (!err) {
+      numCheckedOut++;
+    }
+  }
+  return err;
+}
+
+static PF_Err CheckinExtraSources(PF_InData *in_data, PF_ParamDef *defs,
+                                  A_long numCheckedOut) {
+  PF_Err err = PF_Err_NONE;
+  PF_Err err2 = PF_Err_NONE;
+  for (A_long n = 0; n < numCheckedOut; n++) {
+    ERR2(PF_CHECKIN_PARAM(in_data, &defs[n]));
+  }
+  return err2;
+}
+
+/**
+ * Place a Source 2-4 layer on the Input: centered on it and cropped to it.
+ *
+ * @param input Input layer
+ * @param layer Checked-out source layer (data must be valid)
+ * @param source Output source; its pixels cover layer positions
+ *               offset .. offset + size, all inside the Input
+ */
+static void PlaceExtraSource(const PF_LayerDef *input, const PF_LayerDef *layer,
+                             SliceSource &source) {
+  const A_long offsetX = (input->width - layer->width) / 2;
+  const A_long offsetY = (input->height - layer->height) / 2;
+  const A_long cropX = MAX(static_cast<A_long>(0), -offsetX);
+  const A_long cropY = MAX(static_cast<A_long>(0), -offsetY);
+  const size_t pixelSize = PF_WORLD_IS_DEEP(layer) ? sizeof(PF_Pixel16) : sizeof(PF_Pixel);
+
+  source.rowbytes = layer->rowbytes;
+  source.data = static_cast<const char *>(layer->data) +
+                static_cast<ptrdiff_t>(cropY) * layer->rowbytes + cropX * pixelSize;
+  source.offsetX = MAX(static_cast<A_long>(0), offsetX);
+  source.offsetY = MAX(static_cast<A_long>(0), offsetY);
+  source.width = MIN(layer->width - cropX, input->width - source.offsetX);
+  source.height = MIN(layer->height - cropY, input->height - source.offsetY);
+}
+
+/**
+ * Collect the sources the slices sample from: the Input, then each
+ * connected Source 2-4 layer in order.
+ *
+ * @param input Input layer (data must be valid)
+ * @param defs Checked-out Source 2-4 parameters
+ * @param numCheckedOut Number of valid entries in defs
+ * @param sources Output sources (MULTI_SOURCE_MAX)
+ * @return Number of sources (at least 1)
+ */
+static A_long GatherSliceSources(const PF_LayerDef *input, const PF_ParamDef *defs,
+                                 A_long numCheckedOut, SliceSource *sources) {
+  A_long numSources = 0;
+  sources[numSources].data = input->data;
+  sources[numSources].rowbytes = input->rowbytes;
+  sources[numSources].width = input->width;
+  sources[numSources].height = input->height;
+  sources[numSources].offsetX = 0;
+  sources[numSources].offsetY = 0;
+  numSources++;
+
+  for (A_long n = 0; n < numCheckedOut; n++) {
+    const PF_LayerDef *layer = &defs[n].u.ld;
+    if (layer->data && layer->width > 0 && layer->height > 0) {
+      PlaceExtraSource(input, layer, sources[numSources++]);
+    }
+  }
+  return numSources;
+}
+
+/**
+ * Grow a content rectangle by what a Source 2-4 layer can contribute.
+ *
+ * @param input Input layer
+ * @param layer Checked-out source layer (data must be valid)
+ * @param crop Whether to measure the layer's non-zero bounds (Crop to
+ *             Content) instead of using the whole layer
+ * @param content Rectangle to grow, in Input coordinates
+ */
+static void UnionSourceContent(const PF_LayerDef *input, const PF_LayerDef *layer,
+                               bool crop, PF_Rect &content) {
+  SliceSource source;
+  PlaceExtraSource(input, layer, source);
+
+  // Bounds within the placed (cropped) part of the layer
+  PF_Rect bounds = {0, 0, source.width, source.height};
+  if (crop) {
+    PF_Rect measured;
+    MeasureContentBounds(layer, measured);
+    const A_long cropX = MAX(static_cast<A_long>(0), (layer->width - input->width) / 2);
+    const A_long cropY = MAX(static_cast<A_long>(0), (layer->height - input->height) / 2);
+    bounds.left = MAX(measured.left - cropX, static_cast<A_long>(0));
+    bounds.top = MAX(measured.top - cropY, static_cast<A_long>(0));
+    bounds.right = MIN(measured.right - cropX, source.width);
+    bounds.bottom = MIN(measured.bottom - cropY, source.height);
+  }
+  if (bounds.left >= bounds.right || bounds.top >= bounds.bottom) {
+    return;
+  }
+
+  bounds.left += source.offsetX;
+  bounds.right += source.offsetX;
+  bounds.top += source.offsetY;
+  bounds.bottom += source.offsetY;
+  if (content.left >= content.right || content.top >= content.bottom) {
+    content = bounds;
+  } else {
+    content.left = MIN(content.left, bounds.left);
+    content.top = MIN(content.top, bounds.top);
+    content.right = MAX(content.right, bounds.right);
+    content.bottom = MAX(content.bottom, bounds.bottom);
+  }
+}
+
+/**
+ * Choose each slice's source.
+ *
+ * - Alternate: slice i draws from source i mod numSources
+ * - Random: a seeded draw per slice
+ * - Transition: every slice steps from the Input to the last source as
+ *   Source Transition goes from 0 to 100%, each at its own random moment,
+ *   so at 50% about half of the slices show the next clip (a slice wipe)
+ *
+ * With a single source everything stays on the Input.
+ *
+ * @param mode Source Selection popup value
+ * @param transition Source Transition (0.0-1.0)
+ * @param seed Random seed
+ * @param numSources Number of sources (1-MULTI_SOURCE_MAX)
+ * @param layout Slice layout whose segments receive the source index
+ */
+static void AssignSliceSources(A_long mode, float transition, A_long seed,
+                               A_long numSources, SliceLayout &layout) {
+  for (A_long i = 0; i < layout.numSlices; i++) {
+    SliceSegment &segment = layout.segments[i];
+    A_long sourceSeed = (seed * SOURCE_SEED_MULT + i * SOURCE_SEED_OFFSET) & 0x7FFF;
+    float random = GetRandomValue(sourceSeed, 0);
+
+    A_long source = 0;
+    if (numSources > 1) {
+      if (mode == SOURCE_MODE_RANDOM) {
+        source = static_cast<A_long>(random * numSources);
+      } else if (mode == SOURCE_MODE_TRANSITION) {
+        // Each step between sources starts at the slice's own random delay
+        source = static_cast<A_long>(floorf(transition * (numSources - 1) + random));
+      } else {
+        source = i % numSources;
+      }
+    }
+    segment.source = CLAMP(source, static_cast<A_long>(0), numSources - 1);
+  }
+}
+
+// =============================================================================
+// Per-slice export - each visible slice as its own image (offline)
+// =============================================================================
+
+/**
+ * Render one slice-space row of every exported slice that crosses it.
+ *
+ * Slice space is the layout rotated around the anchor so that each slice
+ * is a vertical band and its shift moves straight down the band; an
+ * exported image is a rectangle of that space. Along a row the layout
+ * position and its shifted source are both linear, so ClipSpan finds the
+ * part of each image row whose samples can land on the content, and only
+ * that part is sampled (the rest is zero). Pixels are tested against the
+ * slice's own feathered band; RGB is kept and alpha is scaled by the
+ * coverage, so the slice composites back as it appears in the frame.
+ * Called through iterate_generic, one row per call.
+ *
+ * @param refcon Pointer to SliceExportContext
+ * @param thread_index Worker thread index (unused)
+ * @param y Row to render, counted from the context's top
+ * @param iterations Total number of rows (unused)
+ * @return PF_Err error code (always PF_Err_NONE)
+ */
+template <typename PixelType, typename ChannelType, ChannelType MaxChannel,
+          PixelType (*SampleFunc)(float, float, const SliceSource *)>
+static PF_Err ExportSliceRowT(void *refcon, A_long thread_index, A_long y,
+                              A_long iterations) {
+  (void)thread_index;
+  (void)iterations;
+  const SliceExportContext *ec = reinterpret_cast<const SliceExportContext *>(refcon);
+  const SliceContext *ctx = ec->slices;
+  const A_long sliceY = ec->top + y;
+  const float c = ctx->angleCos;
+  const float s = ctx->angleSin;
+  const float srcMinX = ctx->content.left - SPAN_SOURCE_MARGIN;
+  const float srcMaxX = ctx->content.right - 1.0f + SPAN_SOURCE_MARGIN;
+  const float srcMinY = ctx->content.top - SPAN_SOURCE_MARGIN;
+  const float srcMaxY = ctx->content.bottom - 1.0f + SPAN_SOURCE_MARGIN;
+  const float maxC = static_cast<float>(MaxChannel);
+
+  for (A_long n = 0; n < ec->numImages; ++n) {
+    const SliceExportImage &image = ec->images[n];
+    if (sliceY < image.top || sliceY >= image.top + image.height) {
+      continue;
+    }
+    PixelType *row = reinterpret_cast<PixelType *>(ec->pixels) + image.offset +
+                     static_cast<size_t>(sliceY - image.top) * image.width;
+    memset(row, 0, sizeof(PixelType) * image.width);
+
+    // Layout position of pixel x: (layoutX0 + x * c, layoutY0 + x * s)
+    const SliceSegment &seg = ctx->segments[image.index];
+    const float dx = static_cast<float>(image.left) - ctx->centerX;
+    const float dy = static_cast<float>(sliceY) - ctx->centerY;
+    const float layoutX0 = ctx->centerX + dx * c - dy * s;
+    const float layoutY0 = ctx->centerY + dx * s + dy * c;
+    const float offsetPixels =
+        ctx->shiftAmount * seg.shiftRandomFactor * seg.shiftDirection;
+    const float srcX0 = layoutX0 + ctx->shiftDirX * offsetPixels;
+    const float srcY0 = layoutY0 + ctx->shiftDirY * offsetPixels;
+
+    A_long x0 = 0;
+    A_long x1 = image.width - 1;
+    if (!ClipSpan(srcX0 - srcMinX, c, x0, x1) || !ClipSpan(srcMaxX - srcX0, -c, x0, x1) ||
+        !ClipSpan(srcY0 - srcMinY, s, x0, x1) || !ClipSpan(srcMaxY - srcY0, -s, x0, x1)) {
+      continue;
+    }
+    // Perspective slices: only what is in front of the camera shows
+    if (ctx->transforms) {
+      const float *fwd = ctx->transforms[image.index].forward;
+      const float w0 = fwd[6] * layoutX0 + fwd[7] * layoutY0 + fwd[8];
+      if (!ClipSpan(w0 - CAMERA_NEAR_W, fwd[6] * c + fwd[7] * s, x0, x1)) {
+        continue;
+      }
+    }
+
+    for (A_long x = x0; x <= x1; ++x) {
+      const float step = static_cast<float>(x);
+      const float coverage =
+          SliceCoverage(seg, SlicePositionAt(ctx, layoutX0 + step * c, layoutY0 + step * s));
+      if (coverage <= COVERAGE_THRESHOLD) {
+        continue;
+      }
+      PixelType p = SampleFunc(srcX0 + step * c, srcY0 + step * s, &ctx->sources[seg.source]);
+      p.alpha = static_cast<ChannelType>(CLAMP(p.alpha * coverage + 0.5f, 0.0f, maxC));
+      row[x] = p;
+    }
+  }
+  return PF_Err_NONE;
+}
+
+static PF_Err ExportSliceRow8(void *refcon, A_long thread_index, A_long y, A_long iterations) {
+  return ExportSliceRowT<PF_Pixel, A_u_char, 255, SampleSourcePixel8>(refcon, thread_index, y, iterations);
+}
+
+static PF_Err ExportSliceRow16(void *refcon, A_long thread_index, A_long y, A_long iterations) {
+  return ExportSliceRowT<PF_Pixel16, A_u_short, PF_MAX_CHAN16, SampleSourcePixel16>(refcon, thread_index, y, iterations);
+}
+
+/**
+ * Write a packed RGBA buffer as a PAM image (16-bit samples are big-endian
+ * with AE's 0-32768 range as MAXVAL). The image is written under a
+ * temporary name and replaces path whole.
+ *
+ * @return false if the file could not be written
+ */
+static bool WritePAM(const char *path, const void *pixels, A_long width,
+                     A_long height, bool deep) {
+  char temporary[SLICE_EXPORT_PATH_SIZE + 64];
+  TemporaryPath(path, pixels, temporary, sizeof(temporary));
+  FILE *file = fopen(temporary, "wb");
+  if (!file) {
+    return false;
+  }
+  fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL %d\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+          static_cast<int>(width), static_cast<int>(height),
+          deep ? PF_MAX_CHAN16 : 255);
+
+  const size_t count = static_cast<size_t>(width) * height;
+  bool ok = true;
+  for (size_t i = 0; ok && i < count; i++) {
+    if (deep) {
+      const PF_Pixel16 &p = reinterpret_cast<const PF_Pixel16 *>(pixels)[i];
+      const A_u_short channels[4] = {p.red, p.green, p.blue, p.alpha};
+      A_u_char bytes[8];
+      for (int c = 0; c < 4; c++) {
+        bytes[2 * c] = static_cast<A_u_char>(channels[c] >> 8);
+        bytes[2 * c + 1] = static_cast<A_u_char>(channels[c] & 0xFF);
+      }
+      ok = fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+    } else {
+      const PF_Pixel &p = reinterpret_cast<const PF_Pixel *>(pixels)[i];
+      const A_u_char bytes[4] = {p.red, p.green, p.blue, p.alpha};
+      ok = fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+    }
+  }
+  ok = (fclose(file) == 0) && ok;
+  if (!ok) {
+    remove(temporary);
+    return false;
+  }
+  return ReplaceWithFile(temporary, path);
+}
+
+// Whether a render is final output: high quality at full resolution. RAM
+// previews at other settings are skipped; one at final settings renders the
+// same pixels.
+static bool IsFinalOutputRender(const PF_InData *in_data) {
+  return in_data->quality == PF_Quality_HI &&
+         GetDownscaleFactor(in_data->downsample_x) == 1.0f &&
+         GetDownscaleFactor(in_data->downsample_y) == 1.0f;
+}
+
+/**
+ * Write every visible slice of the frame as its own image.
+ *
+ * Each image is the slice-aligned rectangle around the slice's content
+ * (ClipSliceContent) in slice space, so it is the slice's band width by
+ * the length of the content along it, at any angle. All images share one
+ * buffer and are rendered in a single pass over the slice-space rows
+ * (ExportSliceRowT); together they hold about the frame's visible content
+ * once, plus a feathered margin along each slice. Images are named
+ * <dir>/slice_f<frame>_s<index>.pam. The sidecar <dir>/slices_f<frame>.json
+ * lists each image with the 3x3 row-major transform taking its pixel
+ * (u, v, 1) to layer coordinates (x w, y w, w): the rotation into the
+ * layout, then the slice's own transform if it has one. Layer coordinates
+ * times the scale, plus the output origin, are buffer coordinates. The
+ * sidecar is written last. Slices are exported at layer resolution. Every
+ * file is written under a temporary name and replaces the previous one
+ * whole, so renders of the same frame on other threads or processes never
+ * leave a mix of both. A file that cannot be written stops the export but
+ * not the render.
+ *
+ * @param in_data For the frame number and output origin
+ * @param ctx Render context (layout fields set)
+ * @param layout Slice layout of this frame
+ * @param suites Suite handler for iterate_generic and scratch memory
+ * @param directory Export directory
+ * @param deep Whether the layer is 16-bit
+ * @return PF_Err error code
+ */
+static PF_Err ExportSlices(PF_InData *in_data, const SliceContext *ctx,
+                           const SliceLayout &layout, AEGP_SuiteHandler &suites,
+                           const char *directory, bool deep) {
+  PF_Err err = PF_Err_NONE;
+  const A_long frame = in_data->current_time / MAX(in_data->time_step, static_cast<A_long>(1));
+  const size_t pixelSize = deep ? sizeof(PF_Pixel16) : sizeof(PF_Pixel);
+  const float c = layout.angleCos;
+  const float s = layout.angleSin;
+  static const float identity[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+                                    0.0f, 0.0f, 0.0f, 1.0f};
+  char path[SLICE_EXPORT_PATH_SIZE];
+  char sidecarPath[SLICE_EXPORT_PATH_SIZE];
+  char sidecarTemporary[SLICE_EXPORT_PATH_SIZE + 64];
+  PF_Handle imagesHandle = nullptr;
+  PF_Handle pixelsHandle = nullptr;
+  SliceExportContext exportContext;
+  AEFX_CLR_STRUCT(exportContext);
+  SliceExportImage *images = nullptr;
+  size_t totalPixels = 0;
+  A_long bottom = 0;
+  bool complete = true;
+
+  snprintf(sidecarPath, sizeof(sidecarPath), "%s/slices_f%05d.json", directory,
+           static_cast<int>(frame));
+  TemporaryPath(sidecarPath, ctx, sidecarTemporary, sizeof(sidecarTemporary));
+  FILE *sidecar = fopen(sidecarTemporary, "w");
+  if (!sidecar) {
+    return PF_Err_NONE;
+  }
+  fprintf(sidecar,
+          "{\n  \"frame\": %d,\n  \"origin\": [%d, %d],\n  \"scale\": %g,\n  \"slices\": [",
+          static_cast<int>(frame), static_cast<int>(in_data->output_origin_x),
+          static_cast<int>(in_data->output_origin_y), 1.0 / ctx->pixelScale);
+
+  // Slice-space rectangle of each slice's content
+  imagesHandle = suites.HandleSuite1()->host_new_handle(
+      sizeof(SliceExportImage) * MAX(ctx->lastSlice - ctx->firstSlice + 1, static_cast<A_long>(1)));
+  if (!imagesHandle || !*imagesHandle) {
+    err = PF_Err_OUT_OF_MEMORY;
+  } else {
+    images = *reinterpret_cast<SliceExportImage **>(imagesHandle);
+  }
+  for (A_long i = ctx->firstSlice; !err && i <= ctx->lastSlice; i++) {
+    float polyX[8], polyY[8];
+    const int n = ClipSliceContent(layout, ctx->content, i, polyX, polyY);
+    if (n == 0) {
+      continue;
+    }
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    for (int v = 0; v < n; ++v) {
+      const float dx = polyX[v] - layout.centerX;
+      const float dy = polyY[v] - layout.centerY;
+      const float sliceX = layout.centerX + dx * c + dy * s;
+      const float sliceY = layout.centerY - dx * s + dy * c;
+      minX = MIN(minX, sliceX);
+      minY = MIN(minY, sliceY);
+      maxX = MAX(maxX, sliceX);
+      maxY = MAX(maxY, sliceY);
+    }
+    SliceExportImage &image = images[exportContext.numImages];
+    image.index = i;
+    image.left = static_cast<A_long>(floorf(minX)) - BOUNDS_MARGIN;
+    image.top = static_cast<A_long>(floorf(minY)) - BOUNDS_MARGIN;
+    image.width = static_cast<A_long>(ceilf(maxX)) + BOUNDS_MARGIN - image.left;
+    image.height = static_cast<A_long>(ceilf(maxY)) + BOUNDS_MARGIN - image.top;
+    image.offset = totalPixels;
+    totalPixels += static_cast<size_t>(image.width) * image.height;
+    if (exportContext.numImages == 0 || image.top < exportContext.top) {
+      exportContext.top = image.top;
+    }
+    if (exportContext.numImages == 0 || image.top + image.height > bottom) {
+      bottom = image.top + image.height;
+    }
+    exportContext.numImages++;
+  }
+
+  // Render all of them in one pass over the slice-space rows
+  if (!err && exportContext.numImages > 0) {
+    pixelsHandle = suites.HandleSuite1()->host_new_handle(totalPixels * pixelSize);
+    if (!pixelsHandle || !*pixelsHandle) {
+      err = PF_Err_OUT_OF_MEMORY;
+    } else {
+      exportContext.slices = ctx;
+      exportContext.images = images;
+      exportContext.pixels = *pixelsHandle;
+      err = suites.Iterate8Suite1()->iterate_generic(bottom - exportContext.top, &exportContext,
+                                                     deep ? ExportSliceRow16 : ExportSliceRow8);
+    }
+  }
+
+  for (A_long n = 0; !err && n < exportContext.numImages; n++) {
+    const SliceExportImage &image = images[n];
+    snprintf(path, sizeof(path), "%s/slice_f%05d_s%04d.pam", directory,
+             static_cast<int>(frame), static_cast<int>(image.index));
+    if (!WritePAM(path, static_cast<const char *>(exportContext.pixels) + image.offset * pixelSize,
+                  image.width, image.height, deep)) {
+      complete = false;
+      break;
+    }
+
+    // Image pixel -> slice space -> layout (rotation), then the slice's
+    // own transform
+    const float dx = static_cast<float>(image.left) - layout.centerX;
+    const float dy = static_cast<float>(image.top) - layout.centerY;
+    const float toLayout[9] = {c, -s, layout.centerX + dx * c - dy * s,
+                               s, c, layout.centerY + dx * s + dy * c,
+                               0.0f, 0.0f, 1.0f};
+    const float *fwd = layout.transforms ? layout.transforms[image.index].forward : identity;
+    fprintf(sidecar,
+            "%s\n    {\"index\": %d, \"file\": \"slice_f%05d_s%04d.pam\", "
+            "\"width\": %d, \"height\": %d, \"source\": %d, \"transform\": [",
+            n ? "," : "", static_cast<int>(image.index), static_cast<int>(frame),
+            static_cast<int>(image.index), static_cast<int>(image.width),
+            static_cast<int>(image.height), static_cast<int>(ctx->segments[image.index].source));
+    for (int row = 0; row < 3; row++) {
+      for (int col = 0; col < 3; col++) {
+        const float value = fwd[row * 3] * toLayout[col] + fwd[row * 3 + 1] * toLayout[3 + col] +
+                            fwd[row * 3 + 2] * toLayout[6 + col];
+        fprintf(sidecar, "%s%g", (row || col) ? ", " : "", value);
+      }
+    }
+    fprintf(sidecar, "]}");
+  }
+
+  fprintf(sidecar, "\n  ]\n}\n");
+  complete = (fclose(sidecar) == 0) && complete && !err;
+  if (complete) {
+    ReplaceWithFile(sidecarTemporary, sidecarPath);
+  } else {
+    remove(sidecarTemporary);
+  }
+  if (pixelsHandle) {
+    suites.HandleSuite1()->host_dispose_handle(pixelsHandle);
+  }
+  if (imagesHandle) {
+    suites.HandleSuite1()->host_dispose_handle(imagesHandle);
+  }
+  return err;
+}
+
+/**
+ * Sort the rendered output along the slices (Pixel Sort pass).
+ *
+ * Sets up the digital lines parallel to the slice direction over the whole
+ * output buffer and sorts them in parallel with SortLinesT. Ascending order
+ * follows the slice direction, so the result rotates with the Angle.
+ *
+ * @param ctx Render context (dst* set, output already rendered)
+ * @param params Effect parameters
+ * @param suites Suite handler for iterate_generic and scratch memory
+ * @param outputHeight Height of the output buffer
+ * @param deep Whether the output is 16-bit
+ * @return PF_Err error code
+ */
+static PF_Err SortSlicePixels(const SliceContext *ctx, PF_ParamDef *params[],
+                              AEGP_SuiteHandler &suites, A_long outputHeight,
+                              bool deep) {
+  PixelSortContext sortContext;
+  AEFX_CLR_STRUCT(sortContext);
+  sortContext.slices = ctx;
+  sortContext.handleSuite = suites.HandleSuite1();
+  sortContext.mode = params[MULTISLICER_PIXEL_SORT]->u.pd.value;
+  sortContext.threshold = static_cast<float>(params[MULTISLICER_SORT_THRESHOLD]->u.fs_d.value) / 100.0f;
+  sortContext.width = ctx->dstWidth;
+  sortContext.height = outputHeight;
+
+  // Walk the major axis of the slice direction one pixel at a time
+  sortContext.yMajor = fabsf(ctx->shiftDirY) >= fabsf(ctx->shiftDirX);
+  float major = sortContext.yMajor ? ctx->shiftDirY : ctx->shiftDirX;
+  float minor = sortContext.yMajor ? ctx->shiftDirX : ctx->shiftDirY;
+  sortContext.slope = minor / major;
+  sortContext.descending = (major < 0.0f);
+  sortContext.lineLength = sortContext.yMajor ? sortContext.height : sortContext.width;
+
+  // Lines are offsets along the minor axis that reach the buffer at any step
+  A_long minorSize = sortContext.yMajor ? sortContext.width : sortContext.height;
+  A_long endOffset = static_cast<A_long>(
+      floorf((sortContext.lineLength - 1) * sortContext.slope + 0.5f));
+  sortContext.firstLine = -MAX(static_cast<A_long>(0), endOffset);
+  sortContext.numLines = minorSize - MIN(static_cast<A_long>(0), endOffset) - sortContext.firstLine;
+
+  if (sortContext.lineLength <= 0 || sortContext.numLines <= 0) {
+    return PF_Err_NONE;
+  }
+
+  return suites.Iterate8Suite1()->iterate_generic(
+      PF_Iterations_ONCE_PER_PROCESSOR, &sortContext,
+      deep ? SortLines16Callback : SortLines8Callback);
+}
+
+// =============================================================================
+// Performance statistics - per-instance totals for PF_Cmd_COMPLETELY_GENERAL
+// =============================================================================
+
+// Totals of one effect instance. MFR render threads cannot write sequence
+// data, so the totals live here, keyed by the id in the instance's
+// sequence data, and sequence setdown drops them.
+struct InstanceStats {
+  A_u_longlong frames = 0;
+  A_u_longlong failedFrames = 0;
+  A_u_longlong totalNs = 0;
+  A_u_longlong maxNs = 0;
+  A_u_longlong histogram[STATS_HISTOGRAM_BINS] = {};
+  A_u_longlong paths[STATS_PATH_COUNT] = {};
+  A_u_longlong resampledFrames = 0;
+  A_u_longlong sortedFrames = 0;
+  A_u_longlong geometryHits = 0;
+  A_u_longlong geometryBuilds = 0;
+  A_u_longlong geometryMisses = 0;
+  A_u_longlong frameSetups = 0;
+  A_u_longlong expansionBytes = 0;
+  A_u_longlong draftFrames = 0;
+  A_u_longlong reducedFrames = 0;
+  A_u_longlong overBudgetFrames = 0;
+  double budgetMs = 0.0;  // of the latest budgeted render
+  double nsPerWork = 0.0; // running average of measured time per work unit
+};
+
+// What one render did, filled in by Render
+struct RenderStatsSample {
+  A_long path = -1; // STATS_PATH_*, -1 when no renderer ran
+  A_long resampleFactor = 1; // subsamples per output pixel, per axis
+  bool sorted = false;
+  bool geometryTried = false; // eligible for the geometry cache
+  bool geometryUsed = false;
+  bool geometryBuilt = false;
+  bool geometryWarmed = false; // the map came from a warm-up
+  bool geometryLoaded = false; // the map came from the layout cache
+  const char *geometryMiss = nullptr; // why an eligible render had no map
+  double work = 0.0;    // estimated cost of what was rendered, in Mwork
+  bool draft = false;   // frame budget: draft sampling
+  bool reduced = false; // frame budget: half resolution
+  double fullMs = 0.0;  // frame budget: estimated time at full quality
+  double budgetMs = 0.0; // frame budget the host gave the render, 0 for none
+};
+
+static std::mutex sStatsMutex;
+static std::map<A_u_long, InstanceStats> sInstanceStats;
+static A_u_long sLastInstance = 0;
+// Ids of this session held by an instance's sequence data right now
+static std::set<A_u_long> sLiveInstances;
+
+// Read-only sequence data for render threads (AE 2022 and later), acquired
+// at global setup; MFR renders must not touch in_data->sequence_data
+static const PF_EffectSequenceDataSuite1 *sSequenceDataSuite = nullptr;
+
+// Ids restart with every session; sequence data from another one (a saved
+// project) is told apart by this stamp
+static A_u_long StatsSession() {
+  static const A_u_long session = static_cast<A_u_long>(
+      std::chrono::system_clock::now().time_since_epoch().count() | 1);
+  return session;
+}
+
+// The instance's sequence data, or nullptr when it has none of ours
+static SequenceData *GetSequenceData(PF_InData *in_data) {
+  if (!in_data->sequence_data || !*in_data->sequence_data) {
+    return nullptr;
+  }
+  AEGP_SuiteHandler suites(in_data->pica_basicP);
+  if (suites.HandleSuite1()->host_get_handle_size(in_data->sequence_data) <
+      sizeof(SequenceData)) {
+    return nullptr;
+  }
+  SequenceData *data = *reinterpret_cast<SequenceData **>(in_data->sequence_data);
+  return (data->magic == SEQUENCE_DATA_MAGIC) ? data : nullptr;
+}
+
+// The instance's sequence data through PF_GetConstSequenceData, or
+// in_data->sequence_data on hosts without it (which render on one thread)
+static const SequenceData *GetConstSequenceData(PF_InData *in_data) {
+  PF_ConstHandle handle = nullptr;
+  if (!sSequenceDataSuite ||
+      sSequenceDataSuite->PF_GetConstSequenceData(in_data->effect_ref, &handle)) {
+    return GetSequenceData(in_data);
+  }
+  if (!handle || !*handle) {
+    return nullptr;
+  }
+  const SequenceData *data = *reinterpret_cast<const SequenceData *const *>(handle);
+  return (data->magic == SEQUENCE_DATA_MAGIC) ? data : nullptr;
+}
+
+// Statistics id of the instance, 0 (never recorded) without sequence data.
+// Safe on render threads.
+static A_u_long GetStatsInstance(PF_InData *in_data) {
+  const SequenceData *data = GetConstSequenceData(in_data);
+  return (data && data->session == StatsSession()) ? data->instance : 0;
+}
+
+// Acquire the sequence data suite (global setup)
+static void AcquireSequenceDataSuite(PF_InData *in_data) {
+  const void *suite = nullptr;
+  if (!sSequenceDataSuite && in_data->pica_basicP &&
+      !in_data->pica_basicP->AcquireSuite(kPFEffectSequenceDataSuite,
+                                          kPFEffectSequenceDataSuiteVersion1, &suite)) {
+    sSequenceDataSuite = static_cast<const PF_EffectSequenceDataSuite1 *>(suite);
+  }
+}
+
+// Release the sequence data suite (global setdown)
+static void ReleaseSequenceDataSuite(PF_InData *in_data) {
+  if (sSequenceDataSuite) {
+    in_data->pica_basicP->ReleaseSuite(kPFEffectSequenceDataSuite,
+                                       kPFEffectSequenceDataSuiteVersion1);
+    sSequenceDataSuite = nullptr;
+  }
+}
+
+// Totals of an instance, created on first use; nullptr for id 0 or without
+// memory. Call with sStatsMutex held.
+static InstanceStats *FindInstanceStats(A_u_long instance) {
+  if (!instance) {
+    return nullptr;
+  }
+  try {
+    return &sInstanceStats[instance];
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+// Render time bin: four per octave, from 1 us
+static A_long StatsHistogramBin(A_u_longlong ns) {
+  const double us = ns * 1e-3;
+  if (us <= 1.0) {
+    return 0;
+  }
+  return MIN(static_cast<A_long>(4.0 * log2(us)), static_cast<A_long>(STATS_HISTOGRAM_BINS - 1));
+}
+
+// The frame budget a stand-in host passed with PF_Cmd_RENDER, or null
+static MultiSlicerFrameBudget *GetFrameBudget(void *extra) {
+  MultiSlicerFrameBudget *budget = static_cast<MultiSlicerFrameBudget *>(extra);
+  return (budget && budget->magic == FRAME_BUDGET_MAGIC) ? budget : nullptr;
+}
+
+/**
+ * Estimated cost of one row renderer over a frame (see RENDER_COST_*).
+ *
+ * @param path STATS_PATH_* renderer
+ * @param pixels Output pixels, in millions
+ * @param samples Rendered samples, in millions (pixels times subsamples)
+ * @param prefiltered Whether slice rows run with Prefilter Slices
+ * @param sorted Whether a Pixel Sort pass follows
+ * @return Estimated cost in millions of work units
+ */
+static double EstimateRenderWork(A_long path, double pixels, double samples, bool prefiltered,
+                                 bool sorted) {
+  static const double pathCosts[STATS_PATH_COUNT] = {
+      RENDER_COST_PASS_THROUGH, RENDER_COST_SLICE_ROWS, RENDER_COST_CACHED_ROWS,
+      RENDER_COST_TRANSFORMED_ROWS};
+  if (path == STATS_PATH_PASS_THROUGH) {
+    return pixels * pathCosts[path];
+  }
+  double work = samples * pathCosts[path];
+  if (path == STATS_PATH_SLICE_ROWS && prefiltered) {
+    work += samples * RENDER_COST_PREFILTER;
+  }
+  if (sorted) {
+    work += pixels * RENDER_COST_PIXEL_SORT;
+  }
+  return work;
+}
+
+// Measured ns per work unit of the instance's recent renders, 0 before its
+// first
+static double GetInstanceCostRate(PF_InData *in_data) {
+  const A_u_long instance = GetStatsInstance(in_data);
+  if (!instance) {
+    return 0.0;
+  }
+  std::lock_guard<std::mutex> lock(sStatsMutex);
+  auto found = sInstanceStats.find(instance);
+  return (found != sInstanceStats.end()) ? found->second.nsPerWork : 0.0;
+}
+
+/**
+ * Add one render to its instance's totals.
+ *
+ * @param in_data Input data of the render (sequence data)
+ * @param sample What the render did
+ * @param err Result of the render
+ * @param ns Time spent in Render
+ */
+static void RecordRenderStats(PF_InData *in_data, const RenderStatsSample &sample, PF_Err err,
+                              A_u_longlong ns) {
+  const A_u_long instance = GetStatsInstance(in_data);
+  if (!instance) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(sStatsMutex);
+  InstanceStats *stats = FindInstanceStats(instance);
+  if (!stats) {
+    return;
+  }
+  if (err) {
+    stats->failedFrames++;
+    return;
+  }
+  stats->frames++;
+  stats->totalNs += ns;
+  stats->maxNs = MAX(stats->maxNs, ns);
+  stats->histogram[StatsHistogramBin(ns)]++;
+  if (sample.path >= 0 && sample.path < STATS_PATH_COUNT) {
+    stats->paths[sample.path]++;
+  }
+  if (sample.work > 0.0) {
+    const double rate = ns / sample.work;
+    stats->nsPerWork = stats->nsPerWork > 0.0 ? stats->nsPerWork + RENDER_COST_RATE_WEIGHT *
+                                                                       (rate - stats->nsPerWork)
+                                              : rate;
+  }
+  stats->draftFrames += sample.draft ? 1 : 0;
+  stats->reducedFrames += sample.reduced ? 1 : 0;
+  if (sample.budgetMs > 0.0) {
+    stats->budgetMs = sample.budgetMs;
+    stats->overBudgetFrames += (ns * 1e-6 > sample.budgetMs) ? 1 : 0;
+  }
+  stats->resampledFrames += (sample.resampleFactor > 1) ? 1 : 0;
+  stats->sortedFrames += sample.sorted ? 1 : 0;
+  if (sample.geometryTried) {
+    if (!sample.geometryUsed) {
+      stats->geometryMisses++;
+    } else if (sample.geometryBuilt) {
+      stats->geometryBuilds++;
+    } else {
+      stats->geometryHits++;
+    }
+  }
+}
+
+// Add one frame setup, and the buffer it asked for beyond the layer
+static void RecordFrameSetupStats(PF_InData *in_data, PF_OutData *out_data,
+                                  PF_ParamDef *params[]) {
+  const A_u_long instance = GetStatsInstance(in_data);
+  if (!instance) {
+    return;
+  }
+  const PF_LayerDef *input = &params[MULTISLICER_INPUT]->u.ld;
+  const double layerPixels = static_cast<double>(input->width) * input->height;
+  const double bufferPixels = (out_data->width > 0 && out_data->height > 0)
+                                  ? static_cast<double>(out_data->width) * out_data->height
+                                  : layerPixels;
+  const double pixelSize = PF_WORLD_IS_DEEP(input) ? sizeof(PF_Pixel16) : sizeof(PF_Pixel8);
+
+  std::lock_guard<std::mutex> lock(sStatsMutex);
+  InstanceStats *stats = FindInstanceStats(instance);
+  if (stats) {
+    stats->frameSetups++;
+    stats->expansionBytes +=
+        static_cast<A_u_longlong>(MAX(bufferPixels - layerPixels, 0.0) * pixelSize);
+  }
+}
+
+// New sequence data with a new statistics id
+static PF_Err SequenceSetup(PF_InData *in_data, PF_OutData *out_data) {
+  AEGP_SuiteHandler suites(in_data->pica_basicP);
+  PF_Handle handle = suites.HandleSuite1()->host_new_handle(sizeof(SequenceData));
+  if (!handle || !*handle) {
+    return PF_Err_OUT_OF_MEMORY;
+  }
+  SequenceData *data = *reinterpret_cast<SequenceData **>(handle);
+  data->magic = SEQUENCE_DATA_MAGIC;
+  data->session = StatsSession();
+  {
+    std::lock_guard<std::mutex> lock(sStatsMutex);
+    data->instance = ++sLastInstance;
+    try {
+      sLiveInstances.insert(data->instance);
+    } catch (const std::bad_alloc &) {
+      // A duplicate of this instance then keeps its id
+    }
+  }
+  out_data->sequence_data = handle;
+  return PF_Err_NONE;
+}
+
+// Sequence data was loaded or duplicated. An id of this session that no
+// instance holds any more (an effect deleted and brought back by undo) is
+// kept; one another instance still holds (a duplicate of it) or one from
+// another session is replaced, so every instance has totals of its own.
+static PF_Err SequenceResetup(PF_InData *in_data, PF_OutData *out_data) {
+  SequenceData *data = GetSequenceData(in_data);
+  if (!data) {
+    if (in_data->sequence_data) {
+      AEGP_SuiteHandler suites(in_data->pica_basicP);
+      suites.HandleSuite1()->host_dispose_handle(in_data->sequence_data);
+    }
+    return SequenceSetup(in_data, out_data);
+  }
+
+  std::lock_guard<std::mutex> lock(sStatsMutex);
+  if (data->session != StatsSession() || sLiveInstances.count(data->instance)) {
+    data->session = StatsSession();
+    data->instance = ++sLastInstance;
+  }
+  try {
+    sLiveInstances.insert(data->instance);
+  } catch (const std::bad_alloc &) {
+  }
+  out_data->sequence_data = in_data->sequence_data;
+  return PF_Err_NONE;
+}
+
+// Drop the instance's totals, its last geometry key and its sequence data
+static PF_Err SequenceSetdown(PF_InData *in_data, PF_OutData *out_data) {
+  const A_u_long instance = GetStatsInstance(in_data);
+  if (instance) {
+    {
+      std::lock_guard<std::mutex> lock(sStatsMutex);
+      sInstanceStats.erase(instance);
+      sLiveInstances.erase(instance);
+    }
+    ForgetGeometryInstance(instance);
+  }
+  if (in_data->sequence_data) {
+    AEGP_SuiteHandler suites(in_data->pica_basicP);
+    suites.HandleSuite1()->host_dispose_handle(in_data->sequence_data);
+  }
+  out_data->sequence_data = nullptr;
+  return PF_Err_NONE;
+}
+
+// A copy of the (already flat) sequence data, for saving while renders run
+static PF_Err GetFlattenedSequenceData(PF_InData *in_data, PF_OutData *out_data) {
+  const SequenceData *data = GetSequenceData(in_data);
+  if (!data) {
+    return PF_Err_NONE;
+  }
+  AEGP_SuiteHandler suites(in_data->pica_basicP);
+  PF_Handle handle = suites.HandleSuite1()->host_new_handle(sizeof(SequenceData));
+  if (!handle || !*handle) {
+    return PF_Err_OUT_OF_MEMORY;
+  }
+  **reinterpret_cast<SequenceData **>(handle) = *data;
+  out_data->sequence_data = handle;
+  return PF_Err_NONE;
+}
+
+/**
+ * Answer a statistics request sent with PF_Cmd_COMPLETELY_GENERAL.
+ *
+ * Calls whose extra is not a MultiSlicerStats (other AEGPs) are left alone.
+ * The average and 99th percentile are over successful renders; the
+ * percentile is the upper bound of its histogram bin, within 19%.
+ *
+ * @param in_data Input data of the call (sequence data)
+ * @param extra The caller's MultiSlicerStats
+ * @return PF_Err error code (always PF_Err_NONE)
+ */
+static PF_Err AnswerStatsRequest(PF_InData *in_data, void *extra) {
+  MultiSlicerStats *request = static_cast<MultiSlicerStats *>(extra);
+  if (!request || request->magic != STATS_MAGIC ||
+      request->size < offsetof(MultiSlicerStats, frames)) {
+    return PF_Err_NONE;
+  }
+
+  MultiSlicerStats answer;
+  AEFX_CLR_STRUCT(answer);
+  answer.magic = STATS_MAGIC;
+  answer.version = STATS_VERSION;
+  answer.size = static_cast<A_u_long>(MIN(static_cast<size_t>(request->size), sizeof(answer)));
+  answer.flags = request->flags;
+  answer.instance = GetStatsInstance(in_data);
+
+  if (answer.instance) {
+    std::lock_guard<std::mutex> lock(sStatsMutex);
+    auto found = sInstanceStats.find(answer.instance);
+    if (found != sInstanceStats.end()) {
+      InstanceStats &stats = found->second;
+      answer.frames = stats.frames;
+      answer.failedFrames = stats.failedFrames;
+      answer.maxMs = stats.maxNs * 1e-6;
+      if (stats.frames) {
+        answer.averageMs = stats.totalNs * 1e-6 / stats.frames;
+        const A_u_longlong rank = (stats.frames * 99 + 99) / 100;
+        A_u_longlong count = 0;
+        for (A_long bin = 0; bin < STATS_HISTOGRAM_BINS; bin++) {
+          count += stats.histogram[bin];
+          if (count >= rank) {
+            answer.p99Ms = MIN(pow(2.0, (bin + 1) / 4.0) * 1e-3, answer.maxMs);
+            break;
+          }
+        }
+      }
+      for (A_long path = 0; path < STATS_PATH_COUNT; path++) {
+        answer.paths[path] = stats.paths[path];
+      }
+      answer.resampledFrames = stats.resampledFrames;
+      answer.sortedFrames = stats.sortedFrames;
+      answer.geometryHits = stats.geometryHits;
+      answer.geometryBuilds = stats.geometryBuilds;
+      answer.geometryMisses = stats.geometryMisses;
+      answer.frameSetups = stats.frameSetups;
+      answer.expansionBytes = stats.expansionBytes;
+      answer.draftFrames = stats.draftFrames;
+      answer.reducedFrames = stats.reducedFrames;
+      answer.overBudgetFrames = stats.overBudgetFrames;
+      answer.budgetMs = stats.budgetMs;
+      if (request->flags & STATS_RESET) {
+        stats = InstanceStats();
+      }
+    }
+  }
+
+  memcpy(request, &answer, answer.size);
+  return PF_Err_NONE;
+}
+
+// =============================================================================
+// Frame setup - output buffer size
+// =============================================================================
+
+// Whether any Source 2-4 layer is connected (slices may then switch
+// sources even when nothing moves)
+static bool HasExtraSources(PF_InData *in_data) {
+  PF_ParamDef sourceDefs[MULTI_SOURCE_MAX - 1];
+  A_long numSourceDefs = 0;
+  bool connected = false;
+  PF_Err err = CheckoutExtraSources(in_data, sourceDefs, numSourceDefs);
+  for (A_long n = 0; n < numSourceDefs && !err; n++) {
+    connected = connected || (sourceDefs[n].u.ld.data != nullptr);
+  }
+  CheckinExtraSources(in_data, sourceDefs, numSourceDefs);
+  return connected;
+}
+
+// Output Scale as a factor (1.0 = 100%)
+static inline float GetOutputScale(PF_ParamDef *params[]) {
+  return MAX(static_cast<float>(params[MULTISLICER_OUTPUT_SCALE]->u.fs_d.value) / 100.0f,
+             OUTPUT_SCALE_TOLERANCE);
+}
+
+static inline bool IsOutputScaled(PF_ParamDef *params[]) {
+  return fabsf(GetOutputScale(params) - 1.0f) >= OUTPUT_SCALE_TOLERANCE;
+}
+
+/**
+ * Size the output buffer to a layer-space rectangle at Output Scale.
+ *
+ * @param out_data Receives the buffer size and the origin (buffer position
+ *                 of the layer's top-left corner)
+ * @param scale Output Scale factor
+ * @param left Layer-space bounds, right and bottom exclusive
+ */
+static void SetOutputRect(PF_OutData *out_data, float scale, int left, int top,
+                          int right, int bottom) {
+  if (scale != 1.0f) {
+    left = static_cast<int>(floorf(left * scale));
+    top = static_cast<int>(floorf(top * scale));
+    right = MAX(left + 1, static_cast<int>(ceilf(right * scale)));
+    bottom = MAX(top + 1, static_cast<int>(ceilf(bottom * scale)));
+  }
+  out_data->width = right - left;
+  out_data->height = bottom - top;
+  out_data->origin.h = static_cast<short>(CLAMP(-left, SHRT_MIN, SHRT_MAX));
+  out_data->origin.v = static_cast<short>(CLAMP(-top, SHRT_MIN, SHRT_MAX));
+}
+
+// Whether Render copies the input unchanged: a single slice, or nothing
+// that moves, narrows, re-sorts or re-sources the slices, at 100% Output Scale
+static bool IsPassThrough(PF_InData *in_data, PF_ParamDef *params[]) {
+  float width = params[MULTISLICER_WIDTH]->u.fs_d.value / 100.0f;
+  A_long numSlices = params[MULTISLICER_SLICES]->u.sd.value;
+  float downscale_x = GetDownscaleFactor(in_data->downsample_x);
+  float downscale_y = GetDownscaleFactor(in_data->downsample_y);
+  float shiftAmount =
+      fabsf(params[MULTISLICER_SHIFT]->u.fs_d.value) * MIN(downscale_x, downscale_y);
+
+  bool isNoShiftEffect = (shiftAmount < NO_EFFECT_THRESHOLD);
+  bool isFullWidth = (fabsf(width - FULL_WIDTH_THRESHOLD) < WIDTH_TOLERANCE);
+  bool hasPixelSort = (params[MULTISLICER_PIXEL_SORT]->u.pd.value != PIXEL_SORT_OFF);
+
+  return !IsOutputScaled(params) &&
+         ((isNoShiftEffect && isFullWidth && !HasSliceTransforms(params) &&
+           !hasPixelSort && !HasExtraSources(in_data)) ||
+          numSlices <= 1);
+}
+
+/**
+ * Measure the content of the layer and any Source 2-4 layers for Crop to
+ * Content during FRAME_SETUP. AE passes the input layer without pixels
+ * there, so it is checked out like the other layers.
+ *
+ * @param in_data Input data of the command
+ * @param input Input layer as passed to FRAME_SETUP (pixels used if present)
+ * @param content Receives the content bounds, in layer coordinates
+ * @param measured Receives whether the pixels were available
+ * @return PF_Err error code
+ */
+static PF_Err MeasureFrameContent(PF_InData *in_data, const PF_LayerDef *input,
+                                  PF_Rect &content, bool &measured) {
+  PF_Err err = PF_Err_NONE;
+  PF_Err err2 = PF_Err_NONE;
+  PF_ParamDef inputDef;
+  PF_ParamDef sourceDefs[MULTI_SOURCE_MAX - 1];
+  A_long numSourceDefs = 0;
+  const PF_LayerDef *layer = input;
+  bool checkedOut = false;
+  AEFX_CLR_STRUCT(inputDef);
+  measured = false;
+
+  if (!layer->data) {
+    ERR(CheckoutLayerParam(in_data, MULTISLICER_INPUT, &inputDef));
+    checkedOut = !err;
+    layer = &inputDef.u.ld;
+  }
+  if (!err && layer->data && layer->width == input->width && layer->height == input->height) {
+    MeasureContentBounds(layer, content);
+    err = CheckoutExtraSources(in_data, sourceDefs, numSourceDefs);
+    for (A_long n = 0; n < numSourceDefs && !err; n++) {
+      if (sourceDefs[n].u.ld.data) {
+        UnionSourceContent(layer, &sourceDefs[n].u.ld, true, content);
+      }
+    }
+    ERR2(CheckinExtraSources(in_data, sourceDefs, numSourceDefs));
+    measured = !err;
+  }
+  if (checkedOut) {
+    ERR2(PF_CHECKIN_PARAM(in_data, &inputDef));
+  }
+  return err ? err : err2;
+}
+
+// FrameSetup: expand output buffer based on shift amount, or to the exact
+// bounds of the slices when per-slice transforms or Crop to Content are on;
+// the result is then sized by Output Scale
+static PF_Err FrameSetup(PF_InData *in_data, PF_OutData *out_data,
+                         PF_ParamDef *params[], PF_LayerDef *output) {
+  PF_Err err = PF_Err_NONE;
+  const float outputScale = GetOutputScale(params);
+
+  // Get input dimensions
+  PF_LayerDef *input = &params[MULTISLICER_INPUT]->u.ld;
+  const int input_width = input->width;
+  const int input_height = input->height;
+
+  if (input_width <= 0 || input_height <= 0) {
+    return PF_Err_NONE;
+  }
+
+  // Crop to Content: measure the layer (and any Source 2-4 layers) once per
+  // frame, kept in frame_data for Render, and size the buffer to what the
+  // slices can show of it, at most MAX_EXPANSION beyond the layer. If the
+  // layer's pixels cannot be checked out, Render measures on its own and
+  // the buffer keeps its usual size.
+  PF_Rect measuredContent = {0, 0, 0, 0};
+  bool measured = false;
+  if (params[MULTISLICER_CROP_TO_CONTENT]->u.bd.value && !IsPassThrough(in_data, params)) {
+    err = MeasureFrameContent(in_data, input, measuredContent, measured);
+    if (err) {
+      return err;
+    }
+  }
+  if (measured) {
+    AEGP_SuiteHandler suites(in_data->pica_basicP);
+    PF_Handle contentHandle = suites.HandleSuite1()->host_new_handle(sizeof(PF_Rect));
+    if (!contentHandle || !*contentHandle) {
+      return PF_Err_OUT_OF_MEMORY;
+    }
+    PF_Rect *content = *reinterpret_cast<PF_Rect **>(contentHandle);
+    *content = measuredContent;
+    out_data->frame_data = contentHandle;
+
+    SliceLayout layout;
+    AEFX_CLR_STRUCT(layout);
+
+    float minX = 0.0f, minY = 0.0f, maxX = 0.0f, maxY = 0.0f;
+    err = BuildSliceLayout(in_data, params, suites, layout);
+    if (!err) {
+      // Nothing can show: the smallest buffer AE accepts
+      int left = 0, top = 0, right = 1, bottom = 1;
+      if (ComputeSliceBounds(layout, *content, minX, minY, maxX, maxY)) {
+        minX = CLAMP(minX, static_cast<float>(-MAX_EXPANSION), static_cast<float>(input_width + MAX_EXPANSION));
+        minY = CLAMP(minY, static_cast<float>(-MAX_EXPANSION), static_cast<float>(input_height + MAX_EXPANSION));
+        maxX = CLAMP(maxX, static_cast<float>(-MAX_EXPANSION), static_cast<float>(input_width + MAX_EXPANSION));
+        maxY = CLAMP(maxY, static_cast<float>(-MAX_EXPANSION), static_cast<float>(input_height + MAX_EXPANSION));
+
+        left = static_cast<int>(floorf(minX)) - BOUNDS_MARGIN;
+        top = static_cast<int>(floorf(minY)) - BOUNDS_MARGIN;
+        right = static_cast<int>(ceilf(maxX)) + BOUNDS_MARGIN;
+        bottom = static_cast<int>(ceilf(maxY)) + BOUNDS_MARGIN;
+      }
+      SetOutputRect(out_data, outputScale, left, top, right, bottom);
+    }
+    DisposeSliceLayout(suites, layout);
+    return err;
+  }
+
+  // Transformed slices: size the buffer to what they can actually cover,
+  // never smaller than the layer and at most MAX_EXPANSION beyond it
+  if (HasSliceTransforms(params)) {
+    AEGP_SuiteHandler suites(in_data->pica_basicP);
+    SliceLayout layout;
+    AEFX_CLR_STRUCT(layout);
+
+    PF_Rect layerRect = {0, 0, input_width, input_height};
+    float minX = 0.0f, minY = 0.0f, maxX = 0.0f, maxY = 0.0f;
+    err = BuildSliceLayout(in_data, params, suites, layout);
+    if (!err && layout.transforms &&
+        ComputeSliceBounds(layout, layerRect, minX, minY, maxX, maxY)) {
+      minX = CLAMP(minX, static_cast<float>(-MAX_EXPANSION), 0.0f);
+      minY = CLAMP(minY, static_cast<float>(-MAX_EXPANSION), 0.0f);
+      maxX = CLAMP(maxX, static_cast<float>(input_width), static_cast<float>(input_width + MAX_EXPANSION));
+      maxY = CLAMP(maxY, static_cast<float>(input_height), static_cast<float>(input_height + MAX_EXPANSION));
+
+      int left = static_cast<int>(floorf(minX)) - BOUNDS_MARGIN;
+      int top = static_cast<int>(floorf(minY)) - BOUNDS_MARGIN;
+      int right = static_cast<int>(ceilf(maxX)) + BOUNDS_MARGIN;
+      int bottom = static_cast<int>(ceilf(maxY)) + BOUNDS_MARGIN;
+      SetOutputRect(out_data, outputScale, left, top, right, bottom);
+    } else if (!err) {
+      SetOutputRect(out_data, outputScale, 0, 0, input_width, input_height);
+    }
+    DisposeSliceLayout(suites, layout);
+    return err;
+  }
+
+  // Get shift parameter
+  float shiftRaw = params[MULTISLICER_SHIFT]->u.fs_d.value;
+
+  // Downsample adjustment
+  float downscale_x = GetDownscaleFactor(in_data->downsample_x);
+  float downscale_y = GetDownscaleFactor(in_data->downsample_y);
+  float resolution_scale = MIN(downscale_x, downscale_y);
+  float shiftAmount = fabsf(shiftRaw) * resolution_scale;
+
+  // If no shift, no expansion needed (only the scale, if any)
+  if (shiftAmount < NO_EFFECT_THRESHOLD) {
+    if (IsOutputScaled(params)) {
+      SetOutputRect(out_data, outputScale, 0, 0, input_width, input_height);
+    }
+    return PF_Err_NONE;
+  }
+
+  // Narrow pixels stretch a horizontal shift by 1 / aspect
+  float pixelAspect = GetPixelAspect(in_data);
+  if (pixelAspect < 1.0f) {
+    shiftAmount /= pixelAspect;
+  }
+
+  // Calculate expansion needed (shift can occur in any direction)
+  // Use maximum possible shift with some margin
+  // CRITICAL FIX #5: Check for integer overflow before setting dimensions
+  int expansion = static_cast<int>(ceilf(shiftAmount * EXPANSION_MULTIPLIER)) + EXPANSION_MARGIN;
+  expansion = MIN(expansion, MAX_EXPANSION);
+
+  // Check for integer overflow before setting dimensions
+  if (input_width > INT_MAX - expansion * 2 || input_height > INT_MAX - expansion * 2) {
+    // Skip expansion on overflow to prevent undefined behavior
+    return PF_Err_NONE;
+  }
+
+  // Set output dimensions and origin (SetOutputRect clamps the origin to a short)
+  SetOutputRect(out_data, outputScale, -expansion, -expansion, input_width + expansion,
+                input_height + expansion);
+
+  return err;
+}
+
+// QueryDynamicFlags: Shatter moves slices with time even when no parameter
+// is animated, so AE must not reuse frames while it is on. Without it the
+// output depends only on parameters and NON_PARAM_VARY is cleared.
+static PF_Err QueryDynamicFlags(PF_InData *in_data, PF_OutData *out_data,
+                                PF_ParamDef *params[], void *extra) {
+  PF_Err err = PF_Err_NONE;
+  PF_Err err2 = PF_Err_NONE;
+  bool shatter = false;
+
+  const A_long shatterParams[] = {MULTISLICER_SHATTER_VELOCITY,
+                                  MULTISLICER_SHATTER_SPIN,
+                                  MULTISLICER_SHATTER_GRAVITY};
+  for (A_long index : shatterParams) {
+    PF_ParamDef def;
+    AEFX_CLR_STRUCT(def);
+    ERR(PF_CHECKOUT_PARAM(in_data, index, in_data->current_time,
+                          in_data->time_step, in_data->time_scale, &def));
+    if (!err && def.u.fs_d.value > 0.0) {
+      shatter = true;
+    }
+    ERR2(PF_CHECKIN_PARAM(in_data, &def));
+  }
+
+  if (!err) {
+    if (shatter) {
+      out_data->out_flags |= PF_OutFlag_NON_PARAM_VARY;
+    } else {
+      out_data->out_flags &= ~PF_OutFlag_NON_PARAM_VARY;
+    }
+  }
+
+  return err;
+}
+
+// =============================================================================
+// Geometry warm-up - the next map, built while the artist changes parameters
+// =============================================================================
+
+// A warm-up's own copy of the slices, so the layout can be released before
+// the map is classified
+struct GeometryWarmup {
+  SliceContext slices;
+  std::vector<SliceSegment> segments;
+  std::vector<float> warp;
+  GeometryKey key;
+  A_long margin = 0;
+  A_u_long instance = 0;   // statistics id of the instance it is for
+  A_u_long generation = 0; // sWarmGeneration it was started as
+  std::shared_ptr<std::atomic<bool>> finished; // set as the thread's last step
+};
+
+/**
+ * Classify a warm-up's map and hand it to the geometry cache.
+ *
+ * Runs on the warm-up's own thread (see sWarmThreads for why not through
+ * iterate_generic). Rows are shared out to at most GEOMETRY_WARMUP_THREADS
+ * workers, this thread included; all of them stop at the next row once a
+ * newer warm-up has started, and a cancelled map is dropped.
+ *
+ * @param job Slices, key and margin of the map to build
+ */
+static void RunGeometryWarmup(std::unique_ptr<GeometryWarmup> job) {
+  const A_u_long generation = job->generation;
+  auto cancelled = [generation]() { return sWarmGeneration != generation; };
+  std::unique_ptr<GeometryMap> map;
+  if (!LoadGeometryMapFile(job->key, job->margin, map)) {
+    AllocateGeometryMap(std::move(job->key), job->margin, map);
+  }
+  if (map && !map->mapped) {
+    GeometryBuildContext buildContext;
+    buildContext.slices = &job->slices;
+    buildContext.cells = map->cells.data();
+    buildContext.left = map->left;
+    buildContext.top = map->top;
+    buildContext.width = map->width;
+    std::atomic<A_long> nextRow(0);
+    auto classify = [&buildContext, &nextRow, &map, &cancelled]() {
+      for (A_long i = nextRow++; i < map->height && !cancelled(); i = nextRow++) {
+        BuildGeometryRow(&buildContext, 0, i, map->height);
+      }
+    };
+    std::vector<std::thread> workers;
+    try {
+      const unsigned threads =
+          MIN(std::thread::hardware_concurrency(), static_cast<unsigned>(GEOMETRY_WARMUP_THREADS));
+      for (unsigned n = 1; n < threads; n++) {
+        workers.emplace_back(classify);
+      }
+    } catch (const std::exception &) {
+      // Fewer workers; this thread classifies whatever is left
+    }
+    classify();
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+    map->warmed = true;
+    if (!cancelled()) {
+      StoreGeometryMapFile(*map);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(sGeometryMutex);
+  if (map && !cancelled()) {
+    if (sComputeCache) {
+      sWarmMap = std::move(map);
+    } else {
+      try {
+        std::shared_ptr<const GeometryMap> shared(map.release());
+        InsertGeometryMap(shared);
+        SeenGeometryKey(job->instance, shared->key);
+      } catch (const std::bad_alloc &) {
+      }
+    }
+  }
+  if (!cancelled()) {
+    sWarmBuilding = false;
+  }
+  *job->finished = true;
+}
+
+/**
+ * Fingerprint of what a warm-up lays the slices out from: the shape of the
+ * instance's last render and every parameter value but Shift (which only
+ * moves the sources) and the layers. Equal fingerprints give equal
+ * geometry keys, so a UI command that changed neither needs no layout.
+ */
+static A_u_longlong WarmupFingerprint(PF_ParamDef *params[], const GeometryShape &shape) {
+  A_u_longlong hash = GEOMETRY_HASH_BASIS;
+  auto mix = [&hash](const void *data, size_t size) {
+    const A_u_char *bytes = static_cast<const A_u_char *>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * GEOMETRY_HASH_PRIME;
+    }
+  };
+  mix(&shape.imageWidth, sizeof(shape.imageWidth));
+  mix(&shape.imageHeight, sizeof(shape.imageHeight));
+  mix(&shape.downscaleX, sizeof(shape.downscaleX));
+  mix(&shape.downscaleY, sizeof(shape.downscaleY));
+  mix(&shape.pixelAspect, sizeof(shape.pixelAspect));
+  mix(&shape.left, sizeof(shape.left));
+  mix(&shape.top, sizeof(shape.top));
+  mix(&shape.width, sizeof(shape.width));
+  mix(&shape.height, sizeof(shape.height));
+  for (A_long i = 1; i < MULTISLICER_NUM_PARAMS; i++) {
+    const PF_ParamDef &def = *params[i];
+    if (i == MULTISLICER_SHIFT) {
+      continue;
+    }
+    switch (def.param_type) {
+    case PF_Param_FLOAT_SLIDER:
+      mix(&def.u.fs_d.value, sizeof(def.u.fs_d.value));
+      break;
+    case PF_Param_SLIDER:
+      mix(&def.u.sd.value, sizeof(def.u.sd.value));
+      break;
+    case PF_Param_ANGLE:
+      mix(&def.u.ad.value, sizeof(def.u.ad.value));
+      break;
+    case PF_Param_CHECKBOX:
+      mix(&def.u.bd.value, sizeof(def.u.bd.value));
+      break;
+    case PF_Param_POPUP:
+      mix(&def.u.pd.value, sizeof(def.u.pd.value));
+      break;
+    case PF_Param_POINT:
+      mix(&def.u.td.x_value, sizeof(def.u.td.x_value));
+      mix(&def.u.td.y_value, sizeof(def.u.td.y_value));
+      break;
+    default:
+      break;
+    }
+  }
+  return hash;
+}
+
+/**
+ * Start building the geometry cache for the current parameters.
+ *
+ * Called for PF_Cmd_USER_CHANGED_PARAM and PF_Cmd_UPDATE_PARAMS_UI, so the
+ * first render after a change of Seed, Number of Slices or any other slice
+ * geometry finds its map ready instead of rendering slice rows while the
+ * new key is seen for the first time.
+ * The slices are laid out here for the layer, downsampling and output of
+ * this instance's last render that tried the cache; the map is classified on
+ * a thread of its own, replacing a warm-up still running for older
+ * parameters (which stops at its next row, unwaited).
+ *
+ * UPDATE_PARAMS_UI comes with every change of time, so the parameters are
+ * compared with the instance's last warm-up by WarmupFingerprint first;
+ * unchanged, nothing is laid out.
+ *
+ * Nothing is built when the cache would not be used (per-slice transforms,
+ * Prefilter Slices, Output Scale), when no render of the instance has
+ * tried it yet, or when that render applied a Shift or Density Map: layer
+ * maps cannot be checked out during UI commands.
+ *
+ * @param in_data Input data of the UI command
+ * @param params Effect parameters at the current time
+ * @return PF_Err error code
+ */
+static PF_Err WarmGeometryCache(PF_InData *in_data, PF_ParamDef *params[]) {
+  PF_Err err = PF_Err_NONE;
+  AEGP_SuiteHandler suites(in_data->pica_basicP);
+  GeometryShape shape;
+  SliceLayout layout;
+  std::unique_ptr<GeometryWarmup> job;
+  A_long margin = 0;
+  bool ready = false;
+
+  if (sGeometryCacheOff || !params || params[MULTISLICER_SLICES]->u.sd.value <= 1 ||
+      HasSliceTransforms(params) ||
+      params[MULTISLICER_PREFILTER]->u.bd.value || IsOutputScaled(params)) {
+    return PF_Err_NONE;
+  }
+  {
+    std::lock_guard<std::mutex> lock(sGeometryMutex);
+    auto found = sGeometryInstances.find(GetStatsInstance(in_data));
+    if (found == sGeometryInstances.end() || !found->second.shape.valid ||
+        found->second.shape.layerMaps) {
+      return PF_Err_NONE;
+    }
+    shape = found->second.shape;
+    const A_u_longlong fingerprint = WarmupFingerprint(params, shape);
+    if (found->second.warmFingerprint == fingerprint) {
+      return PF_Err_NONE;
     }
+    found->second.warmFingerprint = fingerprint;
+  }
+  margin = CoverGeometryMargin(shape.imageWidth, shape.imageHeight, shape.left, shape.top,
+                               shape.width, shape.height, GEOMETRY_MIN_MARGIN);
+  if (!margin) {
+    return PF_Err_NONE;
+  }
 
-    // Enforce minimum spacing to prevent overlapping slices
-    float minSpacing = avgSpacing * DIV_MIN_SPACING_RATIO;
-    for (A_long i = 1; i < numSlices; i++) {
-      if (divPoints[i] < divPoints[i - 1] + minSpacing) {
-        divPoints[i] = divPoints[i - 1] + minSpacing;
+  // The layout of the last render's layer, with the Anchor Point (in full
+  // resolution pixels here) scaled to its downsampling
+  AEFX_CLR_STRUCT(layout);
+  layout.imageWidth = shape.imageWidth;
+  layout.imageHeight = shape.imageHeight;
+  layout.centerX = static_cast<float>(params[MULTISLICER_ANCHOR_POINT]->u.td.x_value) /
+                   FIXED_POINT_SCALE * shape.downscaleX;
+  layout.centerY = static_cast<float>(params[MULTISLICER_ANCHOR_POINT]->u.td.y_value) /
+                   FIXED_POINT_SCALE * shape.downscaleY;
+  layout.resolutionScale = MIN(shape.downscaleX, shape.downscaleY);
+  layout.pixelAspect = shape.pixelAspect;
+  err = BuildSliceLayoutFor(in_data, params, suites, false, layout);
+  if (!err) {
+    try {
+      job.reset(new GeometryWarmup());
+      BuildGeometryKey(layout, job->key);
+      job->segments.assign(layout.segments, layout.segments + layout.numSlices);
+      if (layout.warp) {
+        job->warp.assign(layout.warp, layout.warp + layout.warpCount);
       }
+    } catch (const std::bad_alloc &) {
+      job.reset();
     }
+  }
+  if (job) {
+    SliceContext &ctx = job->slices;
+    ctx = {};
+    ctx.centerX = layout.centerX;
+    ctx.centerY = layout.centerY;
+    ctx.angleCos = layout.angleCos;
+    ctx.angleSin = layout.angleSin;
+    ctx.numSlices = layout.numSlices;
+    ctx.segments = job->segments.data();
+    ctx.warp = layout.warp ? job->warp.data() : nullptr;
+    ctx.warpStart = layout.warpStart;
+    ctx.warpInvStep = layout.warpInvStep;
+    ctx.warpCount = layout.warpCount;
+    ctx.warpAmplitude = layout.warpAmplitude;
+    job->margin = margin;
+    job->instance = GetStatsInstance(in_data);
+  }
+  DisposeSliceLayout(suites, layout);
+  if (err || !job) {
+    return err;
+  }
 
-    // Scale to fit full range if needed (prevents compression at edges)
-    if (divPoints[numSlices - 1] < divPoints[numSlices] - minSpacing) {
-      float actualRange = divPoints[numSlices - 1] - divPoints[0];
-      float targetRange = divPoints[numSlices] - divPoints[0];
+  // Already cached, or already being built
+  {
+    std::lock_guard<std::mutex> lock(sGeometryMutex);
+    std::shared_ptr<const GeometryMap> cached = FindGeometryMap(job->key);
+    ready = (sWarmKey == job->key && (sWarmBuilding || sWarmMap)) ||
+            (cached && cached->left <= -margin);
+  }
+  if (!ready && sComputeCache) {
+    bool built = false;
+    GeometryComputeOptions options = {&job->slices, &suites, &job->key, margin, &built};
+    AEGP_CCCheckoutReceiptP receipt = nullptr;
+    if (!sComputeCache->AEGP_CheckoutCached(GEOMETRY_CACHE_CLASS, &options, &receipt) &&
+        receipt) {
+      sComputeCache->AEGP_CheckinComputeReceipt(receipt);
+      ready = true;
+    }
+  }
+  if (ready) {
+    return PF_Err_NONE;
+  }
 
-      if (actualRange > DIV_RANGE_CHECK_THRESHOLD) {
-        // Proportional scaling
-        for (A_long i = 1; i < numSlices; i++) {
-          float relativePos = (divPoints[i] - divPoints[0]) / actualRange;
-          divPoints[i] = divPoints[0] + relativePos * targetRange;
-        }
-      } else {
-        // Fallback to even distribution
-        for (A_long i = 1; i < numSlices; i++) {
-          divPoints[i] = divPoints[0] + (i * targetRange / numSlices);
-        }
-      }
+  CancelGeometryWarmup();
+  JoinGeometryWarmups(false);
+  job->generation = sWarmGeneration;
+  try {
+    job->finished = std::make_shared<std::atomic<bool>>(false);
+    sWarmThreads.emplace_back();
+  } catch (const std::bad_alloc &) {
+    return PF_Err_NONE;
+  }
+  {
+    std::lock_guard<std::mutex> lock(sGeometryMutex);
+    try {
+      sWarmKey = job->key;
+    } catch (const std::bad_alloc &) {
+      sWarmThreads.pop_back();
+      return PF_Err_NONE;
     }
+    sWarmMap.reset();
+    sWarmBuilding = true;
+  }
+  WarmThread &warm = sWarmThreads.back();
+  warm.finished = job->finished;
+  try {
+    warm.thread = std::thread(RunGeometryWarmup, std::move(job));
+  } catch (const std::system_error &) {
+    sWarmThreads.pop_back();
+    std::lock_guard<std::mutex> lock(sGeometryMutex);
+    sWarmBuilding = false;
+  }
+  return PF_Err_NONE;
+}
+
+// =============================================================================
+// Render explain log - which row renderer a frame took, and why
+// =============================================================================
+
+// Opened on the first render when EXPLAIN_FILE_ENV is set; appended to by
+// every instance and render thread of the process
+static std::mutex sExplainMutex;
+static std::once_flag sExplainOnce;
+static FILE *sExplainFile = nullptr;
+
+static void OpenExplainFile() {
+  const char *path = getenv(EXPLAIN_FILE_ENV);
+  if (path && *path) {
+    sExplainFile = fopen(path, "a");
+  }
+}
+
+// Explain log, or nullptr when it is off. Only the first call reads the
+// environment.
+static FILE *AcquireExplainFile() {
+  std::call_once(sExplainOnce, OpenExplainFile);
+  return sExplainFile;
+}
+
+// Append a reason, separated from the previous one
+static void AppendExplain(std::string &text, const char *format, ...) {
+  char buffer[EXPLAIN_LINE_SIZE];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (!text.empty()) {
+    text += "; ";
+  }
+  text += buffer;
+}
+
+// Why Render could not copy the input: the tests of IsPassThrough, each
+// that failed
+static void ExplainPassThrough(PF_InData *in_data, PF_ParamDef *params[], std::string &reasons) {
+  if (IsOutputScaled(params)) {
+    AppendExplain(reasons, "Output Scale %.0f%% is not 100%%", GetOutputScale(params) * 100.0f);
+  }
+  if (params[MULTISLICER_SLICES]->u.sd.value <= 1) {
+    return;
+  }
+  float downscale_x = GetDownscaleFactor(in_data->downsample_x);
+  float downscale_y = GetDownscaleFactor(in_data->downsample_y);
+  float shiftAmount =
+      fabsf(params[MULTISLICER_SHIFT]->u.fs_d.value) * MIN(downscale_x, downscale_y);
+  float width = params[MULTISLICER_WIDTH]->u.fs_d.value / 100.0f;
+
+  if (shiftAmount >= NO_EFFECT_THRESHOLD) {
+    AppendExplain(reasons, "Shift %.1f px is not 0", shiftAmount);
+  }
+  if (fabsf(width - FULL_WIDTH_THRESHOLD) >= WIDTH_TOLERANCE) {
+    AppendExplain(reasons, "Width %.1f%% is not 100%%", width * 100.0f);
+  }
+  if (HasSliceTransforms(params)) {
+    AppendExplain(reasons, "per-slice transforms are on");
+  }
+  if (params[MULTISLICER_PIXEL_SORT]->u.pd.value != PIXEL_SORT_OFF) {
+    AppendExplain(reasons, "Pixel Sort is on");
+  }
+  if (HasExtraSources(in_data)) {
+    AppendExplain(reasons, "Source 2-4 are connected");
+  }
+}
+
+// Why untransformed slices were not rendered from the geometry cache
+static void ExplainGeometryCache(PF_ParamDef *params[], const RenderStatsSample &sample,
+                                 std::string &reasons) {
+  if (params[MULTISLICER_PREFILTER]->u.bd.value && !sample.draft) {
+    AppendExplain(reasons, "Prefilter Slices is on");
+  }
+  if (IsOutputScaled(params)) {
+    AppendExplain(reasons, "Output Scale is not 100%%");
+  }
+  if (sample.geometryMiss) {
+    AppendExplain(reasons, "%s", sample.geometryMiss);
+  }
+  if (sample.geometryUsed && sample.reduced) {
+    AppendExplain(reasons, "half resolution for the frame budget");
   }
 }
 
 /**
- * Initialize slice segment metadata from division points.
+ * Append one render to the explain log.
  *
- * For each slice, calculates:
- * - Boundaries (sliceStart, sliceEnd) from division points
- * - Visible region (visibleStart, visibleEnd) based on width parameter
- *   (controls how much of each slice is displayed)
- * - Random shift direction (perpendicular to slice direction)
- * - Random shift magnitude (affects how far slices move)
+ * Names the row renderer the frame took and, for each cheaper one, the
+ * parameters that ruled it out, so an artist can see which tweak keeps a
+ * comp on the fast path. Estimated cost is output samples times the
+ * renderer's work units (RENDER_COST_*); measured time per unit shows
+ * where the estimate is off.
  *
- * @param seed Random seed for consistent patterns
- * @param numSlices Number of slices to initialize
- * @param width Width parameter (0.0-1.0) for visible portion
- * @param shiftDirection Global shift direction (1.0 or -1.0)
- * @param divPoints Array of division points (size numSlices + 1)
- * @param segments Output array of SliceSegment structures (size numSlices)
+ * @param log Explain log
+ * @param in_data Input data of the render
+ * @param params Parameter array of the render
+ * @param output Output world
+ * @param sample What the render did
+ * @param err Result of the render
+ * @param ns Time spent in Render
  */
-static void InitializeSliceSegments(A_long seed, A_long numSlices, float width,
-                                     float shiftDirection, const float *divPoints,
-                                     SliceSegment *segments) {
-  for (A_long i = 0; i < numSlices; i++) {
-    SliceSegment &segment = segments[i];
-
-    // Set slice boundaries from division points
-    segment.sliceStart = divPoints[i];
-    segment.sliceEnd = divPoints[i + 1];
-    float sliceWidth = segment.sliceEnd - segment.sliceStart;
-    float sliceCenter = segment.sliceStart + (sliceWidth * 0.5f);
-
-    // Calculate visible region based on width parameter
-    float halfVisible = MAX(0.0f, sliceWidth * width * 0.5f);
-    segment.visibleStart = sliceCenter - halfVisible;
-    segment.visibleEnd = sliceCenter + halfVisible;
+static void ExplainRender(FILE *log, PF_InData *in_data, PF_ParamDef *params[],
+                          PF_LayerDef *output, const RenderStatsSample &sample, PF_Err err,
+                          A_u_longlong ns) {
+  static const char *const pathNames[STATS_PATH_COUNT] = {
+      "pass-through", "slice rows", "geometry cache rows", "transformed rows"};
+  if (!in_data || !params || !params[MULTISLICER_INPUT] || !output) {
+    return;
+  }
+  const PF_LayerDef *input = &params[MULTISLICER_INPUT]->u.ld;
+  const double pixels = static_cast<double>(output->width) * output->height * 1e-6;
+  const double step = sample.reduced ? FRAME_BUDGET_REDUCED_STEP : 1.0;
+  const double samples = pixels * sample.resampleFactor * sample.resampleFactor / (step * step);
+  const bool prefiltered = params[MULTISLICER_PREFILTER]->u.bd.value &&
+                           !HasSliceTransforms(params) && !sample.draft;
+  auto estimate = [&](A_long path) {
+    return EstimateRenderWork(path, pixels, samples, prefiltered, sample.sorted);
+  };
 
-    // Generate random shift properties
-    A_long dirSeed = (seed * DIR_SEED_MULT + i * DIR_SEED_OFFSET) & 0x7FFF;
-    A_long factorSeed = (seed * FACTOR_SEED_MULT + i * FACTOR_SEED_OFFSET) & 0x7FFF;
-    float randomDir = (GetRandomValue(dirSeed, 0) > 0.5f) ? 1.0f : -1.0f;
-    float randomShiftFactor = DEFAULT_FEATHER + GetRandomValue(factorSeed, 0) * MAX_RANDOM_SHIFT_FACTOR;
+  try {
+    std::string text;
+    char buffer[EXPLAIN_LINE_SIZE];
+    snprintf(buffer, sizeof(buffer), "[instance %u] t=%.3fs ds %d/%d %dx%d -> %dx%d %s: ",
+             static_cast<unsigned>(GetStatsInstance(in_data)),
+             in_data->time_scale ? static_cast<double>(in_data->current_time) / in_data->time_scale
+                                 : 0.0,
+             static_cast<int>(in_data->downsample_x.num),
+             static_cast<int>(in_data->downsample_x.den), static_cast<int>(input->width),
+             static_cast<int>(input->height), static_cast<int>(output->width),
+             static_cast<int>(output->height), PF_WORLD_IS_DEEP(output) ? "16-bit" : "8-bit");
+    text = buffer;
+    if (sample.path < 0 || sample.path >= STATS_PATH_COUNT) {
+      snprintf(buffer, sizeof(buffer), "failed (error %d) before choosing a renderer, %.3f ms\n",
+               static_cast<int>(err), ns * 1e-6);
+      text += buffer;
+    } else {
+      const double work = sample.work;
+      snprintf(buffer, sizeof(buffer), "%s%s, est %.2f Mwork, %.3f ms (%.2f ns/work)%s\n",
+               pathNames[sample.path],
+               sample.path != STATS_PATH_CACHED_ROWS ? ""
+               : sample.geometryBuilt                ? " (map built)"
+               : sample.geometryLoaded               ? " (map from the layout cache)"
+               : sample.geometryWarmed               ? " (warmed-up map)"
+                                                     : "",
+               work, ns * 1e-6, work > 0.0 ? ns * 1e-6 / work : 0.0,
+               err ? " - failed" : "");
+      text += buffer;
+
+      // Cheaper renderers, cheapest first, each with what ruled it out
+      std::string reasons;
+      if (sample.path != STATS_PATH_PASS_THROUGH) {
+        ExplainPassThrough(in_data, params, reasons);
+        snprintf(buffer, sizeof(buffer), "    not pass-through (est %.2f Mwork): ",
+                 estimate(STATS_PATH_PASS_THROUGH));
+        text += buffer + reasons + "\n";
+      }
+      if (sample.path == STATS_PATH_SLICE_ROWS || sample.path == STATS_PATH_TRANSFORMED_ROWS) {
+        reasons.clear();
+        if (sample.path == STATS_PATH_TRANSFORMED_ROWS) {
+          AppendExplain(reasons, "per-slice transforms are on (Random Rotation, Scale, Depth, "
+                                 "Tilt or Shatter)");
+        } else {
+          ExplainGeometryCache(params, sample, reasons);
+        }
+        snprintf(buffer, sizeof(buffer), "    not geometry cache rows (est %.2f Mwork): ",
+                 estimate(STATS_PATH_CACHED_ROWS));
+        text += buffer + reasons + "\n";
+      }
+      if (sample.path == STATS_PATH_TRANSFORMED_ROWS) {
+        snprintf(buffer, sizeof(buffer),
+                 "    not slice rows (est %.2f Mwork): per-slice transforms are on\n",
+                 estimate(STATS_PATH_SLICE_ROWS));
+        text += buffer;
+      }
+      if (sample.resampleFactor > 1 || sample.sorted) {
+        reasons.clear();
+        if (sample.resampleFactor > 1) {
+          AppendExplain(reasons, "%dx%d subsamples per pixel for Output Scale %.0f%%",
+                        static_cast<int>(sample.resampleFactor),
+                        static_cast<int>(sample.resampleFactor), GetOutputScale(params) * 100.0f);
+        }
+        if (sample.sorted) {
+          AppendExplain(reasons, "Pixel Sort pass");
+        }
+        text += "    plus " + reasons + "\n";
+      }
+      if (sample.draft || sample.reduced) {
+        snprintf(buffer, sizeof(buffer),
+                 "    degraded for the %.1f ms frame budget (est %.1f ms at full quality): %s%s\n",
+                 sample.budgetMs, sample.fullMs, sample.draft ? "draft sampling" : "",
+                 sample.reduced ? (sample.draft ? ", half resolution" : "half resolution") : "");
+        text += buffer;
+      }
+    }
 
-    segment.shiftDirection = shiftDirection * randomDir;
-    segment.shiftRandomFactor = randomShiftFactor;
+    std::lock_guard<std::mutex> lock(sExplainMutex);
+    fputs(text.c_str(), log);
+    fflush(log);
+  } catch (const std::bad_alloc &) {
   }
 }
 
@@ -646,8 +5969,10 @@ static void InitializeSliceSegments(A_long seed, A_long numSlices, float width,
 // =============================================================================
 
 static PF_Err Render(PF_InData *in_data, PF_OutData *out_data,
-                     PF_ParamDef *params[], PF_LayerDef *output) {
+                     PF_ParamDef *params[], PF_LayerDef *output,
+                     RenderStatsSample &sample) {
   PF_Err err = PF_Err_NONE;
+  PF_Err err2 = PF_Err_NONE;
   AEGP_SuiteHandler suites(in_data->pica_basicP);
 
   // CRITICAL FIX: Validate input parameters to prevent NULL pointer dereference
@@ -674,173 +5999,315 @@ static PF_Err Render(PF_InData *in_data, PF_OutData *out_data,
 
   // CRITICAL FIX: Declare all variables before any goto statements to fix C2362 errors
   // Variables are declared but not initialized until needed
-  A_long imageWidth;
-  A_long imageHeight;
-  float centerX;
-  float centerY;
-  float angleRad;
-  float angleCos;
-  float angleSin;
-  float sliceLength;
-  PF_Handle segmentsHandle;
-  PF_Handle divPointsHandle;
-  SliceSegment *segments;
-  float *divPoints;
+  SliceLayout layout;
   SliceContext context;
+  OccupancyContext occupancyContext;
+  PF_Handle occupancyHandle = nullptr;
+  GeometryHold geometry;
+  const char *exportDir = nullptr;
+  PF_ParamDef sourceDefs[MULTI_SOURCE_MAX - 1];
+  A_long numSourceDefs = 0;
+  ResampleContext resampleContext;
+  ReducedContext reducedContext;
+  PF_Err (*renderRow)(void *, A_long, A_long, A_long) = nullptr;
+  const double outputPixels = static_cast<double>(outputP->width) * outputP->height * 1e-6;
+  const double budgetMs = sample.budgetMs;
+  const double nsPerWork = (budgetMs > 0.0) ? GetInstanceCostRate(in_data) : 0.0;
+  AEFX_CLR_STRUCT(layout);
+
+  // Below 100% Output Scale each output pixel averages factor x factor
+  // subsamples, enough for subsamples at most one layer pixel apart
+  const float outputScale = GetOutputScale(params);
+  A_long resampleFactor =
+      (outputScale < 1.0f - OUTPUT_SCALE_TOLERANCE)
+          ? MIN(static_cast<A_long>(OUTPUT_SCALE_MAX_FACTOR),
+                static_cast<A_long>(ceilf(1.0f / outputScale - OUTPUT_SCALE_TOLERANCE)))
+          : 1;
 
-  // Extract parameters
-  float shiftRaw = params[MULTISLICER_SHIFT]->u.fs_d.value;
-  float width = params[MULTISLICER_WIDTH]->u.fs_d.value / 100.0f;
   A_long numSlices = params[MULTISLICER_SLICES]->u.sd.value;
-  PF_Fixed anchor_x = params[MULTISLICER_ANCHOR_POINT]->u.td.x_value;
-  PF_Fixed anchor_y = params[MULTISLICER_ANCHOR_POINT]->u.td.y_value;
-  A_long angle_long = params[MULTISLICER_ANGLE]->u.ad.value >> 16;
-  A_long seed = params[MULTISLICER_SEED]->u.sd.value;
+  bool hasPixelSort = (params[MULTISLICER_PIXEL_SORT]->u.pd.value != PIXEL_SORT_OFF);
+  PF_Rect content = {0, 0, inputP->width, inputP->height};
 
   // CRITICAL FIX: Validate numSlices to prevent integer overflow
   if (numSlices > 1000 || numSlices < 1) {
     return PF_Err_UNRECOGNIZED_PARAM_TYPE;
   }
-  numSlices = MAX(1, numSlices);
-
-  float shiftDirection = (shiftRaw >= 0) ? 1.0f : -1.0f;
-
-  float downscale_x = GetDownscaleFactor(in_data->downsample_x);
-  float downscale_y = GetDownscaleFactor(in_data->downsample_y);
-  float resolution_scale = MIN(downscale_x, downscale_y);
-  float shiftAmount = fabsf(shiftRaw) * resolution_scale;
 
-  // Early exit conditions for no-op cases
-  // CRITICAL FIX: Use constants from header instead of duplicate definitions
-  bool isNoShiftEffect = (shiftAmount < NO_EFFECT_THRESHOLD);
-  bool isFullWidth = (fabsf(width - FULL_WIDTH_THRESHOLD) < WIDTH_TOLERANCE);
-  bool isSingleSlice = (numSlices <= 1);
-
-  if ((isNoShiftEffect && isFullWidth) || isSingleSlice) {
+  // Early exit for no-op cases
+  if (IsPassThrough(in_data, params)) {
     // CRITICAL FIX #4: Add ERR() macro to copy_hq call
     err = suites.WorldTransformSuite1()->copy_hq(in_data->effect_ref, inputP,
                                                   output, NULL, NULL);
     ERR(err);
+    sample.path = STATS_PATH_PASS_THROUGH;
+    sample.work = EstimateRenderWork(STATS_PATH_PASS_THROUGH, outputPixels, outputPixels, false,
+                                     false);
     goto render_cleanup;
   }
 
-  // Initialize variables declared earlier
-  imageWidth = inputP->width;
-  imageHeight = inputP->height;
-
-  // Calculate anchor point in pixel coordinates
-  centerX = static_cast<float>(anchor_x) / FIXED_POINT_SCALE;
-  centerY = static_cast<float>(anchor_y) / FIXED_POINT_SCALE;
-  centerX = MAX(0.0f, MIN(centerX, static_cast<float>(imageWidth - 1)));
-  centerY = MAX(0.0f, MIN(centerY, static_cast<float>(imageHeight - 1)));
-
-  // Calculate rotation parameters
-  angleRad = (float)angle_long * PF_RAD_PER_DEGREE;
-  angleCos = cosf(angleRad);
-  angleSin = sinf(angleRad);
-
-  // Use LAYER size for sliceLength (controls slice spacing/appearance)
-  // Not expanded buffer size - that would stretch the slices
-  sliceLength =
-      2.0f * sqrtf(static_cast<float>(imageWidth * imageWidth +
-                                      imageHeight * imageHeight));
-
-  // Allocate memory for slice segments and division points
-  segmentsHandle = nullptr;
-  divPointsHandle = nullptr;
-
-  segmentsHandle = suites.HandleSuite1()->host_new_handle(numSlices * sizeof(SliceSegment));
-  if (!segmentsHandle) {
-    err = PF_Err_OUT_OF_MEMORY;
-    goto render_cleanup;
-  }
-  segments = *((SliceSegment **)segmentsHandle);
-  if (!segments) {
-    suites.HandleSuite1()->host_dispose_handle(segmentsHandle);
-    segmentsHandle = nullptr;
-    err = PF_Err_OUT_OF_MEMORY;
+  // Division points, segments, maps and per-slice transforms
+  err = BuildSliceLayout(in_data, params, suites, layout);
+  if (err) {
     goto render_cleanup;
   }
 
-  divPointsHandle = suites.HandleSuite1()->host_new_handle((numSlices + 1) * sizeof(float));
-  if (!divPointsHandle) {
-    err = PF_Err_OUT_OF_MEMORY;
+  // Sources: the Input plus any connected Source 2-4 layers, one per slice
+  err = CheckoutExtraSources(in_data, sourceDefs, numSourceDefs);
+  if (err) {
     goto render_cleanup;
   }
-  divPoints = *((float **)divPointsHandle);
-  if (!divPoints) {
-    suites.HandleSuite1()->host_dispose_handle(divPointsHandle);
-    divPointsHandle = nullptr;
-    suites.HandleSuite1()->host_dispose_handle(segmentsHandle);
-    segmentsHandle = nullptr;
-    err = PF_Err_OUT_OF_MEMORY;
-    goto render_cleanup;
-  }
-
-  // Calculate division points using extracted function
-  CalculateDivisionPoints(seed, numSlices, sliceLength, divPoints);
-
-  // Initialize slice segments using extracted function
-  InitializeSliceSegments(seed, numSlices, width, shiftDirection, divPoints, segments);
-
-  // Division points no longer needed after segment initialization
-  suites.HandleSuite1()->host_dispose_handle(divPointsHandle);
-  divPointsHandle = nullptr;
 
   // Build render context for iterate callbacks
   context = {};
-  context.srcData = inputP->data;
-  context.rowbytes = inputP->rowbytes;
-  context.width = imageWidth;
-  context.height = imageHeight;
-  context.centerX = centerX;
-  context.centerY = centerY;
-  context.angleCos = angleCos;
-  context.angleSin = angleSin;
-  context.shiftDirX = -angleSin;
-  context.shiftDirY = angleCos;
-  context.shiftAmount = shiftAmount;
-  context.numSlices = numSlices;
-  context.segments = segments;
+  context.numSources = GatherSliceSources(inputP, sourceDefs, numSourceDefs, context.sources);
+  AssignSliceSources(params[MULTISLICER_SOURCE_MODE]->u.pd.value,
+                     static_cast<float>(params[MULTISLICER_SOURCE_TRANSITION]->u.fs_d.value) / 100.0f,
+                     params[MULTISLICER_SEED]->u.sd.value, context.numSources, layout);
+  context.centerX = layout.centerX;
+  context.centerY = layout.centerY;
+  context.angleCos = layout.angleCos;
+  context.angleSin = layout.angleSin;
+  context.shiftDirX = -layout.angleSin;
+  context.shiftDirY = layout.angleCos;
+  context.shiftAmount = layout.shiftAmount;
+  context.numSlices = layout.numSlices;
+  context.segments = layout.segments;
+  context.transforms = layout.transforms;
+  context.drawOrder = layout.drawOrder;
+  context.warp = layout.warp;
+  context.warpStart = layout.warpStart;
+  context.warpInvStep = layout.warpInvStep;
+  context.warpCount = layout.warpCount;
+  context.warpAmplitude = layout.warpAmplitude;
+  context.prefixWidth = layout.prefixWidth;
+  context.prefixShift = layout.prefixShift;
+  context.buckets = layout.buckets;
+  context.bucketStart = layout.bucketStart;
+  context.bucketInvStep = layout.bucketInvStep;
+  context.bucketCount = layout.bucketCount;
   // pixelSpan reserved for future use in advanced interpolation
-  context.pixelSpan = MAX(1e-3f, resolution_scale * (fabsf(angleCos) + fabsf(angleSin)));
+  context.pixelSpan = MAX(1e-3f, layout.resolutionScale *
+                                     (fabsf(layout.angleCos) + fabsf(layout.angleSin)));
   // Set origin for coordinate transformation (from FrameSetup expansion)
   context.output_origin_x = static_cast<float>(in_data->output_origin_x);
   context.output_origin_y = static_cast<float>(in_data->output_origin_y);
+  context.pixelScale = 1.0f;
+  if (IsOutputScaled(params)) {
+    // Pixel centers of both grids line up at the layer's top-left corner
+    context.pixelScale = 1.0f / outputScale;
+    context.output_origin_x -= 0.5f * (1.0f - outputScale);
+    context.output_origin_y -= 0.5f * (1.0f - outputScale);
+  }
+  context.dstData = outputP->data;
+  context.dstRowbytes = outputP->rowbytes;
+  context.dstWidth = outputP->width;
+
+  // Crop to Content: the bounds measured in FrameSetup, or measured here if
+  // the input was not available then. Slices that cannot reach the content
+  // of any source (or the layer) are culled either way.
+  if (params[MULTISLICER_CROP_TO_CONTENT]->u.bd.value) {
+    if (in_data->frame_data && *in_data->frame_data) {
+      content = **reinterpret_cast<PF_Rect **>(in_data->frame_data);
+    } else {
+      MeasureContentBounds(inputP, content);
+      for (A_long n = 0; n < numSourceDefs; n++) {
+        if (sourceDefs[n].u.ld.data) {
+          UnionSourceContent(inputP, &sourceDefs[n].u.ld, true, content);
+        }
+      }
+    }
+  }
+  context.content = content;
+  CullSlicesToContent(layout, content, context.firstSlice, context.lastSlice);
+
+  // Frame budget: estimated at full quality from this instance's measured
+  // cost per work unit. Prefilter Slices and Output Scale subsampling rule
+  // out the geometry cache, so slice rows are what they would cost; over
+  // budget, they are dropped first (draft sampling).
+  if (nsPerWork > 0.0) {
+    sample.fullMs = nsPerWork * 1e-6 *
+                    EstimateRenderWork(layout.transforms ? STATS_PATH_TRANSFORMED_ROWS
+                                                         : STATS_PATH_SLICE_ROWS,
+                                       outputPixels,
+                                       outputPixels * resampleFactor * resampleFactor,
+                                       context.prefixWidth != nullptr, hasPixelSort);
+    if (sample.fullMs > budgetMs && (context.prefixWidth || resampleFactor > 1)) {
+      context.prefixWidth = nullptr;
+      context.prefixShift = nullptr;
+      resampleFactor = 1;
+      sample.draft = true;
+    }
+  }
 
-  // CRITICAL FIX #1: Replace std::thread with SDK Iterate Pattern
-  // Use AE SDK's iterate suite for proper MFR (Multi-Frame Rendering) support
-  // FIX for SDK 25.6: Iterate8Suite1/Iterate16Suite1 don't use PF_RenderPixelFilterDef
-  if (PF_WORLD_IS_DEEP(inputP)) {
-    // 16-bit rendering path
-    err = suites.Iterate16Suite1()->iterate(in_data,
-                                             0,                    // progress_base
-                                             outputP->width,       // progress_final
-                                             inputP,               // src
-                                             nullptr,              // area (NULL for all pixels)
-                                             &context,             // refcon
-                                             Iterate16Callback,    // pix_fn
-                                             outputP);             // dst
-    ERR(err);
+  // Source occupancy: classify 16x16 source tiles in one parallel pass so
+  // the renderers can skip regions that would only sample zero. Without
+  // memory for it, everything is simply rendered. Prefiltered pixels sample
+  // at a mean shift between slices, which the per-slice tile test cannot
+  // vouch for, so they go without.
+  occupancyContext = {};
+  occupancyContext.srcData = inputP->data;
+  occupancyContext.rowbytes = inputP->rowbytes;
+  occupancyContext.width = inputP->width;
+  occupancyContext.height = inputP->height;
+  occupancyContext.tilesX = (inputP->width + OCCUPANCY_TILE_SIZE - 1) >> OCCUPANCY_TILE_SHIFT;
+  occupancyContext.tilesY = (inputP->height + OCCUPANCY_TILE_SIZE - 1) >> OCCUPANCY_TILE_SHIFT;
+  occupancyContext.content = content;
+  if (!context.prefixWidth) {
+    occupancyHandle = suites.HandleSuite1()->host_new_handle(
+        2 * occupancyContext.tilesX * occupancyContext.tilesY);
+  }
+  if (occupancyHandle && *occupancyHandle) {
+    occupancyContext.occupancy = *((A_u_char **)occupancyHandle);
+    A_u_char *tileSkip =
+        occupancyContext.occupancy + occupancyContext.tilesX * occupancyContext.tilesY;
+
+    err = suites.Iterate8Suite1()->iterate_generic(
+        occupancyContext.tilesY, &occupancyContext,
+        PF_WORLD_IS_DEEP(inputP) ? BuildOccupancyRow16 : BuildOccupancyRow8);
+    if (err) {
+      goto render_cleanup;
+    }
+    BuildTileSkip(occupancyContext.occupancy, occupancyContext.tilesX,
+                  occupancyContext.tilesY, tileSkip);
+
+    context.tileSkip = tileSkip;
+    context.tilesX = occupancyContext.tilesX;
+    context.tilesY = occupancyContext.tilesY;
+  }
+
+  // Untransformed slices: from the geometry cache while only Shift changes
+  // (at 100% Output Scale), otherwise per-pixel slice logic on live spans
+  // only. The cache classifies pixels by slice, which prefiltered pixels
+  // ignore.
+  //
+  // The budget is checked first. A frame over budget even from a cached
+  // map is rendered at half resolution from slice rows (the map holds
+  // full-resolution pixels) and asks for no map. A map that is not cached
+  // yet costs about as much as slice rows to build, and is only built when
+  // the budget leaves time for both.
+  if (!layout.transforms && !context.prefixWidth && context.pixelScale == 1.0f) {
+    RememberGeometryShape(in_data, GetStatsInstance(in_data), layout,
+                          -in_data->output_origin_x, -in_data->output_origin_y, outputP->width,
+                          outputP->height);
+    bool mayBuild = true;
+    if (nsPerWork > 0.0 && resampleFactor == 1) {
+      const double cachedMs =
+          nsPerWork * 1e-6 * EstimateRenderWork(STATS_PATH_CACHED_ROWS, outputPixels,
+                                                outputPixels, false, hasPixelSort);
+      const double buildMs =
+          nsPerWork * 1e-6 * EstimateRenderWork(STATS_PATH_SLICE_ROWS, outputPixels,
+                                                outputPixels, false, false);
+      sample.reduced = cachedMs > budgetMs;
+      mayBuild = cachedMs + buildMs <= budgetMs;
+    }
+    sample.geometryTried = true;
+    if (sample.reduced) {
+      sample.geometryMiss = "over the frame budget even from a map";
+    } else {
+      err = AcquireGeometryMap(&context, layout, suites, GetStatsInstance(in_data),
+                               -in_data->output_origin_x, -in_data->output_origin_y,
+                               outputP->width, outputP->height, mayBuild, geometry);
+      sample.geometryUsed = (geometry.map != nullptr);
+      sample.geometryBuilt = geometry.built;
+      sample.geometryWarmed = geometry.map && geometry.map->warmed;
+      sample.geometryLoaded = geometry.map && geometry.map->mapped;
+      sample.geometryMiss = geometry.miss;
+    }
+    if (!err && geometry.map) {
+      const GeometryMap *map = geometry.map;
+      context.geometryStride = map->width;
+      context.geometry = GeometryCells(*map) +
+                         (-in_data->output_origin_y - map->top) * context.geometryStride +
+                         (-in_data->output_origin_x - map->left);
+    }
+  }
+  if (layout.transforms) {
+    // Per-slice transforms: each row is rendered as per-slice spans
+    renderRow = PF_WORLD_IS_DEEP(outputP) ? TransformedRow16Callback : TransformedRow8Callback;
+    sample.path = STATS_PATH_TRANSFORMED_ROWS;
+  } else if (context.geometry) {
+    renderRow = PF_WORLD_IS_DEEP(outputP) ? CachedRow16Callback : CachedRow8Callback;
+    sample.path = STATS_PATH_CACHED_ROWS;
   } else {
-    // 8-bit rendering path
-    err = suites.Iterate8Suite1()->iterate(in_data,
-                                            0,                    // progress_base
-                                            outputP->width,       // progress_final
-                                            inputP,               // src
-                                            nullptr,              // area (NULL for all pixels)
-                                            &context,             // refcon
-                                            Iterate8Callback,     // pix_fn
-                                            outputP);             // dst
-    ERR(err);
+    renderRow = PF_WORLD_IS_DEEP(outputP) ? SliceRow16Callback : SliceRow8Callback;
+    sample.path = STATS_PATH_SLICE_ROWS;
+  }
+  sample.resampleFactor = resampleFactor;
+  sample.sorted = hasPixelSort;
+
+  // Estimated cost as chosen (a map built for this frame costs about as
+  // much as slice rows). Still over budget, the frame is rendered at half
+  // resolution. Frames on a map were checked before asking for it.
+  {
+    const double buildWork =
+        sample.geometryBuilt ? EstimateRenderWork(STATS_PATH_SLICE_ROWS, outputPixels,
+                                                  outputPixels, false, false)
+                             : 0.0;
+    sample.work = buildWork + EstimateRenderWork(sample.path, outputPixels,
+                                                 outputPixels * resampleFactor * resampleFactor,
+                                                 context.prefixWidth != nullptr, hasPixelSort);
+    if (nsPerWork > 0.0 && !sample.draft) {
+      sample.fullMs = sample.work * nsPerWork * 1e-6;
+    }
+    if (nsPerWork > 0.0 && resampleFactor == 1 && !context.geometry &&
+        sample.work * nsPerWork * 1e-6 > budgetMs) {
+      sample.reduced = true;
+    }
+    if (sample.reduced) {
+      sample.work = buildWork + EstimateRenderWork(sample.path, outputPixels,
+                                                   outputPixels / (FRAME_BUDGET_REDUCED_STEP *
+                                                                   FRAME_BUDGET_REDUCED_STEP),
+                                                   context.prefixWidth != nullptr, hasPixelSort);
+    }
   }
 
-render_cleanup:
-  if (segmentsHandle) {
-    suites.HandleSuite1()->host_dispose_handle(segmentsHandle);
+  // Rows are distributed across threads by iterate_generic
+  // (CRITICAL FIX #1: SDK iterate pattern for proper MFR support)
+  if (!err && resampleFactor > 1) {
+    resampleContext = {};
+    resampleContext.slices = &context;
+    resampleContext.handleSuite = suites.HandleSuite1();
+    resampleContext.renderRow = renderRow;
+    resampleContext.factor = resampleFactor;
+    resampleContext.height = outputP->height;
+    err = suites.Iterate8Suite1()->iterate_generic(
+        PF_Iterations_ONCE_PER_PROCESSOR, &resampleContext,
+        PF_WORLD_IS_DEEP(outputP) ? ResampleRows16Callback : ResampleRows8Callback);
+  } else if (!err && sample.reduced) {
+    reducedContext = {};
+    reducedContext.slices = &context;
+    reducedContext.handleSuite = suites.HandleSuite1();
+    reducedContext.renderRow = renderRow;
+    reducedContext.step = FRAME_BUDGET_REDUCED_STEP;
+    reducedContext.height = outputP->height;
+    err = suites.Iterate8Suite1()->iterate_generic(
+        PF_Iterations_ONCE_PER_PROCESSOR, &reducedContext,
+        PF_WORLD_IS_DEEP(outputP) ? ReducedRows16Callback : ReducedRows8Callback);
+  } else {
+    ERR(suites.Iterate8Suite1()->iterate_generic(outputP->height, &context, renderRow));
+  }
+
+  // Pixel sort runs on the finished output, along the slices
+  if (!err && hasPixelSort) {
+    err = SortSlicePixels(&context, params, suites, outputP->height,
+                          PF_WORLD_IS_DEEP(outputP));
+  }
+
+  // Offline per-slice export, only when the environment asks for it and only
+  // for final output: RAM previews and other draft or downsampled renders
+  // of the frame would replace its files
+  exportDir = getenv(SLICE_EXPORT_DIR_ENV);
+  if (!err && exportDir && *exportDir && IsFinalOutputRender(in_data)) {
+    err = ExportSlices(in_data, &context, layout, suites, exportDir,
+                       PF_WORLD_IS_DEEP(inputP));
   }
-  if (divPointsHandle) {
-    suites.HandleSuite1()->host_dispose_handle(divPointsHandle);
+
+render_cleanup:
+  ReleaseGeometryMap(geometry);
+  ERR2(CheckinExtraSources(in_data, sourceDefs, numSourceDefs));
+  DisposeSliceLayout(suites, layout);
+  if (occupancyHandle) {
+    suites.HandleSuite1()->host_dispose_handle(occupancyHandle);
   }
 
   // CRITICAL FIX: Add FPU Context Restore before return with NULL check
@@ -853,6 +6320,179 @@ render_cleanup:
   return err;
 }
 
+// =============================================================================
+// Render trace - opt-in recording of the host's command stream
+// =============================================================================
+
+// Opened on the first command when TRACE_FILE_ENV is set; kept for the life
+// of the process so MFR threads and reloads append to one trace
+static std::mutex sTraceMutex;
+static std::once_flag sTraceOnce;
+static FILE *sTraceFile = nullptr;
+static std::chrono::steady_clock::time_point sTraceEpoch;
+static std::atomic<A_u_long> sTraceThreads(0);
+
+// The trace of each process goes to its own <TRACE_FILE_ENV>.<process id>,
+// so aerender processes started with the same environment do not overwrite
+// one another
+static void OpenTraceFile() {
+  const char *base = getenv(TRACE_FILE_ENV);
+  char path[TRACE_PATH_SIZE];
+  if (!base || !*base) {
+    return;
+  }
+  snprintf(path, sizeof(path), "%s.%lu", base, CurrentProcessId());
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return;
+  }
+  TraceHeader header = {TRACE_MAGIC, TRACE_VERSION, MULTISLICER_NUM_PARAMS,
+                        static_cast<A_u_long>(sizeof(TraceRecord))};
+  if (fwrite(&header, sizeof(header), 1, file) != 1) {
+    fclose(file);
+    return;
+  }
+  sTraceEpoch = std::chrono::steady_clock::now();
+  sTraceFile = file;
+}
+
+// Trace file, or nullptr when tracing is off. Only the first call reads the
+// environment.
+static FILE *AcquireTraceFile() {
+  std::call_once(sTraceOnce, OpenTraceFile);
+  return sTraceFile;
+}
+
+static A_u_longlong TraceNow() {
+  return static_cast<A_u_longlong>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                       std::chrono::steady_clock::now() - sTraceEpoch)
+                                       .count());
+}
+
+static A_u_long TraceThreadIndex() {
+  static thread_local A_u_long index = sTraceThreads++;
+  return index;
+}
+
+/**
+ * Record the value of one parameter.
+ *
+ * Layer parameters other than the input are recorded as the command itself
+ * checked them out (tTraceLayers); tracing checks nothing out, so AE renders
+ * no layer it would not have. A layer the command did not check out is
+ * recorded as not connected.
+ *
+ * @param params Parameter array of the command
+ * @param index Parameter to record
+ * @param value Receives the value
+ */
+static void RecordTraceParam(PF_ParamDef *params[], A_long index, TraceParam &value) {
+  const PF_ParamDef *param = params[index];
+  value.value = 0.0;
+  value.x = 0;
+  value.y = 0;
+  switch (param->param_type) {
+  case PF_Param_LAYER:
+    if (index != MULTISLICER_INPUT) {
+      value = tTraceLayers[index];
+    } else if (param->u.ld.data) {
+      value.x = param->u.ld.width;
+      value.y = param->u.ld.height;
+      value.value = PF_WORLD_IS_DEEP(&param->u.ld) ? 1.0 : 0.0;
+    }
+    break;
+  case PF_Param_FLOAT_SLIDER:
+    value.value = param->u.fs_d.value;
+    break;
+  case PF_Param_POINT:
+    value.x = param->u.td.x_value;
+    value.y = param->u.td.y_value;
+    break;
+  case PF_Param_SLIDER:
+    value.x = param->u.sd.value;
+    break;
+  case PF_Param_ANGLE:
+    value.x = param->u.ad.value;
+    break;
+  case PF_Param_CHECKBOX:
+    value.x = param->u.bd.value;
+    break;
+  case PF_Param_POPUP:
+    value.x = param->u.pd.value;
+    break;
+  default:
+    break;
+  }
+}
+
+/**
+ * Append one command to the trace.
+ *
+ * Everything a replay needs to issue the same call is kept - time, scale,
+ * origin, world sizes and, for FRAME_SETUP and RENDER, every parameter -
+ * along with what the plugin answered and how long it took. Pixels are not
+ * recorded; the replay host fills layers with a test pattern.
+ *
+ * @param trace Trace file
+ * @param cmd Command that ran
+ * @param in_data Input data of the command
+ * @param out_data Output data after the command
+ * @param params Parameter array of the command
+ * @param output Output world (RENDER only)
+ * @param err Result of the command
+ * @param startNs When the command started (TraceNow)
+ */
+static void RecordTraceCommand(FILE *trace, PF_Cmd cmd, PF_InData *in_data,
+                               PF_OutData *out_data, PF_ParamDef *params[],
+                               PF_LayerDef *output, PF_Err err, A_u_longlong startNs) {
+  TraceRecord record;
+  TraceParam values[MULTISLICER_NUM_PARAMS];
+  AEFX_CLR_STRUCT(record);
+
+  record.durationNs = TraceNow() - startNs;
+  record.startNs = startNs;
+  record.cmd = cmd;
+  record.thread = TraceThreadIndex();
+  record.err = err;
+  if (in_data) {
+    record.currentTime = in_data->current_time;
+    record.timeStep = in_data->time_step;
+    record.timeScale = in_data->time_scale;
+    record.downsampleX = in_data->downsample_x;
+    record.downsampleY = in_data->downsample_y;
+    record.pixelAspect = in_data->pixel_aspect_ratio;
+    record.originX = in_data->output_origin_x;
+    record.originY = in_data->output_origin_y;
+  }
+
+  if ((cmd == PF_Cmd_FRAME_SETUP || cmd == PF_Cmd_RENDER) && in_data && params) {
+    const PF_LayerDef *input = &params[MULTISLICER_INPUT]->u.ld;
+    record.inputWidth = input->width;
+    record.inputHeight = input->height;
+    record.deep = PF_WORLD_IS_DEEP(input) ? 1 : 0;
+    record.numParams = MULTISLICER_NUM_PARAMS;
+    for (A_long i = 0; i < MULTISLICER_NUM_PARAMS; i++) {
+      RecordTraceParam(params, i, values[i]);
+    }
+  }
+  if (cmd == PF_Cmd_RENDER && output) {
+    record.outputWidth = output->width;
+    record.outputHeight = output->height;
+  } else if (cmd == PF_Cmd_FRAME_SETUP && out_data) {
+    record.outputWidth = out_data->width;
+    record.outputHeight = out_data->height;
+    record.outputOriginX = out_data->origin.h;
+    record.outputOriginY = out_data->origin.v;
+  }
+
+  std::lock_guard<std::mutex> lock(sTraceMutex);
+  fwrite(&record, sizeof(record), 1, trace);
+  if (record.numParams > 0) {
+    fwrite(values, sizeof(TraceParam), record.numParams, trace);
+  }
+  fflush(trace);
+}
+
 extern "C" DllExport PF_Err PluginDataEntryFunction2(
     PF_PluginDataPtr inPtr, PF_PluginDataCB2 inPluginDataCallBackPtr,
     SPBasicSuite *inSPBasicSuitePtr, const char *inHostName,
@@ -876,6 +6516,11 @@ extern "C" DllExport PF_Err EffectMain(PF_Cmd cmd, PF_InData *in_data,
                                        PF_ParamDef *params[],
                                        PF_LayerDef *output, void *extra) {
   PF_Err err = PF_Err_NONE;
+  FILE *trace = AcquireTraceFile();
+  const A_u_longlong traceStart = trace ? TraceNow() : 0;
+  if (trace) {
+    memset(tTraceLayers, 0, sizeof(tTraceLayers));
+  }
 
   switch (cmd) {
   case PF_Cmd_ABOUT:
@@ -884,24 +6529,84 @@ extern "C" DllExport PF_Err EffectMain(PF_Cmd cmd, PF_InData *in_data,
 
   case PF_Cmd_GLOBAL_SETUP:
     err = GlobalSetup(in_data, out_data, params, output);
+    RegisterGeometryCache(in_data);
+    AcquireSequenceDataSuite(in_data);
+    break;
+
+  case PF_Cmd_GLOBAL_SETDOWN:
+    ReleaseGeometryCache(in_data);
+    ReleaseSequenceDataSuite(in_data);
     break;
 
   case PF_Cmd_PARAMS_SETUP:
     err = ParamsSetup(in_data, out_data, params, output);
     break;
 
+  case PF_Cmd_SEQUENCE_SETUP:
+    err = SequenceSetup(in_data, out_data);
+    break;
+
+  case PF_Cmd_SEQUENCE_RESETUP:
+    err = SequenceResetup(in_data, out_data);
+    break;
+
+  case PF_Cmd_SEQUENCE_FLATTEN:
+    // Sequence data is already flat
+    err = PF_Err_NONE;
+    break;
+
+  case PF_Cmd_SEQUENCE_SETDOWN:
+    err = SequenceSetdown(in_data, out_data);
+    break;
+
   case PF_Cmd_FRAME_SETUP:
     err = FrameSetup(in_data, out_data, params, output);
+    if (!err) {
+      RecordFrameSetupStats(in_data, out_data, params);
+    }
     break;
 
   case PF_Cmd_FRAME_SETDOWN:
     // CRITICAL FIX #3: Add missing PF_Cmd_FRAME_SETDOWN handler
-    // Paired with FRAME_SETUP, called after rendering completes
+    // Paired with FRAME_SETUP, called after rendering completes.
+    // Releases the content bounds measured for Crop to Content.
+    if (in_data->frame_data) {
+      AEGP_SuiteHandler suites(in_data->pica_basicP);
+      suites.HandleSuite1()->host_dispose_handle(in_data->frame_data);
+      out_data->frame_data = NULL;
+    }
     err = PF_Err_NONE;
     break;
 
-  case PF_Cmd_RENDER:
-    err = Render(in_data, out_data, params, output);
+  case PF_Cmd_RENDER: {
+    const auto renderStart = std::chrono::steady_clock::now();
+    MultiSlicerFrameBudget *budget = GetFrameBudget(extra);
+    RenderStatsSample sample;
+    sample.budgetMs = (budget && budget->budgetMs > 0.0) ? budget->budgetMs : 0.0;
+    err = Render(in_data, out_data, params, output, sample);
+    if (budget) {
+      budget->draft = sample.draft;
+      budget->reduced = sample.reduced;
+    }
+    const A_u_longlong renderNs = static_cast<A_u_longlong>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                             renderStart)
+            .count());
+    RecordRenderStats(in_data, sample, err, renderNs);
+    if (FILE *explain = AcquireExplainFile()) {
+      ExplainRender(explain, in_data, params, output, sample, err, renderNs);
+    }
+    break;
+  }
+
+  case PF_Cmd_QUERY_DYNAMIC_FLAGS:
+    err = QueryDynamicFlags(in_data, out_data, params, extra);
+    break;
+
+  case PF_Cmd_USER_CHANGED_PARAM:
+  case PF_Cmd_UPDATE_PARAMS_UI:
+    // Parameters changed in the UI: start on the next geometry map
+    err = WarmGeometryCache(in_data, params);
     break;
 
   case PF_Cmd_EVENT:
@@ -911,12 +6616,13 @@ extern "C" DllExport PF_Err EffectMain(PF_Cmd cmd, PF_InData *in_data,
 
   case PF_Cmd_GET_FLATTENED_SEQUENCE_DATA:
     // Called to get flattened sequence data for project saving
-    err = PF_Err_NONE;
+    err = GetFlattenedSequenceData(in_data, out_data);
     break;
 
   case PF_Cmd_COMPLETELY_GENERAL:
     // Called for completely general effect calls via AEGP (SDK 25.6 uses COMPLETELY_GENERAL, not COMPLETE_GENERAL)
-    err = PF_Err_NONE;
+    // Answers performance statistics requests (MultiSlicerStats)
+    err = AnswerStatsRequest(in_data, extra);
     break;
 
   default:
@@ -924,5 +6630,9 @@ extern "C" DllExport PF_Err EffectMain(PF_Cmd cmd, PF_InData *in_data,
     break;
   }
 
+  if (trace) {
+    RecordTraceCommand(trace, cmd, in_data, out_data, params, output, err, traceStart);
+  }
+
   return err;
 }
@@ -15,7 +15,9 @@ typedef unsigned short PixelType;
 #include "AE_Effect.h"
 #include "AE_EffectCB.h"
 #include "AE_EffectCBSuites.h"
+#include "AE_EffectSuites.h"
 #include "AE_GeneralPlug.h"
+#include "AE_ComputeCacheSuite.h"
 #include "AE_Macros.h"
 #include "Param_Utils.h"
 #include "String_Utils.h"
@@ -28,6 +30,7 @@ typedef unsigned short PixelType;
 #include "AEFX_ChannelDepthTpl.h"
 #include "AEGP_SuiteHandler.h"
 #include <algorithm>
+#include <cstddef>
 
 #include "MultiSlicer_Strings.h"
 
@@ -94,6 +97,7 @@ typedef unsigned short PixelType;
 // Sampling and coordinate constants
 #define SAMPLE_ROUND_OFFSET 0.5f
 #define BINARY_SEARCH_THRESHOLD 8
+#define PREFILTER_BUCKETS_PER_SLICE 2 // Prefilter Slices bucket index
 #define COVERAGE_THRESHOLD 0.001f
 #define FEATHER_SOFT_EDGE (2.0f * DEFAULT_FEATHER)
 #define FIXED_POINT_SCALE 65536.0f
@@ -103,6 +107,162 @@ typedef unsigned short PixelType;
 #define SEARCH_LENGTH_MARGIN 0.1f
 #define SEARCH_SLICE_VARIETY 2.0f
 
+// Shift map sampling constants (Rec. 601 luma weights)
+#define SHIFT_MAP_CENTERLINE_SAMPLES 16
+#define LUMA_WEIGHT_R 0.299f
+#define LUMA_WEIGHT_G 0.587f
+#define LUMA_WEIGHT_B 0.114f
+
+// Density map constants (1-D luminance profile along the slice axis)
+#define DENSITY_MAX_BINS 4096
+#define DENSITY_MAX_SAMPLES_PER_AXIS 512
+#define DENSITY_MIN_WEIGHT 0.01f
+#define MULTISLICER_DENSITY_AMOUNT_DFLT 100
+
+// Per-slice transform constants
+#define ROTATION_SEED_MULT 29
+#define ROTATION_SEED_OFFSET 53
+#define SCALE_SEED_MULT 37
+#define SCALE_SEED_OFFSET 61
+#define MIN_SLICE_SCALE 0.01f
+#define SPAN_CHUNK_SIZE 512
+#define SPAN_SOURCE_MARGIN 1.5f
+#define BOUNDS_MARGIN 1
+
+// Perspective (3-D card) constants - AE's default 50mm comp camera
+#define DEPTH_SEED_MULT 43
+#define DEPTH_SEED_OFFSET 67
+#define TILT_SEED_MULT 47
+#define TILT_SEED_OFFSET 71
+#define CAMERA_FOCAL_LENGTH 50.0f
+#define CAMERA_FILM_SIZE 36.0f
+#define CAMERA_NEAR_W 0.01f
+#define HOMOGENEOUS_W_EPSILON 1e-6f
+#define HOMOGRAPHY_DET_EPSILON 1e-12
+#define MULTISLICER_SLICE_DEPTH_MAX 10000
+
+// Edge warp constants (1-D displacement profile along the slices)
+#define WARP_MAX_ENTRIES 131072
+#define WARP_NOISE_OCTAVES 3
+#define WARP_FREQUENCY_SCALE 100.0f
+#define WARP_SEED_MULT 53
+#define WARP_SEED_OFFSET 79
+#define MULTISLICER_WARP_AMPLITUDE_MAX 1000
+#define MULTISLICER_WARP_FREQUENCY_DFLT 1
+#define MULTISLICER_WARP_SEED_DFLT 1
+
+// Shatter constants (closed-form per-slice motion)
+#define SHATTER_ANGLE_SEED_MULT 59
+#define SHATTER_ANGLE_SEED_OFFSET 83
+#define SHATTER_SPEED_SEED_MULT 67
+#define SHATTER_SPEED_SEED_OFFSET 89
+#define SHATTER_SPIN_SEED_MULT 71
+#define SHATTER_SPIN_SEED_OFFSET 97
+#define SHATTER_GRAVITY_SEED_MULT 73
+#define SHATTER_GRAVITY_SEED_OFFSET 101
+#define SHATTER_RANDOM_MIN 0.5f
+#define MULTISLICER_SHATTER_MAX 10000
+
+// Pixel sort constants
+#define PIXEL_SORT_MIN_RADIX_RUN 64
+#define PIXEL_SORT_RADIX_BITS 8
+#define PIXEL_SORT_RADIX_BUCKETS (1 << PIXEL_SORT_RADIX_BITS)
+#define MULTISLICER_SORT_THRESHOLD_DFLT 25
+
+// Source occupancy constants (coarse alpha tiles)
+#define OCCUPANCY_TILE_SHIFT 4
+#define OCCUPANCY_TILE_SIZE (1 << OCCUPANCY_TILE_SHIFT)
+
+// Multi-source constants (Input plus the Source 2-4 layers)
+#define MULTI_SOURCE_MAX 4
+#define SOURCE_SEED_MULT 61
+#define SOURCE_SEED_OFFSET 103
+
+// Output scale constants: below 100% each output pixel averages up to
+// OUTPUT_SCALE_MAX_FACTOR x OUTPUT_SCALE_MAX_FACTOR subsamples
+#define MULTISLICER_OUTPUT_SCALE_DFLT 100
+#define OUTPUT_SCALE_MAX_FACTOR 8
+#define OUTPUT_SCALE_TOLERANCE 0.001f
+
+// Per-slice export (offline): when this environment variable names a
+// directory, every visible slice of a final-quality render is also written
+// there as its own image
+#define SLICE_EXPORT_DIR_ENV "MULTISLICER_EXPORT_DIR"
+#define SLICE_EXPORT_PATH_SIZE 1024
+
+// Render trace (offline benchmarking): when this environment variable names
+// a file, every command of the process is appended to <file>.<process id>
+// as a TraceRecord for the Linux replay host (Linux/MultiSlicerReplay.cpp)
+#define TRACE_FILE_ENV "MULTISLICER_TRACE"
+#define TRACE_PATH_SIZE 1024
+#define TRACE_MAGIC 0x5254534DU // "MSTR"
+#define TRACE_VERSION 1
+
+// Layout cache (render farms): when this environment variable names a
+// directory, geometry maps are also kept there as files, one per geometry
+// key, that every render process on the machine maps read-only
+#define LAYOUT_CACHE_DIR_ENV "MULTISLICER_LAYOUT_CACHE_DIR"
+#define LAYOUT_CACHE_MAGIC 0x4743534DU // "MSCG"
+#define LAYOUT_CACHE_VERSION 2 // bump with the file layout or the cell classes
+#define LAYOUT_CACHE_ALIGN 64  // cells start at a multiple of this
+#define LAYOUT_CACHE_PATH_SIZE 1024
+
+// Render cost model: work units per output sample of each row renderer,
+// relative to a geometry cache row. Used by the explain log and the frame
+// budget.
+#define RENDER_COST_PASS_THROUGH 0.25
+#define RENDER_COST_CACHED_ROWS 1.0
+#define RENDER_COST_SLICE_ROWS 3.0
+#define RENDER_COST_TRANSFORMED_ROWS 4.0
+#define RENDER_COST_PREFILTER 3.0 // added to slice rows
+#define RENDER_COST_PIXEL_SORT 2.0
+#define RENDER_COST_RATE_WEIGHT 0.2 // of the newest frame in the ns/unit average
+
+// Render explain log (debugging): when this environment variable names a
+// file, every render appends which row renderer it took, why the cheaper
+// ones were passed over, and its estimated and measured cost
+#define EXPLAIN_FILE_ENV "MULTISLICER_EXPLAIN"
+#define EXPLAIN_LINE_SIZE 512
+
+// Frame budget (real-time playout on stand-in hosts): a host that passes a
+// MultiSlicerFrameBudget as extra with PF_Cmd_RENDER has a render whose
+// estimated cost exceeds it first drop to draft sampling (no Prefilter
+// Slices, no Output Scale subsampling), then to half resolution on both
+// axes. After Effects passes none, so its renders are always full quality.
+#define FRAME_BUDGET_MAGIC 0x4742534DU // "MSBG"
+#define FRAME_BUDGET_REDUCED_STEP 2 // output pixels per rendered pixel, per axis
+
+// Performance statistics: an AEGP asks an instance for its totals by
+// sending PF_Cmd_COMPLETELY_GENERAL with extra pointing to a
+// MultiSlicerStats. Instances are told apart by an id in sequence data.
+#define STATS_MAGIC 0x5453534DU // "MSST"
+#define STATS_VERSION 2
+#define STATS_RESET 0x1 // request flag: clear the totals after answering
+#define STATS_HISTOGRAM_BINS 96 // render times, four bins per octave from 1 us
+#define SEQUENCE_DATA_MAGIC 0x5153534DU // "MSSQ"
+
+// Geometry cache constants (per-pixel slice geometry reused across frames)
+#define GEOMETRY_CLASS_SHIFT 14
+#define GEOMETRY_INDEX_MASK ((1 << GEOMETRY_CLASS_SHIFT) - 1)
+#define GEOMETRY_MIN_MARGIN 64
+#define GEOMETRY_MAX_CELLS (128 * 1024 * 1024)
+// Maps the plugin keeps itself when the host has no compute cache: at most
+// this many, and this many bytes of cells together (the newest always stays)
+#define GEOMETRY_CACHE_MAPS 4
+#define GEOMETRY_CACHE_BYTES (512ULL * 1024 * 1024)
+// Threads classifying a warm-up map, its own included: it runs beside AE's
+// renders and UI, so it takes a small share of the machine
+#define GEOMETRY_WARMUP_THREADS 2
+// Checks and troubleshooting: with this environment variable set to 0 at
+// global setup, every frame renders slice rows without the geometry cache
+#define GEOMETRY_CACHE_ENV "MULTISLICER_GEOMETRY_CACHE"
+// Compute cache class of geometry maps, and the FNV-1a parameters of its
+// 128-bit key
+#define GEOMETRY_CACHE_CLASS "361do MultiSlicer Geometry"
+#define GEOMETRY_HASH_BASIS 14695981039346656037ULL
+#define GEOMETRY_HASH_PRIME 1099511628211ULL
+#define GEOMETRY_HASH_SALT 0x9E3779B97F4A7C15ULL
+
 enum {
   MULTISLICER_INPUT = 0,
   MULTISLICER_SHIFT,
@@ -111,6 +271,32 @@ enum {
   MULTISLICER_ANCHOR_POINT,
   MULTISLICER_ANGLE,
   MULTISLICER_SEED,
+  MULTISLICER_SHIFT_MAP,
+  MULTISLICER_SHIFT_MAP_SAMPLING,
+  MULTISLICER_DENSITY_MAP,
+  MULTISLICER_DENSITY_AMOUNT,
+  MULTISLICER_SLICE_ROTATION,
+  MULTISLICER_SLICE_SCALE,
+  MULTISLICER_SLICE_DEPTH,
+  MULTISLICER_SLICE_TILT,
+  MULTISLICER_EDGE_WARP,
+  MULTISLICER_WARP_AMPLITUDE,
+  MULTISLICER_WARP_FREQUENCY,
+  MULTISLICER_WARP_SEED,
+  MULTISLICER_SHATTER_VELOCITY,
+  MULTISLICER_SHATTER_SPIN,
+  MULTISLICER_SHATTER_GRAVITY,
+  MULTISLICER_SHATTER_START,
+  MULTISLICER_PIXEL_SORT,
+  MULTISLICER_SORT_THRESHOLD,
+  MULTISLICER_CROP_TO_CONTENT,
+  MULTISLICER_SOURCE_2,
+  MULTISLICER_SOURCE_3,
+  MULTISLICER_SOURCE_4,
+  MULTISLICER_SOURCE_MODE,
+  MULTISLICER_SOURCE_TRANSITION,
+  MULTISLICER_PREFILTER,
+  MULTISLICER_OUTPUT_SCALE,
   MULTISLICER_NUM_PARAMS
 };
 
@@ -120,7 +306,87 @@ enum {
   SLICES_DISK_ID,
   ANCHOR_POINT_DISK_ID,
   ANGLE_DISK_ID,
-  SEED_DISK_ID
+  SEED_DISK_ID,
+  SHIFT_MAP_DISK_ID,
+  SHIFT_MAP_SAMPLING_DISK_ID,
+  DENSITY_MAP_DISK_ID,
+  DENSITY_AMOUNT_DISK_ID,
+  SLICE_ROTATION_DISK_ID,
+  SLICE_SCALE_DISK_ID,
+  SLICE_DEPTH_DISK_ID,
+  SLICE_TILT_DISK_ID,
+  EDGE_WARP_DISK_ID,
+  WARP_AMPLITUDE_DISK_ID,
+  WARP_FREQUENCY_DISK_ID,
+  WARP_SEED_DISK_ID,
+  SHATTER_VELOCITY_DISK_ID,
+  SHATTER_SPIN_DISK_ID,
+  SHATTER_GRAVITY_DISK_ID,
+  SHATTER_START_DISK_ID,
+  PIXEL_SORT_DISK_ID,
+  SORT_THRESHOLD_DISK_ID,
+  CROP_TO_CONTENT_DISK_ID,
+  SOURCE_2_DISK_ID,
+  SOURCE_3_DISK_ID,
+  SOURCE_4_DISK_ID,
+  SOURCE_MODE_DISK_ID,
+  SOURCE_TRANSITION_DISK_ID,
+  PREFILTER_DISK_ID,
+  OUTPUT_SCALE_DISK_ID
+};
+
+// Shift Map Sampling popup choices (popup values are 1-based)
+enum {
+  SHIFT_MAP_SAMPLING_CENTER = 1,
+  SHIFT_MAP_SAMPLING_CENTERLINE,
+  SHIFT_MAP_SAMPLING_NUM_CHOICES = SHIFT_MAP_SAMPLING_CENTERLINE
+};
+
+// Edge Warp popup choices (popup values are 1-based)
+enum {
+  EDGE_WARP_NONE = 1,
+  EDGE_WARP_SINE,
+  EDGE_WARP_NOISE,
+  EDGE_WARP_NUM_CHOICES = EDGE_WARP_NOISE
+};
+
+// Pixel Sort popup choices (popup values are 1-based)
+enum {
+  PIXEL_SORT_OFF = 1,
+  PIXEL_SORT_LUMINANCE,
+  PIXEL_SORT_HUE,
+  PIXEL_SORT_NUM_CHOICES = PIXEL_SORT_HUE
+};
+
+// Source Selection popup choices (popup values are 1-based)
+enum {
+  SOURCE_MODE_ALTERNATE = 1,
+  SOURCE_MODE_RANDOM,
+  SOURCE_MODE_TRANSITION,
+  SOURCE_MODE_NUM_CHOICES = SOURCE_MODE_TRANSITION
+};
+
+// Source occupancy tile states
+enum {
+  OCCUPANCY_EMPTY = 0, // every pixel is zero (transparent, no color)
+  OCCUPANCY_MIXED,
+  OCCUPANCY_OPAQUE     // every pixel has full alpha
+};
+
+// Geometry cache cell classes (stored above GEOMETRY_CLASS_SHIFT)
+enum {
+  GEOMETRY_EMPTY = 0, // no slice covers the pixel
+  GEOMETRY_SINGLE,    // only the indexed slice covers it, fully
+  GEOMETRY_BLEND      // on a feathered edge: full per-pixel logic
+};
+
+// Row renderers counted by the performance statistics
+enum {
+  STATS_PATH_PASS_THROUGH = 0, // input copied unchanged
+  STATS_PATH_SLICE_ROWS,       // per-pixel slice logic
+  STATS_PATH_CACHED_ROWS,      // geometry cache
+  STATS_PATH_TRANSFORMED_ROWS, // per-slice transforms
+  STATS_PATH_COUNT
 };
 
 // Slice metadata describing each horizontal band in slice space
@@ -131,14 +397,93 @@ typedef struct {
   float visibleEnd;
   float shiftDirection;
   float shiftRandomFactor;
+  // Shatter response, scaled by the Shatter parameters at render time
+  float velocityX;    // unit direction times random speed factor
+  float velocityY;
+  float spinFactor;   // -1.0 to 1.0
+  float gravityFactor; // random response to gravity
+  A_long source;       // index into the render's sources (0 = Input)
 } SliceSegment;
 
-// Context shared across iterate callbacks
+// One layer the slices sample from. Sources other than the Input are
+// centered on it: layer position p reads source pixel p - offset.
 typedef struct {
-  void *srcData;
-  A_long rowbytes;
+  const void *data;
+  ptrdiff_t rowbytes; // strides are ptrdiff_t so row offsets cannot wrap
   A_long width;
   A_long height;
+  A_long offsetX;
+  A_long offsetY;
+} SliceSource;
+
+// Per-slice projective transform (homography) in layer coordinates.
+// Matrices are 3x3 row-major; the last row is [0 0 1] for flat slices.
+typedef struct {
+  float forward[9]; // unshifted-slice layout -> output
+  float inverse[9]; // output -> unshifted-slice layout
+  float depth;      // camera-space z of the slice center (larger is farther)
+} SliceTransform;
+
+// Slice layout for one frame, shared by FrameSetup and Render
+typedef struct {
+  A_long numSlices;
+  A_long imageWidth;
+  A_long imageHeight;
+  float centerX;
+  float centerY;
+  float angleCos;
+  float angleSin;
+  float sliceLength;
+  float shiftAmount;
+  float resolutionScale;
+  // Slicing happens in square pixels; a buffer pixel is pixelAspect square
+  // pixels wide. Seen in buffer pixels the slices run at another angle
+  // (angleCos/angleSin), and square-pixel distances across and along them
+  // scale by acrossScale and alongScale (all 1 for square pixels).
+  float pixelAspect;
+  float acrossScale;
+  float alongScale;
+  bool layerMaps; // a Shift or Density Map layer was applied
+  PF_Handle segmentsHandle;
+  SliceSegment *segments;
+  // Only allocated when per-slice rotation or scale is active
+  PF_Handle transformsHandle;
+  SliceTransform *transforms;
+  // Only allocated in perspective mode: slice indices sorted front to back
+  PF_Handle drawOrderHandle;
+  A_long *drawOrder;
+  // Only allocated when Edge Warp is on: sliceX displacement indexed by
+  // position along the slices (warpStart + i / warpInvStep), built from the
+  // mode, amplitude, frequency and seed below
+  PF_Handle warpHandle;
+  float *warp;
+  float warpStart;
+  float warpInvStep;
+  A_long warpCount;
+  float warpAmplitude;
+  A_long warpMode;
+  float warpFrequency;
+  A_long warpSeed;
+  // Only allocated when Prefilter Slices is on: for each slice index i,
+  // the visible width of slices 0..i-1 and the same width weighted by the
+  // slices' shift factors, kept apart for the slices shifted forward and
+  // backward (numSlices + 1 entries each: forward, then backward).
+  // The same handle holds the bucket index: bucketCount equal buckets over
+  // the slices' span (bucketStart + b / bucketInvStep), each with the first
+  // slice reaching its start, bucketCount + 1 entries
+  PF_Handle prefixHandle;
+  float *prefixWidth;
+  float *prefixShift;
+  A_long *buckets;
+  float bucketStart;
+  float bucketInvStep;
+  A_long bucketCount;
+} SliceLayout;
+
+// Context shared across iterate callbacks
+typedef struct {
+  SliceSource sources[MULTI_SOURCE_MAX];
+  A_long numSources;
   float centerX;
   float centerY;
   float angleCos;
@@ -148,12 +493,252 @@ typedef struct {
   float shiftAmount;
   A_long numSlices;
   const SliceSegment *segments;
+  const SliceTransform *transforms;
+  // Perspective mode: composite slices front to back in this order
+  const A_long *drawOrder;
+  // Edge warp lookup (nullptr when off), see SliceLayout
+  const float *warp;
+  float warpStart;
+  float warpInvStep;
+  A_long warpCount;
+  float warpAmplitude;
+  // Prefilter Slices: prefix sums and bucket index from SliceLayout
+  // (nullptr when off)
+  const float *prefixWidth;
+  const float *prefixShift;
+  const A_long *buckets;
+  float bucketStart;
+  float bucketInvStep;
+  A_long bucketCount;
   float pixelSpan;
   // Origin offset for coordinate transformation (buffer coords -> layer coords)
   float output_origin_x;
   float output_origin_y;
+  // Layer pixels per buffer pixel (1 / Output Scale)
+  float pixelScale;
+  // Destination for row-based rendering (iterate_generic does not pass worlds)
+  void *dstData;
+  ptrdiff_t dstRowbytes;
+  A_long dstWidth;
+  // Source tiles that are empty together with their neighbors (nullptr when
+  // unavailable); samples landing there are known to be zero
+  const A_u_char *tileSkip;
+  A_long tilesX;
+  A_long tilesY;
+  // Source pixels outside this rectangle are zero (all sources' layers,
+  // trimmed by Crop to Content); only firstSlice..lastSlice can reach it
+  PF_Rect content;
+  A_long firstSlice;
+  A_long lastSlice;
+  // Cached geometry for untransformed slices (nullptr when not in use),
+  // offset so that buffer pixel (x, y) is geometry[y * geometryStride + x]
+  const A_u_short *geometry;
+  ptrdiff_t geometryStride;
 } SliceContext;
 
+// One image of a per-slice export: a rectangle of slice space (the layout
+// rotated so the slices run down the rows) and where it starts in the
+// export buffer
+typedef struct {
+  A_long index;  // slice
+  A_long left;   // slice-space position of the image's first pixel
+  A_long top;
+  A_long width;
+  A_long height;
+  size_t offset; // first pixel in the export buffer, rows packed
+} SliceExportImage;
+
+// Context for rendering every exported slice, one slice-space row at a time
+typedef struct {
+  const SliceContext *slices;
+  const SliceExportImage *images;
+  A_long numImages;
+  A_long top;   // slice-space row of iteration 0
+  void *pixels; // export buffer
+} SliceExportContext;
+
+// Context for building the geometry cache
+typedef struct {
+  const SliceContext *slices;
+  A_u_short *cells;
+  A_long left; // layer position of cells[0]
+  A_long top;
+  A_long width;
+} GeometryBuildContext;
+
+// Context for building the source occupancy map
+typedef struct {
+  const void *srcData;
+  ptrdiff_t rowbytes;
+  A_long width;
+  A_long height;
+  A_long tilesX;
+  A_long tilesY;
+  PF_Rect content; // tiles outside it are empty without being read
+  A_u_char *occupancy;
+} OccupancyContext;
+
+// Context for rendering at reduced resolution (frame budget): each rendered
+// row of step x step blocks is drawn by renderRow, then repeated
+typedef struct {
+  const SliceContext *slices;
+  PF_HandleSuite1 *handleSuite;
+  PF_Err (*renderRow)(void *refcon, A_long thread_index, A_long y, A_long iterations);
+  A_long step;   // output pixels per rendered pixel along each axis
+  A_long height; // output rows
+} ReducedContext;
+
+// Context for rendering below 100% Output Scale: each output row is rendered
+// as factor subsample rows by renderRow, then box-filtered
+typedef struct {
+  const SliceContext *slices;
+  PF_HandleSuite1 *handleSuite;
+  PF_Err (*renderRow)(void *refcon, A_long thread_index, A_long y, A_long iterations);
+  A_long factor; // subsamples per output pixel along each axis
+  A_long height; // output rows
+} ResampleContext;
+
+// Context for the pixel sort pass over the rendered output.
+// Lines run along the slices as digital lines: one pixel per step along the
+// major axis, minor = line + round(step * slope), so every pixel belongs to
+// exactly one line.
+typedef struct {
+  const SliceContext *slices;
+  PF_HandleSuite1 *handleSuite;
+  A_long mode;
+  float threshold;
+  bool yMajor;
+  bool descending;
+  float slope;
+  A_long firstLine;
+  A_long numLines;
+  A_long lineLength;
+  A_long width;
+  A_long height;
+} PixelSortContext;
+
+// Render trace file layout: a TraceHeader, then per command a TraceRecord
+// followed by numParams TraceParams. Host byte order.
+typedef struct {
+  A_u_long magic;      // TRACE_MAGIC
+  A_u_long version;    // TRACE_VERSION
+  A_u_long numParams;  // MULTISLICER_NUM_PARAMS of the recording plugin
+  A_u_long recordSize; // sizeof(TraceRecord)
+} TraceHeader;
+
+typedef struct {
+  A_u_longlong startNs;    // since the first traced command
+  A_u_longlong durationNs; // time spent inside EffectMain
+  A_long cmd;
+  A_u_long thread; // calling thread, numbered in order of first command
+  A_long err;
+  A_long numParams; // only FRAME_SETUP and RENDER carry parameters
+  A_long currentTime;
+  A_long timeStep;
+  A_u_long timeScale;
+  PF_RationalScale downsampleX;
+  PF_RationalScale downsampleY;
+  PF_RationalScale pixelAspect;
+  A_long originX; // in_data output origin
+  A_long originY;
+  A_long inputWidth;
+  A_long inputHeight;
+  A_long deep;
+  A_long outputWidth; // RENDER: output world; FRAME_SETUP: requested size
+  A_long outputHeight;
+  A_long outputOriginX; // FRAME_SETUP: requested origin
+  A_long outputOriginY;
+} TraceRecord;
+
+// One parameter value. Float sliders use value; points use x/y as fixed
+// point; layers use x/y as width/height (0 when not connected, or not
+// checked out by the command) and value as 1 for 16-bit; every other type
+// keeps its raw value in x.
+typedef struct {
+  double value;
+  A_long x;
+  A_long y;
+} TraceParam;
+
+// Layout cache file layout: a LayoutCacheHeader, the geometry key's
+// bandCount floats (slice and visible bounds of every slice), then at
+// cellsOffset width x height geometry cells. Host byte order; files are
+// only ever replaced whole, never written in place.
+typedef struct {
+  A_u_long magic;   // LAYOUT_CACHE_MAGIC
+  A_u_long version; // LAYOUT_CACHE_VERSION
+  A_u_longlong hash[2]; // geometry key and margin, as in the file name
+  A_long imageWidth;
+  A_long imageHeight;
+  A_long numSlices;
+  float centerX;
+  float centerY;
+  float angleCos;
+  float angleSin;
+  A_long warpMode;
+  float warpAmplitude;
+  float warpFrequency;
+  A_long warpSeed;
+  float warpStart;
+  A_long warpCount;
+  A_long bandCount;
+  A_long left; // layer position of the first cell
+  A_long top;
+  A_long width;
+  A_long height;
+  A_u_longlong cellsOffset;
+  A_u_longlong fileSize;
+} LayoutCacheHeader;
+
+// Sequence data: flat, so it is saved as is. The id is only meaningful
+// within the session that assigned it.
+typedef struct {
+  A_u_long magic;    // SEQUENCE_DATA_MAGIC
+  A_u_long session;  // stamp of the session that assigned instance
+  A_u_long instance; // performance statistics id
+} SequenceData;
+
+// PF_Cmd_COMPLETELY_GENERAL statistics request. The caller sets magic,
+// version, size and flags; the instance fills in at most size bytes, sets
+// version to the version it answered and size to the bytes it wrote. Later
+// versions only append fields.
+typedef struct {
+  A_u_long magic;   // STATS_MAGIC
+  A_u_long version; // highest version the caller understands
+  A_u_long size;    // sizeof the caller's MultiSlicerStats
+  A_u_long flags;   // STATS_RESET
+  A_u_long instance;
+  A_u_long reserved;
+  A_u_longlong frames;       // renders that succeeded
+  A_u_longlong failedFrames; // renders that returned an error
+  double averageMs;          // over frames
+  double p99Ms;              // upper bound of the bin holding the 99th percentile
+  double maxMs;
+  A_u_longlong paths[STATS_PATH_COUNT]; // frames per row renderer
+  A_u_longlong resampledFrames;         // Output Scale below 100%
+  A_u_longlong sortedFrames;            // Pixel Sort on
+  A_u_longlong geometryHits;   // geometry map reused
+  A_u_longlong geometryBuilds; // geometry map built for this instance
+  A_u_longlong geometryMisses; // eligible for a map, rendered without
+  A_u_longlong frameSetups;
+  A_u_longlong expansionBytes; // output buffers beyond the layer, summed over FrameSetup
+  // Version 2: frame budget
+  double budgetMs;                // of the latest budgeted render, 0 when there was none
+  A_u_longlong draftFrames;       // rendered with draft sampling
+  A_u_longlong reducedFrames;     // rendered at half resolution
+  A_u_longlong overBudgetFrames;  // took longer than the budget anyway
+} MultiSlicerStats;
+
+// PF_Cmd_RENDER frame budget, passed as extra. The host sets magic and
+// budgetMs; the render sets draft and reduced to what it gave up.
+typedef struct {
+  A_u_long magic;    // FRAME_BUDGET_MAGIC
+  A_u_long reserved;
+  double budgetMs;   // 0 for none
+  A_Boolean draft;   // rendered with draft sampling
+  A_Boolean reduced; // rendered at half resolution
+} MultiSlicerFrameBudget;
+
 extern "C" {
 DllExport PF_Err EffectMain(PF_Cmd cmd, PF_InData *in_data,
                             PF_OutData *out_data, PF_ParamDef *params[],
@@ -51,6 +51,36 @@ TableString     g_strs[StrID_NUMTYPES] = {
     StrID_Width_Param_Name,             "Width",
     StrID_Slices_Param_Name,            "Number of Slices",
     StrID_Seed_Param_Name,              "Seed",
+    StrID_Shift_Map_Param_Name,         "Shift Map",
+    StrID_Shift_Map_Sampling_Param_Name, "Shift Map Sampling",
+    StrID_Shift_Map_Sampling_Choices,   "Slice Center|Centerline Average",
+    StrID_Density_Map_Param_Name,       "Density Map",
+    StrID_Density_Amount_Param_Name,    "Density Amount",
+    StrID_Slice_Rotation_Param_Name,    "Random Rotation",
+    StrID_Slice_Scale_Param_Name,       "Random Scale",
+    StrID_Slice_Depth_Param_Name,       "Random Depth",
+    StrID_Slice_Tilt_Param_Name,        "Random Tilt",
+    StrID_Edge_Warp_Param_Name,         "Edge Warp",
+    StrID_Edge_Warp_Choices,            "None|Sine|Noise",
+    StrID_Warp_Amplitude_Param_Name,    "Warp Amplitude",
+    StrID_Warp_Frequency_Param_Name,    "Warp Frequency",
+    StrID_Warp_Seed_Param_Name,         "Warp Seed",
+    StrID_Shatter_Velocity_Param_Name,  "Shatter Velocity",
+    StrID_Shatter_Spin_Param_Name,      "Shatter Spin",
+    StrID_Shatter_Gravity_Param_Name,   "Shatter Gravity",
+    StrID_Shatter_Start_Param_Name,     "Shatter Start",
+    StrID_Pixel_Sort_Param_Name,        "Pixel Sort",
+    StrID_Pixel_Sort_Choices,           "Off|Luminance|Hue",
+    StrID_Sort_Threshold_Param_Name,    "Sort Threshold",
+    StrID_Crop_To_Content_Param_Name,   "Crop to Content",
+    StrID_Source_2_Param_Name,          "Source 2",
+    StrID_Source_3_Param_Name,          "Source 3",
+    StrID_Source_4_Param_Name,          "Source 4",
+    StrID_Source_Mode_Param_Name,       "Source Selection",
+    StrID_Source_Mode_Choices,          "Alternate|Random|Transition",
+    StrID_Source_Transition_Param_Name, "Source Transition",
+    StrID_Prefilter_Param_Name,         "Prefilter Slices",
+    StrID_Output_Scale_Param_Name,      "Output Scale",
 };
 
 
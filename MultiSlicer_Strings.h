@@ -47,5 +47,35 @@ typedef enum {
     StrID_Width_Param_Name,
     StrID_Slices_Param_Name,
     StrID_Seed_Param_Name,
+    StrID_Shift_Map_Param_Name,
+    StrID_Shift_Map_Sampling_Param_Name,
+    StrID_Shift_Map_Sampling_Choices,
+    StrID_Density_Map_Param_Name,
+    StrID_Density_Amount_Param_Name,
+    StrID_Slice_Rotation_Param_Name,
+    StrID_Slice_Scale_Param_Name,
+    StrID_Slice_Depth_Param_Name,
+    StrID_Slice_Tilt_Param_Name,
+    StrID_Edge_Warp_Param_Name,
+    StrID_Edge_Warp_Choices,
+    StrID_Warp_Amplitude_Param_Name,
+    StrID_Warp_Frequency_Param_Name,
+    StrID_Warp_Seed_Param_Name,
+    StrID_Shatter_Velocity_Param_Name,
+    StrID_Shatter_Spin_Param_Name,
+    StrID_Shatter_Gravity_Param_Name,
+    StrID_Shatter_Start_Param_Name,
+    StrID_Pixel_Sort_Param_Name,
+    StrID_Pixel_Sort_Choices,
+    StrID_Sort_Threshold_Param_Name,
+    StrID_Crop_To_Content_Param_Name,
+    StrID_Source_2_Param_Name,
+    StrID_Source_3_Param_Name,
+    StrID_Source_4_Param_Name,
+    StrID_Source_Mode_Param_Name,
+    StrID_Source_Mode_Choices,
+    StrID_Source_Transition_Param_Name,
+    StrID_Prefilter_Param_Name,
+    StrID_Output_Scale_Param_Name,
     StrID_NUMTYPES
 } StrIDType;
\ No newline at end of file